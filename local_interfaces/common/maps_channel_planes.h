@@ -0,0 +1,181 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/cudaarithm.hpp>
+
+#include "maps_cuda_struct.h"
+#include "maps_image_view.h"
+
+// Split and merge of the channels of the images carried by MapsCudaStruct, for ChannelsSplitter and ChannelsMerger.
+// A pixel-ordered image is viewed as a single matrix. A planar image is made of nChannels planes that follow each other,
+// each plane being viewed with the view of a single channel image.
+// Mat is cv::cuda::GpuMat for device data, or cv::Mat for buffers allocated in MapsCudaMemory::Host memory:
+// the unit tests (tests/) run the same code on the host, without a GPU.
+namespace ChannelPlanes
+{
+    // Header on the plane channel of the planar image, restricted to the region of interest of planeView
+    template <typename Mat>
+    Mat Plane(const ImageView<Mat>& planeView, const MapsCudaStruct& image, const int channel)
+    {
+        const size_t planeSize = static_cast<size_t>(image.m_size) / image.m_IplImageProxy.nChannels;
+        return planeView(static_cast<const unsigned char*>(image.m_points) + channel * planeSize);
+    }
+
+    // Makes out reference the rows [firstRow, firstRow + nbRows) of the plane channel of the planar image in, without copy.
+    inline void SharePlane(MapsCudaStruct& out, const MapsCudaStruct& in, const int channel, const int firstRow, const int nbRows)
+    {
+        const int planeSize = in.m_size / in.m_IplImageProxy.nChannels;
+        const int rowSize = planeSize / in.m_IplImageProxy.height;
+        out.ShareFrom(in, channel * planeSize + firstRow * rowSize, nbRows * rowSize, out.m_IplImageProxy);
+    }
+
+    // Writes the channel channels[i] of the pixel-ordered image src to dsts[i] (preallocated single channel images).
+    // scratch holds one plane per channel of src, kept by the caller from one frame to the next: the GPU version writes
+    // the channels that are not selected there. On the host, nothing is written for them and scratch is not used.
+    inline void Split(const cv::Mat& src, cv::Mat* dsts, const std::vector<int>& channels, cv::Mat* /*scratch*/ = nullptr)
+    {
+        const int nbOutputs = static_cast<int>(channels.size());
+        if (nbOutputs == src.channels() && std::is_sorted(channels.begin(), channels.end()))
+        {
+            // cv::split dispatches to the vectorized deinterleave kernels of OpenCV for 2, 3 and 4 channels.
+            cv::split(src, dsts);
+            return;
+        }
+
+        // Strided gather of the selected channels only
+        std::array<int, 8> fromTo;
+        for (int i = 0; i < nbOutputs; ++i)
+        {
+            fromTo[2 * i] = channels[i];
+            fromTo[2 * i + 1] = i;
+        }
+        cv::mixChannels(&src, 1, dsts, nbOutputs, fromTo.data(), nbOutputs);
+    }
+
+    inline void Split(const cv::cuda::GpuMat& src, cv::cuda::GpuMat* dsts, const std::vector<int>& channels, cv::cuda::GpuMat* scratch)
+    {
+        const int cn = src.channels();
+        const int nbOutputs = static_cast<int>(channels.size());
+        if (cn == 1)
+        {
+            src.copyTo(dsts[0]);
+        }
+        else
+        {
+            // Single kernel launch for all the planes, whatever the depth. CUDA OpenCV has no mixChannels: the channels
+            // that are not selected are written to their scratch plane, allocated on the first frame only.
+            std::array<cv::cuda::GpuMat, 4> planes;
+            for (int i = 0; i < nbOutputs; ++i)
+                planes[channels[i]] = dsts[i];
+            for (int c = 0; c < cn; ++c)
+            {
+                if (planes[c].empty())
+                {
+                    scratch[c].create(src.size(), src.depth());
+                    planes[c] = scratch[c];
+                }
+            }
+            cv::cuda::split(src, planes.data());
+        }
+    }
+
+    // Interleaves the count single channel images srcs into dst (preallocated)
+    inline void Merge(const cv::Mat* srcs, const int count, cv::Mat& dst)
+    {
+        // cv::merge dispatches to the vectorized interleave kernels of OpenCV for 2, 3 and 4 channels.
+        cv::merge(srcs, count, dst);
+    }
+
+    inline void Merge(const cv::cuda::GpuMat* srcs, const int count, cv::cuda::GpuMat& dst)
+    {
+        if (count == 1)
+            srcs[0].copyTo(dst);
+        else
+            cv::cuda::merge(srcs, count, dst);
+    }
+
+    // Throws when OpenCV reallocated a destination instead of writing into the buffer it was viewing.
+    template <typename Mat>
+    void CheckWrittenInPlace(const Mat& dst, const void* data)
+    {
+        if (static_cast<const void*>(dst.data) != data)
+            throw std::runtime_error("Matrix data ptr and output data ptr are different.");
+    }
+
+    // Writes the channels[i] of in (pixel-ordered or planar) to outs[i], single channel images viewed with outView.
+    // For a planar image, inView is the view of one plane. scratch: see Split().
+    template <typename Mat>
+    void SplitImage(const MapsCudaStruct& in, const ImageView<Mat>& inView, const std::vector<int>& channels,
+                    MapsCudaStruct* const* outs, const ImageView<Mat>& outView, Mat* scratch)
+    {
+        const int nbOutputs = static_cast<int>(channels.size());
+        std::array<Mat, 4> dsts;
+        for (int i = 0; i < nbOutputs; ++i)
+            dsts[i] = outView(outs[i]->Writable().m_points);
+
+        if (in.m_IplImageProxy.dataOrder == IPL_DATA_ORDER_PLANE)
+        {
+            // The planes are already contiguous: only the selected ones are copied.
+            for (int i = 0; i < nbOutputs; ++i)
+                Plane(inView, in, channels[i]).copyTo(dsts[i]);
+        }
+        else
+        {
+            Split(inView(in.m_points), dsts.data(), channels, scratch);
+        }
+
+        for (int i = 0; i < nbOutputs; ++i)
+            CheckWrittenInPlace(dsts[i], outs[i]->m_points);
+    }
+
+    // Writes the single channel images srcs (one per channel of out) to out, pixel-ordered or planar.
+    // For a planar image, outView is the view of one plane.
+    template <typename Mat>
+    void MergeImages(const Mat* srcs, MapsCudaStruct& out, const ImageView<Mat>& outView)
+    {
+        const int cn = out.m_IplImageProxy.nChannels;
+        out.Writable();
+
+        if (out.m_IplImageProxy.dataOrder == IPL_DATA_ORDER_PLANE)
+        {
+            // Each channel is copied into its own plane, no interleaving needed.
+            for (int c = 0; c < cn; ++c)
+            {
+                Mat dst = Plane(outView, out, c);
+                const void* const planeData = dst.data;
+                srcs[c].copyTo(dst);
+                CheckWrittenInPlace(dst, planeData);
+            }
+        }
+        else
+        {
+            Mat dst = outView(out.m_points);
+            Merge(srcs, cn, dst);
+            CheckWrittenInPlace(dst, out.m_points);
+        }
+    }
+}
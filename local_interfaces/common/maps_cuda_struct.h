@@ -18,53 +18,337 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <cstdlib>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
+#include <vector>
 
 #include <cuda.h>
 #include <cuda_runtime.h>
 
 #include <maps.h> 
+
+#include "maps_memory_budget.h"
+
 #define maps_report_callback MAPS::ReportInfo
 
+// Kind of memory of the buffers of MapsCudaStruct.
+enum class MapsCudaMemory : int
+{
+    Device = 0,  // cudaMalloc: device memory, copied explicitly to and from the host
+    Managed = 1, // cudaMallocManaged: unified memory, accessible from the host and the device (shared DRAM on integrated GPUs)
+    Mapped = 2,  // cudaHostAlloc(cudaHostAllocMapped): page-locked host memory accessed by the device without copy
+    Host = 3     // malloc: host memory only, the host pointer is used as device pointer. To test the buffer management without a GPU
+};
+
+// Whether the host may access managed memory while the device runs kernels (cudaDevAttrConcurrentManagedAccess).
+// Without it (GPUs before Pascal, Windows, some integrated GPUs), a host access to any managed buffer while a kernel
+// runs faults, so MapsCudaMemory::Managed cannot be read from the host in a diagram.
+inline bool ConcurrentManagedAccess()
+{
+    int device = 0;
+    int concurrent = 0;
+    if (cudaGetDevice(&device) != cudaSuccess
+        || cudaDeviceGetAttribute(&concurrent, cudaDevAttrConcurrentManagedAccess, device) != cudaSuccess)
+        return false;
+    return concurrent != 0;
+}
+
+// Allocation strategy of the buffers of MapsCudaStorage, one per MapsCudaMemory.
+class MapsCudaAllocator
+{
+public:
+    virtual ~MapsCudaAllocator() = default;
+
+    // Allocates size_ bytes and returns the pointer used by the device. hostPoints receives the pointer to the same bytes
+    // used by the host, or nullptr when the host cannot access them. Throws std::runtime_error on failure.
+    virtual void* Allocate(const int size_, void*& hostPoints) = 0;
+    virtual void Free(void* points, void* hostPoints) = 0;
+
+    static MapsCudaAllocator& Get(const MapsCudaMemory memory);
+
+protected:
+    static void* Check(const cudaError_t cudaErr, void* points)
+    {
+        if (cudaErr != cudaError_t::cudaSuccess || points == nullptr)
+        {
+            maps_report_callback("Allocation failed");
+            throw std::runtime_error("Allocation failed");
+        }
+        return points;
+    }
+};
+
+class MapsCudaDeviceAllocator : public MapsCudaAllocator
+{
+public:
+    void* Allocate(const int size_, void*& hostPoints) override
+    {
+        void* points = nullptr;
+        hostPoints = nullptr;
+        return Check(cudaMalloc(&points, size_), points);
+    }
+
+    void Free(void* points, void* /*hostPoints*/) override
+    {
+        cudaFree(points);
+    }
+};
+
+class MapsCudaManagedAllocator : public MapsCudaAllocator
+{
+public:
+    void* Allocate(const int size_, void*& hostPoints) override
+    {
+        void* points = nullptr;
+        hostPoints = Check(cudaMallocManaged(&points, size_), points);
+        return points;
+    }
+
+    void Free(void* points, void* /*hostPoints*/) override
+    {
+        cudaFree(points);
+    }
+};
+
+class MapsCudaMappedAllocator : public MapsCudaAllocator
+{
+public:
+    void* Allocate(const int size_, void*& hostPoints) override
+    {
+        void* host = nullptr;
+        Check(cudaHostAlloc(&host, size_, cudaHostAllocMapped), host);
+        void* points = nullptr;
+        const cudaError_t cudaErr = cudaHostGetDevicePointer(&points, host, 0);
+        if (cudaErr != cudaError_t::cudaSuccess)
+            cudaFreeHost(host);
+        hostPoints = host;
+        return Check(cudaErr, points);
+    }
+
+    void Free(void* /*points*/, void* hostPoints) override
+    {
+        cudaFreeHost(hostPoints);
+    }
+};
+
+class MapsCudaHostAllocator : public MapsCudaAllocator
+{
+public:
+    void* Allocate(const int size_, void*& hostPoints) override
+    {
+        hostPoints = Check(cudaSuccess, std::malloc(size_));
+        return hostPoints;
+    }
+
+    void Free(void* /*points*/, void* hostPoints) override
+    {
+        std::free(hostPoints);
+    }
+};
+
+inline MapsCudaAllocator& MapsCudaAllocator::Get(const MapsCudaMemory memory)
+{
+    static MapsCudaDeviceAllocator device;
+    static MapsCudaManagedAllocator managed;
+    static MapsCudaMappedAllocator mapped;
+    static MapsCudaHostAllocator host;
+    switch (memory)
+    {
+    case MapsCudaMemory::Managed: return managed;
+    case MapsCudaMemory::Mapped: return mapped;
+    case MapsCudaMemory::Host: return host;
+    default: return device;
+    }
+}
+
+// Reference-counted device buffer.
+// Several MapsCudaStruct share the same storage when a component forwards its input instead of copying it.
+struct MapsCudaStorage
+{
+    void* m_points;
+    int m_size; //size in bytes
+    std::atomic<int> m_refCount;
+    MapsCudaMemory m_memory;
+    void* m_hostPoints; // the same bytes seen from the host, nullptr for MapsCudaMemory::Device
+    const void* m_budgetOwner; // memory budget the storage is reserved in while it is referenced, or nullptr
+    MAPSInt64 m_budgetRun; // run of m_budgetOwner the storage is reserved in (see MemoryBudget::Unreserve())
+
+    // When budgetOwner is set, the bytes are reserved in its memory budget (see MemoryBudget) until the storage is
+    // released, whether it is allocated or taken from the pool. Throws std::runtime_error when the budget would be
+    // exceeded or the allocation fails: nothing is acquired then.
+    static MapsCudaStorage* Acquire(const int size_, const MapsCudaMemory memory = MapsCudaMemory::Device, const void* budgetOwner = nullptr)
+    {
+        MAPSInt64 budgetRun = 0;
+        if (budgetOwner != nullptr)
+            budgetRun = MemoryBudget::Instance().Reserve(budgetOwner, 0, size_);
+
+        MapsCudaStorage* storage = Pool().Take(size_, memory);
+        if (storage == nullptr)
+        {
+            try
+            {
+                storage = new MapsCudaStorage(size_, memory);
+            }
+            catch (...)
+            {
+                if (budgetOwner != nullptr)
+                    MemoryBudget::Instance().Unreserve(budgetOwner, budgetRun, 0, size_);
+                throw;
+            }
+        }
+        storage->m_refCount = 1;
+        storage->m_budgetOwner = budgetOwner;
+        storage->m_budgetRun = budgetRun;
+        return storage;
+    }
+
+    void AddRef()
+    {
+        m_refCount.fetch_add(1);
+    }
+
+    void Release()
+    {
+        if (m_refCount.fetch_sub(1) == 1)
+        {
+            if (m_budgetOwner != nullptr)
+            {
+                MemoryBudget::Instance().Unreserve(m_budgetOwner, m_budgetRun, 0, m_size);
+                m_budgetOwner = nullptr;
+            }
+            if (!Pool().Give(this))
+                delete this;
+        }
+    }
+
+    bool IsShared() const
+    {
+        return m_refCount.load() > 1;
+    }
+
+private:
+    MapsCudaStorage(const int size_, const MapsCudaMemory memory)
+        : m_points(nullptr)
+        , m_size(size_)
+        , m_refCount(1)
+        , m_memory(memory)
+        , m_hostPoints(nullptr)
+        , m_budgetOwner(nullptr)
+        , m_budgetRun(0)
+    {
+        m_points = MapsCudaAllocator::Get(m_memory).Allocate(m_size, m_hostPoints);
+    }
+
+    ~MapsCudaStorage()
+    {
+        MapsCudaAllocator::Get(m_memory).Free(m_points, m_hostPoints);
+    }
+
+    // Released storages are kept for reuse, so that copy-on-write does not call cudaMalloc/cudaFree on every frame.
+    // They are not counted in the memory budget while they are in the pool: the pool is bounded instead, to kMaxPooled
+    // storages and kMaxPooledBytes bytes. The storages that do not fit are freed.
+    struct StoragePool
+    {
+        static constexpr size_t kMaxPooled = 16;
+        static constexpr MAPSInt64 kMaxPooledBytes = 128 * 1024 * 1024;
+
+        std::mutex m_mutex;
+        std::vector<MapsCudaStorage*> m_free;
+        MAPSInt64 m_freeBytes = 0;
+
+        MapsCudaStorage* Take(const int size_, const MapsCudaMemory memory)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (size_t i = 0; i < m_free.size(); ++i)
+            {
+                if (m_free[i]->m_size == size_ && m_free[i]->m_memory == memory)
+                {
+                    MapsCudaStorage* storage = m_free[i];
+                    m_free[i] = m_free.back();
+                    m_free.pop_back();
+                    m_freeBytes -= storage->m_size;
+                    return storage;
+                }
+            }
+            return nullptr;
+        }
+
+        bool Give(MapsCudaStorage* storage)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_free.size() >= kMaxPooled || m_freeBytes + storage->m_size > kMaxPooledBytes)
+                return false;
+            m_free.push_back(storage);
+            m_freeBytes += storage->m_size;
+            return true;
+        }
+
+        ~StoragePool()
+        {
+            for (MapsCudaStorage* storage : m_free)
+                delete storage;
+        }
+    };
+
+    static StoragePool& Pool()
+    {
+        // The allocators are constructed first so that they are destroyed after the pool, which frees its storages with them
+        MapsCudaAllocator::Get(MapsCudaMemory::Device);
+        static StoragePool pool;
+        return pool;
+    }
+};
+
 #pragma pack(push,1)
 
+// The device buffer is not allocated by the constructors but by the first call to Writable() (or shared by ShareFrom()),
+// so that the buffers of an output FIFO that are never written cost no device memory.
+// Producers must call Writable() before each write into m_points: the buffer of an output element may still be
+// referenced by other structs (an input forwarded by RotateAndFlip, the planes shared by ChannelsSplitter, a frame held
+// by the GPU tap), which would otherwise see the frame being written.
+//
+// Layout: m_size, m_IplImageProxy and m_points are exchanged with the packages built against the previous version of
+// this struct, which end there. The fields after m_points only exist in the structs built by this version: they are
+// only read once IsCurrentLayout() confirmed it, from the kLayoutId marker that the constructors write in the ID field
+// of the proxy (unused by the IplImage consumers, and never written by the previous version).
 struct MapsCudaStruct
 {
+    static constexpr int kLayoutId = 0x4D435302; // "MCS" and layout version 2
+
     int m_size; //size in bytes
     IplImage m_IplImageProxy;
-    void* m_points;
+    void* m_points; // device data, inside m_storage. nullptr until the buffer is allocated. Only written after Writable()
+    // Only valid when IsCurrentLayout()
+    MapsCudaStorage* m_storage;
+    const void* m_budgetOwner = nullptr; // when set, each buffer taken by Writable() is reserved in its memory budget (see MemoryBudget)
+    MapsCudaMemory m_memory = MapsCudaMemory::Device; // kind of memory of the buffers allocated by Writable()
 
-    MapsCudaStruct(const int width_, const int height_, const int nbChannels_, const IplImage& image)
+    MapsCudaStruct(const int width_, const int height_, const int nbChannels_, const IplImage& image, const MapsCudaMemory memory = MapsCudaMemory::Device)
         : m_size(width_ * height_ * nbChannels_)
+        , m_points(nullptr)
+        , m_storage(nullptr)
+        , m_memory(memory)
     {
-        m_points = allocateMemory(m_size);
-
-        m_IplImageProxy.align = image.align;
-        m_IplImageProxy.depth = image.depth;
-        m_IplImageProxy.dataOrder = image.dataOrder;
-        m_IplImageProxy.nChannels = image.nChannels;
-        m_IplImageProxy.width = image.width;
-        m_IplImageProxy.height = image.height;
-        memcpy(m_IplImageProxy.channelSeq, image.channelSeq, 4);
+        copyProxy(image);
+        m_IplImageProxy.ID = kLayoutId;
 
         //std::ostringstream oss;
         //oss << "New " << toString();
         //maps_report_callback(oss.str().c_str());
     }
 
-    MapsCudaStruct(const int size_, const IplImage& image)
+    MapsCudaStruct(const int size_, const IplImage& image, const MapsCudaMemory memory = MapsCudaMemory::Device)
         : m_size(size_)
+        , m_points(nullptr)
+        , m_storage(nullptr)
+        , m_memory(memory)
     {
-        m_points = allocateMemory(m_size);
-
-        m_IplImageProxy.align = image.align;
-        m_IplImageProxy.depth = image.depth;
-        m_IplImageProxy.dataOrder = image.dataOrder;
-        m_IplImageProxy.nChannels = image.nChannels;
-        m_IplImageProxy.width = image.width;
-        m_IplImageProxy.height = image.height;
-        memcpy(m_IplImageProxy.channelSeq, image.channelSeq, 4);
+        copyProxy(image);
+        m_IplImageProxy.ID = kLayoutId;
 
         //std::ostringstream oss;
         //oss << "New " << toString();
@@ -73,16 +357,12 @@ struct MapsCudaStruct
 
     MapsCudaStruct(const MapsCudaStruct& cudaStruct)
         : m_size(cudaStruct.m_size)
+        , m_points(nullptr)
+        , m_storage(nullptr)
+        , m_memory(cudaStruct.m_memory)
     {
-        m_points = allocateMemory(m_size);
-
-        m_IplImageProxy.align = cudaStruct.m_IplImageProxy.align;
-        m_IplImageProxy.depth = cudaStruct.m_IplImageProxy.depth;
-        m_IplImageProxy.dataOrder = cudaStruct.m_IplImageProxy.dataOrder;
-        m_IplImageProxy.nChannels = cudaStruct.m_IplImageProxy.nChannels;
-        m_IplImageProxy.width = cudaStruct.m_IplImageProxy.width;
-        m_IplImageProxy.height = cudaStruct.m_IplImageProxy.height;
-        memcpy(m_IplImageProxy.channelSeq, cudaStruct.m_IplImageProxy.channelSeq, 4);
+        copyProxy(cudaStruct.m_IplImageProxy);
+        m_IplImageProxy.ID = kLayoutId;
 
         //std::ostringstream oss;
         //oss << "New " << toString();
@@ -95,29 +375,99 @@ struct MapsCudaStruct
         //oss << "Delete " << toString();
         //maps_report_callback(oss.str().c_str());
 
-        freeMemory(m_points);
+        if (m_storage != nullptr)
+            m_storage->Release();
+
+        // The memory may be reused for a struct of the previous layout, which does not write the marker. The store goes
+        // through a volatile glvalue: as the last store to a dying object, a plain one may be removed by the compiler.
+        volatile MapsCudaStruct* const self = this;
+        self->m_IplImageProxy.ID = 0;
     }
 
-    static void* allocateMemory(const int nbPoints_)
+    // False for the structs produced by packages built against the previous layout, which end at m_points:
+    // the fields after m_points must not be read.
+    bool IsCurrentLayout() const
     {
-        void* points = nullptr;
-        const cudaError_t cudaErr = cudaMalloc(&points, nbPoints_);
+        return m_IplImageProxy.ID == kLayoutId;
+    }
 
-        if (cudaErr != cudaError_t::cudaSuccess)
-        {
-            maps_report_callback("Allocation failed");
-            throw std::runtime_error("Allocation failed");
-        }
+    // Whether ShareFrom() can reference the buffer of this struct (a struct of the current layout,
+    // whose buffer is allocated). Otherwise the data has to be copied.
+    bool CanShare() const
+    {
+        return IsCurrentLayout() && m_storage != nullptr;
+    }
 
-        return points;
+    // Makes this struct reference the data of src (or the part of it starting at byteOffset) instead of its own buffer.
+    // The data stays alive until both structs are written again or destroyed.
+    // src.CanShare() is required: throws std::logic_error otherwise.
+    void ShareFrom(const MapsCudaStruct& src, const int byteOffset, const int size_, const IplImage& image)
+    {
+        if (!src.CanShare())
+            throw std::logic_error("MapsCudaStruct::ShareFrom: the source buffer cannot be shared (not allocated, or built by a package with a previous MapsCudaStruct layout).");
+        src.m_storage->AddRef();
+        if (m_storage != nullptr)
+            m_storage->Release();
+        m_storage = src.m_storage;
+        m_points = static_cast<unsigned char*>(src.m_points) + byteOffset;
+        m_size = size_;
+        copyProxy(image);
     }
 
-    static void freeMemory(void* points_)
+    void ShareFrom(const MapsCudaStruct& src)
     {
-        if (points_ != nullptr)
+        ShareFrom(src, 0, src.m_size, src.m_IplImageProxy);
+    }
+
+    // Must be called before writing the data: when the storage is shared with other structs
+    // (forwarded input, or forwarded by a downstream component), a private buffer is taken instead.
+    // The previous content is not copied, the caller is expected to overwrite the whole buffer.
+    // The first call allocates the buffer of the struct. Each buffer taken is reserved in the memory budget of
+    // m_budgetOwner until it is released: throws std::runtime_error when the budget would be exceeded.
+    MapsCudaStruct& Writable()
+    {
+        if (m_storage == nullptr)
+        {
+            m_storage = MapsCudaStorage::Acquire(m_size, m_memory, m_budgetOwner);
+            m_points = m_storage->m_points;
+        }
+        else if (m_storage->IsShared() || m_points != m_storage->m_points || m_storage->m_size != m_size)
         {
-            cudaFree(points_);
+            MapsCudaStorage* storage = MapsCudaStorage::Acquire(m_size, m_memory, m_budgetOwner);
+            m_storage->Release();
+            m_storage = storage;
+            m_points = m_storage->m_points;
         }
+        return *this;
+    }
+
+    // The data seen from the host, without copy, or nullptr when the buffer is not accessible from the host
+    // (MapsCudaMemory::Device, or not allocated yet). Only valid once the device work that wrote it is complete.
+    void* HostPointer() const
+    {
+        if (m_storage == nullptr || m_storage->m_hostPoints == nullptr)
+            return nullptr;
+        const std::ptrdiff_t offset = static_cast<const unsigned char*>(m_points) - static_cast<const unsigned char*>(m_storage->m_points);
+        return static_cast<unsigned char*>(m_storage->m_hostPoints) + offset;
+    }
+
+    // Bytes per row of the device data: the rows are packed, one plane per channel for planar images.
+    int PackedWidthStep() const
+    {
+        const int pixelBytes = (m_IplImageProxy.depth & 0xFF) / 8;
+        return m_IplImageProxy.width * pixelBytes * (m_IplImageProxy.dataOrder == IPL_DATA_ORDER_PIXEL ? m_IplImageProxy.nChannels : 1);
+    }
+
+    // IplImage header on HostPointer(), with the packed rows of the device data. imageData is nullptr when the data
+    // is not accessible from the host.
+    IplImage HostImage() const
+    {
+        IplImage image = MAPS::IplImageModel(m_IplImageProxy.width, m_IplImageProxy.height, m_IplImageProxy.channelSeq,
+            m_IplImageProxy.dataOrder, m_IplImageProxy.depth, m_IplImageProxy.align);
+        image.widthStep = PackedWidthStep();
+        image.imageSize = m_size;
+        image.imageData = static_cast<char*>(HostPointer());
+        return image;
     }
 
     std::string toString() const
@@ -126,10 +476,44 @@ struct MapsCudaStruct
         oss << "MyCudaStruct [this:" << this << "] (Size:" << m_size << ")";
         return oss.str();
     }
+
+private:
+    void copyProxy(const IplImage& image)
+    {
+        m_IplImageProxy.align = image.align;
+        m_IplImageProxy.depth = image.depth;
+        m_IplImageProxy.dataOrder = image.dataOrder;
+        m_IplImageProxy.nChannels = image.nChannels;
+        m_IplImageProxy.width = image.width;
+        m_IplImageProxy.height = image.height;
+        memcpy(m_IplImageProxy.channelSeq, image.channelSeq, 4);
+    }
 };
 
 #pragma pack(pop)
 
+// Device memory of a MapsCudaStruct, for the memory budget of MAPS_DynamicCustomStructComponent. 0 until its buffer is allocated.
+inline size_t DeviceByteSize(const MapsCudaStruct* cudaStruct)
+{
+    return cudaStruct->m_storage != nullptr ? static_cast<size_t>(cudaStruct->m_storage->m_size) : 0;
+}
+
+// Device memory a MapsCudaStruct holds once its buffer is allocated, to size the FIFO of an output from the memory budget.
+inline size_t DeviceBufferByteSize(const MapsCudaStruct* cudaStruct)
+{
+    return static_cast<size_t>(cudaStruct->m_size);
+}
+
+// Called by MAPS_DynamicCustomStructComponent on each element of an output FIFO: the buffer is allocated now,
+// or on the first write when the output is lazy. Either way it, and the buffers taken by the next writes
+// (copy-on-write), are reserved in the memory budget of budgetOwner while they are referenced.
+inline void PrepareDeviceMemory(MapsCudaStruct* cudaStruct, const void* budgetOwner, const bool allocateNow)
+{
+    cudaStruct->m_budgetOwner = budgetOwner;
+    if (allocateNow)
+        cudaStruct->Writable();
+}
+
 #ifdef MAPS_FILTER_USER_DYNAMIC_STRUCTURE
 const MAPSTypeFilterBase Filter_MapsCudaStruct = MAPS_FILTER_USER_DYNAMIC_STRUCTURE(MapsCudaStruct);
 #endif
\ No newline at end of file
@@ -0,0 +1,398 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include "maps_cuda_struct.h"
+
+// Records a decimated subset of the frames of a MapsCudaStruct stream to a raw file, without blocking the thread
+// that offers them.
+// Offer() keeps a reference on the buffer of the frame (so the producer writes its next frames into other buffers,
+// see MapsCudaStruct::Writable()), enqueues its copy into a page-locked slot of a ring on a dedicated CUDA stream
+// and returns. An I/O thread waits for the copies, in order, and writes the frames to the file.
+// When all the slots are busy (the copies or the disk do not keep up), the frame is dropped.
+// The page-locked slots are allocated outside of Offer(): by Preallocate() before the first frame, then by the I/O thread
+// when larger frames are offered. A frame larger than its slot is dropped while the slots are enlarged.
+// The frames must be complete when they are offered, i.e. written by synchronous calls as the components of the package do:
+// the copies run on a non-blocking stream that does not wait for the default stream.
+//
+// File format: a FrameHeader per frame, followed by planeCount planes of height rows of pitch bytes.
+class MapsCudaTap
+{
+public:
+#pragma pack(push,1)
+    struct FrameHeader
+    {
+        char magic[4];          // "MCTP"
+        int32_t version;        // 1
+        int64_t timestamp;      // us
+        int32_t width;
+        int32_t height;
+        int32_t depth;          // IPL_DEPTH_*
+        int32_t nChannels;
+        int32_t dataOrder;      // IPL_DATA_ORDER_PIXEL or IPL_DATA_ORDER_PLANE
+        char channelSeq[4];
+        int32_t planeCount;     // 1 for pixel-ordered images, nChannels for planar ones
+        int32_t pitch;          // bytes per row of a plane
+        int64_t dataSize;       // planeCount * height * pitch bytes follow the header
+    };
+#pragma pack(pop)
+
+    ~MapsCudaTap()
+    {
+        Stop();
+    }
+
+    // Opens path and starts the I/O thread. One frame out of decimation is recorded, through a ring of slotCount slots.
+    // Throws std::runtime_error when the file or the CUDA resources cannot be created.
+    void Start(const std::string& path, const int decimation, const int slotCount)
+    {
+        Stop();
+
+        m_decimation = std::max(decimation, 1);
+        m_offered = 0;
+        m_captured = 0;
+        m_dropped = 0;
+        m_written = 0;
+        m_writtenBytes = 0;
+        m_writeFailed = false;
+        m_slotBytes = 0;
+        m_enlargeRequested = false;
+        m_allocFailed = false;
+
+        m_file = std::fopen(path.c_str(), "wb");
+        if (m_file == nullptr)
+            throw std::runtime_error("Cannot open the tap file " + path);
+
+        if (cudaStreamCreateWithFlags(&m_stream, cudaStreamNonBlocking) != cudaSuccess)
+        {
+            Close();
+            throw std::runtime_error("Cannot create the CUDA stream of the tap");
+        }
+
+        m_slots.resize(std::max(slotCount, 1));
+        m_free.reserve(m_slots.size());
+        m_pending.assign(m_slots.size(), -1);
+        m_pendingHead = 0;
+        m_pendingCount = 0;
+        for (size_t i = 0; i < m_slots.size(); ++i)
+        {
+            if (cudaEventCreateWithFlags(&m_slots[i].copied, cudaEventDisableTiming) != cudaSuccess)
+            {
+                Close();
+                throw std::runtime_error("Cannot create the CUDA events of the tap");
+            }
+            m_free.push_back(static_cast<int>(i));
+        }
+
+        m_stopping = false;
+        m_thread = std::thread(&MapsCudaTap::Run, this);
+    }
+
+    // Writes the frames already offered, then stops the I/O thread and closes the file.
+    void Stop()
+    {
+        if (m_thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_cond.notify_one();
+            m_thread.join();
+        }
+        Close();
+    }
+
+    bool Running() const { return m_file != nullptr; }
+
+    // Allocates the free page-locked slots for frames of frameBytes bytes (see FrameBytes()), on the calling thread.
+    // To be called once started, before the first frame is offered. Throws std::runtime_error when the allocation fails.
+    void Preallocate(const size_t frameBytes)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_slotBytes = std::max(m_slotBytes, frameBytes);
+        if (!EnlargeFreeSlots(lock))
+            throw std::runtime_error("Cannot allocate the page-locked buffers of the tap");
+    }
+
+    // Number of bytes recorded for frame
+    static size_t FrameBytes(const MapsCudaStruct& frame)
+    {
+        FrameHeader header;
+        FillHeader(header, frame, 0);
+        return static_cast<size_t>(std::min<int64_t>(header.dataSize, frame.m_size));
+    }
+
+    // Called for each frame of the stream. Never waits for the GPU, the disk or the I/O thread, and never allocates:
+    // returns false when the frame is not recorded (decimated, no free slot, or a slot too small for the frame).
+    bool Offer(const MapsCudaStruct& frame, const MAPSTimestamp ts)
+    {
+        if (!Running() || !frame.CanShare())
+            return false; // No buffer yet, or a struct of the previous layout that cannot be referenced
+        if (m_offered++ % m_decimation != 0)
+            return false;
+
+        std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+        if (!lock.owns_lock() || m_free.empty())
+        {
+            ++m_dropped;
+            return false;
+        }
+
+        const int idx = m_free.back();
+        Slot& slot = m_slots[idx];
+        FillHeader(slot.header, frame, ts);
+        const size_t dataSize = static_cast<size_t>(std::min<int64_t>(slot.header.dataSize, frame.m_size));
+        slot.header.dataSize = static_cast<int64_t>(dataSize);
+
+        if (slot.capacity < dataSize)
+        {
+            // Larger frames: the I/O thread enlarges the free slots, the next frames of this size are recorded
+            ++m_dropped;
+            if (!m_allocFailed)
+            {
+                m_slotBytes = std::max(m_slotBytes, dataSize);
+                m_enlargeRequested = true;
+                lock.unlock();
+                m_cond.notify_one();
+            }
+            return false;
+        }
+
+        if (cudaMemcpyAsync(slot.pinned, frame.m_points, dataSize, cudaMemcpyDefault, m_stream) != cudaSuccess
+            || cudaEventRecord(slot.copied, m_stream) != cudaSuccess)
+        {
+            ++m_dropped;
+            return false;
+        }
+
+        frame.m_storage->AddRef();
+        slot.source = frame.m_storage;
+        m_free.pop_back();
+        m_pending[(m_pendingHead + m_pendingCount) % m_pending.size()] = idx;
+        ++m_pendingCount;
+        ++m_captured;
+        lock.unlock();
+        m_cond.notify_one();
+        return true;
+    }
+
+    // To be called once stopped.
+    std::string Report() const
+    {
+        std::ostringstream ss;
+        ss << "GPU tap: " << m_written << " frames written (" << MemoryBudget::ToMB(m_writtenBytes) << " MB), "
+           << m_dropped << " dropped, of " << m_offered << " frames received (decimation " << m_decimation << ").";
+        if (m_writeFailed)
+            ss << " Writing to the file failed, the following frames were not written.";
+        if (m_allocFailed)
+            ss << " The page-locked buffers could not be enlarged, the larger frames were dropped.";
+        return ss.str();
+    }
+
+    // Counters of the frames passed to Offer(), for the thread that calls it
+    MAPSInt64 Offered() const { return m_offered; }
+    MAPSInt64 Captured() const { return m_captured; }
+    MAPSInt64 Dropped() const { return m_dropped; }
+
+private:
+    struct Slot
+    {
+        cudaEvent_t copied = nullptr;
+        void* pinned = nullptr;              // page-locked host copy of the frame
+        size_t capacity = 0;
+        FrameHeader header;
+        MapsCudaStorage* source = nullptr;   // referenced until the copy is complete
+    };
+
+    static void FillHeader(FrameHeader& header, const MapsCudaStruct& frame, const MAPSTimestamp ts)
+    {
+        const IplImage& proxy = frame.m_IplImageProxy;
+        std::memcpy(header.magic, "MCTP", 4);
+        header.version = 1;
+        header.timestamp = ts;
+        header.width = proxy.width;
+        header.height = proxy.height;
+        header.depth = proxy.depth;
+        header.nChannels = proxy.nChannels;
+        header.dataOrder = proxy.dataOrder;
+        std::memcpy(header.channelSeq, proxy.channelSeq, 4);
+        header.planeCount = proxy.dataOrder == IPL_DATA_ORDER_PIXEL ? 1 : proxy.nChannels;
+        header.pitch = frame.PackedWidthStep();
+        header.dataSize = static_cast<int64_t>(header.planeCount) * header.height * header.pitch;
+    }
+
+    // (Re)allocates the free slots smaller than m_slotBytes. lock is held on m_mutex: the slots are taken out of m_free
+    // and the lock is released while they are allocated, so that Offer() is never blocked by cudaHostAlloc/cudaFreeHost
+    // (it drops the frames meanwhile). Returns false when an allocation failed.
+    bool EnlargeFreeSlots(std::unique_lock<std::mutex>& lock)
+    {
+        const size_t size = m_slotBytes;
+        std::vector<int> enlarged;
+        for (size_t i = 0; i < m_free.size();)
+        {
+            if (m_slots[m_free[i]].capacity < size)
+            {
+                enlarged.push_back(m_free[i]);
+                m_free[i] = m_free.back();
+                m_free.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+        m_enlargeRequested = false;
+        if (enlarged.empty())
+            return true;
+
+        lock.unlock();
+        bool allocated = true;
+        for (const int idx : enlarged)
+        {
+            Slot& slot = m_slots[idx];
+            if (slot.pinned != nullptr)
+                cudaFreeHost(slot.pinned);
+            slot.pinned = nullptr;
+            slot.capacity = 0;
+            if (cudaHostAlloc(&slot.pinned, size, cudaHostAllocDefault) != cudaSuccess)
+            {
+                slot.pinned = nullptr;
+                allocated = false;
+                continue;
+            }
+            slot.capacity = size;
+        }
+        lock.lock();
+
+        m_free.insert(m_free.end(), enlarged.begin(), enlarged.end());
+        if (!allocated)
+            m_allocFailed = true;
+        return allocated;
+    }
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_cond.wait(lock, [this] { return m_stopping || m_pendingCount != 0 || m_enlargeRequested; });
+            if (m_pendingCount == 0)
+            {
+                if (m_stopping)
+                    break;
+                EnlargeFreeSlots(lock);
+                continue;
+            }
+
+            const int idx = m_pending[m_pendingHead];
+            m_pendingHead = (m_pendingHead + 1) % m_pending.size();
+            --m_pendingCount;
+            lock.unlock();
+
+            Slot& slot = m_slots[idx];
+            cudaEventSynchronize(slot.copied);
+            slot.source->Release();
+            slot.source = nullptr;
+            Write(slot);
+
+            lock.lock();
+            m_free.push_back(idx);
+        }
+    }
+
+    void Write(const Slot& slot)
+    {
+        if (m_writeFailed)
+            return;
+        const size_t dataSize = static_cast<size_t>(slot.header.dataSize);
+        if (std::fwrite(&slot.header, sizeof(FrameHeader), 1, m_file) != 1
+            || std::fwrite(slot.pinned, 1, dataSize, m_file) != dataSize)
+        {
+            m_writeFailed = true;
+            return;
+        }
+        ++m_written;
+        m_writtenBytes += static_cast<MAPSInt64>(sizeof(FrameHeader) + dataSize);
+    }
+
+    void Close()
+    {
+        for (Slot& slot : m_slots)
+        {
+            if (slot.copied != nullptr)
+                cudaEventDestroy(slot.copied);
+            if (slot.pinned != nullptr)
+                cudaFreeHost(slot.pinned);
+        }
+        m_slots.clear();
+        m_free.clear();
+        m_pending.clear();
+        m_pendingHead = 0;
+        m_pendingCount = 0;
+
+        if (m_stream != nullptr)
+        {
+            cudaStreamDestroy(m_stream);
+            m_stream = nullptr;
+        }
+        if (m_file != nullptr)
+        {
+            std::fclose(m_file);
+            m_file = nullptr;
+        }
+    }
+
+    std::FILE* m_file = nullptr;
+    cudaStream_t m_stream = nullptr;
+    std::vector<Slot> m_slots;
+    std::vector<int> m_free;        // slots that can receive a frame, reserved for all the slots
+    std::vector<int> m_pending;     // ring of the slots holding a frame to write, in the order of the frames
+    size_t m_pendingHead = 0;       // oldest frame of m_pending
+    size_t m_pendingCount = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+    bool m_stopping = false;
+    bool m_writeFailed = false;
+    size_t m_slotBytes = 0;         // size of the frames the slots are (being) allocated for
+    bool m_enlargeRequested = false;
+    bool m_allocFailed = false;     // the slots are no longer enlarged
+
+    int m_decimation = 1;
+    MAPSInt64 m_offered = 0;        // updated by Offer() only
+    MAPSInt64 m_captured = 0;
+    MAPSInt64 m_dropped = 0;
+    MAPSInt64 m_written = 0;        // updated by the I/O thread only
+    MAPSInt64 m_writtenBytes = 0;
+};
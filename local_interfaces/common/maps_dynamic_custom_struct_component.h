@@ -32,7 +32,7 @@
 #endif
 
 // std
-#include <algorithm>    // find
+#include <algorithm>    // find, max, min
 #include <cstddef>      // size_t
 #include <exception>    // exception
 #include <functional>   // function
@@ -47,9 +47,11 @@
 // rtmaps
 #include <maps.hpp>
 
+#include "maps_memory_budget.h"
+
 // version
 #define MAPS_DynamicCustomStructComponent_Version_MAJOR 2
-#define MAPS_DynamicCustomStructComponent_Version_MINOR 1
+#define MAPS_DynamicCustomStructComponent_Version_MINOR 3
 #define MAPS_DynamicCustomStructComponent_Version_PATCH 0
 
 /// \brief A component parent that abstracts away memory management when using Dynamic Custom Structs in component outputs
@@ -97,6 +99,32 @@
 ///     MAPS_DynamicCustomStructComponent::FreeBuffers();
 /// \endcode
 ///
+/// \brief Device memory held by a dynamic custom struct, counted in the memory budget (see MemoryBudget).
+///
+/// Overload it, in the namespace of the struct, for the structs that own device memory. The others hold none.
+inline size_t DeviceByteSize(const void* /*customStruct*/)
+{
+    return 0;
+}
+
+/// \brief Device memory a dynamic custom struct that has just been built will hold once its buffer is allocated,
+/// used to size the FIFO of its output from the memory budget (see SetFifoDepthFromBudget()).
+///
+/// Overload it, in the namespace of the struct, for the structs that own device memory. The others hold none.
+inline size_t DeviceBufferByteSize(const void* /*customStruct*/)
+{
+    return 0;
+}
+
+/// \brief Allocates the device memory of a dynamic custom struct that has just been built (allocateNow),
+/// or prepares it to be allocated on its first write (lazy outputs, see SetLazyDynamicOutputs()).
+/// The device memory is reserved in the memory budget of budgetOwner when it is allocated.
+///
+/// Overload it, in the namespace of the struct, for the structs that own device memory. The others hold none.
+inline void PrepareDeviceMemory(void* /*customStruct*/, const void* /*budgetOwner*/, const bool /*allocateNow*/)
+{
+}
+
 class MAPS_DynamicCustomStructComponent : public MAPSComponent
 {
 public:
@@ -112,6 +140,9 @@ public:
         const std::function<void(void*)> dtor;
         const std::string                typeName;
         const size_t                     elementByteSize;
+        const std::function<size_t(const void*)> deviceByteSize;
+        const std::function<size_t(const void*)> deviceBufferByteSize;
+        const std::function<void(void*, const void*, bool)> prepareDeviceMemory;
 
         OutputWrapper() = delete;
         ~OutputWrapper() = default;
@@ -124,6 +155,9 @@ public:
             , dtor(other.dtor)
             , typeName(other.typeName)
             , elementByteSize(other.elementByteSize)
+            , deviceByteSize(other.deviceByteSize)
+            , deviceBufferByteSize(other.deviceBufferByteSize)
+            , prepareDeviceMemory(other.prepareDeviceMemory)
         {}
 
         OutputWrapper(OutputWrapper&& other)
@@ -132,6 +166,9 @@ public:
             , dtor(other.dtor)
             , typeName(other.typeName)
             , elementByteSize(other.elementByteSize)
+            , deviceByteSize(other.deviceByteSize)
+            , deviceBufferByteSize(other.deviceBufferByteSize)
+            , prepareDeviceMemory(other.prepareDeviceMemory)
         {}
 
         OutputWrapper(
@@ -139,12 +176,18 @@ public:
             std::function<void* ()>     ctor_,
             std::function<void(void*)> dtor_,
             std::string                typeName_,
-            const size_t               elementByteSize_)
+            const size_t               elementByteSize_,
+            std::function<size_t(const void*)> deviceByteSize_,
+            std::function<size_t(const void*)> deviceBufferByteSize_,
+            std::function<void(void*, const void*, bool)> prepareDeviceMemory_)
             : output(output_)
             , ctor(std::move(ctor_))
             , dtor(std::move(dtor_))
             , typeName(std::move(typeName_))
             , elementByteSize(elementByteSize_)
+            , deviceByteSize(std::move(deviceByteSize_))
+            , deviceBufferByteSize(std::move(deviceBufferByteSize_))
+            , prepareDeviceMemory(std::move(prepareDeviceMemory_))
         {}
 
         std::string outputName() const { return std::string((const char*)output->Name().Tail('.')); }
@@ -192,7 +235,10 @@ public:
             [constructT] { return static_cast<void*>(constructT());  },
             [destroyT](void* p) { destroyT(static_cast<T*>(p)); },
             typeName<T>(),
-            sizeof(T)
+            sizeof(T),
+            [](const void* p) { return DeviceByteSize(static_cast<const T*>(p)); },
+            [](const void* p) { return DeviceBufferByteSize(static_cast<const T*>(p)); },
+            [](void* p, const void* owner, bool allocateNow) { PrepareDeviceMemory(static_cast<T*>(p), owner, allocateNow); }
         };
     }
     /// \brief Creates an OutputWrapper object for use in AllocateDynamicOutputBuffers()
@@ -237,6 +283,9 @@ protected:
 
 private:
     std::vector<OutputWrapper> m_outputWrappers;
+    bool m_lazyOutputs = false;
+    int m_prewarmCount = 0;
+    bool m_fifoDepthFromBudget = false;
 
 protected:
 
@@ -299,12 +348,62 @@ protected:
         allocateDynamicOutputs();
     }
 
-    /// \brief Frees the memory that has been allocated by AllocateDynamicOutputBuffers
+    /// \brief Defers the allocation of the device memory of the dynamic outputs to the first write of each element
+    ///
+    /// By default, the device memory of all the elements of the FIFOs is allocated by AllocateDynamicOutputBuffers().
+    /// In lazy mode, only the first prewarmCount elements of each FIFO are allocated there: the device memory of the
+    /// others is allocated (and reserved in the memory budget) the first time the component writes into them, so that
+    /// the memory used follows the number of elements actually in flight in the diagram rather than the FIFO size.
+    ///
+    /// \note Must be called before AllocateDynamicOutputBuffers()
+    ///
+    /// \param[in] lazy          Whether the allocation is deferred
+    /// \param[in] prewarmCount  Number of elements of each FIFO allocated upfront in lazy mode
+    void SetLazyDynamicOutputs(const bool lazy, const int prewarmCount)
+    {
+        m_lazyOutputs = lazy;
+        m_prewarmCount = prewarmCount > 0 ? prewarmCount : 0;
+    }
+
+    /// \brief Sizes the FIFO of the dynamic outputs from the memory budget when they are allocated
+    ///
+    /// The FIFOs of the outputs given to AllocateDynamicOutputBuffers() get the same depth: the number of elements of
+    /// all of them that fit in the device memory left in the budget (see MemoryBudget), at least 1, at most the
+    /// current size of the FIFOs. Nothing changes when no budget is set.
+    ///
+    /// \note Must be called before AllocateDynamicOutputBuffers()
+    void SetFifoDepthFromBudget(const bool fromBudget)
+    {
+        m_fifoDepthFromBudget = fromBudget;
+    }
+
+    /// \brief Allocates the IplImage buffers of an output, like MAPSOutput::AllocOutputBufferIplImage(),
+    /// after reserving them in the memory budget (see MemoryBudget)
+    ///
+    /// \param[in] output The output
+    /// \param[in] model  The model of the images
+    void AllocateIplImageOutputBuffer(MAPSOutput& output, const IplImage& model)
+    {
+        try
+        {
+            MemoryBudget::Instance().Reserve(this, static_cast<MAPSInt64>(model.imageSize) * MemoryBudget::FifoSize(output), 0);
+        }
+        catch (const std::exception& ex)
+        {
+            Error(ex.what());
+        }
+
+        output.AllocOutputBufferIplImage(model);
+        ReportInfo(MemoryBudget::Instance().Report(this).c_str());
+    }
+
+    /// \brief Frees the memory that has been allocated by AllocateDynamicOutputBuffers, and its reservation in the memory budget
     ///
     /// \note Must be called in your component's FreeBuffers()
     void FreeBuffers() override
     {
         FreeDynamicOutputs();
+        MemoryBudget::Instance().Release(this);
         MAPSComponent::FreeBuffers();
     }
 
@@ -316,6 +415,9 @@ private:
 
     void allocateDynamicOutputs()
     {
+        if (m_fifoDepthFromBudget)
+            sizeDynamicOutputFifos();
+
         for (auto& outputWrapper : m_outputWrappers)
         {
             allocateDynamicOutput(outputWrapper);
@@ -332,8 +434,65 @@ private:
         }
 
         forEachFifoElt(outputWrapper, [this](MAPSIOElt& ioEltOut, OutputWrapper& outputWrapper_, const size_t fifoIdx) {
+            if (fifoIdx == 0)
+                reserveDynamicOutput(outputWrapper_);
             allocateDynamicOutputElement(ioEltOut, outputWrapper_, fifoIdx);
             });
+
+        ReportInfo(MemoryBudget::Instance().Report(this).c_str());
+    }
+
+    // Sets the depth of the FIFOs to the number of elements of all the outputs that fit in the budget left
+    void sizeDynamicOutputFifos()
+    {
+        const MAPSInt64 available = MemoryBudget::Instance().Available();
+        if (available < 0)
+            return;
+
+        MAPSInt64 elementBytes = 0;
+        int fifoSize = 0;
+        for (auto& outputWrapper : m_outputWrappers)
+        {
+            void* const probe = outputWrapper.ctor();
+            if (probe != nullptr)
+            {
+                elementBytes += static_cast<MAPSInt64>(outputWrapper.deviceBufferByteSize(probe));
+                outputWrapper.dtor(probe);
+            }
+            const int outputFifoSize = MemoryBudget::FifoSize(*outputWrapper.output);
+            if (fifoSize == 0 || outputFifoSize < fifoSize)
+                fifoSize = outputFifoSize;
+        }
+        if (elementBytes == 0)
+            return;
+
+        const int depth = static_cast<int>(std::max<MAPSInt64>(1, std::min<MAPSInt64>(available / elementBytes, fifoSize)));
+        for (auto& outputWrapper : m_outputWrappers)
+            outputWrapper.output->SetFifoSize(depth);
+
+        std::ostringstream oss;
+        oss << "FIFO depth derived from the memory budget: " << depth << " (" << MemoryBudget::ToMB(elementBytes)
+            << " MB of device memory per element, " << MemoryBudget::ToMB(available) << " MB left in the budget)";
+        const std::string infoStr(oss.str());
+        ReportInfo(infoStr.c_str());
+    }
+
+    // The structs are reserved for the whole FIFO. Their device memory is reserved buffer by buffer,
+    // while the buffers are referenced (see PrepareDeviceMemory()).
+    void reserveDynamicOutput(OutputWrapper& outputWrapper)
+    {
+        const MAPSInt64 fifoSize = MemoryBudget::FifoSize(*outputWrapper.output);
+        try
+        {
+            MemoryBudget::Instance().Reserve(this, static_cast<MAPSInt64>(outputWrapper.elementByteSize) * fifoSize, 0);
+        }
+        catch (const std::exception& ex)
+        {
+            std::ostringstream oss;
+            oss << "Output [" << outputWrapper.outputName() << "]: " << ex.what();
+            const std::string errStr(oss.str());
+            Error(errStr.c_str());
+        }
     }
 
     void allocateDynamicOutputElement(MAPSIOElt& ioEltOut, OutputWrapper& outputWrapper, const size_t fifoIdx)
@@ -345,6 +504,11 @@ private:
         try
         {
             ioEltOut.Data() = outputWrapper.ctor();
+            if (ioEltOut.Data() != nullptr)
+            {
+                const bool allocateNow = !m_lazyOutputs || fifoIdx < static_cast<size_t>(m_prewarmCount);
+                outputWrapper.prepareDeviceMemory(ioEltOut.Data(), this, allocateNow);
+            }
         }
         catch (const std::bad_alloc& ex)
         {
@@ -412,9 +576,22 @@ private:
             ReportInfo(infoStr.c_str());
         }
 
-        forEachFifoElt(outputWrapper, [this](MAPSIOElt& ioEltOut, OutputWrapper& outputWrapper_, const size_t fifoIdx) {
+        size_t allocatedCount = 0; // elements that were written, or that received the data of another struct
+        size_t fifoSize = 0;
+        forEachFifoElt(outputWrapper, [&](MAPSIOElt& ioEltOut, OutputWrapper& outputWrapper_, const size_t fifoIdx) {
+            if (ioEltOut.Data() != nullptr && outputWrapper_.deviceByteSize(ioEltOut.Data()) > 0)
+                ++allocatedCount;
+            ++fifoSize;
             freeDynamicOutputElement(ioEltOut, outputWrapper_, fifoIdx);
             });
+
+        if (m_lazyOutputs)
+        {
+            std::ostringstream oss;
+            oss << "Output [" << outputWrapper.outputName() << "]: " << allocatedCount << " of the " << fifoSize << " elements held device memory";
+            const std::string infoStr(oss.str());
+            ReportInfo(infoStr.c_str());
+        }
     }
 
     void freeDynamicOutputElement(MAPSIOElt& ioEltOut, OutputWrapper& outputWrapper, const size_t /*fifoIdx*/)
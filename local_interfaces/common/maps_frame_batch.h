@@ -0,0 +1,87 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdexcept>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include <maps.hpp>
+
+// Frames accumulated to be processed in a single call ("batch_size" mode).
+// The frames are copied one under the other in a single matrix: a per-pixel operation processes the whole batch
+// in one call, and a matrix with the same layout (Slice) holds the results.
+// The frames are copied because the input FIFO may recycle its buffers before the batch is full.
+class FrameBatch
+{
+public:
+    void Reset(int capacity, const cv::Size& frameSize, int type)
+    {
+        m_frameSize = frameSize;
+        m_frames.create(capacity * frameSize.height, frameSize.width, type);
+        m_timestamps.assign(capacity, 0);
+        m_count = 0;
+    }
+
+    void Add(const cv::Mat& frame, MAPSTimestamp ts)
+    {
+        if (Full())
+            throw std::logic_error("FrameBatch: the batch is full.");
+        cv::Mat slot = Slice(m_frames, m_count, m_frameSize.height);
+        frame.copyTo(slot);
+        m_timestamps[m_count++] = ts;
+    }
+
+    void Clear() { m_count = 0; }
+
+    // Empties the batch when it goes out of scope, whether it was processed or an exception was thrown,
+    // so that the frames of a failed batch are not kept and the next batch starts empty.
+    class ClearGuard
+    {
+    public:
+        explicit ClearGuard(FrameBatch& batch) : m_batch(batch) {}
+        ~ClearGuard() { m_batch.Clear(); }
+        ClearGuard(const ClearGuard&) = delete;
+        ClearGuard& operator=(const ClearGuard&) = delete;
+
+    private:
+        FrameBatch& m_batch;
+    };
+
+    int Size() const { return m_count; }
+    bool Full() const { return m_count == static_cast<int>(m_timestamps.size()); }
+
+    // The frames added so far, stacked
+    cv::Mat Frames() const { return m_frames.rowRange(0, m_count * m_frameSize.height); }
+    MAPSTimestamp Timestamp(int i) const { return m_timestamps[i]; }
+
+    // Frame i of a stacked matrix (cv::Mat or cv::cuda::GpuMat) of frames of the given height
+    template <typename Mat>
+    static Mat Slice(const Mat& stacked, int i, int frameHeight)
+    {
+        return stacked.rowRange(i * frameHeight, (i + 1) * frameHeight);
+    }
+
+private:
+    cv::Size m_frameSize;
+    cv::Mat m_frames;
+    std::vector<MAPSTimestamp> m_timestamps;
+    int m_count = 0;
+};
@@ -0,0 +1,220 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <exception>
+#include <string>
+#include <vector>
+
+#include <maps.hpp>
+#include <maps_io_access.hpp>  // MAPS::OutputGuard
+
+#include "maps_OpenCV_Conversion.h"
+#include "maps_dynamic_custom_struct_component.h"
+#include "maps_cuda_struct.h"
+#include "maps_image_view.h"
+#include "maps_input_policy.h"
+#include "maps_memory_budget.h"
+
+// Parent of the image components of the package that read IplImage or MapsCudaStruct (GpuMat) images, process them
+// on the CPU or with CUDA, and output IplImage or MapsCudaStruct images.
+// It holds the state and the code they share:
+// - the use_cuda, gpu_mat_as_input and gpu_mat_as_output switches, set by the Dynamic() of the component;
+// - the properties of the GpuMat output buffers: fifo_depth, memory_budget, lazy_allocation, prewarm_buffers, memory_mode;
+// - the input policy: input_policy and drop_interval properties, input_stats output;
+// - the region of interest (roi_x, roi_y, roi_width, roi_height properties) and the views of the input and output images.
+// The properties and outputs are declared by the component, under these names.
+class MAPS_GpuImageComponent : public MAPS_DynamicCustomStructComponent
+{
+protected:
+    MAPS_GpuImageComponent(const char* componentName, MAPSComponentDefinition& md)
+        : MAPS_DynamicCustomStructComponent(componentName, md)
+    {
+    }
+
+    /// \brief Frees the GpuMat output buffers, or the IplImage ones, and their reservation in the memory budget
+    void FreeBuffers() override
+    {
+        if (m_useCuda && m_gpuMatAsOutput)
+        {
+            MAPS_DynamicCustomStructComponent::FreeBuffers();
+        }
+        else
+        {
+            MemoryBudget::Instance().Release(this);
+            MAPSComponent::FreeBuffers();
+        }
+    }
+
+    /// \brief Creates the input_policy property, and the drop_interval property and the input_stats output it needs
+    ///
+    /// \note To be called in Dynamic()
+    void NewInputPolicyProperties()
+    {
+        NewProperty("input_policy");
+        const int inputPolicy = static_cast<int>(GetIntegerProperty("input_policy"));
+        if (inputPolicy == InputPolicy::Mode_DropEveryN)
+            NewProperty("drop_interval");
+        if (inputPolicy != InputPolicy::Mode_Fifo)
+            NewOutput("input_stats");
+    }
+
+    /// \brief Creates the properties of the GpuMat output buffers when they are used, and sizes the FIFO of the outputs
+    ///
+    /// \note To be called in Dynamic(), once m_gpuMatAsOutput is set and the outputs are created
+    ///
+    /// \param[in] outputNames The GpuMat outputs of the component
+    void NewGpuOutputProperties(const std::vector<std::string>& outputNames)
+    {
+        if (!m_gpuMatAsOutput)
+            return;
+
+        // 0 keeps the default size of the output FIFO, or derives it from the memory budget (see ApplyGpuOutputProperties())
+        const int fifoDepth = static_cast<int>(NewProperty("fifo_depth").IntegerValue());
+        if (fifoDepth > 0)
+        {
+            for (const std::string& name : outputNames)
+                Output(name.c_str()).SetFifoSize(fifoDepth);
+        }
+        NewProperty("memory_budget");
+        if (NewProperty("lazy_allocation").BoolValue())
+            NewProperty("prewarm_buffers");
+        NewProperty("memory_mode");
+    }
+
+    void NewGpuOutputProperties(const char* outputName)
+    {
+        NewGpuOutputProperties(std::vector<std::string>{ outputName });
+    }
+
+    /// \brief Applies the properties of the GpuMat output buffers: memory budget, FIFO depth, lazy allocation and memory mode
+    ///
+    /// \note To be called in Birth(), before the output buffers are allocated. The "Managed" memory mode falls back
+    /// to "Mapped" when the device does not support the concurrent access to managed memory from the host.
+    /// When fifo_depth is 0 and a budget is set, the FIFOs are sized from the budget left when the buffers are
+    /// allocated, from the size of the first image.
+    void ApplyGpuOutputProperties()
+    {
+        const MAPSInt64 budget = m_gpuMatAsOutput ? GetIntegerProperty("memory_budget") * 1024 * 1024 : 0;
+        MemoryBudget::Instance().SetLimit(this, budget);
+        const bool fifoDepthFromBudget = m_gpuMatAsOutput && budget > 0 && GetIntegerProperty("fifo_depth") == 0;
+        SetFifoDepthFromBudget(fifoDepthFromBudget);
+        if (fifoDepthFromBudget)
+            ReportInfo("fifo_depth: the depth of the output FIFOs is derived from memory_budget and the size of the first image.");
+        const bool lazyAllocation = m_gpuMatAsOutput && GetBoolProperty("lazy_allocation");
+        SetLazyDynamicOutputs(lazyAllocation, lazyAllocation ? static_cast<int>(GetIntegerProperty("prewarm_buffers")) : 0);
+        m_memoryMode = m_gpuMatAsOutput ? static_cast<MapsCudaMemory>(GetIntegerProperty("memory_mode")) : MapsCudaMemory::Device;
+        if (m_memoryMode == MapsCudaMemory::Managed && !ConcurrentManagedAccess())
+        {
+            ReportWarning("memory_mode: this device does not support the access to managed memory from the host while it runs. Mapped memory is used instead.");
+            m_memoryMode = MapsCudaMemory::Mapped;
+        }
+    }
+
+    /// \brief Applies the input_policy and drop_interval properties
+    ///
+    /// \note To be called in Birth()
+    void ApplyInputPolicyProperties()
+    {
+        const int inputPolicy = static_cast<int>(GetIntegerProperty("input_policy"));
+        m_inputPolicy.Reset(inputPolicy, inputPolicy == InputPolicy::Mode_DropEveryN ? GetIntegerProperty("drop_interval") : 2);
+    }
+
+    /// \brief Returns true when the frame received at ts on the first input is skipped because of the input_policy property:
+    /// newer frames are already waiting in the input FIFO. The input_stats output gives the number of dropped and received frames.
+    bool DropInput(const MAPSTimestamp ts)
+    {
+        if (!m_inputPolicy.Enabled())
+            return false;
+
+        const bool drop = m_inputPolicy.Drop(DataAvailableInFIFO(Input(0)) != 0);
+
+        MAPS::OutputGuard<MAPSFloat64> outGuard{ this, Output("input_stats") };
+        outGuard.Data(0) = static_cast<MAPSFloat64>(m_inputPolicy.Dropped());
+        outGuard.Data(1) = static_cast<MAPSFloat64>(m_inputPolicy.Received());
+        outGuard.VectorSize() = 2;
+        outGuard.Timestamp() = ts;
+        return drop;
+    }
+
+    /// \brief Sets m_roi from the roi_* properties, for input images of the given size
+    ///
+    /// \param[in] alignment The offset and size of the region are multiples of alignment
+    void ResolveRoi(const int width, const int height, const int alignment = 1)
+    {
+        try
+        {
+            m_roi = convTools::resolveRoi(width, height, GetIntegerProperty("roi_x"), GetIntegerProperty("roi_y"), GetIntegerProperty("roi_width"), GetIntegerProperty("roi_height"), alignment);
+        }
+        catch (const std::exception& e)
+        {
+            Error(e.what());
+        }
+    }
+
+    void ResolveRoi(const IplImage& image)
+    {
+        ResolveRoi(image.width, image.height);
+    }
+
+    /// \brief Creates the views of the input images (restricted to m_roi) and of the output images, on the host or the device
+    ///
+    /// \param[in] imageIn Model of the input images, nullptr to only create the output views
+    /// \param[in] model   Model of the output images
+    void CreateViews(const IplImage* imageIn, const IplImage& model)
+    {
+        try
+        {
+            if (imageIn != nullptr)
+            {
+                if (m_gpuMatAsInput)
+                    m_deviceInView = DeviceImageView(*imageIn, m_roi);
+                else
+                    m_hostInView = HostImageView(*imageIn, m_roi);
+            }
+
+            if (m_gpuMatAsOutput)
+                m_deviceOutView = DeviceImageView(model);
+            else
+                m_hostOutView = HostImageView(model);
+        }
+        catch (const std::exception& e)
+        {
+            Error(e.what());
+        }
+    }
+
+    void CreateViews(const IplImage& imageIn, const IplImage& model)
+    {
+        CreateViews(&imageIn, model);
+    }
+
+    bool m_useCuda = false;
+    bool m_gpuMatAsInput = false;
+    bool m_gpuMatAsOutput = false;
+    MapsCudaMemory m_memoryMode = MapsCudaMemory::Device; // memory of the GpuMat output buffers
+
+    cv::Rect m_roi; // region of the input images that is processed
+    HostImageView m_hostInView;
+    DeviceImageView m_deviceInView;
+    HostImageView m_hostOutView;
+    DeviceImageView m_deviceOutView;
+
+    InputPolicy m_inputPolicy;
+};
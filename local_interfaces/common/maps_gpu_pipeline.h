@@ -0,0 +1,224 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+
+#include <maps.hpp>
+
+// Pipelined processing of host images on the GPU (CUDA mode with IplImage input and output).
+// Each frame goes through a slot holding its own page-locked host buffers, device buffers and CUDA stream, and the
+// slots are used in turn: while frame N is uploaded, frame N-1 can be processed and frame N-2 downloaded.
+// A frame is output (emitted) as soon as its work is complete, in the order of reception and with its own timestamp:
+// - EmitCompleted() emits the oldest frames whose work is done, without waiting. It is called after each submission;
+// - EmitBeforeRead() is called before waiting for the next input: it emits the completed frames when an input is already
+//   waiting, and otherwise waits for the frames in flight and emits them, so that a frame is not held until the next
+//   ones arrive (the read would block for an unbounded time anyway);
+// - Next() only waits when all the slots hold a frame, for the oldest one, which it emits;
+// - Flush() waits for the frames still in flight and emits them, when the component stops.
+//
+// Usage:
+//     for each received frame:
+//         GpuPipeline::Slot& slot = pipeline.Next(emit);              // emit(const Slot&) outputs slot.PinnedOut() at slot.Timestamp()
+//         slot.Upload(src); process slot.Src() into slot.Dst() on slot.stream; slot.Download();
+//         pipeline.Submit(ts);
+//         pipeline.EmitCompleted(emit);
+//     before waiting for the next input: pipeline.EmitBeforeRead(emit, DataAvailableInFIFO(input) != 0);
+//     in Death(): pipeline.Flush(emit);
+//
+// The ordering does not depend on CUDA: BasicGpuPipeline takes any slot type derived from GpuPipelineSlotBase with
+// bool IsComplete() (non-blocking) and void WaitForCompletion(). The unit tests (tests/) emulate the GPU on the host that way.
+class GpuPipelineSlotBase
+{
+public:
+    MAPSTimestamp Timestamp() const { return m_ts; }
+    bool InFlight() const { return m_inFlight; }
+
+private:
+    template <typename Slot>
+    friend class BasicGpuPipeline;
+
+    MAPSTimestamp m_ts = 0;
+    bool m_inFlight = false;
+};
+
+template <typename SlotType>
+class BasicGpuPipeline
+{
+public:
+    using Slot = SlotType;
+
+    // depth < 2 disables the pipeline. The frames in flight are forgotten.
+    void Reset(int depth)
+    {
+        m_slots.clear();
+        if (depth >= 2)
+            m_slots.resize(depth);
+        m_next = 0;
+        m_oldest = 0;
+        m_inFlight = 0;
+        m_frames = 0;
+        m_waited = std::chrono::steady_clock::duration::zero();
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    bool Enabled() const { return !m_slots.empty(); }
+    int Depth() const { return static_cast<int>(m_slots.size()); }
+    int InFlight() const { return m_inFlight; }
+
+    // Slot of the next frame. When it still holds a frame (the oldest one), waits for its work and emits it.
+    template <typename Emit>
+    Slot& Next(Emit emit)
+    {
+        Slot& slot = m_slots[m_next];
+        if (slot.m_inFlight)
+        {
+            Wait(slot);
+            EmitOldest(emit);
+        }
+        return slot;
+    }
+
+    // Marks the slot returned by Next() as holding the frame received at ts, once its work has been enqueued.
+    void Submit(MAPSTimestamp ts)
+    {
+        Slot& slot = m_slots[m_next];
+        slot.m_ts = ts;
+        slot.m_inFlight = true;
+        m_next = (m_next + 1) % m_slots.size();
+        ++m_inFlight;
+        ++m_frames;
+    }
+
+    // Emits, in order, the frames whose work is complete, without waiting: stops at the first frame still in progress.
+    template <typename Emit>
+    void EmitCompleted(Emit emit)
+    {
+        while (m_inFlight > 0 && m_slots[m_oldest].IsComplete())
+            EmitOldest(emit);
+    }
+
+    // To be called before reading the next input. When inputWaiting is false, the read blocks until the next frame
+    // arrives: the frames in flight are waited for and emitted rather than held until then.
+    template <typename Emit>
+    void EmitBeforeRead(Emit emit, const bool inputWaiting)
+    {
+        if (inputWaiting)
+            EmitCompleted(emit);
+        else
+            Flush(emit);
+    }
+
+    // Waits for the frames in flight and emits them, in order.
+    template <typename Emit>
+    void Flush(Emit emit)
+    {
+        while (m_inFlight > 0)
+        {
+            Wait(m_slots[m_oldest]);
+            EmitOldest(emit);
+        }
+    }
+
+    // Share of the time the component was blocked waiting for the GPU. Close to 0 when the transfers and the
+    // processing are fully overlapped with the reception of the next frames.
+    std::string Report() const
+    {
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+        const double waited = std::chrono::duration<double>(m_waited).count();
+        std::ostringstream ss;
+        ss << "GPU pipeline (" << m_slots.size() << " slots): " << m_frames << " frames, "
+           << (elapsed > 0 ? 100.0 * waited / elapsed : 0.0) << "% of the time waiting for the GPU.";
+        return ss.str();
+    }
+
+private:
+    void Wait(Slot& slot)
+    {
+        const auto waitStart = std::chrono::steady_clock::now();
+        slot.WaitForCompletion();
+        m_waited += std::chrono::steady_clock::now() - waitStart;
+    }
+
+    // The slot is released before emit is called, so that an exception thrown by emit leaves the pipeline consistent.
+    template <typename Emit>
+    void EmitOldest(Emit& emit)
+    {
+        Slot& slot = m_slots[m_oldest];
+        slot.m_inFlight = false;
+        m_oldest = (m_oldest + 1) % m_slots.size();
+        --m_inFlight;
+        emit(static_cast<const Slot&>(slot));
+    }
+
+    std::vector<Slot> m_slots;
+    size_t m_next = 0;      // slot of the next frame
+    size_t m_oldest = 0;    // slot of the oldest frame in flight, when m_inFlight > 0
+    int m_inFlight = 0;
+    MAPSInt64 m_frames = 0;
+    std::chrono::steady_clock::duration m_waited = std::chrono::steady_clock::duration::zero();
+    std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+};
+
+// Slot of the CUDA pipeline: the work of a frame is enqueued on the stream of its slot.
+class GpuPipelineSlot : public GpuPipelineSlotBase
+{
+public:
+    // Copies src into the page-locked buffer and enqueues its upload.
+    void Upload(const cv::Mat& src)
+    {
+        m_pinnedIn.create(src.rows, src.cols, src.type());
+        cv::Mat pinned = m_pinnedIn.createMatHeader();
+        src.copyTo(pinned);
+        m_src.upload(m_pinnedIn, stream);
+    }
+
+    // Enqueues the download of Dst() into the page-locked output buffer.
+    void Download()
+    {
+        m_dst.download(m_pinnedOut, stream);
+    }
+
+    const cv::cuda::GpuMat& Src() const { return m_src; }
+    cv::cuda::GpuMat& Dst() { return m_dst; }
+
+    // Result of the frame, valid when it is emitted.
+    cv::Mat PinnedOut() const { return m_pinnedOut.createMatHeader(); }
+
+    bool IsComplete() { return stream.queryIfComplete(); }
+    void WaitForCompletion() { stream.waitForCompletion(); }
+
+    cv::cuda::Stream stream;
+    cv::cuda::GpuMat work;                   // scratch buffers of the processing, one set per slot since
+    std::vector<cv::cuda::GpuMat> planes;    // the slots run concurrently
+
+private:
+    cv::cuda::HostMem m_pinnedIn;
+    cv::cuda::HostMem m_pinnedOut;
+    cv::cuda::GpuMat m_src;
+    cv::cuda::GpuMat m_dst;
+};
+
+using GpuPipeline = BasicGpuPipeline<GpuPipelineSlot>;
@@ -0,0 +1,88 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/cudawarping.hpp>
+
+// Downloads a nearest neighbour subsample of GPU images without waiting for the GPU, for the statistics that are
+// applied from the next frame on anyway (auto white balance, temporal equalization).
+// Enqueue() resizes the image and enqueues the copy of the subsample into page-locked memory on the default stream,
+// after the work already enqueued on it.
+// Take() returns the subsample on a later frame, once its copy is complete. Only one subsample is in flight:
+// the frames received meanwhile are not sampled.
+//
+// Usage, for each frame:
+//     cv::Mat sample;
+//     if (sampler.Take(sample)) use the statistics of sample;
+//     sampler.Enqueue(src, step);
+class GpuSampler
+{
+public:
+    // Enqueues the subsample of src, one pixel every step in each direction, unless the previous one is still in flight.
+    void Enqueue(const cv::cuda::GpuMat& src, const int step)
+    {
+        if (m_pending)
+            return;
+
+        const cv::Size sampleSize(std::max(1, src.cols / step), std::max(1, src.rows / step));
+        cv::cuda::resize(src, m_gpuSample, sampleSize, 0, 0, cv::INTER_NEAREST);
+        m_gpuSample.download(m_hostSample, cv::cuda::Stream::Null());
+        if (!m_copied)
+            m_copied = cv::makePtr<cv::cuda::Event>(cv::cuda::Event::DISABLE_TIMING);
+        m_copied->record(cv::cuda::Stream::Null());
+        m_pending = true;
+    }
+
+    // Sets sample to the subsample in flight when its copy is complete (or once complete, when wait is true),
+    // and returns true. sample is valid until the next call to Enqueue().
+    bool Take(cv::Mat& sample, const bool wait = false)
+    {
+        if (!m_pending)
+            return false;
+        if (wait)
+            m_copied->waitForCompletion();
+        else if (!m_copied->queryIfComplete())
+            return false;
+
+        m_pending = false;
+        sample = m_hostSample.createMatHeader();
+        return true;
+    }
+
+    // Waits for the subsample in flight, if any, and frees the buffers.
+    void Release()
+    {
+        if (m_pending)
+            m_copied->waitForCompletion();
+        m_pending = false;
+        m_gpuSample.release();
+        m_hostSample.release();
+        m_copied.release();
+    }
+
+private:
+    cv::cuda::GpuMat m_gpuSample;
+    cv::cuda::HostMem m_hostSample;   // page-locked, so that the download does not block the host
+    cv::Ptr<cv::cuda::Event> m_copied;   // created with the first subsample: the component may run without a GPU
+    bool m_pending = false;
+};
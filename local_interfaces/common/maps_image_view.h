@@ -0,0 +1,138 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/cudaarithm.hpp>
+
+#include "maps_OpenCV_Conversion.h"
+
+// Describes the images of a stream (size, OpenCV type, row step and region of interest) so that the matrix header
+// on each frame is built without looking at the IplImage again nor validating it.
+// It is built once per stream, in the callbacks that allocate the output buffers, and all the frames of the stream
+// are expected to have the same format.
+// Mat is cv::Mat to view IplImage data (rows are widthStep bytes apart) or cv::cuda::GpuMat to view the device
+// data of a MapsCudaStruct (rows are packed).
+// Planar color images are viewed through a packed copy of their region of interest, interleaved on each frame: the
+// matrix is then only valid until the next frame, and the components make packed images out of them.
+template <typename Mat>
+class ImageView
+{
+    static_assert(std::is_same<Mat, cv::Mat>::value || std::is_same<Mat, cv::cuda::GpuMat>::value,
+                  "ImageView is only available for cv::Mat and cv::cuda::GpuMat");
+
+public:
+    ImageView() = default;
+
+    // Throws std::domain_error for unsupported depths, empty images or when roi does not fit.
+    // An empty roi selects the whole image.
+    explicit ImageView(const IplImage& image, const cv::Rect& roi = cv::Rect())
+        : m_rows(image.height)
+        , m_cols(image.width)
+        , m_type(convTools::cvType(&image))
+        , m_step(std::is_same<Mat, cv::Mat>::value ? static_cast<size_t>(image.widthStep) : cv::Mat::AUTO_STEP)
+        , m_roi(roi.area() > 0 ? roi : cv::Rect(0, 0, image.width, image.height))
+    {
+        if ((image.dataOrder == IPL_DATA_ORDER_PLANE) && (image.nChannels != 1))
+        {
+            if (image.nChannels > 4)
+                throw std::domain_error("Planar images with more than 4 channels are not supported.");
+            m_planar = true;
+            m_planarModel = image;
+            m_planarModel.roi = nullptr;
+            m_planarModel.imageData = nullptr;
+        }
+        if ((m_rows <= 0) || (m_cols <= 0))
+        {
+            throw std::domain_error("Image width or height <= 0. Cannot view the image as a matrix.");
+        }
+        if ((m_roi & cv::Rect(0, 0, m_cols, m_rows)) != m_roi)
+        {
+            std::ostringstream s;
+            s << "ROI [" << m_roi.x << ", " << m_roi.y << ", " << m_roi.width << " x " << m_roi.height << "] is outside of the " << m_cols << " x " << m_rows << " image.";
+            throw std::domain_error(s.str());
+        }
+        m_fullFrame = (m_roi.width == m_cols) && (m_roi.height == m_rows);
+    }
+
+    // Matrix header on data, restricted to the region of interest. The data is not copied, unless the image is planar.
+    Mat operator()(const void* data) const
+    {
+        if (m_planar)
+        {
+            interleave(data, m_packed);
+            return m_packed;
+        }
+        const Mat full(m_rows, m_cols, m_type, const_cast<void*>(data), m_step);
+        return m_fullFrame ? full : full(m_roi);
+    }
+
+    bool IsValid() const { return m_type >= 0; }
+    int Type() const { return m_type; }
+    const cv::Rect& Roi() const { return m_roi; }
+    // Whether the images are planar color images, viewed through a packed copy
+    bool IsPlanar() const { return m_planar; }
+
+private:
+    void interleave(const void* data, cv::Mat& packed) const
+    {
+        IplImage planar = m_planarModel;
+        IplROI roi;
+        roi.coi = 0;
+        roi.xOffset = m_roi.x;
+        roi.yOffset = m_roi.y;
+        roi.width = m_roi.width;
+        roi.height = m_roi.height;
+        planar.roi = m_fullFrame ? nullptr : &roi;
+        planar.imageData = static_cast<char*>(const_cast<void*>(data));
+        convTools::planarToPacked(&planar, packed);
+    }
+
+    // The planes of a MapsCudaStruct follow each other, with packed rows
+    void interleave(const void* data, cv::cuda::GpuMat& packed) const
+    {
+        const int planeType = CV_MAT_DEPTH(m_type);
+        const size_t planeBytes = static_cast<size_t>(m_rows) * m_cols * CV_ELEM_SIZE(planeType);
+        cv::cuda::GpuMat planes[4];
+        for (int c = 0; c < m_planarModel.nChannels; ++c)
+        {
+            const cv::cuda::GpuMat plane(m_rows, m_cols, planeType, static_cast<char*>(const_cast<void*>(data)) + c * planeBytes);
+            planes[c] = m_fullFrame ? plane : plane(m_roi);
+        }
+        cv::cuda::merge(planes, m_planarModel.nChannels, packed);
+    }
+
+    int m_rows = 0;
+    int m_cols = 0;
+    int m_type = -1;
+    size_t m_step = cv::Mat::AUTO_STEP;
+    cv::Rect m_roi;
+    bool m_fullFrame = true;
+    bool m_planar = false;
+    IplImage m_planarModel{};
+    mutable Mat m_packed; // packed copy of the last planar frame
+};
+
+using HostImageView = ImageView<cv::Mat>;
+using DeviceImageView = ImageView<cv::cuda::GpuMat>;
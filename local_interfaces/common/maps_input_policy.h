@@ -0,0 +1,87 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <sstream>
+#include <string>
+
+#include <maps.hpp>
+
+// Frames skipped when a component is slower than its input ("input_policy" property).
+// The policy only applies when newer frames are already waiting in the input FIFO: a component that keeps up with
+// its input processes every frame whatever the policy.
+//  - FIFO: every frame is processed, the latency grows with the backlog.
+//  - Latest only: a frame is skipped when a newer one is waiting, only the newest frame is processed.
+//  - Drop every N: under backlog, one frame out of N is skipped.
+class InputPolicy
+{
+public:
+    enum Mode
+    {
+        Mode_Fifo = 0,
+        Mode_LatestOnly = 1,
+        Mode_DropEveryN = 2
+    };
+
+    void Reset(int mode, MAPSInt64 dropInterval = 2)
+    {
+        m_mode = static_cast<Mode>(mode);
+        m_dropInterval = dropInterval < 2 ? 2 : dropInterval;
+        m_received = 0;
+        m_dropped = 0;
+        m_backlogged = 0;
+    }
+
+    bool Enabled() const { return m_mode != Mode_Fifo; }
+
+    // To be called for each frame read. backlog tells whether newer frames are waiting in the input FIFO.
+    // Returns true when the frame must be skipped.
+    bool Drop(bool backlog)
+    {
+        ++m_received;
+        bool drop = false;
+        if (backlog)
+        {
+            if (m_mode == Mode_LatestOnly)
+                drop = true;
+            else if (m_mode == Mode_DropEveryN)
+                drop = (++m_backlogged % m_dropInterval) == 0;
+        }
+        if (drop)
+            ++m_dropped;
+        return drop;
+    }
+
+    MAPSInt64 Received() const { return m_received; }
+    MAPSInt64 Dropped() const { return m_dropped; }
+
+    std::string Report() const
+    {
+        std::ostringstream ss;
+        ss << "Input policy : " << m_dropped << " of " << m_received << " frames dropped.";
+        return ss.str();
+    }
+
+private:
+    Mode m_mode = Mode_Fifo;
+    MAPSInt64 m_dropInterval = 2;
+    MAPSInt64 m_received = 0;
+    MAPSInt64 m_dropped = 0;
+    MAPSInt64 m_backlogged = 0;
+};
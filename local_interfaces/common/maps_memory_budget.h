@@ -0,0 +1,172 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <maps.hpp>
+
+// Output buffers reserved by the components of the package, and optional budget of device memory shared by all of them
+// ("memory_budget" property). The components reserve the buffers of an output before allocating them: the reservation
+// fails, and nothing is allocated, when the device bytes of all the components would exceed the budget.
+// When several components set a budget, the smallest one applies.
+class MemoryBudget
+{
+public:
+    static MemoryBudget& Instance()
+    {
+        static MemoryBudget budget;
+        return budget;
+    }
+
+    // bytes <= 0 : no budget set by this owner.
+    void SetLimit(const void* owner, MAPSInt64 bytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ownerLocked(owner).limit = bytes > 0 ? bytes : 0;
+    }
+
+    // Reserves hostBytes and deviceBytes more for owner, and returns the run of owner they are reserved in (see Unreserve()).
+    // Throws std::runtime_error when the budget would be exceeded.
+    MAPSInt64 Reserve(const void* owner, MAPSInt64 hostBytes, MAPSInt64 deviceBytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const MAPSInt64 limit = limitLocked();
+        const MAPSInt64 total = deviceBytesLocked() + deviceBytes;
+        if (limit > 0 && total > limit)
+        {
+            std::ostringstream ss;
+            ss << "Memory budget exceeded: " << ToMB(deviceBytes) << " MB of device memory requested, "
+               << ToMB(deviceBytesLocked()) << " MB already reserved by the package, budget " << ToMB(limit) << " MB. "
+               << "Reduce fifo_depth or increase memory_budget.";
+            throw std::runtime_error(ss.str());
+        }
+        Owner& o = ownerLocked(owner);
+        o.hostBytes += hostBytes;
+        o.deviceBytes += deviceBytes;
+        return o.run;
+    }
+
+    // Gives back hostBytes and deviceBytes reserved by owner in run, when the buffer they were reserved for is freed.
+    // Ignored once the reservations of that run are forgotten (Release()): the buffers still referenced by other
+    // components when owner stops are released afterwards, possibly once owner restarted at the same address.
+    void Unreserve(const void* owner, const MAPSInt64 run, MAPSInt64 hostBytes, MAPSInt64 deviceBytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto it = m_owners.find(owner);
+        if (it == m_owners.end() || it->second.run != run)
+            return;
+        it->second.hostBytes -= hostBytes;
+        it->second.deviceBytes -= deviceBytes;
+    }
+
+    // Device bytes that can still be reserved before the budget is exceeded, or -1 when no budget is set.
+    MAPSInt64 Available()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const MAPSInt64 limit = limitLocked();
+        if (limit <= 0)
+            return -1;
+        return std::max<MAPSInt64>(limit - deviceBytesLocked(), 0);
+    }
+
+    // Forgets the reservations and the budget of owner, once its buffers are freed. Its next reservations belong to a new run.
+    void Release(const void* owner)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_owners.erase(owner);
+    }
+
+    std::string Report(const void* owner)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const Owner& o = ownerLocked(owner);
+        const MAPSInt64 limit = limitLocked();
+        std::ostringstream ss;
+        ss << "Output buffers reserved: " << ToMB(o.hostBytes) << " MB host, " << ToMB(o.deviceBytes) << " MB device. "
+           << "Package: " << ToMB(deviceBytesLocked()) << " MB device";
+        if (limit > 0)
+            ss << " of the " << ToMB(limit) << " MB budget";
+        ss << ".";
+        return ss.str();
+    }
+
+    // Number of buffers in the FIFO of an output, once the FIFOs are created (i.e. from Birth()).
+    static int FifoSize(MAPSOutput& output)
+    {
+        MAPSIOMonitor& monitor = output.Monitor();
+        int count = 0;
+        for (MAPSFastIOHandle it = monitor.InitBegin(); it; monitor.InitNext(it))
+            ++count;
+        return count;
+    }
+
+    static double ToMB(MAPSInt64 bytes)
+    {
+        return static_cast<double>(bytes) / (1024.0 * 1024.0);
+    }
+
+private:
+    struct Owner
+    {
+        MAPSInt64 limit = 0;
+        MAPSInt64 hostBytes = 0;
+        MAPSInt64 deviceBytes = 0;
+        MAPSInt64 run = 0;
+    };
+
+    // The entry of owner, created for a new run when its previous reservations were forgotten
+    Owner& ownerLocked(const void* owner)
+    {
+        const auto it = m_owners.find(owner);
+        if (it != m_owners.end())
+            return it->second;
+        Owner& o = m_owners[owner];
+        o.run = ++m_runs;
+        return o;
+    }
+
+    MAPSInt64 limitLocked() const
+    {
+        MAPSInt64 limit = 0;
+        for (const auto& o : m_owners)
+        {
+            if (o.second.limit > 0 && (limit == 0 || o.second.limit < limit))
+                limit = o.second.limit;
+        }
+        return limit;
+    }
+
+    MAPSInt64 deviceBytesLocked() const
+    {
+        MAPSInt64 total = 0;
+        for (const auto& o : m_owners)
+            total += o.second.deviceBytes;
+        return total;
+    }
+
+    std::mutex m_mutex;
+    std::map<const void*, Owner> m_owners;
+    MAPSInt64 m_runs = 0;
+};
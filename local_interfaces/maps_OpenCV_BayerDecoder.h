@@ -26,8 +26,8 @@
 // Includes maps sdk library header
 #include "maps_OpenCV_Conversion.h"
 #include "maps/input_reader/maps_input_reader.hpp"
-#include "common/maps_dynamic_custom_struct_component.h"
-#include "common/maps_cuda_struct.h"
+#include "common/maps_gpu_image_component.h"
+#include "common/maps_gpu_pipeline.h"
 
 enum OUTPUT_FORMAT : uint8_t
 {
@@ -38,14 +38,13 @@ enum OUTPUT_FORMAT : uint8_t
 };
 
 // Declares a new MAPSComponent child class
-class MAPSBayerDecoder : public MAPS_DynamicCustomStructComponent
+class MAPSBayerDecoder : public MAPS_GpuImageComponent
 {
     // Use standard header definition macro
-    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSBayerDecoder, MAPS_DynamicCustomStructComponent)
+    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSBayerDecoder, MAPS_GpuImageComponent)
 
     void Set(MAPSProperty& p, const MAPSString& value) override;
     void Dynamic() override;
-    void FreeBuffers() override;
 
 private:
     void AllocateOutputBufferIpl(const MAPSTimestamp /*ts*/, const MAPS::InputElt<IplImage> imageInElt);
@@ -54,17 +53,18 @@ private:
     void ProcessDataIpl(const MAPSTimestamp ts, const MAPS::InputElt<IplImage> inElt);
     void ProcessDataMaps(const MAPSTimestamp ts, const MAPS::InputElt<MAPSImage> inElt);
     void ProcessDataGpu(const MAPSTimestamp ts, const MAPS::InputElt<MapsCudaStruct> inElt);
+    void ProcessDataPipelined(const MAPSTimestamp ts, const cv::Mat& src);
+    void WritePipelined(const GpuPipeline::Slot& done);
 
-    void ConvertGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst);
+    MAPSUInt32 OutputChannelSeq() const;
+    void ConvertGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst, cv::cuda::Stream& stream = cv::cuda::Stream::Null());
 
 private :
     // Place here your specific methods and attributes
     OUTPUT_FORMAT m_outputFormat;
     cv::ColorConversionCodes m_colorConvCode;
     int	 m_pattern;
-    bool m_useCuda;
-    bool m_gpuMatAsInput = false;
-    bool m_gpuMatAsOutput = false;
+    GpuPipeline m_pipeline; // CUDA mode with host input and output only
 
     cv::Mat m_tempImageIn;
     cv::Mat m_tempImageOut;
@@ -26,17 +26,20 @@
 // Includes maps sdk library header
 #include "maps/input_reader/maps_input_reader.hpp"
 #include "maps_OpenCV_Conversion.h"
-#include "common/maps_dynamic_custom_struct_component.h"
-#include "common/maps_cuda_struct.h"
+#include "common/maps_gpu_image_component.h"
+#include "common/maps_channel_planes.h"
+
+#include <opencv2/core/cuda.hpp>  // cv::cuda::GpuMat
+#include <memory>
+#include <vector>
 
 // Declares a new MAPSComponent child class
-class MAPSOpenCV_ChannelsMerger : public MAPS_DynamicCustomStructComponent
+class MAPSOpenCV_ChannelsMerger : public MAPS_GpuImageComponent
 {
     // Use standard header definition macro
-    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSOpenCV_ChannelsMerger, MAPS_DynamicCustomStructComponent)
+    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSOpenCV_ChannelsMerger, MAPS_GpuImageComponent)
 
     void Dynamic() override;
-    void FreeBuffers() override;
 
 private:
     void AllocateOutputBufferSize(const MAPSTimestamp /*ts*/, const MAPS::ArrayView<MAPS::InputElt<IplImage>> imageInElts);
@@ -44,17 +47,43 @@ private:
     void AllocateOutputBufferSizeGpu(const MAPSTimestamp /*ts*/, const MAPS::ArrayView<MAPS::InputElt<MapsCudaStruct>> imageInElts);
     void ProcessDataGpu(const MAPSTimestamp ts, const MAPS::ArrayView<MAPS::InputElt<MapsCudaStruct>> inElts);
 
+    void CheckInputImages(const std::vector<const IplImage*>& imagesIn);
+    void AllocateOutputs(const IplImage& imageIn1);
+    void MergeImages(const MAPSTimestamp ts, const std::vector<const IplImage*>& imagesIn);
+    void MergeGpuImages(const MAPSTimestamp ts, const std::vector<const MapsCudaStruct*>& imagesIn);
+    // Merges (or copies plane by plane) m_tempGpuMats to the output
+    void WriteGpuChannels(MAPS::OutputGuard<>& outGuard);
+    // Reads channel1 (trigger) and the latest sample of the other inputs. Returns false when the component is dying.
+    bool ReadLatestInputs(MAPSTimestamp& ts);
+
+public:
+    enum SyncStrategy
+    {
+        SyncStrategy_WaitForAll = 0,
+        SyncStrategy_LatestOnTrigger,
+        SyncStrategy_TimeoutThenPrevious
+    };
+
 private :
     // Place here your specific methods and attributes
     bool m_isOutputPlanar;
+    bool m_roiFullFrame = true;
+    int m_nbChannels;
     std::string m_channelSeq;
 
-    bool m_useCuda;
-    bool m_gpuMatAsInput = false;
-    bool m_gpuMatAsOutput = false;
+    SyncStrategy m_syncStrategy;
+    MAPSInt64 m_syncTimeout = 0;
+    MAPSInt64 m_syncTolerance = 0;
+    std::vector<MAPSInput*> m_inputs;
+    std::vector<MAPSIOElt*> m_lastElts; // Latest sample of each input, reused when no newer one is available
+    bool m_outputAllocated = false;
+    MAPSInt64 m_droppedSamples = 0;
+    MAPSInt64 m_duplicatedSamples = 0;
+    MAPSInt64 m_lateSamples = 0;
 
-    std::array<cv::Mat, 3> m_tempImageIn;
+    std::vector<cv::Mat> m_tempImageIn;
     cv::Mat m_tempImageOut;
     std::unique_ptr<MAPS::InputReader> m_inputReader;
     std::vector<cv::cuda::GpuMat> m_tempGpuMats;
+    cv::cuda::GpuMat m_tempGpuMerged;
 };
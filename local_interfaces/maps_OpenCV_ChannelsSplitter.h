@@ -26,17 +26,21 @@
 // Includes maps sdk library header
 #include "maps/input_reader/maps_input_reader.hpp"
 #include "maps_OpenCV_Conversion.h"
-#include "common/maps_dynamic_custom_struct_component.h"
-#include "common/maps_cuda_struct.h"
+#include "common/maps_gpu_image_component.h"
+#include "common/maps_channel_planes.h"
+
+#include <opencv2/core/cuda.hpp>  // cv::cuda::GpuMat
+#include <array>
+#include <memory>
+#include <vector>
 
 // Declares a new MAPSComponent child class
-class MAPSOpenCV_SplitChannels : public MAPS_DynamicCustomStructComponent
+class MAPSOpenCV_SplitChannels : public MAPS_GpuImageComponent
 {
     // Use standard header definition macro
-    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSOpenCV_SplitChannels, MAPS_DynamicCustomStructComponent)
+    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSOpenCV_SplitChannels, MAPS_GpuImageComponent)
 
     void Dynamic() override;
-    void FreeBuffers() override;
 
 private:
     void AllocateOutputBufferSize(const MAPSTimestamp /*ts*/, const MAPS::InputElt<IplImage> imageInElt);
@@ -44,12 +48,22 @@ private:
     void AllocateOutputBufferSizeGpu(const MAPSTimestamp /*ts*/, const MAPS::InputElt<MapsCudaStruct> imageInElt);
     void ProcessDataGpu(const MAPSTimestamp ts, const MAPS::InputElt<MapsCudaStruct> inElt);
 
+    void ParseChannels(const MAPSString& channels);
+    void AllocateOutputs(const IplImage& imageIn);
+    // Extracts the selected planes of a pixel-ordered image (uploaded, or to be downloaded), they are written directly to the GpuMat outputs
+    void SplitGpu(const cv::cuda::GpuMat& src, std::array<std::unique_ptr<MAPS::OutputGuard<>>, 4>& outGuards);
+    void SplitHost(const IplImage& imageIn, std::array<std::unique_ptr<MAPS::OutputGuard<>>, 4>& outGuards);
+    // Copies or downloads the selected m_tempGpuPlanes to the outputs
+    void WriteGpuPlanes(std::array<std::unique_ptr<MAPS::OutputGuard<>>, 4>& outGuards);
+
 private :
     // Place here your specific methods and attributes
     bool m_isInputPlanar;
-    bool m_useCuda;
-    bool m_gpuMatAsInput = false;
-    bool m_gpuMatAsOutput = false;
-    std::array<cv::Mat, 3> m_tempImageOut;
+    bool m_roiFullFrame = true;
+    int m_nbChannels;
+    std::vector<int> m_channels; // Selected source channels, one output each
+    std::array<cv::Mat, 4> m_tempImageOut;
+    std::array<cv::cuda::GpuMat, 4> m_tempGpuPlanes;  // indexed by channel: the selected planes, and the others as scratch of the split
+    cv::cuda::GpuMat m_tempGpuIn;
     std::unique_ptr<MAPS::InputReader> m_inputReader;
 };
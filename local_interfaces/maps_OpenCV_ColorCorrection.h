@@ -23,27 +23,88 @@
 
 #pragma once
 
+#include <atomic>
+#include <mutex>
+
 // Includes maps sdk library header
 #include "maps/input_reader/maps_input_reader.hpp"
 #include "maps_OpenCV_Conversion.h"
-#include "common/maps_dynamic_custom_struct_component.h"
-#include "common/maps_cuda_struct.h"
+#include "common/maps_gpu_image_component.h"
+#include "common/maps_gpu_sample.h"
+
+#include <opencv2/cudaarithm.hpp>   // cv::cuda::LookUpTable
 
 // Declares a new MAPSComponent child class
-class MAPSColorCorrection : public MAPS_DynamicCustomStructComponent
+class MAPSColorCorrection : public MAPS_GpuImageComponent
 {
     // Use standard header definition macro
-    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSColorCorrection, MAPS_DynamicCustomStructComponent)
+    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSColorCorrection, MAPS_GpuImageComponent)
 
     void Dynamic() override;
-    void FreeBuffers() override;
 
     void Set(MAPSProperty& p, MAPSFloat64 value) override;
+    void Set(MAPSProperty& p, const MAPSString& value) override;
+
+    enum ToneCurve
+    {
+        ToneCurve_None = 0,
+        ToneCurve_Gamma,
+        ToneCurve_sRGB,
+        ToneCurve_Table
+    };
+
+    enum AutoWhiteBalance
+    {
+        AWB_Off = 0,
+        AWB_GrayWorld,
+        AWB_WhitePatch,
+        AWB_Percentile
+    };
+
+    // Statistics of a (subsampled) frame used by the auto white balance, in the channel order of the images
+    struct AwbStats
+    {
+        double sum[3] = {};
+        double max[3] = {};
+        int hist[3][256] = {};
+        int count = 0;
+
+        void Merge(const AwbStats& other);
+    };
+    // Coefficients of the correction, always expressed in RGB order whatever the channel sequence of the images.
+    // out = matrix * diag(gains) * in + offsets
+    struct CorrectionParams
+    {
+        cv::Vec3d gains = cv::Vec3d(1.0, 1.0, 1.0);
+        cv::Matx33d matrix = cv::Matx33d::eye();
+        cv::Vec3d offsets = cv::Vec3d(0.0, 0.0, 0.0);
+        // Tone curve applied after the correction, on values normalized to [0, 1]
+        int toneCurve = ToneCurve_None;
+        double gamma = 2.2;
+        std::vector<double> toneTable;
+    };
+
 private:
     void AllocateOutputBufferSize(const MAPSTimestamp /*ts*/, const MAPS::InputElt<IplImage> imageInElt);
     void AllocateOutputBufferSizeGpu(const MAPSTimestamp /*ts*/, const MAPS::InputElt<MapsCudaStruct> imageInElt);
     void ProcessData(const MAPSTimestamp ts, const MAPS::InputElt<IplImage> inElt);
     void ProcessDataGpu(const MAPSTimestamp ts, const MAPS::InputElt<MapsCudaStruct> inElt);
+    void CheckInputImage(const IplImage& image);
+    void UpdateParams(bool reportOnly);
+    void SnapshotParams();
+    void UpdateGains(const int idx[3]);
+    // In "Gains" mode without auto white balance, the gains are folded into the tone curve tables
+    bool GainsInLut() const { return !m_useMatrix && m_awbMode == AWB_Off; }
+    void BuildToneLuts(const int idx[3]);
+    void Correct(const cv::Mat& src, cv::Mat& dst);
+    void CorrectRows(const cv::Mat& src, cv::Mat& dst);
+    void ApplyToneCurve(cv::Mat& image);
+    void CorrectGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst);
+    void CollectAwbSample();
+    void ApplyToneCurveGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst);
+    void AccumulateAwbStats(const cv::Mat& rows, int firstRow, int stride, AwbStats& stats);
+    void UpdateAwbGains(const AwbStats& stats);
+    void WriteAwbGains(const MAPSTimestamp ts);
 
 private :
     // Place here your specific methods and attributes
@@ -51,9 +112,43 @@ private :
     cv::Mat m_tempImageOut;
     std::vector<cv::Mat> m_vTmpSplit;
     double m_dRed, m_dGreen, m_dBlue;
-    bool m_useCuda;
-    bool m_gpuMatAsInput = false;
-    bool m_gpuMatAsOutput = false;
+    double m_dGamma = 2.2;
+    bool m_useMatrix = false;
+    int m_toneCurve = ToneCurve_None;
+    bool m_isBGR = false;
+    int m_nChannels = 3;
+    int m_depth = IPL_DEPTH_8U;
+
+    // Auto white balance (processing thread only)
+    int m_awbMode = AWB_Off;
+    int m_awbStride = 8;
+    double m_awbSmoothing = 0.9;
+    double m_awbPercentile = 99.0;
+    cv::Vec3d m_awbGains;            // estimated gains (RGB order), smoothed over the frames
+    cv::Vec3d m_awbAppliedGains;     // gains applied on top of the user gains, updated when m_awbGains moved enough
+    bool m_awbInitialized = false;
+    bool m_awbUpdated = false;       // m_awbGains moved away from m_awbAppliedGains since the last SnapshotParams()
+    GpuSampler m_awbSampler;         // subsample of the frames, downloaded without waiting (CUDA)
+
+    // Written by Set() (any thread), read by the processing thread at the beginning of each frame
+    std::mutex m_paramsMutex;
+    CorrectionParams m_pendingParams;
+    std::atomic<int> m_pendingVersion{ 0 };
+    int m_appliedVersion = -1;
+
+    // Snapshot used by the processing thread
+    CorrectionParams m_params;
+    cv::Scalar m_gainsScalar;     // gains in the channel order of the images
+    cv::Mat m_transform;          // cn x (cn + 1) matrix in the channel order of the images, for cv::transform and CorrectGpu()
+    std::vector<cv::cuda::GpuMat> m_gpuOutPlanes; // corrected planes of the "Matrix" mode, merged into the output
+    cv::cuda::GpuMat m_gpuPartial;   // partial sum of the "Matrix" mode, see CorrectGpu()
+    double m_gpuPartialScale = 1.0;
+    int m_gpuPartialDepth = CV_16S;
+    cv::Mat m_lut;                   // 1 x 256 table, one channel per image channel (gains included in "Gains" mode)
+    std::vector<ushort> m_lut16;     // tone curve for 16 bits images
+    cv::Ptr<cv::cuda::LookUpTable> m_gpuLut;
+    cv::Ptr<cv::cuda::LookUpTable> m_gpuPlaneLuts[3]; // per channel tables for 4 channels images
+    std::vector<cv::cuda::GpuMat> m_gpuPlanes;
 
     std::unique_ptr<MAPS::InputReader> m_inputReader;
 };
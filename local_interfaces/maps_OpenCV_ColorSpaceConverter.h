@@ -27,8 +27,9 @@
 #include "maps/input_reader/maps_input_reader.hpp"
 #include "maps_OpenCV_Conversion.h"
 
-#include "common/maps_dynamic_custom_struct_component.h"
-#include "common/maps_cuda_struct.h"
+#include "common/maps_gpu_image_component.h"
+#include "common/maps_gpu_pipeline.h"
+#include "common/maps_frame_batch.h"
 
 namespace
 {
@@ -43,36 +44,52 @@ namespace
 }
 
 // Declares a new MAPSComponent child class
-class MAPSColorSpaceConverter : public MAPS_DynamicCustomStructComponent
+class MAPSColorSpaceConverter : public MAPS_GpuImageComponent
 {
     // Use standard header definition macro
-    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSColorSpaceConverter, MAPS_DynamicCustomStructComponent)
+    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSColorSpaceConverter, MAPS_GpuImageComponent)
 
     void Set(MAPSProperty& p, const MAPSString& value) override;
     void Set(MAPSProperty& p, const MAPSEnumStruct& enum_prop) override;
     void Dynamic() override;
-    void FreeBuffers() override;
 
 private:
     void AllocateOutputBufferSize(const MAPSTimestamp /*ts*/, const MAPS::InputElt<IplImage> imageInElt);
+    void AllocateOutputs(const IplImage& imageIn);
     void ProcessData(const MAPSTimestamp ts, const MAPS::InputElt<IplImage> inElt);
+    void ProcessDataPipelined(const MAPSTimestamp ts, const IplImage& imageIn);
+    void WritePipelined(const GpuPipeline::Slot& done);
+    void ReadBatch();
+    void AddToBatch(MAPSIOElt& ioElt);
+    void ProcessBatch();
     void AllocateOutputBufferSizeGpu(const MAPSTimestamp /*ts*/, const MAPS::InputElt<MapsCudaStruct> imageInElt);
     void ProcessDataGpu(const MAPSTimestamp ts, const MAPS::InputElt<MapsCudaStruct> inElt);
     void CheckInputColorSpace(int chanSeq);
+    void Convert(const cv::Mat& src, cv::Mat& dst);
     void ConvertGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst);
+    void ConvertGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst, cv::cuda::GpuMat& workImage,
+                    std::vector<cv::cuda::GpuMat>& tempChannels, cv::cuda::Stream& stream);
 
 private :
     // Place here your specific methods and attributes
     int m_inputCS;
     int m_outputCS;
     int m_openCVConvertCode;
-    bool m_useCuda;
-    bool m_gpuMatAsInput = false;
-    bool m_gpuMatAsOutput = false;
+    GpuPipeline m_pipeline; // CUDA mode with IplImage input and output only
+
+    int m_batchSize = 1;            // > 1 : the IplImage inputs are read in Core() and converted by batches
+    MAPSInt64 m_batchTimeout = 0;   // us
+    bool m_outputAllocated = false;
+    FrameBatch m_batch;
+    cv::Mat m_batchOut;
+    cv::cuda::GpuMat m_gpuBatchIn;
+    cv::cuda::GpuMat m_gpuBatchOut;
+    cv::cuda::GpuMat m_gpuWorkImage;
+    std::vector<cv::cuda::GpuMat> m_gpuTempChannels;
+    cv::cuda::Stream m_batchStream;
 
     std::array<cv::Mat, 3> m_tempChannels;
     cv::Mat m_workImage;
 
-
     std::unique_ptr<MAPS::InputReader> m_inputReader;
 };
@@ -33,6 +33,24 @@ namespace convTools
     // Don't copy the IplImage and create a cv::Mat object. Overload of previous one, use it when we have an IplImage that we can write on (e.g Output image)
     cv::Mat noCopyIplImage2Mat(IplImage* image);
 
+    // OpenCV depth (CV_8U, CV_16S, CV_32F...) of an IplImage. Throws for the depths that cv::Mat does not support.
+    int cvDepth(const IplImage* image);
+
+    // OpenCV type (depth and number of channels) of an IplImage, or of the proxy of a MapsCudaStruct.
+    int cvType(const IplImage* image);
+
+    // Interleaves the planes of a planar (IPL_DATA_ORDER_PLANE) IplImage into a packed cv::Mat. 1 to 4 channels, 8, 16 or 32 bits.
+    // packed is (re)allocated only when its size or type does not match.
+    void planarToPacked(const IplImage* planar, cv::Mat& packed);
+
+    // Deinterleaves a packed cv::Mat into the planes of a planar IplImage of the same size, depth and number of channels.
+    void packedToPlanar(const cv::Mat& packed, IplImage* planar);
+
+    // Computes the region of interest of an image from the roi_x/roi_y/roi_width/roi_height properties of a component.
+    // A width or height <= 0 extends the region up to the border of the image. The offsets are rounded down and the size
+    // rounded down to a multiple of alignment (e.g. 2 for Bayer images, to keep the same pattern). Throws if the region is empty.
+    cv::Rect resolveRoi(int imageWidth, int imageHeight, MAPSInt64 x, MAPSInt64 y, MAPSInt64 width, MAPSInt64 height, int alignment = 1);
+
     // Don't copy the IplImage and create a cv::Mat object. Use constness to stop us from writing on an image that we shouldn't (e.g: Input image)
     const cv::Mat noCopyIplImage2MatRoi(const IplImage* image, MAPSInt32 x, MAPSInt32 y, MAPSInt32 width, MAPSInt32 height);
 
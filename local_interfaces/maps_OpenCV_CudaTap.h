@@ -0,0 +1,41 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Includes maps sdk library header
+#include "maps/input_reader/maps_input_reader.hpp"
+#include "common/maps_cuda_struct.h"
+#include "common/maps_cuda_tap.h"
+
+#include <memory>
+
+// Declares a new MAPSComponent child class
+class MAPSOpenCV_CudaTap : public MAPSComponent
+{
+    // Use standard header definition macro
+    MAPS_COMPONENT_STANDARD_HEADER_CODE(MAPSOpenCV_CudaTap)
+
+private:
+    void StartRecording(const MAPSTimestamp /*ts*/, const MAPS::InputElt<MapsCudaStruct> imageInElt);
+    void ProcessData(const MAPSTimestamp ts, const MAPS::InputElt<MapsCudaStruct> inElt);
+
+private:
+    MapsCudaTap m_tap;
+    std::unique_ptr<MAPS::InputReader> m_inputReader;
+};
@@ -26,31 +26,92 @@
 // Includes maps sdk library header
 #include "maps/input_reader/maps_input_reader.hpp"
 #include "maps_OpenCV_Conversion.h"
-#include "common/maps_dynamic_custom_struct_component.h"
-#include "common/maps_cuda_struct.h"
+#include "common/maps_gpu_image_component.h"
+#include "common/maps_gpu_sample.h"
+
+#include <opencv2/cudaimgproc.hpp>  // cv::cuda::CLAHE
+#include <opencv2/cudaarithm.hpp>   // cv::cuda::LookUpTable
 
 // Declares a new MAPSComponent child class
-class MAPSOpenCV_EqualizeHistogram : public MAPS_DynamicCustomStructComponent
+class MAPSOpenCV_EqualizeHistogram : public MAPS_GpuImageComponent
 {
     // Use standard header definition macro
-    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSOpenCV_EqualizeHistogram, MAPS_DynamicCustomStructComponent)
+    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSOpenCV_EqualizeHistogram, MAPS_GpuImageComponent)
 
     void Dynamic() override;
-    void FreeBuffers() override;
 
 private:
     void AllocateOutputBufferSize(const MAPSTimestamp /*ts*/, const MAPS::InputElt<IplImage> imageInElt);
     void AllocateOutputBufferSizeGpu(const MAPSTimestamp /*ts*/, const MAPS::InputElt<MapsCudaStruct> imageInElt);
     void ProcessData(const MAPSTimestamp ts, const MAPS::InputElt<IplImage> inElt);
     void ProcessDataGpu(const MAPSTimestamp ts, const MAPS::InputElt<MapsCudaStruct> inElt);
+    void CheckInputImage(const IplImage& image);
+    void Equalize(const cv::Mat& src, cv::Mat& dst);
+    void EqualizePlane(const cv::Mat& src, cv::Mat& dst);
+    void EqualizeGlobal(const cv::Mat& src, cv::Mat& dst);
+    void EqualizeLuma(const cv::Mat& src, cv::Mat& dst);
+    void EqualizeLumaClahe(const cv::Mat& src, cv::Mat& dst);
+    void ScaleByLuma(const cv::Mat& src, cv::Mat& dst, const int* scale);
+    void AccumulateHistogram(const cv::Mat& rows, int firstRow, int step, int* lumaHist, int* channelHist);
+    template <typename Apply>
+    void HistogramPass(const cv::Mat& src, std::vector<int>* lumaHist, std::vector<int>* channelHist, Apply apply, int step = 1);
+    void EqualizeTemporal(const cv::Mat& src, cv::Mat& dst);
+    void UpdateTemporalLut(const int* hist, int nbHist);
+    void EqualizeGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst);
+    void EqualizePlaneGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst, int plane);
+    void UpdateTemporalLutGpu(const cv::Mat& sample);
+    void ComputeHistogramsGpu(const cv::cuda::GpuMat& src);
+    void WriteStatistics(const MAPSTimestamp ts);
+    void EqualizeLumaGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst);
 
 private :
     // Place here your specific methods and attributes
     std::vector<cv::Mat> m_planesMatImages;
     cv::Mat m_tempImageIn;
     cv::Mat m_tempImageOut;
-    bool m_useCuda;
-    bool m_gpuMatAsInput = false;
-    bool m_gpuMatAsOutput = false;
+    bool m_lumaMode = false;
+    bool m_useClahe = false;
+    bool m_temporal = false;
+    bool m_statsOutput = false;
+    bool m_statsOnly = false;
+    bool m_isBGR = false;
+    int m_nChannels = 1;
+
+    // Scratch buffers kept from one frame to the next
+    std::vector<cv::cuda::GpuMat> m_gpuPlanes;
+    std::vector<cv::cuda::GpuMat> m_gpuScalePlanes;
+    cv::cuda::GpuMat m_gpuLuma;
+    cv::cuda::GpuMat m_gpuLumaEq;
+    cv::cuda::GpuMat m_gpuScale;             // Q8 luminance scale per pixel (16U), "Luma" mode
+    cv::cuda::GpuMat m_gpuUnitScale;
+    cv::cuda::GpuMat m_gpuScaleImage;        // m_gpuScale on every channel
+    cv::cuda::GpuMat m_gpuWide;              // the image widened to 16 bits
+    cv::Mat m_planeScratch;
+    cv::Mat m_luma;
+    cv::Mat m_lumaEq;
+
+    // Created once at Birth and reused for every frame
+    cv::Ptr<cv::CLAHE> m_clahe;
+    cv::Ptr<cv::cuda::CLAHE> m_gpuClahe;
+
+    // Temporal mode
+    int m_temporalStep = 4;                 // 2 : 1/4 of the pixels, 4 : 1/16 of the pixels
+    double m_temporalSmoothing = 0.8;
+    bool m_temporalInitialized = false;
+    std::vector<int> m_frameHist;           // subsampled histograms of the current frame
+    std::vector<double> m_smoothHist;       // normalized histograms smoothed over the frames
+    cv::Mat m_temporalLut;                  // 1 x 256, one channel per histogram
+    int m_temporalLumaScale[256] = {};      // luminance scale per luma value (Q12), "Luma" mode
+    std::vector<cv::Ptr<cv::cuda::LookUpTable>> m_gpuTemporalLuts;   // one for all the channels, or one per plane with 4 channels
+    std::vector<cv::Mat> m_uploadedTemporalLuts;   // tables of m_gpuTemporalLuts
+    cv::Mat m_planeLut;
+    GpuSampler m_temporalSampler;
+
+    // Histograms of the last frame
+    std::vector<int> m_statsHist;           // 256 bins per channel, published on the "stats" output
+    std::vector<int> m_lumaHist;
+    cv::Mat m_globalLut;
+    std::vector<cv::cuda::GpuMat> m_gpuStatsPlanes;
+    cv::cuda::GpuMat m_gpuHist;
     std::unique_ptr<MAPS::InputReader> m_inputReader;
 };
@@ -26,25 +26,32 @@
 // Includes maps sdk library header
 #include "maps/input_reader/maps_input_reader.hpp"
 #include "maps_OpenCV_Conversion.h"
-#include "common/maps_dynamic_custom_struct_component.h"
-#include "common/maps_cuda_struct.h"
+#include "common/maps_gpu_image_component.h"
+#include "common/maps_gpu_pipeline.h"
+#include "common/maps_frame_batch.h"
 
 // Declares a new MAPSComponent child class
-class MAPSOpenCV_Resize : public MAPS_DynamicCustomStructComponent
+class MAPSOpenCV_Resize : public MAPS_GpuImageComponent
 {
     // Use standard header definition macro
-    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSOpenCV_Resize, MAPS_DynamicCustomStructComponent)
+    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSOpenCV_Resize, MAPS_GpuImageComponent)
 
     void Set(MAPSProperty& p, MAPSInt64 value) override;
     void Set(MAPSProperty& p, const MAPSEnumStruct& enumStruct) override;
     void Set(MAPSProperty& p, const MAPSString& value) override;
 
     void Dynamic() override;
-    void FreeBuffers() override;
 
 private:
     void AllocateOutputBufferSize(const MAPSTimestamp /*ts*/, const MAPS::InputElt<IplImage> imageInElt);
+    void AllocateOutputs(const IplImage& imageIn);
     void ProcessData(const MAPSTimestamp ts, const MAPS::InputElt<IplImage> inElt);
+    void ProcessDataPipelined(const MAPSTimestamp ts, const IplImage& imageIn);
+    void WritePipelined(const GpuPipeline::Slot& done);
+
+    void ReadBatch();
+    void AddToBatch(MAPSIOElt& ioElt);
+    void ProcessBatch();
 
     void AllocateOutputBufferSizeGpu(const MAPSTimestamp /*ts*/, const MAPS::InputElt<MapsCudaStruct> imageInElt);
     void ProcessDataGpu(const MAPSTimestamp ts, const MAPS::InputElt<MapsCudaStruct> inElt);
@@ -54,10 +61,17 @@ private:
 private:
     // Place here your specific methods and attributes
     int m_method;
-    bool m_useCuda;
-    bool m_gpuMatAsInput = false;
-    bool m_gpuMatAsOutput = false;
 
     cv::Size m_newSize;
+    GpuPipeline m_pipeline; // CUDA mode with IplImage input and output only
+
+    int m_batchSize = 1;            // > 1 : the IplImage inputs are read in Core() and resized by batches
+    MAPSInt64 m_batchTimeout = 0;   // us
+    bool m_outputAllocated = false;
+    FrameBatch m_batch;
+    cv::Mat m_batchOut;
+    cv::cuda::GpuMat m_gpuBatchIn;
+    cv::cuda::GpuMat m_gpuBatchOut;
+    cv::cuda::Stream m_batchStream;
     std::unique_ptr<MAPS::InputReader> m_inputReader;
 };
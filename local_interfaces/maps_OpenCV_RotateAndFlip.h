@@ -27,16 +27,16 @@
 #include "maps/input_reader/maps_input_reader.hpp"
 #include "maps_OpenCV_Conversion.h"
 
-#include "common/maps_dynamic_custom_struct_component.h"
-#include "common/maps_cuda_struct.h"
+#include "common/maps_gpu_image_component.h"
+
+#include <opencv2/core/cuda.hpp>  // cv::cuda::GpuMat
 
 // Declares a new MAPSComponent child class
-class MAPSOpenCV_RotateAndFlip : public MAPS_DynamicCustomStructComponent
+class MAPSOpenCV_RotateAndFlip : public MAPS_GpuImageComponent
 {
     // Use standard header definition macro
-    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSOpenCV_RotateAndFlip, MAPS_DynamicCustomStructComponent)
+    MAPS_CHILD_COMPONENT_HEADER_CODE(MAPSOpenCV_RotateAndFlip, MAPS_GpuImageComponent)
 
-    void FreeBuffers() override;
     void Dynamic() override;
 
 private:
@@ -44,8 +44,19 @@ private:
     void AllocateOutputBufferSizeGpu(const MAPSTimestamp /*ts*/, const MAPS::ArrayView <MAPS::InputElt<>> inElts);
     void ProcessData(const MAPSTimestamp ts, const MAPS::ArrayView <MAPS::InputElt<>> inElts);
     void ProcessDataGpu(const MAPSTimestamp ts, const MAPS::ArrayView <MAPS::InputElt<>> inElts);
+    // Operations that do not modify the image (None, rotation by a multiple of 360 deg)
+    void PassThrough(MAPS::OutputGuard<>& outGuard, const IplImage& imageIn, const cv::Mat& src);
+    void PassThroughGpu(MAPS::OutputGuard<>& outGuard, const MapsCudaStruct& imageIn, const cv::cuda::GpuMat& src);
+    int ReadAngle();
+    // Output size for the rotations in degrees
+    cv::Size RotationCanvasSize(const cv::Size& srcSize);
+    // Rebuilds the remap tables, only when the angle or the sizes changed
+    void UpdateRotationMaps(int degrees, const cv::Size& srcSize, const cv::Size& dstSize, bool gpu);
     void Rotate(int degrees, MAPS::OutputGuard<>& outGuard, const cv::Mat& imageIn);
     void RotateGpu(int degrees, MAPS::OutputGuard<>& outGuard, const cv::cuda::GpuMat& imageIn);
+    // Exact 90/180 deg rotations, rotateCode is a cv::RotateFlags
+    void RotateExact(int rotateCode, MAPS::OutputGuard<>& outGuard, const cv::Mat& imageIn);
+    void RotateExactGpu(int rotateCode, MAPS::OutputGuard<>& outGuard, const cv::cuda::GpuMat& imageIn);
     void Flip(int flipMode, MAPS::OutputGuard<>& outGuard, const cv::Mat& imageIn);
     void FlipGpu(int flipMode, MAPS::OutputGuard<>& outGuard, const cv::cuda::GpuMat& imageIn);
 
@@ -53,9 +64,22 @@ private :
     // Place here your specific methods and attributes
     int m_operation;
     int m_angleInputMode;
-    bool m_useCuda;
-    bool m_gpuMatAsInput = false;
-    bool m_gpuMatAsOutput = false;
+    bool m_expandCanvas = false;
+    cv::Size m_canvasSize;
+    int m_angle;
+
+    cv::cuda::GpuMat m_gpuSrc;
+    cv::cuda::GpuMat m_gpuTransposed;
+    cv::cuda::GpuMat m_gpuDst;
+
+    // Remap tables of the rotation in degrees, for m_mapsAngle
+    int m_mapsAngle;
+    cv::Size m_mapsSrcSize;
+    cv::Size m_mapsDstSize;
+    cv::Mat m_map1;
+    cv::Mat m_map2;
+    cv::cuda::GpuMat m_gpuMapX;
+    cv::cuda::GpuMat m_gpuMapY;
 
     std::vector<MAPSInput*> m_inputs;
     std::unique_ptr<MAPS::InputReader> m_inputReader;
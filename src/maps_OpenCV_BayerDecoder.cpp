@@ -41,6 +41,7 @@ MAPS_END_INPUTS_DEFINITION
 MAPS_BEGIN_OUTPUTS_DEFINITION(MAPSBayerDecoder)
 MAPS_OUTPUT("imageOut", MAPS::IplImage, nullptr, nullptr, 0)
 MAPS_OUTPUT_USER_DYNAMIC_STRUCTURE("o_gpu", MapsCudaStruct)
+MAPS_OUTPUT("input_stats", MAPS::Float64, nullptr, nullptr, 2)
 MAPS_END_OUTPUTS_DEFINITION
 
 // Use the macros to declare the properties
@@ -51,14 +52,33 @@ MAPS_BEGIN_PROPERTIES_DEFINITION(MAPSBayerDecoder)
     MAPS_PROPERTY("use_cuda", false, false, false)
     MAPS_PROPERTY("gpu_mat_as_input", false, false, false)
     MAPS_PROPERTY("gpu_mat_as_output", false, false, false)
+    MAPS_PROPERTY("roi_x", 0, false, false)
+    MAPS_PROPERTY("roi_y", 0, false, false)
+    MAPS_PROPERTY("roi_width", 0, false, false)
+    MAPS_PROPERTY("roi_height", 0, false, false)
+    MAPS_PROPERTY_ENUM("pipeline", "Off|Double buffering|Triple buffering", 0, false, false)
+    MAPS_PROPERTY_ENUM("input_policy", "FIFO|Latest only|Drop every N", 0, false, false)
+    MAPS_PROPERTY("drop_interval", 2, false, false)
+    MAPS_PROPERTY("fifo_depth", 0, false, false)
+    MAPS_PROPERTY("memory_budget", 0, false, false)
+    MAPS_PROPERTY("lazy_allocation", false, false, false)
+    MAPS_PROPERTY("prewarm_buffers", 2, false, false)
+    MAPS_PROPERTY_ENUM("memory_mode", "Device|Managed|Mapped", 0, false, false)
 MAPS_END_PROPERTIES_DEFINITION
 
 // Use the macros to declare the actions
 MAPS_BEGIN_ACTIONS_DEFINITION(MAPSBayerDecoder)
 MAPS_END_ACTIONS_DEFINITION
 
+//Version 1.3: roi_x, roi_y, roi_width and roi_height properties, only the region of interest is decoded.
+//Version 1.4: pipeline property, overlaps the upload, decoding and download of consecutive frames in CUDA mode with host input and output.
+//Version 1.5: input_policy and drop_interval properties, input_stats output: stale frames can be skipped when the component falls behind its input.
+//Version 1.6: fifo_depth and memory_budget properties, sizes the FIFO of the GpuMat outputs and bounds the device memory of their buffers.
+//Version 1.7: lazy_allocation and prewarm_buffers properties, the device memory of the GpuMat output buffers is allocated on their first use.
+//Version 1.8: memory_mode property, the GpuMat output buffers can be allocated in managed or mapped host memory, readable from the host without download.
+
 // Use the macros to declare this component (ColorConvert_Bayer2RGB) behaviour
-MAPS_COMPONENT_DEFINITION(MAPSBayerDecoder,"OpenCV_BayerDecoder_cuda", "1.2.2", 128,
+MAPS_COMPONENT_DEFINITION(MAPSBayerDecoder,"OpenCV_BayerDecoder_cuda", "1.8.0", 128,
                             MAPS::Threaded|MAPS::Sequential, MAPS::Sequential,
                             0, // Nb of inputs
                             0, // Nb of outputs
@@ -75,6 +95,9 @@ enum MAPS_BAYER_PATTERN : uint8_t
 
 void MAPSBayerDecoder::Birth()
 {
+    ApplyGpuOutputProperties();
+    ApplyInputPolicyProperties();
+
     m_outputFormat = static_cast<OUTPUT_FORMAT>(GetIntegerProperty("outputFormat"));
     m_pattern = static_cast<MAPS_BAYER_PATTERN>(GetEnumProperty("input_pattern").GetSelected());
 
@@ -150,6 +173,10 @@ void MAPSBayerDecoder::Birth()
         break;
     }
 
+    // Selection 1 and 2 give 2 and 3 slots, 0 disables the pipeline
+    const bool pipelined = m_useCuda && !m_gpuMatAsInput && !m_gpuMatAsOutput;
+    m_pipeline.Reset(pipelined ? static_cast<int>(GetIntegerProperty("pipeline")) + 1 : 0);
+
     if (m_useCuda && m_gpuMatAsInput)
     {
         m_inputReader = MAPS::MakeInputReader::Reactive(
@@ -188,6 +215,11 @@ void MAPSBayerDecoder::Dynamic()
     m_gpuMatAsInput = false;
     m_gpuMatAsOutput = false;
 
+    NewProperty("roi_x");
+    NewProperty("roi_y");
+    NewProperty("roi_width");
+    NewProperty("roi_height");
+
     if (cv::cuda::getCudaEnabledDeviceCount() > 0)
     {
         Property("use_cuda").SetMutable(true);
@@ -205,6 +237,11 @@ void MAPSBayerDecoder::Dynamic()
         m_gpuMatAsInput = NewProperty("gpu_mat_as_input").BoolValue();
         m_gpuMatAsOutput = NewProperty("gpu_mat_as_output").BoolValue();
 
+        if (!m_gpuMatAsInput && !m_gpuMatAsOutput)
+        {
+            NewProperty("pipeline");
+        }
+
         if (m_gpuMatAsInput)
         {
             NewInput("i_gpu");
@@ -242,28 +279,35 @@ void MAPSBayerDecoder::Dynamic()
         }
         NewOutput("imageOut");
     }
-}
 
-void MAPSBayerDecoder::FreeBuffers()
-{
-    if (m_useCuda && m_gpuMatAsOutput)
-    {
-        MAPS_DynamicCustomStructComponent::FreeBuffers();
-    }
-    else
-    {
-        MAPSComponent::FreeBuffers();
-    }
+    NewInputPolicyProperties();
+    NewGpuOutputProperties("o_gpu");
 }
 
 void MAPSBayerDecoder::Core()
 {
+    // The frames completed since the last input are output before waiting for the next one. When no input is waiting,
+    // the frames still in flight are waited for and output: they are not held while the read blocks.
+    if (m_pipeline.Enabled())
+        m_pipeline.EmitBeforeRead([this](const GpuPipeline::Slot& done) { WritePipelined(done); }, DataAvailableInFIFO(Input(0)) != 0);
+
     m_inputReader->Read();
 }
 
 void MAPSBayerDecoder::Death()
 {
     m_inputReader.reset();
+
+    if (m_inputPolicy.Enabled())
+        ReportInfo(m_inputPolicy.Report().c_str());
+
+    if (m_pipeline.Enabled())
+    {
+        // The frames still in flight are output
+        m_pipeline.Flush([this](const GpuPipeline::Slot& done) { WritePipelined(done); });
+        ReportInfo(m_pipeline.Report().c_str());
+        m_pipeline.Reset(0);
+    }
 }
 
 void MAPSBayerDecoder::Set(MAPSProperty& p, const MAPSString& value)
@@ -282,24 +326,9 @@ void MAPSBayerDecoder::AllocateOutputBufferIpl(const MAPSTimestamp, const MAPS::
     if (*(MAPSUInt32*)imageIn.channelSeq != MAPS_CHANNELSEQ_GRAY)
         Error("This component only accepts GRAY images on its input (8 bpp or 16bpp).");
 
-    MAPSUInt32 outputChanSeq = MAPS_CHANNELSEQ_RGB;
-    switch (m_outputFormat)
-    {
-    case OUTPUT_FORMAT::BGR:
-        outputChanSeq = MAPS_CHANNELSEQ_BGR;
-        break;
-    case OUTPUT_FORMAT::RGB:
-        outputChanSeq = MAPS_CHANNELSEQ_RGB;
-        break;
-    case OUTPUT_FORMAT::BGRA:
-        outputChanSeq = MAPS_CHANNELSEQ_BGRA;
-        break;
-    case OUTPUT_FORMAT::RGBA:
-        outputChanSeq = MAPS_CHANNELSEQ_RGBA;
-        break;
-    }
-
-    IplImage model = MAPS::IplImageModel(imageIn.width, imageIn.height, outputChanSeq, imageIn.dataOrder, imageIn.depth, imageIn.align);
+    ResolveRoi(imageIn.width, imageIn.height, 2); // even offsets and size: the region starts on the same Bayer pattern as the full image
+    IplImage model = MAPS::IplImageModel(m_roi.width, m_roi.height, OutputChannelSeq(), IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
+    CreateViews(&imageIn, model);
 
     if (m_gpuMatAsOutput)
     {
@@ -307,7 +336,7 @@ void MAPSBayerDecoder::AllocateOutputBufferIpl(const MAPSTimestamp, const MAPS::
         {
             AllocateDynamicOutputBuffers(
                 DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(model.width, model.height, model.nChannels, model); }  // struct allocation
+                    [&] { return new MapsCudaStruct(model.width, model.height, model.nChannels, model, m_memoryMode); }  // struct allocation
                 )
             );
         }
@@ -318,7 +347,7 @@ void MAPSBayerDecoder::AllocateOutputBufferIpl(const MAPSTimestamp, const MAPS::
     }
     else
     {
-        Output(0).AllocOutputBufferIplImage(model);
+        AllocateIplImageOutputBuffer(Output(0), model);
     }
 }
 
@@ -326,22 +355,7 @@ void MAPSBayerDecoder::AllocateOutputBufferMaps(const MAPSTimestamp, const MAPS:
 {
     const MAPSImage& imageIn = imageInElt.Data();
 
-    MAPSUInt32 outputChanSeq;
-    switch (m_outputFormat)
-    {
-    case OUTPUT_FORMAT::BGR:
-        outputChanSeq = MAPS_CHANNELSEQ_BGR;
-        break;
-    case OUTPUT_FORMAT::RGB:
-        outputChanSeq = MAPS_CHANNELSEQ_RGB;
-        break;
-    case OUTPUT_FORMAT::BGRA:
-        outputChanSeq = MAPS_CHANNELSEQ_BGRA;
-        break;
-    case OUTPUT_FORMAT::RGBA:
-        outputChanSeq = MAPS_CHANNELSEQ_RGBA;
-        break;
-    }
+    ResolveRoi(imageIn.width, imageIn.height, 2); // even offsets and size: the region starts on the same Bayer pattern as the full image
 
     MAPSUInt32 fourcc = 0;
     MAPS::Memcpy((char*)&fourcc, (const char*)imageIn.imageCoding, 4);
@@ -375,7 +389,8 @@ void MAPSBayerDecoder::AllocateOutputBufferMaps(const MAPSTimestamp, const MAPS:
     }
 
     // Create a new IplImage to allocate the output buffer using the channel sequence determined above
-    IplImage model = MAPS::IplImageModel(imageIn.width, imageIn.height, outputChanSeq, IPL_DATA_ORDER_PIXEL, depth, IPL_ALIGN_QWORD);
+    IplImage model = MAPS::IplImageModel(m_roi.width, m_roi.height, OutputChannelSeq(), IPL_DATA_ORDER_PIXEL, depth, IPL_ALIGN_QWORD);
+    CreateViews(nullptr, model); // MAPSImage inputs: their matrix type depends on their image coding, they are not viewed
 
     if (m_gpuMatAsOutput)
     {
@@ -383,7 +398,7 @@ void MAPSBayerDecoder::AllocateOutputBufferMaps(const MAPSTimestamp, const MAPS:
         {
             AllocateDynamicOutputBuffers(
                 DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(imageIn.imageSize, model); }  // struct allocation
+                    [&] { return new MapsCudaStruct(model.imageSize, model, m_memoryMode); }  // struct allocation
                 )
             );
         }
@@ -394,13 +409,16 @@ void MAPSBayerDecoder::AllocateOutputBufferMaps(const MAPSTimestamp, const MAPS:
     }
     else
     {
-        Output(0).AllocOutputBufferIplImage(model);
+        AllocateIplImageOutputBuffer(Output(0), model);
     }
 }
 
 void MAPSBayerDecoder::AllocateOutputBufferGpu(const MAPSTimestamp, const MAPS::InputElt<MapsCudaStruct> imageInElt)
 {
-    const MapsCudaStruct& imageIn = imageInElt.Data();
+    const IplImage& proxy = imageInElt.Data().m_IplImageProxy;
+    ResolveRoi(proxy.width, proxy.height, 2);
+    IplImage model = MAPS::IplImageModel(m_roi.width, m_roi.height, OutputChannelSeq(), IPL_DATA_ORDER_PIXEL, proxy.depth, proxy.align);
+    CreateViews(&proxy, model);
 
     if (m_gpuMatAsOutput)
     {
@@ -408,7 +426,7 @@ void MAPSBayerDecoder::AllocateOutputBufferGpu(const MAPSTimestamp, const MAPS::
         {
             AllocateDynamicOutputBuffers(
                 DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(imageIn); }
+                    [&] { return new MapsCudaStruct(model.imageSize, model, m_memoryMode); }
                 )
             );
         }
@@ -419,42 +437,109 @@ void MAPSBayerDecoder::AllocateOutputBufferGpu(const MAPSTimestamp, const MAPS::
     }
     else
     {
-        const IplImage& proxy = imageIn.m_IplImageProxy;
-        IplImage model = MAPS::IplImageModel(proxy.width, proxy.height, proxy.channelSeq, proxy.dataOrder, proxy.depth, proxy.align);
-        Output(0).AllocOutputBufferIplImage(model);
+        AllocateIplImageOutputBuffer(Output(0), model);
     }
 }
 
 void MAPSBayerDecoder::ProcessDataIpl(const MAPSTimestamp ts, const MAPS::InputElt<IplImage> inElt)
 {
-    MAPS::OutputGuard<> outGuard{ this, Output(0) };
-    m_tempImageIn = convTools::noCopyIplImage2Mat(&inElt.Data());
-
-    if (m_useCuda)
+    try
     {
-        cv::cuda::GpuMat src(m_tempImageIn);
+        if (DropInput(ts))
+            return;
 
-        if (m_gpuMatAsOutput)
+        m_tempImageIn = m_hostInView(inElt.Data().imageData);
+        if (m_pipeline.Enabled())
         {
-            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-            const IplImage& proxy = outputData.m_IplImageProxy;
-            cv::cuda::GpuMat dst(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), outputData.m_points);
+            ProcessDataPipelined(ts, m_tempImageIn);
+            return;
+        }
+
+        MAPS::OutputGuard<> outGuard{ this, Output(0) };
+
+        if (m_useCuda)
+        {
+            cv::cuda::GpuMat src(m_tempImageIn);
+
+            if (m_gpuMatAsOutput)
+            {
+                MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+                cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
+
+                try {
+                    // Convert an image from one color space to another depending on the pattern use
+                    switch (m_pattern)
+                    {
+                    case MAPS_BAYER_PATTERN_BG:
+                        cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                        break;
+                    case MAPS_BAYER_PATTERN_GB:
+                        cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                        break;
+                    case MAPS_BAYER_PATTERN_RG:
+                        cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                        break;
+                    case MAPS_BAYER_PATTERN_GR:
+                        cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                        break;
+                    }
+                }
+                catch (const std::exception& e)
+                {
+                    Error(e.what());
+                }
+            }
+            else
+            {
+                cv::cuda::GpuMat dst;
+                IplImage& imageOut = outGuard.DataAs<IplImage>();
+                m_tempImageOut = m_hostOutView(imageOut.imageData);
+
+                try {
+                    // Convert an image from one color space to another depending on the pattern use
+                    switch (m_pattern)
+                    {
+                    case MAPS_BAYER_PATTERN_BG:
+                        cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                        break;
+                    case MAPS_BAYER_PATTERN_GB:
+                        cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                        break;
+                    case MAPS_BAYER_PATTERN_RG:
+                        cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                        break;
+                    case MAPS_BAYER_PATTERN_GR:
+                        cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                        break;
+                    }
+                }
+                catch (const std::exception& e)
+                {
+                    Error(e.what());
+                }
+                dst.download(m_tempImageOut);
+            }
+        }
+        else
+        {
+            IplImage& imageOut = outGuard.DataAs<IplImage>();
+            m_tempImageOut = m_hostOutView(imageOut.imageData); // Convert IplImage to cv::Mat without copying
 
             try {
                 // Convert an image from one color space to another depending on the pattern use
                 switch (m_pattern)
                 {
                 case MAPS_BAYER_PATTERN_BG:
-                    cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                    cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
                     break;
                 case MAPS_BAYER_PATTERN_GB:
-                    cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                    cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
                     break;
                 case MAPS_BAYER_PATTERN_RG:
-                    cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                    cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
                     break;
                 case MAPS_BAYER_PATTERN_GR:
-                    cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                    cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
                     break;
                 }
             }
@@ -462,28 +547,112 @@ void MAPSBayerDecoder::ProcessDataIpl(const MAPSTimestamp ts, const MAPS::InputE
             {
                 Error(e.what());
             }
+
+            if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+                Error("cv::Mat data ptr and imageOut data ptr are different.");
+        }
+
+        outGuard.VectorSize() = 0;
+        outGuard.Timestamp() = ts;
+    }
+    catch (const std::exception& e)
+    {
+        Error(e.what());
+    }
+}
+
+void MAPSBayerDecoder::ProcessDataMaps(const MAPSTimestamp ts, const MAPS::InputElt<MAPSImage> inElt)
+{
+    try
+    {
+        if (DropInput(ts))
+            return;
+
+        const MAPSImage& imageIn = inElt.Data();
+
+        MAPSUInt32 fourcc = 0;
+        MAPS::Memcpy((char*)&fourcc, (const char*)imageIn.imageCoding, 4);
+        switch (fourcc)
+        {
+        case MAPS_IMAGECODING_RGGB:
+        case MAPS_IMAGECODING_GRBG:
+        case MAPS_IMAGECODING_GBRG:
+        case MAPS_IMAGECODING_BA81:
+        {
+            m_tempImageIn = cv::Mat(imageIn.height, imageIn.width, CV_8UC1, imageIn.imageData);
+        }
+        break;
+        case MAPS_IMAGECODING_RG10:
+        case MAPS_IMAGECODING_BA10:
+        case MAPS_IMAGECODING_GB10:
+        case MAPS_IMAGECODING_BG10:
+        case MAPS_IMAGECODING_RG12:
+        case MAPS_IMAGECODING_BA12:
+        case MAPS_IMAGECODING_GB12:
+        case MAPS_IMAGECODING_BG12:
+        case MAPS_IMAGECODING_RG16:
+        case MAPS_IMAGECODING_GR16:
+        case MAPS_IMAGECODING_GB16:
+        case MAPS_IMAGECODING_BYR2:
+        {
+            m_tempImageIn = cv::Mat(imageIn.height, imageIn.width, CV_16UC1, imageIn.imageData);
+        }
+        break;
+        default:
+            Error("Image coding not supported");
+        }
+        m_tempImageIn = m_tempImageIn(m_roi);
+
+        if (m_pipeline.Enabled())
+        {
+            ProcessDataPipelined(ts, m_tempImageIn);
+            return;
+        }
+
+        MAPS::OutputGuard<> outGuard{ this, Output(0) };
+
+        if (m_useCuda)
+        {
+            cv::cuda::GpuMat src(m_tempImageIn);
+
+            if (m_gpuMatAsOutput)
+            {
+                MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+                cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
+                ConvertGpu(src, dst);
+            }
+            else
+            {
+                cv::cuda::GpuMat dst;
+                IplImage& imageOut = outGuard.DataAs<IplImage>();
+                m_tempImageOut = m_hostOutView(imageOut.imageData);
+                ConvertGpu(src, dst);
+                dst.download(m_tempImageOut);
+
+                if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+                    Error("cv::Mat data ptr and imageOut data ptr are different.");
+            }
         }
         else
         {
-            cv::cuda::GpuMat dst;
             IplImage& imageOut = outGuard.DataAs<IplImage>();
-            m_tempImageOut = convTools::noCopyIplImage2Mat(&imageOut);
+            m_tempImageOut = m_hostOutView(imageOut.imageData); // Convert IplImage to cv::Mat without copying
 
             try {
                 // Convert an image from one color space to another depending on the pattern use
                 switch (m_pattern)
                 {
                 case MAPS_BAYER_PATTERN_BG:
-                    cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                    cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
                     break;
                 case MAPS_BAYER_PATTERN_GB:
-                    cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                    cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
                     break;
                 case MAPS_BAYER_PATTERN_RG:
-                    cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                    cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
                     break;
                 case MAPS_BAYER_PATTERN_GR:
-                    cv::cuda::cvtColor(src, dst, m_colorConvCode);
+                    cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
                     break;
                 }
             }
@@ -491,189 +660,117 @@ void MAPSBayerDecoder::ProcessDataIpl(const MAPSTimestamp ts, const MAPS::InputE
             {
                 Error(e.what());
             }
-            dst.download(m_tempImageOut);
-        }
-    }
-    else
-    {
-        IplImage& imageOut = outGuard.DataAs<IplImage>();
-        m_tempImageOut = convTools::noCopyIplImage2Mat(&imageOut); // Convert IplImage to cv::Mat without copying
 
-        try {
-            // Convert an image from one color space to another depending on the pattern use
-            switch (m_pattern)
-            {
-            case MAPS_BAYER_PATTERN_BG:
-                cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
-                break;
-            case MAPS_BAYER_PATTERN_GB:
-                cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
-                break;
-            case MAPS_BAYER_PATTERN_RG:
-                cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
-                break;
-            case MAPS_BAYER_PATTERN_GR:
-                cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
-                break;
-            }
-        }
-        catch (const std::exception& e)
-        {
-            Error(e.what());
+            if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+                Error("cv::Mat data ptr and imageOut data ptr are different.");
         }
 
-        if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
-            Error("cv::Mat data ptr and imageOut data ptr are different.");
+        outGuard.VectorSize() = 0;
+        outGuard.Timestamp() = ts;
+    }
+    catch (const std::exception& e)
+    {
+        Error(e.what());
     }
+}
 
-    outGuard.VectorSize() = 0;
-    outGuard.Timestamp() = ts;
+// The frames are output by WritePipelined() as soon as their work is complete, in the order of reception (see GpuPipeline).
+void MAPSBayerDecoder::ProcessDataPipelined(const MAPSTimestamp ts, const cv::Mat& src)
+{
+    const auto emit = [this](const GpuPipeline::Slot& done) { WritePipelined(done); };
+    GpuPipeline::Slot& slot = m_pipeline.Next(emit);
+
+    slot.Upload(src);
+    ConvertGpu(slot.Src(), slot.Dst(), slot.stream);
+    slot.Download();
+    m_pipeline.Submit(ts);
+    m_pipeline.EmitCompleted(emit);
 }
 
-void MAPSBayerDecoder::ProcessDataMaps(const MAPSTimestamp ts, const MAPS::InputElt<MAPSImage> inElt)
+void MAPSBayerDecoder::WritePipelined(const GpuPipeline::Slot& done)
 {
     MAPS::OutputGuard<> outGuard{ this, Output(0) };
+    IplImage& imageOut = outGuard.DataAs<IplImage>();
+    m_tempImageOut = m_hostOutView(imageOut.imageData);
+    done.PinnedOut().copyTo(m_tempImageOut);
+    outGuard.VectorSize() = 0;
+    outGuard.Timestamp() = done.Timestamp();
 
-    const MAPSImage& imageIn = inElt.Data();
+    if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+        Error("cv::Mat data ptr and imageOut data ptr are different.");
+}
 
-    MAPSUInt32 fourcc = 0;
-    MAPS::Memcpy((char*)&fourcc, (const char*)imageIn.imageCoding, 4);
-    switch (fourcc)
-    {
-    case MAPS_IMAGECODING_RGGB:
-    case MAPS_IMAGECODING_GRBG:
-    case MAPS_IMAGECODING_GBRG:
-    case MAPS_IMAGECODING_BA81:
-    {
-        m_tempImageIn = cv::Mat(imageIn.height, imageIn.width, CV_8UC1, imageIn.imageData);
-    }
-    break;
-    case MAPS_IMAGECODING_RG10:
-    case MAPS_IMAGECODING_BA10:
-    case MAPS_IMAGECODING_GB10:
-    case MAPS_IMAGECODING_BG10:
-    case MAPS_IMAGECODING_RG12:
-    case MAPS_IMAGECODING_BA12:
-    case MAPS_IMAGECODING_GB12:
-    case MAPS_IMAGECODING_BG12:
-    case MAPS_IMAGECODING_RG16:
-    case MAPS_IMAGECODING_GR16:
-    case MAPS_IMAGECODING_GB16:
-    case MAPS_IMAGECODING_BYR2:
+void MAPSBayerDecoder::ProcessDataGpu(const MAPSTimestamp ts, const MAPS::InputElt<MapsCudaStruct> inElt)
+{
+    try
     {
-        m_tempImageIn = cv::Mat(imageIn.height, imageIn.width, CV_16UC1, imageIn.imageData);
-    }
-    break;
-    default:
-        Error("Image coding not supported");
-    }
+        if (DropInput(ts))
+            return;
 
-    if (m_useCuda)
-    {
-        cv::cuda::GpuMat src(m_tempImageIn);
+        MAPS::OutputGuard<> outGuard{ this, Output(0) };
+
+        const cv::cuda::GpuMat src = m_deviceInView(inElt.Data().m_points);
 
         if (m_gpuMatAsOutput)
         {
-            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-            const IplImage& proxy = outputData.m_IplImageProxy;
-            cv::cuda::GpuMat dst(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), outputData.m_points);
+            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+            cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
             ConvertGpu(src, dst);
         }
         else
         {
-            cv::cuda::GpuMat dst;
             IplImage& imageOut = outGuard.DataAs<IplImage>();
-            m_tempImageOut = convTools::noCopyIplImage2Mat(&imageOut);
+            m_tempImageOut = m_hostOutView(imageOut.imageData); // Convert IplImage to cv::Mat without copying
+            cv::cuda::GpuMat dst;
             ConvertGpu(src, dst);
             dst.download(m_tempImageOut);
 
             if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
                 Error("cv::Mat data ptr and imageOut data ptr are different.");
         }
+
+        outGuard.VectorSize() = 0;
+        outGuard.Timestamp() = ts;
     }
-    else
+    catch (const std::exception& e)
     {
-        IplImage& imageOut = outGuard.DataAs<IplImage>();
-        m_tempImageOut = convTools::noCopyIplImage2Mat(&imageOut); // Convert IplImage to cv::Mat without copying
-
-        try {
-            // Convert an image from one color space to another depending on the pattern use
-            switch (m_pattern)
-            {
-            case MAPS_BAYER_PATTERN_BG:
-                cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
-                break;
-            case MAPS_BAYER_PATTERN_GB:
-                cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
-                break;
-            case MAPS_BAYER_PATTERN_RG:
-                cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
-                break;
-            case MAPS_BAYER_PATTERN_GR:
-                cv::cvtColor(m_tempImageIn, m_tempImageOut, m_colorConvCode);
-                break;
-            }
-        }
-        catch (const std::exception& e)
-        {
-            Error(e.what());
-        }
-
-        if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
-            Error("cv::Mat data ptr and imageOut data ptr are different.");
+        Error(e.what());
     }
-
-    outGuard.VectorSize() = 0;
-    outGuard.Timestamp() = ts;
 }
 
-void MAPSBayerDecoder::ProcessDataGpu(const MAPSTimestamp ts, const MAPS::InputElt<MapsCudaStruct> inElt)
+MAPSUInt32 MAPSBayerDecoder::OutputChannelSeq() const
 {
-    MAPS::OutputGuard<> outGuard{ this, Output(0) };
-
-    const IplImage& proxy = inElt.Data().m_IplImageProxy;
-    const cv::cuda::GpuMat src(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), inElt.Data().m_points);
-
-    if (m_gpuMatAsOutput)
-    {
-        MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-        const IplImage& proxyDst = outputData.m_IplImageProxy;
-        cv::cuda::GpuMat dst(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
-        ConvertGpu(src, dst);
-    }
-    else
+    switch (m_outputFormat)
     {
-        IplImage& imageOut = outGuard.DataAs<IplImage>();
-        m_tempImageOut = convTools::noCopyIplImage2Mat(&imageOut); // Convert IplImage to cv::Mat without copying
-        cv::cuda::GpuMat dst;
-        ConvertGpu(src, dst);
-        dst.download(m_tempImageOut);
-
-        if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
-            Error("cv::Mat data ptr and imageOut data ptr are different.");
+    case OUTPUT_FORMAT::BGR:
+        return MAPS_CHANNELSEQ_BGR;
+    case OUTPUT_FORMAT::BGRA:
+        return MAPS_CHANNELSEQ_BGRA;
+    case OUTPUT_FORMAT::RGBA:
+        return MAPS_CHANNELSEQ_RGBA;
+    case OUTPUT_FORMAT::RGB:
+    default:
+        return MAPS_CHANNELSEQ_RGB;
     }
-
-    outGuard.VectorSize() = 0;
-    outGuard.Timestamp() = ts;
 }
 
-void MAPSBayerDecoder::ConvertGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst)
+void MAPSBayerDecoder::ConvertGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst, cv::cuda::Stream& stream)
 {
     try {
         // Convert an image from one color space to another depending on the pattern use
         switch (m_pattern)
         {
         case MAPS_BAYER_PATTERN_BG:
-            cv::cuda::cvtColor(src, dst, m_colorConvCode);
+            cv::cuda::cvtColor(src, dst, m_colorConvCode, 0, stream);
             break;
         case MAPS_BAYER_PATTERN_GB:
-            cv::cuda::cvtColor(src, dst, m_colorConvCode);
+            cv::cuda::cvtColor(src, dst, m_colorConvCode, 0, stream);
             break;
         case MAPS_BAYER_PATTERN_RG:
-            cv::cuda::cvtColor(src, dst, m_colorConvCode);
+            cv::cuda::cvtColor(src, dst, m_colorConvCode, 0, stream);
             break;
         case MAPS_BAYER_PATTERN_GR:
-            cv::cuda::cvtColor(src, dst, m_colorConvCode);
+            cv::cuda::cvtColor(src, dst, m_colorConvCode, 0, stream);
             break;
         }
     }
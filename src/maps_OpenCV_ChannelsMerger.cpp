@@ -31,20 +31,26 @@
 #include <opencv2/cudawarping.hpp>
 #include "opencv2/cudaarithm.hpp"
 
+#include <cstdlib>
+#include <sstream>
+
 // Use the macros to declare the inputs
 MAPS_BEGIN_INPUTS_DEFINITION(MAPSOpenCV_ChannelsMerger)
     MAPS_INPUT("channel1", MAPS::FilterIplImage, MAPS::FifoReader)
     MAPS_INPUT("channel2", MAPS::FilterIplImage, MAPS::FifoReader)
     MAPS_INPUT("channel3", MAPS::FilterIplImage, MAPS::FifoReader)
+    MAPS_INPUT("channel4", MAPS::FilterIplImage, MAPS::FifoReader)
     MAPS_INPUT("i_gpu_channel1", Filter_MapsCudaStruct, MAPS::FifoReader)
     MAPS_INPUT("i_gpu_channel2", Filter_MapsCudaStruct, MAPS::FifoReader)
     MAPS_INPUT("i_gpu_channel3", Filter_MapsCudaStruct, MAPS::FifoReader)
+    MAPS_INPUT("i_gpu_channel4", Filter_MapsCudaStruct, MAPS::FifoReader)
     MAPS_END_INPUTS_DEFINITION
 
 // Use the macros to declare the outputs
 MAPS_BEGIN_OUTPUTS_DEFINITION(MAPSOpenCV_ChannelsMerger)
     MAPS_OUTPUT("imageOut", MAPS::IplImage, nullptr, nullptr, 0)
     MAPS_OUTPUT_USER_DYNAMIC_STRUCTURE("o_gpu", MapsCudaStruct)
+    MAPS_OUTPUT("sync_stats", MAPS::Float64, nullptr, nullptr, 3)
     MAPS_END_OUTPUTS_DEFINITION
 
 // Use the macros to declare the properties
@@ -53,8 +59,20 @@ MAPS_BEGIN_PROPERTIES_DEFINITION(MAPSOpenCV_ChannelsMerger)
     MAPS_PROPERTY("outputPlanar", false, false, false)
     MAPS_PROPERTY("synchro_tolerance", 0, false, false)
     MAPS_PROPERTY("use_cuda", false, false, false)
+    MAPS_PROPERTY("nb_channels", 3, false, false)
+    MAPS_PROPERTY_ENUM("sync_strategy", "Wait for all|Latest on trigger|Timeout then previous", 0, false, false)
+    MAPS_PROPERTY("sync_timeout", 20000, false, false)
     MAPS_PROPERTY("gpu_mat_as_input", false, false, false)
     MAPS_PROPERTY("gpu_mat_as_output", false, false, false)
+    MAPS_PROPERTY("roi_x", 0, false, false)
+    MAPS_PROPERTY("roi_y", 0, false, false)
+    MAPS_PROPERTY("roi_width", 0, false, false)
+    MAPS_PROPERTY("roi_height", 0, false, false)
+    MAPS_PROPERTY("fifo_depth", 0, false, false)
+    MAPS_PROPERTY("memory_budget", 0, false, false)
+    MAPS_PROPERTY("lazy_allocation", false, false, false)
+    MAPS_PROPERTY("prewarm_buffers", 2, false, false)
+    MAPS_PROPERTY_ENUM("memory_mode", "Device|Managed|Mapped", 0, false, false)
 MAPS_END_PROPERTIES_DEFINITION
 
 // Use the macros to declare the actions
@@ -62,31 +80,61 @@ MAPS_BEGIN_ACTIONS_DEFINITION(MAPSOpenCV_ChannelsMerger)
     //MAPS_ACTION("aName",MAPSOpenCV_ChannelsMerger::ActionName)
 MAPS_END_ACTIONS_DEFINITION
 
+//Version 1.2: nb_channels property (1 to 4 channels), channel4 inputs.
+//Version 1.3: sync_strategy property, sync_stats output.
+//Version 1.4: roi_x, roi_y, roi_width and roi_height properties, only the region of interest of the inputs is merged.
+//Version 1.5: fifo_depth and memory_budget properties, sizes the FIFO of the GpuMat outputs and bounds the device memory of their buffers.
+//Version 1.6: lazy_allocation and prewarm_buffers properties, the device memory of the GpuMat output buffers is allocated on their first use.
+//Version 1.7: memory_mode property, the GpuMat output buffers can be allocated in managed or mapped host memory, readable from the host without download.
 // Use the macros to declare this component (OpenCV_Resize) behaviour
-MAPS_COMPONENT_DEFINITION(MAPSOpenCV_ChannelsMerger, "OpenCV_ChannelsMerger_cuda", "1.1.0", 128,
+MAPS_COMPONENT_DEFINITION(MAPSOpenCV_ChannelsMerger, "OpenCV_ChannelsMerger_cuda", "1.7.0", 128,
                             MAPS::Threaded|MAPS::Sequential, MAPS::Threaded,
                             0, // Nb of inputs
                             0, // Nb of outputs
-                            4, // Nb of properties
+                            6, // Nb of properties
                             -1) // Nb of actions
 
 
 void MAPSOpenCV_ChannelsMerger::Birth()
 {
+    ApplyGpuOutputProperties();
+
     m_isOutputPlanar = GetBoolProperty("outputPlanar");
     m_channelSeq = GetStringProperty("outputChannelSeq");
-    m_tempGpuMats.resize(3);
+    m_tempImageIn.resize(m_nbChannels);
+    m_tempGpuMats.resize(m_nbChannels);
+
+    if (m_nbChannels == 1)
+    {
+        m_channelSeq = MAPS_CHANNELSEQ_GRAY;
+    }
+    else if (static_cast<int>(m_channelSeq.size()) != m_nbChannels)
+    {
+        std::ostringstream ss;
+        ss << "outputChannelSeq property : Channel sequence must be made of " << m_nbChannels << " characters to match the nb_channels property. (ex : RGB, BGR, YUV, HSV, BGRA, etc...)";
+        Error(ss.str().c_str());
+    }
 
-    if (m_channelSeq.size() > 4)
-        Error("outputChannelSeq property : Channel sequence is too long. It must be made of 4 characters max. (ex : RGB, BGR, YUV, HSV, etc...)");
+    for (int i = 0; i < m_nbChannels; ++i)
+        m_inputs.push_back(&Input(i));
 
-    if (m_useCuda && m_gpuMatAsInput)
+    if (m_syncStrategy != SyncStrategy_WaitForAll)
+    {
+        // The inputs are read in Core(), see ReadLatestInputs()
+        m_lastElts.assign(m_nbChannels, nullptr);
+        m_outputAllocated = false;
+        m_droppedSamples = 0;
+        m_duplicatedSamples = 0;
+        m_lateSamples = 0;
+        m_syncTolerance = GetIntegerProperty("synchro_tolerance");
+    }
+    else if (m_useCuda && m_gpuMatAsInput)
     {
         m_inputReader = MAPS::MakeInputReader::Synchronized(
             this,
             GetIntegerProperty("synchro_tolerance"),
             MAPS::InputReaderOption::Synchronized::SyncBehavior::SyncAllInputs,
-            MAPS::MakeArray(&Input(0), &Input(1), &Input(2)),
+            m_inputs,
             &MAPSOpenCV_ChannelsMerger::AllocateOutputBufferSizeGpu,
             &MAPSOpenCV_ChannelsMerger::ProcessDataGpu
         );
@@ -97,7 +145,7 @@ void MAPSOpenCV_ChannelsMerger::Birth()
             this,
             GetIntegerProperty("synchro_tolerance"),
             MAPS::InputReaderOption::Synchronized::SyncBehavior::SyncAllInputs,
-            MAPS::MakeArray(&Input(0), &Input(1), &Input(2)),
+            m_inputs,
             &MAPSOpenCV_ChannelsMerger::AllocateOutputBufferSize,
             &MAPSOpenCV_ChannelsMerger::ProcessData
         );
@@ -106,12 +154,148 @@ void MAPSOpenCV_ChannelsMerger::Birth()
 
 void MAPSOpenCV_ChannelsMerger::Core()
 {
-    m_inputReader->Read();
+    if (m_syncStrategy == SyncStrategy_WaitForAll)
+    {
+        m_inputReader->Read();
+        return;
+    }
+
+    MAPSTimestamp ts;
+    if (!ReadLatestInputs(ts))
+        return;
+
+    try
+    {
+        if (m_useCuda && m_gpuMatAsInput)
+        {
+            std::vector<const MapsCudaStruct*> imagesIn(m_nbChannels);
+            std::vector<const IplImage*> proxies(m_nbChannels);
+            for (int i = 0; i < m_nbChannels; ++i)
+            {
+                imagesIn[i] = static_cast<const MapsCudaStruct*>(m_lastElts[i]->Data());
+                proxies[i] = &imagesIn[i]->m_IplImageProxy;
+            }
+
+            if (!m_outputAllocated)
+            {
+                CheckInputImages(proxies);
+                AllocateOutputs(*proxies[0]);
+                m_outputAllocated = true;
+            }
+
+            MergeGpuImages(ts, imagesIn);
+        }
+        else
+        {
+            std::vector<const IplImage*> imagesIn(m_nbChannels);
+            for (int i = 0; i < m_nbChannels; ++i)
+            {
+                imagesIn[i] = &m_lastElts[i]->IplImage();
+            }
+
+            if (!m_outputAllocated)
+            {
+                CheckInputImages(imagesIn);
+                AllocateOutputs(*imagesIn[0]);
+                m_outputAllocated = true;
+            }
+
+            MergeImages(ts, imagesIn);
+        }
+
+        // Only published for the merged images
+        MAPS::OutputGuard<MAPSFloat64> outGuard{ this, Output("sync_stats") };
+        outGuard.Data(0) = static_cast<MAPSFloat64>(m_droppedSamples);
+        outGuard.Data(1) = static_cast<MAPSFloat64>(m_duplicatedSamples);
+        outGuard.Data(2) = static_cast<MAPSFloat64>(m_lateSamples);
+        outGuard.VectorSize() = 3;
+        outGuard.Timestamp() = ts;
+    }
+    catch (const std::exception& e)
+    {
+        Error(e.what());
+    }
+}
+
+bool MAPSOpenCV_ChannelsMerger::ReadLatestInputs(MAPSTimestamp& ts)
+{
+    // channel1 triggers the merge, it is never dropped nor duplicated
+    m_lastElts[0] = StartReading(Input(0));
+    if (m_lastElts[0] == nullptr)
+        return false;
+
+    ts = m_lastElts[0]->Timestamp();
+    const MAPSTimestamp deadline = MAPS::CurrentTime() + m_syncTimeout;
+
+    for (int i = 1; i < m_nbChannels; ++i)
+    {
+        MAPSInput& input = Input(i);
+        bool updated = false;
+
+        if (m_lastElts[i] == nullptr)
+        {
+            // Nothing received yet on this input: there is no previous sample to fall back on.
+            m_lastElts[i] = StartReading(input);
+            if (m_lastElts[i] == nullptr)
+                return false;
+            updated = true;
+        }
+        else if (m_syncStrategy == SyncStrategy_TimeoutThenPrevious && !DataAvailableInFIFO(input))
+        {
+            // Blocking read until a new sample arrives or the deadline passes, then the previous sample is reused.
+            const MAPSDelay remaining = deadline - MAPS::CurrentTime();
+            if (remaining > 0)
+            {
+                bool timedOut = false;
+                MAPSIOElt* ioElt = StartReading(input, remaining, &timedOut);
+                if (ioElt != nullptr)
+                {
+                    m_lastElts[i] = ioElt;
+                    updated = true;
+                }
+                else if (!timedOut)
+                {
+                    return false; // The component is dying
+                }
+            }
+        }
+
+        // Keep the most recent sample, the older ones are dropped.
+        while (DataAvailableInFIFO(input))
+        {
+            MAPSIOElt* ioElt = StartReading(input);
+            if (ioElt == nullptr)
+                return false;
+            if (updated)
+                ++m_droppedSamples;
+            m_lastElts[i] = ioElt;
+            updated = true;
+        }
+
+        if (!updated)
+            ++m_duplicatedSamples;
+
+        if (m_syncTolerance > 0 && std::abs(m_lastElts[i]->Timestamp() - ts) > m_syncTolerance)
+            ++m_lateSamples;
+    }
+
+    return true;
 }
 
 void MAPSOpenCV_ChannelsMerger::Death()
 {
+    if (m_syncStrategy != SyncStrategy_WaitForAll)
+    {
+        std::ostringstream ss;
+        ss << "Synchronization : " << m_droppedSamples << " dropped, " << m_duplicatedSamples << " duplicated and " << m_lateSamples << " late samples.";
+        ReportInfo(ss.str().c_str());
+    }
+
     m_inputReader.reset();
+    m_inputs.clear();
+    m_lastElts.clear();
+    m_tempGpuMats.clear();
+    m_tempGpuMerged.release();
 }
 
 void MAPSOpenCV_ChannelsMerger::Dynamic()
@@ -120,6 +304,11 @@ void MAPSOpenCV_ChannelsMerger::Dynamic()
     m_gpuMatAsInput = false;
     m_gpuMatAsOutput = false;
 
+    NewProperty("roi_x");
+    NewProperty("roi_y");
+    NewProperty("roi_width");
+    NewProperty("roi_height");
+
     if (cv::cuda::getCudaEnabledDeviceCount() > 0)
     {
         Property("use_cuda").SetMutable(true);
@@ -132,24 +321,21 @@ void MAPSOpenCV_ChannelsMerger::Dynamic()
     if (Property("use_cuda").IsMutable())
         m_useCuda = GetBoolProperty("use_cuda");
 
+    m_nbChannels = static_cast<int>(GetIntegerProperty("nb_channels"));
+    if (m_nbChannels < 1 || m_nbChannels > 4)
+        Error("nb_channels property : The number of channels must be between 1 and 4.");
+
+    m_syncStrategy = static_cast<SyncStrategy>(GetIntegerProperty("sync_strategy"));
+    if (m_syncStrategy == SyncStrategy_TimeoutThenPrevious)
+    {
+        m_syncTimeout = NewProperty("sync_timeout").IntegerValue();
+    }
+
     if (m_useCuda)
     {
         m_gpuMatAsInput = NewProperty("gpu_mat_as_input").BoolValue();
         m_gpuMatAsOutput = NewProperty("gpu_mat_as_output").BoolValue();
 
-        if (m_gpuMatAsInput)
-        {
-            NewInput("i_gpu_channel1");
-            NewInput("i_gpu_channel2");
-            NewInput("i_gpu_channel3");
-        }
-        else
-        {
-            NewInput("channel1");
-            NewInput("channel2");
-            NewInput("channel3");
-        }
-
         if (m_gpuMatAsOutput)
         {
             NewOutput("o_gpu");
@@ -161,55 +347,44 @@ void MAPSOpenCV_ChannelsMerger::Dynamic()
     }
     else
     {
-        NewInput("channel1");
-        NewInput("channel2");
-        NewInput("channel3");
         NewOutput("imageOut");
     }
-}
 
-void MAPSOpenCV_ChannelsMerger::FreeBuffers()
-{
-    if (m_useCuda && m_gpuMatAsOutput)
+    const std::string inputPrefix = (m_useCuda && m_gpuMatAsInput) ? "i_gpu_channel" : "channel";
+    for (int i = 0; i < m_nbChannels; ++i)
     {
-        MAPS_DynamicCustomStructComponent::FreeBuffers();
+        NewInput((inputPrefix + std::to_string(i + 1)).c_str());
     }
-    else
+
+    if (m_syncStrategy != SyncStrategy_WaitForAll)
     {
-        MAPSComponent::FreeBuffers();
+        NewOutput("sync_stats");
     }
+
+    NewGpuOutputProperties("o_gpu");
 }
 
-void MAPSOpenCV_ChannelsMerger::AllocateOutputBufferSize(const MAPSTimestamp, const MAPS::ArrayView<MAPS::InputElt<IplImage>> imageInElts)
+void MAPSOpenCV_ChannelsMerger::AllocateOutputs(const IplImage& imageIn1)
 {
-    const IplImage& imageIn1 = imageInElts[0].Data();
-
-    m_tempImageIn[0] = convTools::noCopyIplImage2Mat(&imageIn1); // Convert IplImage to cv::Mat
-    m_tempImageIn[1] = convTools::noCopyIplImage2Mat(&imageInElts[1].Data()); // Convert IplImage to cv::Mat
-    m_tempImageIn[2] = convTools::noCopyIplImage2Mat(&imageInElts[2].Data()); // Convert IplImage to cv::Mat
-
-    if (m_tempImageIn[0].channels() != 1)
-        Error("Input 1 : This component only supports single channel images on its inputs.");
+    ResolveRoi(imageIn1);
+    m_roiFullFrame = m_roi.size() == cv::Size(imageIn1.width, imageIn1.height);
 
-    if (m_tempImageIn[1].channels() != 1)
-        Error("Input 2 : This component only supports single channel images on its inputs.");
+    IplImage model = MAPS::IplImageModel(m_roi.width, m_roi.height, m_channelSeq.c_str(), m_isOutputPlanar ? IPL_DATA_ORDER_PLANE : IPL_DATA_ORDER_PIXEL, imageIn1.depth, imageIn1.align);
 
-    if (m_tempImageIn[2].channels() != 1)
-        Error("Input 3 : This component only supports single channel images on its inputs.");
-
-    if (m_tempImageIn[0].size() != m_tempImageIn[1].size() ||
-        m_tempImageIn[0].size() != m_tempImageIn[2].size())
-        Error("Input images must have the same dimensions.");
-
-    IplImage model = MAPS::IplImageModel(imageIn1.width, imageIn1.height, m_channelSeq.c_str(), m_isOutputPlanar ? IPL_DATA_ORDER_PLANE : IPL_DATA_ORDER_PIXEL, imageIn1.depth, imageIn1.align);
+    // All the inputs share the same view. Planar outputs are viewed one plane at a time, the planes having the layout of a single channel image.
+    IplImage viewed = model;
+    if (m_isOutputPlanar)
+        viewed.nChannels = 1;
+    CreateViews(imageIn1, viewed);
 
     if (m_gpuMatAsOutput)
     {
+        const int outputSize = m_roi.width * m_roi.height * m_nbChannels * ((imageIn1.depth & 0xFF) / 8);
         try
         {
             AllocateDynamicOutputBuffers(
                 DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(m_tempImageIn[0].cols, m_tempImageIn[0].rows, m_tempImageIn[0].channels(), model); }  // struct allocation
+                    [this, outputSize, model] { return new MapsCudaStruct(outputSize, model, m_memoryMode); }  // struct allocation
                 )
             );
         }
@@ -220,72 +395,60 @@ void MAPSOpenCV_ChannelsMerger::AllocateOutputBufferSize(const MAPSTimestamp, co
     }
     else
     {
-        Output("imageOut").AllocOutputBufferIplImage(model);
+        AllocateIplImageOutputBuffer(Output("imageOut"), model);
     }
 }
 
-void MAPSOpenCV_ChannelsMerger::ProcessData(const MAPSTimestamp ts, const MAPS::ArrayView<MAPS::InputElt<IplImage>> inElts)
+void MAPSOpenCV_ChannelsMerger::CheckInputImages(const std::vector<const IplImage*>& imagesIn)
 {
-    try
+    for (int i = 0; i < m_nbChannels; ++i)
     {
-        const IplImage& imageIn1 = inElts[0].Data();
-        const IplImage& imageIn2 = inElts[1].Data();
-        const IplImage& imageIn3 = inElts[2].Data();
-        m_tempImageIn[0] = convTools::noCopyIplImage2Mat(&imageIn1); // Convert IplImage to cv::Mat
-        m_tempImageIn[1] = convTools::noCopyIplImage2Mat(&imageIn2); // Convert IplImage to cv::Mat
-        m_tempImageIn[2] = convTools::noCopyIplImage2Mat(&imageIn3); // Convert IplImage to cv::Mat
-        MAPS::OutputGuard<> outGuard{ this, Output(0) };
+        std::ostringstream ss;
+        ss << "Input " << i + 1 << " : ";
 
-        if (m_useCuda)
+        if (imagesIn[i]->nChannels != 1)
         {
-            m_tempGpuMats[0].upload(m_tempImageIn[0]);
-            m_tempGpuMats[1].upload(m_tempImageIn[1]);
-            m_tempGpuMats[2].upload(m_tempImageIn[2]);
-
-            if (m_gpuMatAsOutput)
-            {
-                MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-                const IplImage& proxy = outputData.m_IplImageProxy;
-                cv::cuda::GpuMat dst(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), outputData.m_points);
-
-                cv::cuda::merge(m_tempGpuMats, dst);
-            }
-            else
-            {
-                IplImage& imageOut = outGuard.DataAs<IplImage>();
-                m_tempImageOut = convTools::noCopyIplImage2Mat(&imageOut);
-                cv::cuda::GpuMat dst;
-                cv::cuda::merge(m_tempGpuMats, dst);
-                dst.download(m_tempImageOut);
+            ss << "This component only supports single channel images on its inputs.";
+            Error(ss.str().c_str());
+        }
 
-                if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
-                    Error("cv::Mat data ptr and imageOut data ptr are different.");
-            }
+        if (imagesIn[i]->width != imagesIn[0]->width || imagesIn[i]->height != imagesIn[0]->height)
+        {
+            ss << "Input images must have the same dimensions.";
+            Error(ss.str().c_str());
         }
-        else
+
+        if (imagesIn[i]->depth != imagesIn[0]->depth)
         {
-            IplImage& imageOut = outGuard.DataAs<IplImage>();
+            ss << "Input images must have the same depth.";
+            Error(ss.str().c_str());
+        }
+    }
+}
 
-            if (m_isOutputPlanar)
-            {
-                size_t imageSize = imageIn1.imageSize;
-                for (size_t i = 0; i < inElts.size(); ++i)
-                {
-                    std::memcpy(imageOut.imageData + i * imageSize, inElts[i].Data().imageData, imageSize);
-                }
-            }
-            else
-            {
-                m_tempImageOut = convTools::noCopyIplImage2Mat(&imageOut); // Convert IplImage to cv::Mat without copying
+void MAPSOpenCV_ChannelsMerger::AllocateOutputBufferSize(const MAPSTimestamp, const MAPS::ArrayView<MAPS::InputElt<IplImage>> imageInElts)
+{
+    std::vector<const IplImage*> imagesIn(m_nbChannels);
+    for (int i = 0; i < m_nbChannels; ++i)
+    {
+        imagesIn[i] = &imageInElts[i].Data();
+    }
 
-                cv::merge(m_tempImageIn, m_tempImageOut); // Merge the 3 element of m_tempImageIn into m_tempImageOut
+    CheckInputImages(imagesIn);
+    AllocateOutputs(*imagesIn[0]);
+}
 
-                if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
-                    Error("cv::Mat data ptr and imageOut data ptr are different.");
-            }
+void MAPSOpenCV_ChannelsMerger::ProcessData(const MAPSTimestamp ts, const MAPS::ArrayView<MAPS::InputElt<IplImage>> inElts)
+{
+    try
+    {
+        std::vector<const IplImage*> imagesIn(m_nbChannels);
+        for (int i = 0; i < m_nbChannels; ++i)
+        {
+            imagesIn[i] = &inElts[i].Data();
         }
 
-        outGuard.Timestamp() = ts;
+        MergeImages(ts, imagesIn);
     }
     catch (const std::exception& e)
     {
@@ -293,89 +456,139 @@ void MAPSOpenCV_ChannelsMerger::ProcessData(const MAPSTimestamp ts, const MAPS::
     }
 }
 
-void MAPSOpenCV_ChannelsMerger::AllocateOutputBufferSizeGpu(const MAPSTimestamp, const MAPS::ArrayView<MAPS::InputElt<MapsCudaStruct>> imageInElts)
+void MAPSOpenCV_ChannelsMerger::MergeImages(const MAPSTimestamp ts, const std::vector<const IplImage*>& imagesIn)
 {
-    const MapsCudaStruct& imageIn1 = imageInElts[0].Data();
-    const MapsCudaStruct& imageIn2 = imageInElts[1].Data();
-    const MapsCudaStruct& imageIn3 = imageInElts[2].Data();
+    for (int i = 0; i < m_nbChannels; ++i)
+    {
+        m_tempImageIn[i] = m_hostInView(imagesIn[i]->imageData);
+    }
+    MAPS::OutputGuard<> outGuard{ this, Output(0) };
 
-    if (imageIn1.m_IplImageProxy.nChannels != 1)
-        Error("Input 1 : This component only supports single channel images on its inputs.");
+    if (m_useCuda)
+    {
+        for (int i = 0; i < m_nbChannels; ++i)
+        {
+            m_tempGpuMats[i].upload(m_tempImageIn[i]);
+        }
 
-    if (imageIn2.m_IplImageProxy.nChannels != 1)
-        Error("Input 2 : This component only supports single channel images on its inputs.");
+        WriteGpuChannels(outGuard);
+    }
+    else
+    {
+        IplImage& imageOut = outGuard.DataAs<IplImage>();
 
-    if (imageIn3.m_IplImageProxy.nChannels != 1)
-        Error("Input 3 : This component only supports single channel images on its inputs.");
+        if (m_isOutputPlanar && m_roiFullFrame)
+        {
+            const size_t imageSize = imagesIn[0]->imageSize;
+            for (int i = 0; i < m_nbChannels; ++i)
+            {
+                std::memcpy(imageOut.imageData + i * imageSize, imagesIn[i]->imageData, imageSize);
+            }
+        }
+        else if (m_isOutputPlanar)
+        {
+            const int planeSize = imageOut.imageSize / m_nbChannels;
+            for (int i = 0; i < m_nbChannels; ++i)
+            {
+                char* const planeData = imageOut.imageData + i * planeSize;
+                cv::Mat dst = m_hostOutView(planeData);
+                m_tempImageIn[i].copyTo(dst);
 
-    if (imageIn1.m_size != imageIn2.m_size ||
-        imageIn1.m_size != imageIn3.m_size)
-        Error("Input images must have the same dimensions.");
+                if (static_cast<void*>(dst.data) != static_cast<void*>(planeData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+                    Error("cv::Mat data ptr and imageOut data ptr are different.");
+            }
+        }
+        else
+        {
+            m_tempImageOut = m_hostOutView(imageOut.imageData);
 
-    IplImage model = MAPS::IplImageModel(imageIn1.m_IplImageProxy.width, imageIn1.m_IplImageProxy.height, m_channelSeq.c_str(), m_isOutputPlanar ? IPL_DATA_ORDER_PLANE : IPL_DATA_ORDER_PIXEL,
-        imageIn1.m_IplImageProxy.depth, imageIn1.m_IplImageProxy.align);
+            ChannelPlanes::Merge(m_tempImageIn.data(), m_nbChannels, m_tempImageOut);
 
-    int type = CV_MAKETYPE(imageIn1.m_IplImageProxy.depth == 8 ? 0 : imageIn1.m_IplImageProxy.depth / 8, imageIn1.m_IplImageProxy.nChannels);
+            if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+                Error("cv::Mat data ptr and imageOut data ptr are different.");
+        }
+    }
 
-    if (m_gpuMatAsOutput)
+    outGuard.Timestamp() = ts;
+}
+
+void MAPSOpenCV_ChannelsMerger::AllocateOutputBufferSizeGpu(const MAPSTimestamp, const MAPS::ArrayView<MAPS::InputElt<MapsCudaStruct>> imageInElts)
+{
+    std::vector<const IplImage*> imagesIn(m_nbChannels);
+    for (int i = 0; i < m_nbChannels; ++i)
     {
-        try
-        {
-            AllocateDynamicOutputBuffers(
-                DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(imageIn1.m_size*3, model); }
-                )
-            );
-        }
-        catch (...)
+        imagesIn[i] = &imageInElts[i].Data().m_IplImageProxy;
+    }
+
+    CheckInputImages(imagesIn);
+    AllocateOutputs(*imagesIn[0]);
+}
+
+void MAPSOpenCV_ChannelsMerger::ProcessDataGpu(const MAPSTimestamp ts, const MAPS::ArrayView<MAPS::InputElt<MapsCudaStruct>> inElts)
+{
+    try
+    {
+        std::vector<const MapsCudaStruct*> imagesIn(m_nbChannels);
+        for (int i = 0; i < m_nbChannels; ++i)
         {
-            Error("Failed to allocate the dynamic output buffers");
+            imagesIn[i] = &inElts[i].Data();
         }
+
+        MergeGpuImages(ts, imagesIn);
     }
-    else
+    catch (const std::exception& e)
     {
-        Output("imageOut").AllocOutputBufferIplImage(model);
+        Error(e.what());
     }
 }
 
-void MAPSOpenCV_ChannelsMerger::ProcessDataGpu(const MAPSTimestamp ts, const MAPS::ArrayView<MAPS::InputElt<MapsCudaStruct>> inElts)
+void MAPSOpenCV_ChannelsMerger::MergeGpuImages(const MAPSTimestamp ts, const std::vector<const MapsCudaStruct*>& imagesIn)
 {
-    try
+    for (int i = 0; i < m_nbChannels; ++i)
     {
-        const IplImage& proxy = inElts[0].Data().m_IplImageProxy;
-        const cv::cuda::GpuMat src1(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), inElts[0].Data().m_points);
-        const cv::cuda::GpuMat src2(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), inElts[1].Data().m_points);
-        const cv::cuda::GpuMat src3(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), inElts[2].Data().m_points);
+        m_tempGpuMats[i] = m_deviceInView(imagesIn[i]->m_points);
+    }
 
-        MAPS::OutputGuard<> outGuard{ this, Output(0) };
+    MAPS::OutputGuard<> outGuard{ this, Output(0) };
+    WriteGpuChannels(outGuard);
+    outGuard.Timestamp() = ts;
 
-        m_tempGpuMats[0] = src1;
-        m_tempGpuMats[1] = src2;
-        m_tempGpuMats[2] = src3;
+    // Drop the views on the input buffers, they go back to the upstream FIFOs.
+    for (cv::cuda::GpuMat& mat : m_tempGpuMats)
+        mat.release();
+}
 
-        if (m_gpuMatAsOutput)
+void MAPSOpenCV_ChannelsMerger::WriteGpuChannels(MAPS::OutputGuard<>& outGuard)
+{
+    if (m_gpuMatAsOutput)
+    {
+        ChannelPlanes::MergeImages(m_tempGpuMats.data(), outGuard.DataAs<MapsCudaStruct>(), m_deviceOutView);
+    }
+    else
+    {
+        IplImage& imageOut = outGuard.DataAs<IplImage>();
+
+        if (m_isOutputPlanar)
         {
-            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-            const IplImage& proxyDst = outputData.m_IplImageProxy;
-            cv::cuda::GpuMat dst(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
-            cv::cuda::merge(m_tempGpuMats, dst);
+            const int planeSize = imageOut.imageSize / m_nbChannels;
+            for (int i = 0; i < m_nbChannels; ++i)
+            {
+                char* const planeData = imageOut.imageData + i * planeSize;
+                cv::Mat dst = m_hostOutView(planeData);
+                m_tempGpuMats[i].download(dst);
+
+                if (static_cast<void*>(dst.data) != static_cast<void*>(planeData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+                    Error("cv::Mat data ptr and imageOut data ptr are different.");
+            }
         }
         else
         {
-            IplImage& imageOut = outGuard.DataAs<IplImage>();
-            m_tempImageOut = convTools::noCopyIplImage2Mat(&imageOut);
-            cv::cuda::GpuMat dst;
-            cv::cuda::merge(m_tempGpuMats, dst);
-            dst.download(m_tempImageOut);
+            m_tempImageOut = m_hostOutView(imageOut.imageData);
+            ChannelPlanes::Merge(m_tempGpuMats.data(), m_nbChannels, m_tempGpuMerged);
+            m_tempGpuMerged.download(m_tempImageOut);
 
             if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
                 Error("cv::Mat data ptr and imageOut data ptr are different.");
         }
-
-        outGuard.Timestamp() = ts;
-    }
-    catch (const std::exception& e)
-    {
-        Error(e.what());
     }
 }
@@ -22,7 +22,7 @@
 ////////////////////////////////
 
 ////////////////////////////////
-// Purpose of this module : Divides 3-channel image into several single channel GRAY images.
+// Purpose of this module : Divides a 1 to 4 channels image into several single channel GRAY images.
 ////////////////////////////////
 
 #include "maps_OpenCV_ChannelsSplitter.h"	// Includes the header of this component
@@ -31,6 +31,10 @@
 #include <opencv2/cudawarping.hpp>
 #include "opencv2/cudaarithm.hpp"
 
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+
 // Use the macros to declare the inputs
 MAPS_BEGIN_INPUTS_DEFINITION(MAPSOpenCV_SplitChannels)
     MAPS_INPUT("imageIn", MAPS::FilterIplImage, MAPS::FifoReader)
@@ -42,16 +46,32 @@ MAPS_BEGIN_OUTPUTS_DEFINITION(MAPSOpenCV_SplitChannels)
     MAPS_OUTPUT("channel1", MAPS::IplImage, nullptr, nullptr, 0)
     MAPS_OUTPUT("channel2", MAPS::IplImage, nullptr, nullptr, 0)
     MAPS_OUTPUT("channel3", MAPS::IplImage, nullptr, nullptr, 0)
+    MAPS_OUTPUT("channel4", MAPS::IplImage, nullptr, nullptr, 0)
     MAPS_OUTPUT_USER_DYNAMIC_STRUCTURE("o_gpu_channel1", MapsCudaStruct)
     MAPS_OUTPUT_USER_DYNAMIC_STRUCTURE("o_gpu_channel2", MapsCudaStruct)
     MAPS_OUTPUT_USER_DYNAMIC_STRUCTURE("o_gpu_channel3", MapsCudaStruct)
+    MAPS_OUTPUT_USER_DYNAMIC_STRUCTURE("o_gpu_channel4", MapsCudaStruct)
+    MAPS_OUTPUT("input_stats", MAPS::Float64, nullptr, nullptr, 2)
 MAPS_END_OUTPUTS_DEFINITION
 
 // Use the macros to declare the properties
 MAPS_BEGIN_PROPERTIES_DEFINITION(MAPSOpenCV_SplitChannels)
 MAPS_PROPERTY("use_cuda", false, false, false)
+MAPS_PROPERTY("nb_channels", 3, false, false)
+MAPS_PROPERTY("channels", "", false, false)
 MAPS_PROPERTY("gpu_mat_as_input", false, false, false)
 MAPS_PROPERTY("gpu_mat_as_output", false, false, false)
+MAPS_PROPERTY("roi_x", 0, false, false)
+MAPS_PROPERTY("roi_y", 0, false, false)
+MAPS_PROPERTY("roi_width", 0, false, false)
+MAPS_PROPERTY("roi_height", 0, false, false)
+MAPS_PROPERTY_ENUM("input_policy", "FIFO|Latest only|Drop every N", 0, false, false)
+MAPS_PROPERTY("drop_interval", 2, false, false)
+MAPS_PROPERTY("fifo_depth", 0, false, false)
+MAPS_PROPERTY("memory_budget", 0, false, false)
+MAPS_PROPERTY("lazy_allocation", false, false, false)
+MAPS_PROPERTY("prewarm_buffers", 2, false, false)
+MAPS_PROPERTY_ENUM("memory_mode", "Device|Managed|Mapped", 0, false, false)
 MAPS_END_PROPERTIES_DEFINITION
 
 // Use the macros to declare the actions
@@ -59,16 +79,27 @@ MAPS_BEGIN_ACTIONS_DEFINITION(MAPSOpenCV_SplitChannels)
     //MAPS_ACTION("aName",MAPSOpenCV_SplitChannels::ActionName)
 MAPS_END_ACTIONS_DEFINITION
 
+//Version 1.2: nb_channels property (1 to 4 channels), channel4 outputs.
+//Version 1.3: channels property, only the selected channels are extracted.
+//Version 1.4: planar GpuMat input published as zero-copy plane views on the GpuMat outputs.
+//Version 1.5: roi_x, roi_y, roi_width and roi_height properties, only the region of interest is extracted.
+//Version 1.6: input_policy and drop_interval properties, input_stats output: stale frames can be skipped when the component falls behind its input.
+//Version 1.7: fifo_depth and memory_budget properties, sizes the FIFO of the GpuMat outputs and bounds the device memory of their buffers.
+//Version 1.8: lazy_allocation and prewarm_buffers properties, the device memory of the GpuMat output buffers is allocated on their first use.
+//Version 1.9: memory_mode property, the GpuMat output buffers can be allocated in managed or mapped host memory, readable from the host without download.
 // Use the macros to declare this component (OpenCV_Resize) behaviour
-MAPS_COMPONENT_DEFINITION(MAPSOpenCV_SplitChannels, "OpenCV_ChannelsSplitter_cuda", "1.1.0", 128,
+MAPS_COMPONENT_DEFINITION(MAPSOpenCV_SplitChannels, "OpenCV_ChannelsSplitter_cuda", "1.9.0", 128,
                             MAPS::Threaded|MAPS::Sequential, MAPS::Threaded,
                             0, // Nb of inputs
                             0, // Nb of outputs
-                            1, // Nb of properties
+                            3, // Nb of properties
                             -1) // Nb of actions
 
 void MAPSOpenCV_SplitChannels::Birth()
 {
+    ApplyGpuOutputProperties();
+    ApplyInputPolicyProperties();
+
     if (m_useCuda && m_gpuMatAsInput)
     {
         m_inputReader = MAPS::MakeInputReader::Reactive(
@@ -97,6 +128,13 @@ void MAPSOpenCV_SplitChannels::Core()
 void MAPSOpenCV_SplitChannels::Death()
 {
     m_inputReader.reset();
+
+    if (m_inputPolicy.Enabled())
+        ReportInfo(m_inputPolicy.Report().c_str());
+
+    for (cv::cuda::GpuMat& plane : m_tempGpuPlanes)
+        plane.release();
+    m_tempGpuIn.release();
 }
 
 void MAPSOpenCV_SplitChannels::Dynamic()
@@ -105,6 +143,11 @@ void MAPSOpenCV_SplitChannels::Dynamic()
     m_gpuMatAsInput = false;
     m_gpuMatAsOutput = false;
 
+    NewProperty("roi_x");
+    NewProperty("roi_y");
+    NewProperty("roi_width");
+    NewProperty("roi_height");
+
     if (cv::cuda::getCudaEnabledDeviceCount() > 0)
     {
         Property("use_cuda").SetMutable(true);
@@ -117,6 +160,12 @@ void MAPSOpenCV_SplitChannels::Dynamic()
     if (Property("use_cuda").IsMutable())
         m_useCuda = GetBoolProperty("use_cuda");
 
+    m_nbChannels = static_cast<int>(GetIntegerProperty("nb_channels"));
+    if (m_nbChannels < 1 || m_nbChannels > 4)
+        Error("nb_channels property : The number of channels must be between 1 and 4.");
+
+    ParseChannels(GetStringProperty("channels"));
+
     if (m_useCuda)
     {
         m_gpuMatAsInput = NewProperty("gpu_mat_as_input").BoolValue();
@@ -130,68 +179,106 @@ void MAPSOpenCV_SplitChannels::Dynamic()
         {
             NewInput("imageIn");
         }
-
-        if (m_gpuMatAsOutput)
-        {
-            NewOutput("o_gpu_channel1");
-            NewOutput("o_gpu_channel2");
-            NewOutput("o_gpu_channel3");
-        }
-        else
-        {
-            NewOutput("channel1");
-            NewOutput("channel2");
-            NewOutput("channel3");
-        }
     }
     else
     {
         NewInput("imageIn");
-        NewOutput("channel1");
-        NewOutput("channel2");
-        NewOutput("channel3");
     }
+
+    const std::string outputPrefix = (m_useCuda && m_gpuMatAsOutput) ? "o_gpu_channel" : "channel";
+    std::vector<std::string> outputNames;
+    for (int channel : m_channels)
+    {
+        outputNames.push_back(outputPrefix + std::to_string(channel + 1));
+        NewOutput(outputNames.back().c_str());
+    }
+
+    NewInputPolicyProperties();
+    NewGpuOutputProperties(outputNames);
 }
 
-void MAPSOpenCV_SplitChannels::FreeBuffers()
+void MAPSOpenCV_SplitChannels::ParseChannels(const MAPSString& channels)
 {
-    if (m_useCuda && m_gpuMatAsOutput)
+    m_channels.clear();
+
+    std::istringstream ss((const char*)channels);
+    std::string token;
+    while (std::getline(ss, token, ','))
     {
-        MAPS_DynamicCustomStructComponent::FreeBuffers();
+        token.erase(std::remove_if(token.begin(), token.end(), ::isspace), token.end());
+        if (token.empty())
+            continue;
+
+        const bool isIndex = token.size() == 1 && std::isdigit(static_cast<unsigned char>(token[0]));
+        const int channel = isIndex ? token[0] - '0' : -1;
+
+        if (channel < 0 || channel >= m_nbChannels)
+        {
+            std::ostringstream err;
+            err << "channels property : \"" << token << "\" is not a channel index between 0 and " << m_nbChannels - 1 << ".";
+            Error(err.str().c_str());
+        }
+
+        if (std::find(m_channels.begin(), m_channels.end(), channel) != m_channels.end())
+        {
+            std::ostringstream err;
+            err << "channels property : Channel " << channel << " is selected more than once.";
+            Error(err.str().c_str());
+        }
+
+        m_channels.push_back(channel);
     }
-    else
+
+    // Empty selection: all the channels, in order
+    if (m_channels.empty())
     {
-        MAPSComponent::FreeBuffers();
+        for (int i = 0; i < m_nbChannels; ++i)
+            m_channels.push_back(i);
     }
 }
 
-void MAPSOpenCV_SplitChannels::AllocateOutputBufferSize(const MAPSTimestamp, const MAPS::InputElt<IplImage> imageInElt)
+void MAPSOpenCV_SplitChannels::AllocateOutputs(const IplImage& imageIn)
 {
-    const IplImage& imageIn = imageInElt.Data();
-
-    if (imageIn.nChannels != 3)
+    if (imageIn.nChannels != m_nbChannels)
     {
-        Error("This component only supports 3 channels images.");
+        std::ostringstream ss;
+        ss << "The input image has " << imageIn.nChannels << " channels but the nb_channels property is set to " << m_nbChannels << ".";
+        Error(ss.str().c_str());
     }
 
     m_isInputPlanar = (imageIn.dataOrder == IPL_DATA_ORDER_PLANE);
-    IplImage model = MAPS::IplImageModel(imageIn.width, imageIn.height, MAPS_CHANNELSEQ_GRAY, imageIn.dataOrder, imageIn.depth, imageIn.align);
+    ResolveRoi(imageIn);
+    m_roiFullFrame = m_roi.size() == cv::Size(imageIn.width, imageIn.height);
+    const IplImage model = MAPS::IplImageModel(m_roi.width, m_roi.height, MAPS_CHANNELSEQ_GRAY, imageIn.dataOrder, imageIn.depth, imageIn.align);
+
+    // Planar inputs are viewed one plane at a time, the planes having the layout of a single channel image.
+    IplImage viewed = imageIn;
+    if (m_isInputPlanar)
+        viewed.nChannels = 1;
+    CreateViews(viewed, model);
+
+    // Host view of the packed rows of a GpuMat input, for the buffers readable from the host (see ProcessDataGpu())
+    if (m_gpuMatAsInput && !m_gpuMatAsOutput)
+    {
+        viewed.widthStep = viewed.width * ((viewed.depth & 0xFF) / 8) * viewed.nChannels;
+        m_hostInView = HostImageView(viewed, m_roi);
+    }
 
     if (m_gpuMatAsOutput)
     {
+        // One plane per output, the lambdas capture by value since they are kept by the parent class.
+        const int planeSize = m_roi.width * m_roi.height * ((imageIn.depth & 0xFF) / 8);
+        std::vector<OutputWrapper> outputs;
+        for (int i = 0; i < static_cast<int>(m_channels.size()); ++i)
+        {
+            outputs.push_back(DynamicOutput<MapsCudaStruct>(Output(i),
+                [this, planeSize, model] { return new MapsCudaStruct(planeSize, model, m_memoryMode); }  // struct allocation
+            ));
+        }
+
         try
         {
-            AllocateDynamicOutputBuffers(
-                DynamicOutput<MapsCudaStruct>(Output("o_gpu_channel1"),
-                    [&] { return new MapsCudaStruct(imageIn.width, imageIn.height, 1, model); }  // struct allocation
-                ),
-                DynamicOutput<MapsCudaStruct>(Output("o_gpu_channel2"),
-                    [&] { return new MapsCudaStruct(imageIn.width, imageIn.height, 1, model); }  // struct allocation
-                ),
-                DynamicOutput<MapsCudaStruct>(Output("o_gpu_channel3"),
-                    [&] { return new MapsCudaStruct(imageIn.width, imageIn.height, 1, model); }  // struct allocation
-                )
-            );
+            AllocateDynamicOutputBuffers(outputs.begin(), outputs.end());
         }
         catch (...)
         {
@@ -200,92 +287,180 @@ void MAPSOpenCV_SplitChannels::AllocateOutputBufferSize(const MAPSTimestamp, con
     }
     else
     {
-        Output("channel1").AllocOutputBufferIplImage(model);
-        Output("channel2").AllocOutputBufferIplImage(model);
-        Output("channel3").AllocOutputBufferIplImage(model);
+        for (int i = 0; i < static_cast<int>(m_channels.size()); ++i)
+        {
+            AllocateIplImageOutputBuffer(Output(i), model);
+        }
     }
 }
 
+void MAPSOpenCV_SplitChannels::AllocateOutputBufferSize(const MAPSTimestamp, const MAPS::InputElt<IplImage> imageInElt)
+{
+    AllocateOutputs(imageInElt.Data());
+}
+
 void MAPSOpenCV_SplitChannels::ProcessData(const MAPSTimestamp ts, const MAPS::InputElt<IplImage> inElt)
 {
     try
     {
+        if (DropInput(ts))
+            return;
+
         const IplImage& imageIn = inElt.Data();
-        const cv::Mat tempImageIn = convTools::noCopyIplImage2Mat(&imageIn); // Convert IplImage to cv::Mat without copying
-        MAPS::OutputGuard<> outGuard1{ this, Output(0) };
-        MAPS::OutputGuard<> outGuard2{ this, Output(1) };
-        MAPS::OutputGuard<> outGuard3{ this, Output(2) };
+        const int nbOutputs = static_cast<int>(m_channels.size());
+        std::array<std::unique_ptr<MAPS::OutputGuard<>>, 4> outGuards;
+        for (int i = 0; i < nbOutputs; ++i)
+        {
+            outGuards[i].reset(new MAPS::OutputGuard<>{ this, Output(i) });
+        }
 
         if (m_useCuda)
         {
-            cv::cuda::GpuMat src(tempImageIn);
-            if (m_gpuMatAsOutput)
+            if (m_isInputPlanar)
             {
-                std::vector<cv::cuda::GpuMat> mats;
-                cv::cuda::split(src, mats);
-
-                MapsCudaStruct& outputData1 = outGuard1.DataAs<MapsCudaStruct>();
-                MapsCudaStruct& outputData2 = outGuard2.DataAs<MapsCudaStruct>();
-                MapsCudaStruct& outputData3 = outGuard3.DataAs<MapsCudaStruct>();
-                const IplImage& proxy = outputData1.m_IplImageProxy;
-                cv::cuda::GpuMat dst1(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), outputData1.m_points);
-                cv::cuda::GpuMat dst2(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), outputData2.m_points);
-                cv::cuda::GpuMat dst3(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), outputData3.m_points);
-
-                mats[0].copyTo(dst1);
-                mats[1].copyTo(dst2);
-                mats[2].copyTo(dst3);
+                // Only the selected planes are uploaded, there is no need to deinterleave anything.
+                const int planeSize = imageIn.imageSize / m_nbChannels;
+                for (int channel : m_channels)
+                {
+                    m_tempGpuPlanes[channel].upload(m_hostInView(imageIn.imageData + channel * planeSize));
+                }
+
+                WriteGpuPlanes(outGuards);
             }
             else
             {
-                IplImage& imageOut1 = outGuard1.DataAs<IplImage>();
-                IplImage& imageOut2 = outGuard2.DataAs<IplImage>();
-                IplImage& imageOut3 = outGuard3.DataAs<IplImage>();
-                m_tempImageOut[0] = convTools::noCopyIplImage2Mat(&imageOut1);
-                m_tempImageOut[1] = convTools::noCopyIplImage2Mat(&imageOut2);
-                m_tempImageOut[2] = convTools::noCopyIplImage2Mat(&imageOut3);
-
-                std::vector<cv::cuda::GpuMat> mats;
-                cv::cuda::split(src, mats);
-                mats[0].download(m_tempImageOut[0]);
-                mats[1].download(m_tempImageOut[1]);
-                mats[2].download(m_tempImageOut[2]);
-
-                if (static_cast<void*>(m_tempImageOut[0].data) != static_cast<void*>(imageOut1.imageData) ||
-                    static_cast<void*>(m_tempImageOut[1].data) != static_cast<void*>(imageOut2.imageData) ||
-                    static_cast<void*>(m_tempImageOut[2].data) != static_cast<void*>(imageOut3.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
-                    Error("cv::Mat data ptr and imageOut data ptr are different.");
+                m_tempGpuIn.upload(m_hostInView(imageIn.imageData));
+                SplitGpu(m_tempGpuIn, outGuards);
             }
         }
         else
         {
-            IplImage& imageOut1 = outGuard1.DataAs<IplImage>();
-            IplImage& imageOut2 = outGuard2.DataAs<IplImage>();
-            IplImage& imageOut3 = outGuard3.DataAs<IplImage>();
+            SplitHost(imageIn, outGuards);
+        }
 
-            if (m_isInputPlanar)
+        for (int i = 0; i < nbOutputs; ++i)
+        {
+            outGuards[i]->Timestamp() = ts;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        Error(e.what());
+    }
+}
+
+// Splits the host image imageIn into the IplImage outputs, on the CPU
+void MAPSOpenCV_SplitChannels::SplitHost(const IplImage& imageIn, std::array<std::unique_ptr<MAPS::OutputGuard<>>, 4>& outGuards)
+{
+    const int nbOutputs = static_cast<int>(m_channels.size());
+    const int planeSize = imageIn.imageSize / m_nbChannels;
+    if (m_isInputPlanar && m_roiFullFrame && planeSize == outGuards[0]->DataAs<IplImage>().imageSize)
+    {
+        for (int i = 0; i < nbOutputs; ++i)
+        {
+            IplImage& imageOut = outGuards[i]->DataAs<IplImage>();
+            std::memcpy(imageOut.imageData, imageIn.imageData + m_channels[i] * planeSize, imageOut.imageSize);
+        }
+    }
+    else if (m_isInputPlanar)
+    {
+        for (int i = 0; i < nbOutputs; ++i)
+        {
+            IplImage& imageOut = outGuards[i]->DataAs<IplImage>();
+            m_tempImageOut[i] = m_hostOutView(imageOut.imageData);
+            m_hostInView(imageIn.imageData + m_channels[i] * planeSize).copyTo(m_tempImageOut[i]);
+
+            if (static_cast<void*>(m_tempImageOut[i].data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+                Error("cv::Mat data ptr and imageOut data ptr are different.");
+        }
+    }
+    else
+    {
+        const cv::Mat tempImageIn = m_hostInView(imageIn.imageData);
+        for (int i = 0; i < nbOutputs; ++i)
+        {
+            m_tempImageOut[i] = m_hostOutView(outGuards[i]->DataAs<IplImage>().imageData);
+        }
+
+        ChannelPlanes::Split(tempImageIn, m_tempImageOut.data(), m_channels);
+
+        for (int i = 0; i < nbOutputs; ++i)
+        {
+            if (static_cast<void*>(m_tempImageOut[i].data) != static_cast<void*>(outGuards[i]->DataAs<IplImage>().imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+                Error("cv::Mat data ptr and imageOut data ptr are different.");
+        }
+    }
+}
+
+void MAPSOpenCV_SplitChannels::AllocateOutputBufferSizeGpu(const MAPSTimestamp, const MAPS::InputElt<MapsCudaStruct> imageInElt)
+{
+    AllocateOutputs(imageInElt.Data().m_IplImageProxy);
+}
+
+void MAPSOpenCV_SplitChannels::ProcessDataGpu(const MAPSTimestamp ts, const MAPS::InputElt<MapsCudaStruct> inElt)
+{
+    try
+    {
+        if (DropInput(ts))
+            return;
+
+        const int nbOutputs = static_cast<int>(m_channels.size());
+        std::array<std::unique_ptr<MAPS::OutputGuard<>>, 4> outGuards;
+        for (int i = 0; i < nbOutputs; ++i)
+        {
+            outGuards[i].reset(new MAPS::OutputGuard<>{ this, Output(i) });
+        }
+
+        const IplImage& proxy = inElt.Data().m_IplImageProxy;
+
+        if (m_isInputPlanar && m_gpuMatAsOutput && m_roi.width == proxy.width && inElt.Data().CanShare())
+        {
+            // Zero copy: each output references its plane of the input buffer, which stays alive as long as the outputs do.
+            // A region of interest spanning whole rows is contiguous in the plane, so it can be referenced as well.
+            for (int i = 0; i < nbOutputs; ++i)
             {
-                std::memcpy(imageOut1.imageData, imageIn.imageData, imageOut1.imageSize);
-                std::memcpy(imageOut2.imageData, imageIn.imageData + imageOut2.imageSize, imageOut2.imageSize);
-                std::memcpy(imageOut3.imageData, imageIn.imageData + 2 * imageOut3.imageSize, imageOut3.imageSize);
+                ChannelPlanes::SharePlane(outGuards[i]->DataAs<MapsCudaStruct>(), inElt.Data(), m_channels[i], m_roi.y, m_roi.height);
             }
-            else
+        }
+        else if (m_gpuMatAsOutput)
+        {
+            // The selected channels are written straight into the output buffers
+            std::array<MapsCudaStruct*, 4> outs;
+            for (int i = 0; i < nbOutputs; ++i)
             {
-                m_tempImageOut[0] = convTools::noCopyIplImage2Mat(&imageOut1);
-                m_tempImageOut[1] = convTools::noCopyIplImage2Mat(&imageOut2);
-                m_tempImageOut[2] = convTools::noCopyIplImage2Mat(&imageOut3);
-                cv::split(tempImageIn, m_tempImageOut);
-
-                if (static_cast<void*>(m_tempImageOut[0].data) != static_cast<void*>(imageOut1.imageData) ||
-                    static_cast<void*>(m_tempImageOut[1].data) != static_cast<void*>(imageOut2.imageData) ||
-                    static_cast<void*>(m_tempImageOut[2].data) != static_cast<void*>(imageOut3.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
-                    Error("cv::Mat data ptr and imageOut data ptr are different.");
+                outs[i] = &outGuards[i]->DataAs<MapsCudaStruct>();
             }
+            ChannelPlanes::SplitImage(inElt.Data(), m_deviceInView, m_channels, outs.data(), m_deviceOutView, m_tempGpuPlanes.data());
         }
+        else if (inElt.Data().HostPointer() != nullptr)
+        {
+            // Input buffer in managed or mapped memory: the channels are split on the CPU, without any download.
+            SplitHost(inElt.Data().HostImage(), outGuards);
+        }
+        else if (m_isInputPlanar)
+        {
+            // The planes are already contiguous in device memory: wrap the selected ones instead of splitting.
+            for (int channel : m_channels)
+            {
+                m_tempGpuPlanes[channel] = ChannelPlanes::Plane(m_deviceInView, inElt.Data(), channel);
+            }
+
+            WriteGpuPlanes(outGuards);
 
-        outGuard1.Timestamp() = ts;
-        outGuard2.Timestamp() = ts;
-        outGuard3.Timestamp() = ts;
+            // Drop the views on the input buffer, it goes back to the upstream FIFO.
+            for (int channel : m_channels)
+                m_tempGpuPlanes[channel].release();
+        }
+        else
+        {
+            const cv::cuda::GpuMat src = m_deviceInView(inElt.Data().m_points);
+            SplitGpu(src, outGuards);
+        }
+
+        for (int i = 0; i < nbOutputs; ++i)
+        {
+            outGuards[i]->Timestamp() = ts;
+        }
     }
     catch (const std::exception& e)
     {
@@ -293,103 +468,63 @@ void MAPSOpenCV_SplitChannels::ProcessData(const MAPSTimestamp ts, const MAPS::I
     }
 }
 
-void MAPSOpenCV_SplitChannels::AllocateOutputBufferSizeGpu(const MAPSTimestamp, const MAPS::InputElt<MapsCudaStruct> imageInElt)
+void MAPSOpenCV_SplitChannels::SplitGpu(const cv::cuda::GpuMat& src, std::array<std::unique_ptr<MAPS::OutputGuard<>>, 4>& outGuards)
 {
-    const MapsCudaStruct& imageIn = imageInElt.Data();
+    const int nbOutputs = static_cast<int>(m_channels.size());
 
-    if (imageIn.m_IplImageProxy.nChannels != 3)
+    // Destination of each selected plane: straight into the GpuMat outputs, or into persistent scratch buffers
+    // to be downloaded. They are created beforehand so that OpenCV does not allocate them in the headers below.
+    std::array<cv::cuda::GpuMat, 4> dsts;
+    for (int i = 0; i < nbOutputs; ++i)
     {
-        Error("This component only supports 3 channels images.");
+        if (m_gpuMatAsOutput)
+        {
+            MapsCudaStruct& outputData = outGuards[i]->DataAs<MapsCudaStruct>().Writable();
+            dsts[i] = m_deviceOutView(outputData.m_points);
+        }
+        else
+        {
+            m_tempGpuPlanes[m_channels[i]].create(src.size(), src.depth());
+            dsts[i] = m_tempGpuPlanes[m_channels[i]];
+        }
     }
 
-    const IplImage& proxy = imageIn.m_IplImageProxy;
-    m_isInputPlanar = (proxy.dataOrder == IPL_DATA_ORDER_PLANE);
-    IplImage model = MAPS::IplImageModel(proxy.width, proxy.height, MAPS_CHANNELSEQ_GRAY, proxy.dataOrder, proxy.depth, proxy.align);
-
-    int type = CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels);
+    // The channels that are not selected go to their own m_tempGpuPlanes
+    ChannelPlanes::Split(src, dsts.data(), m_channels, m_tempGpuPlanes.data());
 
     if (m_gpuMatAsOutput)
     {
-        try
-        {
-            AllocateDynamicOutputBuffers(
-                DynamicOutput<MapsCudaStruct>(Output("o_gpu_channel1"),
-                    [&] { return new MapsCudaStruct(proxy.width, proxy.height, 1, model); }
-                ),
-                DynamicOutput<MapsCudaStruct>(Output("o_gpu_channel2"),
-                    [&] { return new MapsCudaStruct(proxy.width, proxy.height, 1, model); }
-                ),
-                DynamicOutput<MapsCudaStruct>(Output("o_gpu_channel3"),
-                    [&] { return new MapsCudaStruct(proxy.width, proxy.height, 1, model); }
-                )
-            );
-        }
-        catch (...)
+        for (int i = 0; i < nbOutputs; ++i)
         {
-            Error("Failed to allocate the dynamic output buffers");
+            if (dsts[i].data != outGuards[i]->DataAs<MapsCudaStruct>().m_points) // if the ptr are different then opencv reallocated memory for the cv::cuda::GpuMat
+                Error("cv::cuda::GpuMat data ptr and output data ptr are different.");
         }
     }
     else
     {
-        Output("channel1").AllocOutputBufferIplImage(model);
-        Output("channel2").AllocOutputBufferIplImage(model);
-        Output("channel3").AllocOutputBufferIplImage(model);
+        WriteGpuPlanes(outGuards);
     }
 }
 
-void MAPSOpenCV_SplitChannels::ProcessDataGpu(const MAPSTimestamp ts, const MAPS::InputElt<MapsCudaStruct> inElt)
+void MAPSOpenCV_SplitChannels::WriteGpuPlanes(std::array<std::unique_ptr<MAPS::OutputGuard<>>, 4>& outGuards)
 {
-    try
+    for (int i = 0; i < static_cast<int>(m_channels.size()); ++i)
     {
-        MAPS::OutputGuard<> outGuard1{ this, Output(0) };
-        MAPS::OutputGuard<> outGuard2{ this, Output(1) };
-        MAPS::OutputGuard<> outGuard3{ this, Output(2) };
-
-        const IplImage& proxy = inElt.Data().m_IplImageProxy;
-        const cv::cuda::GpuMat src(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), inElt.Data().m_points);
-
+        const cv::cuda::GpuMat& plane = m_tempGpuPlanes[m_channels[i]];
         if (m_gpuMatAsOutput)
         {
-            std::vector<cv::cuda::GpuMat> mats;
-            cv::cuda::split(src, mats);
-
-            MapsCudaStruct& outputData = outGuard1.DataAs<MapsCudaStruct>();
-            const IplImage& proxyDst = outputData.m_IplImageProxy;
-            cv::cuda::GpuMat dst1(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
-            cv::cuda::GpuMat dst2(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
-            cv::cuda::GpuMat dst3(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
-
-            mats[0].copyTo(dst1);
-            mats[1].copyTo(dst2);
-            mats[2].copyTo(dst2);
+            MapsCudaStruct& outputData = outGuards[i]->DataAs<MapsCudaStruct>().Writable();
+            cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
+            plane.copyTo(dst);
         }
         else
         {
-            IplImage& imageOut1 = outGuard1.DataAs<IplImage>();
-            IplImage& imageOut2 = outGuard2.DataAs<IplImage>();
-            IplImage& imageOut3 = outGuard3.DataAs<IplImage>();
-            m_tempImageOut[0] = convTools::noCopyIplImage2Mat(&imageOut1);
-            m_tempImageOut[1] = convTools::noCopyIplImage2Mat(&imageOut2);
-            m_tempImageOut[2] = convTools::noCopyIplImage2Mat(&imageOut3);
-
-            std::vector<cv::cuda::GpuMat> mats;
-            cv::cuda::split(src, mats);
-            mats[0].download(m_tempImageOut[0]);
-            mats[1].download(m_tempImageOut[1]);
-            mats[2].download(m_tempImageOut[2]);
-
-            if (static_cast<void*>(m_tempImageOut[0].data) != static_cast<void*>(imageOut1.imageData) ||
-                static_cast<void*>(m_tempImageOut[1].data) != static_cast<void*>(imageOut2.imageData) ||
-                static_cast<void*>(m_tempImageOut[2].data) != static_cast<void*>(imageOut3.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+            IplImage& imageOut = outGuards[i]->DataAs<IplImage>();
+            m_tempImageOut[i] = m_hostOutView(imageOut.imageData);
+            plane.download(m_tempImageOut[i]);
+
+            if (static_cast<void*>(m_tempImageOut[i].data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
                 Error("cv::Mat data ptr and imageOut data ptr are different.");
         }
-
-        outGuard1.Timestamp() = ts;
-        outGuard2.Timestamp() = ts;
-        outGuard3.Timestamp() = ts;
-    }
-    catch (const std::exception& e)
-    {
-        Error(e.what());
     }
 }
@@ -22,7 +22,9 @@
 ////////////////////////////////
 
 ////////////////////////////////
-// Purpose of this module : This component applies a gain on each channel separately to correct colors.
+// Purpose of this module : This component applies a gain on each channel separately to correct colors,
+//                          or a full 3x3 color correction matrix with offsets, followed by an optional tone curve.
+//                          The gains can also be estimated automatically (auto white balance).
 ////////////////////////////////
 
 #include "maps_OpenCV_ColorCorrection.h"	// Includes the header of this component
@@ -31,6 +33,11 @@
 #include <opencv2/cudawarping.hpp>
 #include "opencv2/cudaarithm.hpp"
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <sstream>
+
 // Use the macros to declare the inputs
 MAPS_BEGIN_INPUTS_DEFINITION(MAPSColorCorrection)
 MAPS_INPUT("imageIn", MAPS::FilterIplImage, MAPS::FifoReader)
@@ -41,6 +48,8 @@ MAPS_END_INPUTS_DEFINITION
 MAPS_BEGIN_OUTPUTS_DEFINITION(MAPSColorCorrection)
 MAPS_OUTPUT("imageOut", MAPS::IplImage, nullptr, nullptr, 0)
 MAPS_OUTPUT_USER_DYNAMIC_STRUCTURE("o_gpu", MapsCudaStruct)
+MAPS_OUTPUT("awb_gains", MAPS::Float64, nullptr, nullptr, 3)
+MAPS_OUTPUT("input_stats", MAPS::Float64, nullptr, nullptr, 2)
 MAPS_END_OUTPUTS_DEFINITION
 
 // Use the macros to declare the properties
@@ -49,25 +58,145 @@ MAPS_BEGIN_PROPERTIES_DEFINITION(MAPSColorCorrection)
     MAPS_PROPERTY("green", 1.0, false, true)
     MAPS_PROPERTY("blue", 1.0, false, true)
     MAPS_PROPERTY("use_cuda", false, false, false)
+    MAPS_PROPERTY_ENUM("correction_mode", "Gains|Matrix", 0, false, false)
+    MAPS_PROPERTY_ENUM("tone_curve", "None|Gamma|sRGB|Table", 0, false, false)
+    MAPS_PROPERTY_ENUM("auto_white_balance", "Off|Gray world|White patch|Percentile", 0, false, false)
     MAPS_PROPERTY("gpu_mat_as_input", false, false, false)
     MAPS_PROPERTY("gpu_mat_as_output", false, false, false)
+    MAPS_PROPERTY("matrix", "1 0 0 0 1 0 0 0 1", false, true)
+    MAPS_PROPERTY("offsets", "0 0 0", false, true)
+    MAPS_PROPERTY("gamma", 2.2, false, true)
+    MAPS_PROPERTY("tone_table", "", false, true)
+    MAPS_PROPERTY("awb_stride", 8, false, false)
+    MAPS_PROPERTY("awb_smoothing", 0.9, false, false)
+    MAPS_PROPERTY("awb_percentile", 99.0, false, false)
+    MAPS_PROPERTY("roi_x", 0, false, false)
+    MAPS_PROPERTY("roi_y", 0, false, false)
+    MAPS_PROPERTY("roi_width", 0, false, false)
+    MAPS_PROPERTY("roi_height", 0, false, false)
+    MAPS_PROPERTY_ENUM("input_policy", "FIFO|Latest only|Drop every N", 0, false, false)
+    MAPS_PROPERTY("drop_interval", 2, false, false)
+    MAPS_PROPERTY("fifo_depth", 0, false, false)
+    MAPS_PROPERTY("memory_budget", 0, false, false)
+    MAPS_PROPERTY("lazy_allocation", false, false, false)
+    MAPS_PROPERTY("prewarm_buffers", 2, false, false)
+    MAPS_PROPERTY_ENUM("memory_mode", "Device|Managed|Mapped", 0, false, false)
 MAPS_END_PROPERTIES_DEFINITION
 
 // Use the macros to declare the actions
 MAPS_BEGIN_ACTIONS_DEFINITION(MAPSColorCorrection)
 MAPS_END_ACTIONS_DEFINITION
 
+//Version 1.3: added the "Matrix" correction mode (3x3 color correction matrix + offsets).
+//Version 1.4: added the tone curve (gamma, sRGB or user table), applied in the same pass as the correction.
+//Version 1.5: added the auto white balance.
+//Version 1.6: added the "in_place" property (GpuMat input and output only), removed since: the other readers of the input could not be detected.
+//Version 1.7: added the roi_x, roi_y, roi_width and roi_height properties, only the region of interest is corrected.
+//Version 1.8: added the input_policy and drop_interval properties and the input_stats output.
+//Version 1.9: added the fifo_depth and memory_budget properties (GpuMat output only).
+//Version 1.10: lazy_allocation and prewarm_buffers properties, the device memory of the GpuMat output buffers is allocated on their first use.
+//Version 1.11: memory_mode property, the GpuMat output buffers can be allocated in managed or mapped host memory, readable from the host without download.
+
 // Use the macros to declare this component behaviour
-MAPS_COMPONENT_DEFINITION(MAPSColorCorrection,"OpenCV_ColorCorrection_cuda", "1.2.1", 128,
+MAPS_COMPONENT_DEFINITION(MAPSColorCorrection,"OpenCV_ColorCorrection_cuda", "1.11.0", 128,
                             MAPS::Threaded|MAPS::Sequential, MAPS::Sequential,
                             0, // Nb of inputs
                             0, // Nb of outputs
-                            4, // Nb of properties
+                            7, // Nb of properties
                             -1) // Nb of actions
 
+namespace
+{
+    // Relative change of an auto white balance gain below which the coefficients are not updated
+    constexpr double kAwbUpdateThreshold = 0.002;
+
+    // Parses a list of numbers separated by spaces, commas or semicolons.
+    bool ParseValues(const std::string& str, std::vector<double>& values)
+    {
+        std::string cleaned(str);
+        for (char& c : cleaned)
+        {
+            if (c == ',' || c == ';')
+                c = ' ';
+        }
+
+        values.clear();
+        std::istringstream iss(cleaned);
+        double value;
+        while (iss >> value)
+            values.push_back(value);
+
+        return iss.eof();
+    }
+
+    bool ParseCoefficients(const std::string& str, double* values, size_t count)
+    {
+        std::vector<double> parsed;
+        if (!ParseValues(str, parsed) || parsed.size() != count)
+            return false;
+
+        std::copy(parsed.begin(), parsed.end(), values);
+        return true;
+    }
+
+    // Evaluates the tone curve on x in [0, 1]. The result is in [0, 1].
+    double EvalToneCurve(const MAPSColorCorrection::CorrectionParams& params, double x)
+    {
+        x = std::min(std::max(x, 0.0), 1.0);
+
+        switch (params.toneCurve)
+        {
+        case MAPSColorCorrection::ToneCurve_Gamma:
+            return std::pow(x, 1.0 / params.gamma);
+        case MAPSColorCorrection::ToneCurve_sRGB:
+            return x <= 0.0031308 ? 12.92 * x : 1.055 * std::pow(x, 1.0 / 2.4) - 0.055;
+        case MAPSColorCorrection::ToneCurve_Table:
+        {
+            // Linear interpolation between the entries of the table
+            const double pos = x * (params.toneTable.size() - 1);
+            const size_t i = std::min(static_cast<size_t>(pos), params.toneTable.size() - 2);
+            const double t = pos - i;
+            return params.toneTable[i] * (1.0 - t) + params.toneTable[i + 1] * t;
+        }
+        default:
+            return x;
+        }
+    }
+
+    // Accumulates the statistics of the rows of the image that are multiple of stride (firstRow is the index
+    // of the first row of the stripe in the image), one pixel every stride.
+    template <typename T>
+    void AccumulateRows(const cv::Mat& rows, int firstRow, int stride, int shift, MAPSColorCorrection::AwbStats& stats)
+    {
+        const int cn = rows.channels();
+        const int nbColors = std::min(cn, 3);
+        const int step = cn * stride;
+
+        for (int y = (stride - firstRow % stride) % stride; y < rows.rows; y += stride)
+        {
+            const T* row = rows.ptr<T>(y);
+            const T* end = row + rows.cols * cn;
+            for (const T* pix = row; pix < end; pix += step)
+            {
+                for (int c = 0; c < nbColors; ++c)
+                {
+                    const T value = pix[c];
+                    stats.sum[c] += value;
+                    stats.max[c] = std::max(stats.max[c], static_cast<double>(value));
+                    ++stats.hist[c][value >> shift];
+                }
+            }
+            stats.count += (rows.cols + stride - 1) / stride;
+        }
+    }
+}
 
 void MAPSColorCorrection::Birth()
 {
+    ApplyGpuOutputProperties();
+
+    ApplyInputPolicyProperties();
+
     if (m_useCuda && m_gpuMatAsInput)
     {
         m_inputReader = MAPS::MakeInputReader::Reactive(
@@ -90,6 +219,26 @@ void MAPSColorCorrection::Birth()
     m_dRed = GetFloatProperty("red");
     m_dGreen = GetFloatProperty("green");
     m_dBlue = GetFloatProperty("blue");
+    m_dGamma = m_toneCurve == ToneCurve_Gamma ? GetFloatProperty("gamma") : 2.2;
+
+    if (m_awbMode != AWB_Off)
+    {
+        m_awbStride = static_cast<int>(GetIntegerProperty("awb_stride"));
+        m_awbSmoothing = GetFloatProperty("awb_smoothing");
+        m_awbPercentile = m_awbMode == AWB_Percentile ? GetFloatProperty("awb_percentile") : 99.0;
+        if (m_awbStride < 1)
+            Error("awb_stride property : the value must be at least 1.");
+        if (m_awbSmoothing < 0.0 || m_awbSmoothing >= 1.0)
+            Error("awb_smoothing property : the value must be in [0, 1[.");
+        if (m_awbPercentile <= 0.0 || m_awbPercentile > 100.0)
+            Error("awb_percentile property : the value must be in ]0, 100].");
+    }
+    m_awbGains = cv::Vec3d(1.0, 1.0, 1.0);
+    m_awbAppliedGains = m_awbGains;
+    m_awbInitialized = false;
+    m_awbUpdated = false;
+    m_appliedVersion = -1;
+    UpdateParams(false);
 }
 
 void MAPSColorCorrection::Core()
@@ -100,6 +249,20 @@ void MAPSColorCorrection::Core()
 void MAPSColorCorrection::Death()
 {
     m_inputReader.reset();
+
+    if (m_inputPolicy.Enabled())
+        ReportInfo(m_inputPolicy.Report().c_str());
+
+    m_transform.release();
+    m_gpuOutPlanes.clear();
+    m_gpuPartial.release();
+    m_lut.release();
+    m_lut16.clear();
+    m_gpuLut.release();
+    for (auto& lut : m_gpuPlaneLuts)
+        lut.release();
+    m_gpuPlanes.clear();
+    m_awbSampler.Release();
 }
 
 void MAPSColorCorrection::Dynamic()
@@ -108,6 +271,33 @@ void MAPSColorCorrection::Dynamic()
     m_gpuMatAsInput = false;
     m_gpuMatAsOutput = false;
 
+    NewProperty("roi_x");
+    NewProperty("roi_y");
+    NewProperty("roi_width");
+    NewProperty("roi_height");
+
+    m_useMatrix = GetIntegerProperty("correction_mode") == 1;
+    if (m_useMatrix)
+    {
+        NewProperty("matrix");
+        NewProperty("offsets");
+    }
+
+    m_toneCurve = static_cast<int>(GetIntegerProperty("tone_curve"));
+    if (m_toneCurve == ToneCurve_Gamma)
+        NewProperty("gamma");
+    else if (m_toneCurve == ToneCurve_Table)
+        NewProperty("tone_table");
+
+    m_awbMode = static_cast<int>(GetIntegerProperty("auto_white_balance"));
+    if (m_awbMode != AWB_Off)
+    {
+        NewProperty("awb_stride");
+        NewProperty("awb_smoothing");
+        if (m_awbMode == AWB_Percentile)
+            NewProperty("awb_percentile");
+    }
+
     if (cv::cuda::getCudaEnabledDeviceCount() > 0)
     {
         Property("use_cuda").SetMutable(true);
@@ -148,18 +338,12 @@ void MAPSColorCorrection::Dynamic()
         NewInput("imageIn");
         NewOutput("imageOut");
     }
-}
 
-void MAPSColorCorrection::FreeBuffers()
-{
-    if (m_useCuda && m_gpuMatAsOutput)
-    {
-        MAPS_DynamicCustomStructComponent::FreeBuffers();
-    }
-    else
-    {
-        MAPSComponent::FreeBuffers();
-    }
+    if (m_awbMode != AWB_Off)
+        NewOutput("awb_gains");
+
+    NewInputPolicyProperties();
+    NewGpuOutputProperties("o_gpu");
 }
 
 void MAPSColorCorrection::Set(MAPSProperty &p, MAPSFloat64 value)
@@ -171,24 +355,265 @@ void MAPSColorCorrection::Set(MAPSProperty &p, MAPSFloat64 value)
         m_dGreen = value;
     else if (p.ShortName() == "blue")
         m_dBlue = value;
+    else if (p.ShortName() == "gamma")
+        m_dGamma = value;
+    else
+        return;
+
+    if (IsRunning())
+        UpdateParams(true);
 }
 
-void MAPSColorCorrection::AllocateOutputBufferSize(const MAPSTimestamp, const MAPS::InputElt<IplImage> imageInElt)
+void MAPSColorCorrection::Set(MAPSProperty& p, const MAPSString& value)
 {
-    const IplImage& imageIn = imageInElt.Data();
-    const MAPSInt32 chanSeq = *(MAPSInt32*)imageIn.channelSeq;
+    MAPSComponent::Set(p, value);
+    if ((p.ShortName() == "matrix" || p.ShortName() == "offsets" || p.ShortName() == "tone_table") && IsRunning())
+        UpdateParams(true);
+}
+
+// Builds a new set of coefficients from the properties and publishes it for the processing thread.
+// The processing thread takes it into account at the beginning of the next frame, so that a frame is never
+// processed with a mix of old and new coefficients.
+void MAPSColorCorrection::UpdateParams(bool reportOnly)
+{
+    CorrectionParams params;
+    params.gains = cv::Vec3d(m_dRed, m_dGreen, m_dBlue);
+
+    if (m_useMatrix)
+    {
+        double matrix[9];
+        double offsets[3];
+        if (!ParseCoefficients((const char*)GetStringProperty("matrix"), matrix, 9))
+        {
+            if (reportOnly)
+            {
+                ReportError("matrix property : 9 coefficients are expected (row major, RGB order). The previous matrix is kept.");
+                return;
+            }
+            Error("matrix property : 9 coefficients are expected (row major, RGB order).");
+        }
+        if (!ParseCoefficients((const char*)GetStringProperty("offsets"), offsets, 3))
+        {
+            if (reportOnly)
+            {
+                ReportError("offsets property : 3 values are expected (RGB order). The previous offsets are kept.");
+                return;
+            }
+            Error("offsets property : 3 values are expected (RGB order).");
+        }
+
+        params.matrix = cv::Matx33d(matrix);
+        params.offsets = cv::Vec3d(offsets);
+    }
+
+    params.toneCurve = m_toneCurve;
+    if (m_toneCurve == ToneCurve_Gamma)
+    {
+        if (m_dGamma <= 0.0)
+        {
+            if (reportOnly)
+            {
+                ReportError("gamma property : the value must be strictly positive. The previous value is kept.");
+                return;
+            }
+            Error("gamma property : the value must be strictly positive.");
+        }
+        params.gamma = m_dGamma;
+    }
+    else if (m_toneCurve == ToneCurve_Table)
+    {
+        std::vector<double>& table = params.toneTable;
+        bool valid = ParseValues((const char*)GetStringProperty("tone_table"), table) && (table.size() == 256 || table.size() == 4096);
+        for (size_t i = 0; valid && i < table.size(); ++i)
+            valid = table[i] >= 0.0 && table[i] <= 1.0;
+
+        if (!valid)
+        {
+            if (reportOnly)
+            {
+                ReportError("tone_table property : 256 or 4096 values between 0 and 1 are expected. The previous table is kept.");
+                return;
+            }
+            Error("tone_table property : 256 or 4096 values between 0 and 1 are expected.");
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_paramsMutex);
+    m_pendingParams = params;
+    ++m_pendingVersion;
+}
+
+// Takes the latest coefficients published by UpdateParams() and rebuilds what derives from them.
+// Only called from the processing thread. When only the auto white balance gains changed, only the gain-dependent
+// coefficients are updated : the tone curve tables do not depend on them.
+void MAPSColorCorrection::SnapshotParams()
+{
+    const int version = m_pendingVersion.load();
+    const bool paramsChanged = version != m_appliedVersion;
+    if (!paramsChanged && !m_awbUpdated)
+        return;
+
+    if (paramsChanged)
+    {
+        std::lock_guard<std::mutex> lock(m_paramsMutex);
+        m_params = m_pendingParams;
+        m_appliedVersion = m_pendingVersion.load();
+    }
+    if (m_awbUpdated)
+    {
+        m_awbAppliedGains = m_awbGains;
+        m_awbUpdated = false;
+    }
+
+    // Index of R, G and B in the images
+    const int idx[3] = { m_isBGR ? 2 : 0, 1, m_isBGR ? 0 : 2 };
+
+    UpdateGains(idx);
+
+    // The gains are only folded into the tables when the auto white balance is off, i.e. when they change with the properties
+    if (m_toneCurve != ToneCurve_None && paramsChanged)
+        BuildToneLuts(idx);
+}
+
+// Updates the coefficients that depend on the gains, in place.
+void MAPSColorCorrection::UpdateGains(const int idx[3])
+{
+    // The gains estimated by the auto white balance (unity when disabled) are applied on top of the user gains
+    const cv::Vec3d gains = m_params.gains.mul(m_awbAppliedGains);
+
+    m_gainsScalar = cv::Scalar::all(1.0);
+    for (int i = 0; i < 3; ++i)
+        m_gainsScalar[idx[i]] = gains[i];
+
+    if (m_useMatrix)
+    {
+        const int cn = m_nChannels;
+
+        // m_transform maps [c0, c1, c2, (c3), 1] to [c0, c1, c2, (c3)] : gains are folded into the matrix
+        // and the alpha channel (if any) is left untouched.
+        m_transform.create(cn, cn + 1, CV_32F);
+        m_transform.setTo(cv::Scalar::all(0.0));
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+                m_transform.at<float>(idx[i], idx[j]) = static_cast<float>(m_params.matrix(i, j) * gains[j]);
+            m_transform.at<float>(idx[i], cn) = static_cast<float>(m_params.offsets[i]);
+        }
+        if (cn == 4)
+            m_transform.at<float>(3, 3) = 1.0f;
+
+        if (m_useCuda)
+        {
+            // Partial sums of CorrectGpu() : 16S for 8 bits images, scaled up as much as the largest one allows
+            // to keep the fractional bits, 32F otherwise.
+            m_gpuPartialDepth = m_depth == IPL_DEPTH_8U ? CV_16S : CV_32F;
+            m_gpuPartialScale = 1.0;
+            if (m_gpuPartialDepth == CV_16S)
+            {
+                double maxPartial = 1.0;
+                for (int i = 0; i < 3; ++i)
+                {
+                    const float* row = m_transform.ptr<float>(i);
+                    maxPartial = std::max(maxPartial, (std::abs(row[0]) + std::abs(row[1])) * 255.0 + std::abs(row[cn]));
+                }
+                while (maxPartial * m_gpuPartialScale > SHRT_MAX)
+                    m_gpuPartialScale /= 2.0;
+                while (maxPartial * m_gpuPartialScale * 2.0 <= SHRT_MAX && m_gpuPartialScale < 128.0)
+                    m_gpuPartialScale *= 2.0;
+            }
+        }
+    }
+}
+
+// Precomputes the tone curve into lookup tables, so that applying it costs one lookup per channel.
+// For 8 bits images in "Gains" mode without auto white balance, the gains are folded into the table as well :
+// the whole correction is then a single LUT.
+void MAPSColorCorrection::BuildToneLuts(const int idx[3])
+{
+    const int cn = m_nChannels;
+
+    if (m_depth == IPL_DEPTH_8U)
+    {
+        m_lut.create(1, 256, CV_8UC(cn));
+        for (int c = 0; c < cn; ++c)
+        {
+            const double gain = (!GainsInLut() || c == 3) ? 1.0 : m_gainsScalar[c];
+            for (int v = 0; v < 256; ++v)
+            {
+                const double value = c == 3 ? v : 255.0 * EvalToneCurve(m_params, gain * v / 255.0); // Alpha is left untouched
+                m_lut.ptr<uchar>()[v * cn + c] = cv::saturate_cast<uchar>(value);
+            }
+        }
+
+        if (m_useCuda)
+        {
+            // cv::cuda::LookUpTable only handles 1 or 3 channels tables : 4 channels images are processed plane by plane
+            if (cn == 3)
+            {
+                m_gpuLut = cv::cuda::createLookUpTable(m_lut);
+            }
+            else
+            {
+                std::vector<cv::Mat> planeLuts;
+                cv::split(m_lut, planeLuts);
+                for (int i = 0; i < 3; ++i)
+                    m_gpuPlaneLuts[idx[i]] = cv::cuda::createLookUpTable(planeLuts[idx[i]]);
+            }
+        }
+    }
+    else if (m_depth == IPL_DEPTH_16U)
+    {
+        m_lut16.resize(65536);
+        for (int v = 0; v < 65536; ++v)
+            m_lut16[v] = cv::saturate_cast<ushort>(65535.0 * EvalToneCurve(m_params, v / 65535.0));
+    }
+}
+
+void MAPSColorCorrection::CheckInputImage(const IplImage& image)
+{
+    const MAPSInt32 chanSeq = *(MAPSInt32*)image.channelSeq;
+    const int nChannels = image.nChannels;
 
     if (chanSeq != MAPS_CHANNELSEQ_BGR && chanSeq != MAPS_CHANNELSEQ_BGRA && chanSeq != MAPS_CHANNELSEQ_RGB &&
         chanSeq != MAPS_CHANNELSEQ_RGBA)
         Error("This component only accepts RGB/BGR/RGBA/BGRA images on its input.");
 
+    if (nChannels != 3 && nChannels != 4)
+        Error("This component only accepts 3 or 4 channels images on its input.");
+
+    m_isBGR = (chanSeq == MAPS_CHANNELSEQ_BGR || chanSeq == MAPS_CHANNELSEQ_BGRA);
+    m_nChannels = nChannels;
+    m_depth = image.depth;
+
+    if (m_toneCurve != ToneCurve_None)
+    {
+        if (m_depth != IPL_DEPTH_8U && m_depth != IPL_DEPTH_16U)
+            Error("The tone curve is only available for 8 or 16 bits unsigned images.");
+        if (m_useCuda && m_depth != IPL_DEPTH_8U)
+            Error("With CUDA, the tone curve is only available for 8 bits images.");
+    }
+
+    if (m_awbMode != AWB_Off && m_depth != IPL_DEPTH_8U && m_depth != IPL_DEPTH_16U)
+        Error("The auto white balance is only available for 8 or 16 bits unsigned images.");
+    m_appliedVersion = -1; // The channel order is known now : rebuild the coefficients
+}
+
+void MAPSColorCorrection::AllocateOutputBufferSize(const MAPSTimestamp, const MAPS::InputElt<IplImage> imageInElt)
+{
+    const IplImage& imageIn = imageInElt.Data();
+
+    CheckInputImage(imageIn);
+    ResolveRoi(imageIn);
+    IplImage model = MAPS::IplImageModel(m_roi.width, m_roi.height, imageIn.channelSeq, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
+    CreateViews(imageIn, model);
+
     if (m_gpuMatAsOutput)
     {
         try
         {
             AllocateDynamicOutputBuffers(
                 DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(imageIn.width, imageIn.height, imageIn.nChannels, imageIn); }  // struct allocation
+                    [&] { return new MapsCudaStruct(model.width, model.height, model.nChannels, model, m_memoryMode); }  // struct allocation
                 )
             );
         }
@@ -199,7 +624,7 @@ void MAPSColorCorrection::AllocateOutputBufferSize(const MAPSTimestamp, const MA
     }
     else
     {
-        Output(0).AllocOutputBufferIplImage(imageIn);
+        AllocateIplImageOutputBuffer(Output(0), model);
     }
 }
 
@@ -207,19 +632,21 @@ void MAPSColorCorrection::AllocateOutputBufferSizeGpu(const MAPSTimestamp, const
 {
     const MapsCudaStruct& imageIn = imageInElt.Data();
 
-    const MAPSInt32 chanSeq = *(MAPSInt32*)imageIn.m_IplImageProxy.channelSeq;
-
-    if (chanSeq != MAPS_CHANNELSEQ_BGR && chanSeq != MAPS_CHANNELSEQ_BGRA && chanSeq != MAPS_CHANNELSEQ_RGB &&
-        chanSeq != MAPS_CHANNELSEQ_RGBA)
-        Error("This component only accepts RGB/BGR/RGBA/BGRA images on its input.");
+    CheckInputImage(imageIn.m_IplImageProxy);
+    ResolveRoi(imageIn.m_IplImageProxy);
+    IplImage model = MAPS::IplImageModel(m_roi.width, m_roi.height, imageIn.m_IplImageProxy.channelSeq, IPL_DATA_ORDER_PIXEL,
+        imageIn.m_IplImageProxy.depth, imageIn.m_IplImageProxy.align);
+    CreateViews(imageIn.m_IplImageProxy, model);
 
     if (m_gpuMatAsOutput)
     {
+        // Without ROI the output buffers have the same layout as the input ones
+        const bool fullFrame = m_roi.size() == cv::Size(imageIn.m_IplImageProxy.width, imageIn.m_IplImageProxy.height);
         try
         {
             AllocateDynamicOutputBuffers(
                 DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(imageIn); }
+                    [&] { return fullFrame ? new MapsCudaStruct(imageIn.m_size, imageIn.m_IplImageProxy, m_memoryMode) : new MapsCudaStruct(model.width, model.height, model.nChannels, model, m_memoryMode); }
                 )
             );
         }
@@ -230,9 +657,7 @@ void MAPSColorCorrection::AllocateOutputBufferSizeGpu(const MAPSTimestamp, const
     }
     else
     {
-        IplImage model = MAPS::IplImageModel(imageIn.m_IplImageProxy.width, imageIn.m_IplImageProxy.height, imageIn.m_IplImageProxy.channelSeq, IPL_DATA_ORDER_PIXEL,
-            imageIn.m_IplImageProxy.depth, imageIn.m_IplImageProxy.align);
-        Output(0).AllocOutputBufferIplImage(model);
+        AllocateIplImageOutputBuffer(Output(0), model);
     }
 }
 
@@ -240,49 +665,34 @@ void MAPSColorCorrection::ProcessData(const MAPSTimestamp ts, const MAPS::InputE
 {
     try
     {
+        if (DropInput(ts))
+            return;
+
         const IplImage& imageIn = inElt.Data();
-        m_tempImageIn = convTools::noCopyIplImage2Mat(&imageIn); // Convert IplImage to cv::Mat without copying
+        m_tempImageIn = m_hostInView(imageIn.imageData);
         MAPS::OutputGuard<> outGuard{ this, Output(0) };
-        const MAPSInt32 chanSeq = *(MAPSInt32*)imageIn.channelSeq;
+
+        CollectAwbSample();
+        SnapshotParams();
 
         if (m_useCuda)
         {
             cv::cuda::GpuMat src(m_tempImageIn);
-            std::vector<cv::cuda::GpuMat> vTmpSplit;
 
             if (m_gpuMatAsOutput)
             {
-                MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-                const IplImage& proxy = outputData.m_IplImageProxy;
-                cv::cuda::GpuMat dst(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), outputData.m_points);
+                MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+                cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
 
-                if (chanSeq == MAPS_CHANNELSEQ_BGR || chanSeq == MAPS_CHANNELSEQ_BGRA)
-                {
-                    cv::Scalar coefficients(m_dBlue, m_dGreen, m_dRed);
-                    cv::cuda::multiply(src, coefficients, dst);
-                }
-                else
-                {
-                    cv::Scalar coefficients(m_dRed, m_dGreen, m_dBlue);
-                    cv::cuda::multiply(src, coefficients, dst);
-                }
+                CorrectGpu(src, dst);
             }
             else
             {
                 cv::cuda::GpuMat dst;
                 const IplImage& imageOut = outGuard.DataAs<IplImage>();
-                m_tempImageOut = convTools::noCopyIplImage2Mat(&imageOut); // Convert IplImage to cv::Mat without copying
+                m_tempImageOut = m_hostOutView(imageOut.imageData);
 
-                if (chanSeq == MAPS_CHANNELSEQ_BGR || chanSeq == MAPS_CHANNELSEQ_BGRA)
-                {
-                    cv::Scalar coefficients(m_dBlue, m_dGreen, m_dRed);
-                    cv::cuda::multiply(src, coefficients, dst);
-                }
-                else
-                {
-                    cv::Scalar coefficients(m_dRed, m_dGreen, m_dBlue);
-                    cv::cuda::multiply(src, coefficients, dst);
-                }
+                CorrectGpu(src, dst);
                 dst.download(m_tempImageOut);
 
                 if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
@@ -292,24 +702,18 @@ void MAPSColorCorrection::ProcessData(const MAPSTimestamp ts, const MAPS::InputE
         else
         {
             const IplImage& imageOut = outGuard.DataAs<IplImage>();
-            m_tempImageOut = convTools::noCopyIplImage2Mat(&imageOut); // Convert IplImage to cv::Mat without copying
+            m_tempImageOut = m_hostOutView(imageOut.imageData);
 
-            if (chanSeq == MAPS_CHANNELSEQ_BGR || chanSeq == MAPS_CHANNELSEQ_BGRA)
-            {
-                cv::Scalar coefficients(m_dBlue, m_dGreen, m_dRed);
-                cv::multiply(m_tempImageIn, coefficients, m_tempImageOut);
-            }
-            else
-            {
-                cv::Scalar coefficients(m_dRed, m_dGreen, m_dBlue);
-                cv::multiply(m_tempImageIn, coefficients, m_tempImageOut);
-            }
+            Correct(m_tempImageIn, m_tempImageOut);
 
             if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
                 Error("cv::Mat data ptr and imageOut data ptr are different.");
         }
 
         outGuard.Timestamp() = ts;
+
+        if (m_awbMode != AWB_Off)
+            WriteAwbGains(ts);
     }
     catch (const std::exception& e)
     {
@@ -321,48 +725,30 @@ void MAPSColorCorrection::ProcessDataGpu(const MAPSTimestamp ts, const MAPS::Inp
 {
     try
     {
+        if (DropInput(ts))
+            return;
+
         MAPS::OutputGuard<> outGuard{ this, Output(0) };
 
-        const IplImage& proxy = inElt.Data().m_IplImageProxy;
-        const cv::cuda::GpuMat src(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), inElt.Data().m_points);
+        const cv::cuda::GpuMat src = m_deviceInView(inElt.Data().m_points);
 
-        const MAPSInt32 chanSeq = *(MAPSInt32*)proxy.channelSeq;
-        std::vector<cv::cuda::GpuMat> vTmpSplit;
+        CollectAwbSample();
+        SnapshotParams();
 
         if (m_gpuMatAsOutput)
         {
-            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-            const IplImage& proxyDst = outputData.m_IplImageProxy;
-            cv::cuda::GpuMat dst(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
+            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+            cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
 
-            if (chanSeq == MAPS_CHANNELSEQ_BGR || chanSeq == MAPS_CHANNELSEQ_BGRA)
-            {
-                cv::Scalar coefficients(m_dBlue, m_dGreen, m_dRed);
-                cv::cuda::multiply(src, coefficients, dst);
-            }
-            else
-            {
-                cv::Scalar coefficients(m_dRed, m_dGreen, m_dBlue);
-                cv::cuda::multiply(src, coefficients, dst);
-            }
+            CorrectGpu(src, dst);
         }
         else
         {
             cv::cuda::GpuMat dst;
             const IplImage& imageOut = outGuard.DataAs<IplImage>();
-            m_tempImageOut = convTools::noCopyIplImage2Mat(&imageOut); // Convert IplImage to cv::Mat without copying
-
-            if (chanSeq == MAPS_CHANNELSEQ_BGR || chanSeq == MAPS_CHANNELSEQ_BGRA)
-            {
-                cv::Scalar coefficients(m_dBlue, m_dGreen, m_dRed);
-                cv::cuda::multiply(src, coefficients, dst);
-            }
-            else
-            {
-                cv::Scalar coefficients(m_dRed, m_dGreen, m_dBlue);
-                cv::cuda::multiply(src, coefficients, dst);
-            }
+            m_tempImageOut = m_hostOutView(imageOut.imageData);
 
+            CorrectGpu(src, dst);
             dst.download(m_tempImageOut);
 
             if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
@@ -370,9 +756,264 @@ void MAPSColorCorrection::ProcessDataGpu(const MAPSTimestamp ts, const MAPS::Inp
         }
         
         outGuard.Timestamp() = ts;
+
+        if (m_awbMode != AWB_Off)
+            WriteAwbGains(ts);
     }
     catch (const std::exception& e)
     {
         Error(e.what());
     }
 }
+
+void MAPSColorCorrection::Correct(const cv::Mat& src, cv::Mat& dst)
+{
+    if (m_toneCurve == ToneCurve_None && m_awbMode == AWB_Off)
+    {
+        CorrectRows(src, dst);
+        return;
+    }
+
+    // The correction, the tone curve and the white balance statistics are processed stripe by stripe,
+    // while the stripe is still in cache, instead of several full frame passes.
+    AwbStats stats;
+    std::mutex statsMutex;
+
+    dst.create(src.size(), src.type());
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range)
+    {
+        const cv::Mat srcRows = src.rowRange(range);
+        cv::Mat dstRows = dst.rowRange(range);
+
+        if (m_awbMode != AWB_Off)
+        {
+            AwbStats stripeStats;
+            AccumulateAwbStats(srcRows, range.start, m_awbStride, stripeStats);
+            std::lock_guard<std::mutex> lock(statsMutex);
+            stats.Merge(stripeStats);
+        }
+
+        if (m_toneCurve != ToneCurve_None && GainsInLut() && src.depth() == CV_8U)
+        {
+            cv::LUT(srcRows, m_lut, dstRows); // Gains and tone curve in a single lookup per channel
+        }
+        else
+        {
+            CorrectRows(srcRows, dstRows);
+            if (m_toneCurve != ToneCurve_None)
+                ApplyToneCurve(dstRows);
+        }
+    }, std::max(1, src.rows / 16));
+
+    if (m_awbMode != AWB_Off)
+        UpdateAwbGains(stats); // Applied from the next frame on
+}
+
+void MAPSColorCorrection::CorrectRows(const cv::Mat& src, cv::Mat& dst)
+{
+    if (m_useMatrix)
+    {
+        // For 8 bits 3 channels images, cv::transform uses a SIMD fixed-point kernel (offsets included),
+        // so the matrix costs about the same as the per-channel gains.
+        cv::transform(src, dst, m_transform);
+    }
+    else
+    {
+        cv::multiply(src, m_gainsScalar, dst);
+    }
+}
+
+void MAPSColorCorrection::ApplyToneCurve(cv::Mat& image)
+{
+    if (image.depth() == CV_8U)
+    {
+        cv::LUT(image, m_lut, image);
+        return;
+    }
+
+    // 16 bits : cv::LUT only handles 8 bits sources
+    const int cn = image.channels();
+    const int nbColors = std::min(cn, 3); // Alpha is left untouched
+    const ushort* lut = m_lut16.data();
+    for (int y = 0; y < image.rows; ++y)
+    {
+        ushort* row = image.ptr<ushort>(y);
+        for (int x = 0; x < image.cols; ++x, row += cn)
+        {
+            for (int c = 0; c < nbColors; ++c)
+                row[c] = lut[row[c]];
+        }
+    }
+}
+
+void MAPSColorCorrection::CorrectGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst)
+{
+    if (m_awbMode != AWB_Off)
+    {
+        // Only a nearest neighbour subsample of the image is downloaded to compute the statistics, without waiting for it:
+        // it is used by CollectAwbSample() on a next frame
+        m_awbSampler.Enqueue(src, m_awbStride);
+    }
+
+    if (!m_useMatrix)
+    {
+        if (m_toneCurve == ToneCurve_None)
+        {
+            cv::cuda::multiply(src, m_gainsScalar, dst);
+        }
+        else if (GainsInLut())
+        {
+            ApplyToneCurveGpu(src, dst); // Gains are folded into the tables
+        }
+        else
+        {
+            cv::cuda::multiply(src, m_gainsScalar, dst);
+            ApplyToneCurveGpu(dst, dst);
+        }
+        return;
+    }
+
+    // The matrix is applied plane by plane, at the depth of the image instead of a 32F round trip : each color plane of
+    // the output is the weighted sum of the 3 color planes of the input plus the offset, computed by 2 cv::cuda::addWeighted.
+    // The partial sum of the first 2 terms is kept in 16S for 8 bits images, scaled by m_gpuPartialScale so that it is
+    // neither clipped nor rounded much : the result may differ by 1 from the CPU path. The alpha plane is left untouched.
+    // The planes and the partial sum are allocated on the first frame and reused.
+    const int cn = src.channels();
+
+    cv::cuda::split(src, m_gpuPlanes);
+    m_gpuOutPlanes.resize(cn);
+    for (int c = 0; c < 3; ++c)
+    {
+        const float* row = m_transform.ptr<float>(c);
+        cv::cuda::addWeighted(m_gpuPlanes[0], row[0] * m_gpuPartialScale, m_gpuPlanes[1], row[1] * m_gpuPartialScale,
+            row[cn] * m_gpuPartialScale, m_gpuPartial, m_gpuPartialDepth);
+        cv::cuda::addWeighted(m_gpuPartial, 1.0 / m_gpuPartialScale, m_gpuPlanes[2], row[2], 0.0, m_gpuOutPlanes[c], src.depth());
+
+        if (m_toneCurve != ToneCurve_None && cn == 4)
+            m_gpuPlaneLuts[c]->transform(m_gpuOutPlanes[c], m_gpuOutPlanes[c]); // The tables of 4 channels images are per plane
+    }
+    if (cn == 4)
+        m_gpuOutPlanes[3] = m_gpuPlanes[3];
+    cv::cuda::merge(m_gpuOutPlanes, dst);
+
+    if (m_toneCurve != ToneCurve_None && cn == 3)
+        m_gpuLut->transform(dst, dst);
+}
+
+// Updates the auto white balance gains from the subsample enqueued by CorrectGpu() on a previous frame, once it is downloaded.
+// Called before SnapshotParams() so that the gains apply one frame after the sample, as on the CPU.
+void MAPSColorCorrection::CollectAwbSample()
+{
+    cv::Mat sample;
+    if (m_awbMode == AWB_Off || !m_awbSampler.Take(sample))
+        return;
+
+    AwbStats stats;
+    AccumulateAwbStats(sample, 0, 1, stats);
+    UpdateAwbGains(stats);
+}
+
+void MAPSColorCorrection::ApplyToneCurveGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst)
+{
+    if (src.channels() == 3)
+    {
+        m_gpuLut->transform(src, dst);
+        return;
+    }
+
+    cv::cuda::split(src, m_gpuPlanes);
+    for (int c = 0; c < 3; ++c)
+        m_gpuPlaneLuts[c]->transform(m_gpuPlanes[c], m_gpuPlanes[c]);
+    cv::cuda::merge(m_gpuPlanes, dst);
+}
+
+void MAPSColorCorrection::AwbStats::Merge(const AwbStats& other)
+{
+    for (int c = 0; c < 3; ++c)
+    {
+        sum[c] += other.sum[c];
+        max[c] = std::max(max[c], other.max[c]);
+        for (int i = 0; i < 256; ++i)
+            hist[c][i] += other.hist[c][i];
+    }
+    count += other.count;
+}
+
+void MAPSColorCorrection::AccumulateAwbStats(const cv::Mat& rows, int firstRow, int stride, AwbStats& stats)
+{
+    if (rows.depth() == CV_8U)
+        AccumulateRows<uchar>(rows, firstRow, stride, 0, stats);
+    else
+        AccumulateRows<ushort>(rows, firstRow, stride, 8, stats); // 16 bits : the histograms keep the 8 most significant bits
+}
+
+// Estimates new gains from the statistics of the current frame, and blends them with the previous ones.
+void MAPSColorCorrection::UpdateAwbGains(const AwbStats& stats)
+{
+    if (stats.count == 0)
+        return;
+
+    const double binWidth = m_depth == IPL_DEPTH_16U ? 256.0 : 1.0;
+    const int idx[3] = { m_isBGR ? 2 : 0, 1, m_isBGR ? 0 : 2 };
+
+    // Reference level of each channel (RGB order)
+    cv::Vec3d level;
+    for (int i = 0; i < 3; ++i)
+    {
+        const int c = idx[i];
+        switch (m_awbMode)
+        {
+        case AWB_GrayWorld:
+            level[i] = stats.sum[c] / stats.count;
+            break;
+        case AWB_WhitePatch:
+            level[i] = stats.max[c];
+            break;
+        default:
+        {
+            const double target = stats.count * m_awbPercentile / 100.0;
+            double cumul = 0.0;
+            int bin = 0;
+            for (; bin < 255; ++bin)
+            {
+                cumul += stats.hist[c][bin];
+                if (cumul >= target)
+                    break;
+            }
+            level[i] = (bin + 0.5) * binWidth;
+            break;
+        }
+        }
+    }
+
+    if (level[0] <= 0.0 || level[1] <= 0.0 || level[2] <= 0.0)
+        return; // Not enough information in this frame (e.g. black image) : keep the previous gains
+
+    // Green is the reference. Gains are bounded so that a degenerated scene cannot blow up the image.
+    cv::Vec3d estimate(level[1] / level[0], 1.0, level[1] / level[2]);
+    for (int i = 0; i < 3; ++i)
+        estimate[i] = std::min(std::max(estimate[i], 0.125), 8.0);
+
+    if (m_awbInitialized)
+        m_awbGains = m_awbGains * m_awbSmoothing + estimate * (1.0 - m_awbSmoothing);
+    else
+        m_awbGains = estimate;
+
+    m_awbInitialized = true;
+
+    // The coefficients are only updated when a gain moved noticeably since they were last built
+    for (int i = 0; i < 3; ++i)
+    {
+        if (std::abs(m_awbGains[i] - m_awbAppliedGains[i]) > kAwbUpdateThreshold * m_awbAppliedGains[i])
+            m_awbUpdated = true;
+    }
+}
+
+void MAPSColorCorrection::WriteAwbGains(const MAPSTimestamp ts)
+{
+    MAPS::OutputGuard<MAPSFloat64> outGuard{ this, Output("awb_gains") };
+    for (int i = 0; i < 3; ++i)
+        outGuard.Data(i) = m_awbGains[i];
+    outGuard.VectorSize() = 3;
+    outGuard.Timestamp() = ts;
+}
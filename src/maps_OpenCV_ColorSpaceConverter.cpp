@@ -41,6 +41,7 @@ MAPS_BEGIN_INPUTS_DEFINITION(MAPSColorSpaceConverter)
 MAPS_BEGIN_OUTPUTS_DEFINITION(MAPSColorSpaceConverter)
     MAPS_OUTPUT("imageOut", MAPS::IplImage, nullptr, nullptr, 0)
     MAPS_OUTPUT_USER_DYNAMIC_STRUCTURE("o_gpu", MapsCudaStruct)
+    MAPS_OUTPUT("input_stats", MAPS::Float64, nullptr, nullptr, 2)
     MAPS_END_OUTPUTS_DEFINITION
 
 // Use the macros to declare the properties
@@ -50,6 +51,20 @@ MAPS_BEGIN_PROPERTIES_DEFINITION(MAPSColorSpaceConverter)
     MAPS_PROPERTY("use_cuda", false, false, false)
     MAPS_PROPERTY("gpu_mat_as_input", false, false, false)
     MAPS_PROPERTY("gpu_mat_as_output", false, false, false)
+    MAPS_PROPERTY("roi_x", 0, false, false)
+    MAPS_PROPERTY("roi_y", 0, false, false)
+    MAPS_PROPERTY("roi_width", 0, false, false)
+    MAPS_PROPERTY("roi_height", 0, false, false)
+    MAPS_PROPERTY_ENUM("pipeline", "Off|Double buffering|Triple buffering", 0, false, false)
+    MAPS_PROPERTY("batch_size", 1, false, false)
+    MAPS_PROPERTY("batch_timeout", 20000, false, false)
+    MAPS_PROPERTY_ENUM("input_policy", "FIFO|Latest only|Drop every N", 0, false, false)
+    MAPS_PROPERTY("drop_interval", 2, false, false)
+    MAPS_PROPERTY("fifo_depth", 0, false, false)
+    MAPS_PROPERTY("memory_budget", 0, false, false)
+    MAPS_PROPERTY("lazy_allocation", false, false, false)
+    MAPS_PROPERTY("prewarm_buffers", 2, false, false)
+    MAPS_PROPERTY_ENUM("memory_mode", "Device|Managed|Mapped", 0, false, false)
 MAPS_END_PROPERTIES_DEFINITION
 
 // Use the macros to declare the actions
@@ -57,8 +72,16 @@ MAPS_BEGIN_ACTIONS_DEFINITION(MAPSColorSpaceConverter)
     //MAPS_ACTION("aName",MAPSColorSpaceConverter::ActionName)
 MAPS_END_ACTIONS_DEFINITION
 
+//Version 1.2: roi_x, roi_y, roi_width and roi_height properties, only the region of interest is converted.
+//Version 1.3: pipeline property, overlaps the upload, conversion and download of consecutive frames in CUDA mode with IplImage input and output.
+//Version 1.4: batch_size and batch_timeout properties, converts several IplImage frames per call.
+//Version 1.5: input_policy and drop_interval properties, input_stats output: stale frames can be skipped when the component falls behind its input.
+//Version 1.6: fifo_depth and memory_budget properties, sizes the FIFO of the GpuMat outputs and bounds the device memory of their buffers.
+//Version 1.7: lazy_allocation and prewarm_buffers properties, the device memory of the GpuMat output buffers is allocated on their first use.
+//Version 1.8: memory_mode property, the GpuMat output buffers can be allocated in managed or mapped host memory, readable from the host without download.
+
 // Use the macros to declare this component (ColorDemux_YUV) behaviour
-MAPS_COMPONENT_DEFINITION(MAPSColorSpaceConverter,"OpenCV_ColorSpaceConverter_cuda", "1.1.0", 128,
+MAPS_COMPONENT_DEFINITION(MAPSColorSpaceConverter,"OpenCV_ColorSpaceConverter_cuda", "1.8.0", 128,
                             MAPS::Threaded|MAPS::Sequential, MAPS::Sequential,
                             0, // Nb of inputs
                             0, // Nb of outputs
@@ -74,6 +97,12 @@ void MAPSColorSpaceConverter::Dynamic()
     m_useCuda = false;
     m_gpuMatAsInput = false;
     m_gpuMatAsOutput = false;
+    m_batchSize = 1;
+
+    NewProperty("roi_x");
+    NewProperty("roi_y");
+    NewProperty("roi_width");
+    NewProperty("roi_height");
 
     if (cv::cuda::getCudaEnabledDeviceCount() > 0)
     {
@@ -115,11 +144,40 @@ void MAPSColorSpaceConverter::Dynamic()
         NewInput("imageIn");
         NewOutput("imageOut");
     }
+
+    // Batches are made of IplImage frames
+    if (!m_gpuMatAsInput)
+    {
+        m_batchSize = static_cast<int>(NewProperty("batch_size").IntegerValue());
+        if (m_batchSize > 1)
+            NewProperty("batch_timeout");
+    }
+
+    if (m_useCuda && !m_gpuMatAsInput && !m_gpuMatAsOutput && m_batchSize <= 1)
+    {
+        NewProperty("pipeline");
+    }
+
+    NewInputPolicyProperties();
+    NewGpuOutputProperties("o_gpu");
 }
 
 void MAPSColorSpaceConverter::Birth()
 {
-    if (m_useCuda && m_gpuMatAsInput)
+    ApplyGpuOutputProperties();
+    ApplyInputPolicyProperties();
+
+    // Selection 1 and 2 give 2 and 3 slots, 0 disables the pipeline
+    const bool pipelined = m_useCuda && !m_gpuMatAsInput && !m_gpuMatAsOutput && m_batchSize <= 1;
+    m_pipeline.Reset(pipelined ? static_cast<int>(GetIntegerProperty("pipeline")) + 1 : 0);
+
+    if (m_batchSize > 1)
+    {
+        // The inputs are read in Core(), see ReadBatch()
+        m_batchTimeout = GetIntegerProperty("batch_timeout");
+        m_outputAllocated = false;
+    }
+    else if (m_useCuda && m_gpuMatAsInput)
     {
         m_inputReader = MAPS::MakeInputReader::Reactive(
             this,
@@ -141,21 +199,48 @@ void MAPSColorSpaceConverter::Birth()
 
 void MAPSColorSpaceConverter::Core()
 {
+    if (m_batchSize > 1)
+    {
+        ReadBatch();
+        return;
+    }
+
+    // The frames completed since the last input are output before waiting for the next one. When no input is waiting,
+    // the frames still in flight are waited for and output: they are not held while the read blocks.
+    if (m_pipeline.Enabled())
+        m_pipeline.EmitBeforeRead([this](const GpuPipeline::Slot& done) { WritePipelined(done); }, DataAvailableInFIFO(Input(0)) != 0);
+
     m_inputReader->Read();
 }
 
 void MAPSColorSpaceConverter::Death()
 {
     m_inputReader.reset();
+
+    if (m_inputPolicy.Enabled())
+        ReportInfo(m_inputPolicy.Report().c_str());
+
+    m_batch.Clear();
+    m_gpuBatchIn.release();
+    m_gpuBatchOut.release();
+
+    if (m_pipeline.Enabled())
+    {
+        // The frames still in flight are output
+        m_pipeline.Flush([this](const GpuPipeline::Slot& done) { WritePipelined(done); });
+        ReportInfo(m_pipeline.Report().c_str());
+        m_pipeline.Reset(0);
+    }
 }
 
 void MAPSColorSpaceConverter::AllocateOutputBufferSize(const MAPSTimestamp, const MAPS::InputElt<IplImage> imageInElt)
 {
-    const IplImage& imageIn = imageInElt.Data();
-
-    if (imageIn.dataOrder != IPL_DATA_ORDER_PIXEL)
-        Error("This component only supports pixel oriented images on its input.");
+    AllocateOutputs(imageInElt.Data());
+}
 
+void MAPSColorSpaceConverter::AllocateOutputs(const IplImage& imageIn)
+{
+    ResolveRoi(imageIn);
     int inputChanSeq = *(MAPSUInt32*)imageIn.channelSeq;
     CheckInputColorSpace(inputChanSeq);
     IplImage model;
@@ -169,7 +254,7 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSize(const MAPSTimestamp, cons
         else
             Error("Cannot convert the input image format to GRAY. Only RGB to GRAY and BGR to GRAY are supported.");
 
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, "GRAY", imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, "GRAY", IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     case CS_RGB24: //RGB
@@ -186,7 +271,7 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSize(const MAPSTimestamp, cons
         else
             Error("Cannot convert the input image format to RGB24. Only GRAY to RGB, YUV 24 to RGB and HSV to RGB transformations are supported.");
 
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, MAPS_CHANNELSEQ_RGB, imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, MAPS_CHANNELSEQ_RGB, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     case CS_BGR24: // BGR
@@ -205,7 +290,7 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSize(const MAPSTimestamp, cons
         else
             Error("Cannot convert the input image to BRG24. Only GRAY to BGR, YUV 24 to BGR and HSV to BGR transformations are supported.");
 
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, MAPS_CHANNELSEQ_BGR, imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, MAPS_CHANNELSEQ_BGR, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     case CS_YUV24: // YUV
@@ -216,7 +301,7 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSize(const MAPSTimestamp, cons
         else
             Error("Cannot convert the input image format to YUV24. Only RGB to YUV and BGR to YUV transformations are supported.");
 
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, MAPS_CHANNELSEQ_YUV, imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, MAPS_CHANNELSEQ_YUV, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     case CS_HSV: // HSV
@@ -227,7 +312,7 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSize(const MAPSTimestamp, cons
         else
             Error("Cannot convert the input image format to HSV. Only RGB to HSV and BGR to HSV transformations are supported.");
 
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, MAPS_FC('H', 'S', 'V', 000), imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, MAPS_FC('H', 'S', 'V', 000), IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     case CS_RGBA: // RGBA
@@ -240,7 +325,7 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSize(const MAPSTimestamp, cons
         else
             Error("Conversion not supported. Ask Intempora.");
 
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, MAPS_CHANNELSEQ_RGBA, imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, MAPS_CHANNELSEQ_RGBA, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     case CS_BGRA: // BGRA
@@ -253,13 +338,17 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSize(const MAPSTimestamp, cons
         else
             Error("Conversion not supported.");
 
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, MAPS_CHANNELSEQ_BGRA, imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, MAPS_CHANNELSEQ_BGRA, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     default:
         Error("Unsupported image format on input. This component can only deal with GRAY, RGB, BGR, YUV and HSV images.");
     }
 
+    CreateViews(imageIn, model);
+
+    if (m_batchSize > 1)
+        m_batch.Reset(m_batchSize, m_roi.size(), m_hostInView.Type());
 
     if (m_gpuMatAsOutput)
     {
@@ -267,7 +356,7 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSize(const MAPSTimestamp, cons
         {
             AllocateDynamicOutputBuffers(
                 DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(imageIn.width, imageIn.height, model.nChannels, model); }  // struct allocation
+                    [&] { return new MapsCudaStruct(model.width, model.height, model.nChannels, model, m_memoryMode); }  // struct allocation
                 )
             );
         }
@@ -278,81 +367,204 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSize(const MAPSTimestamp, cons
     }
     else
     {
-        Output(0).AllocOutputBufferIplImage(model);
+        AllocateIplImageOutputBuffer(Output(0), model);
     }
 }
 
 void MAPSColorSpaceConverter::ProcessData(const MAPSTimestamp ts, const MAPS::InputElt<IplImage> inElt)
 {
-    MAPS::OutputGuard<> outGuard{ this, Output(0) };
-    cv::Mat matIn = convTools::noCopyIplImage2Mat(&inElt.Data());
-
-    if (m_useCuda)
+    try
     {
-        cv::cuda::GpuMat src(matIn);
-        if (m_gpuMatAsOutput)
+        if (DropInput(ts))
+            return;
+
+        if (m_pipeline.Enabled())
         {
-            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-            const IplImage& proxy = outputData.m_IplImageProxy;
-            cv::cuda::GpuMat dst(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), outputData.m_points);
-            ConvertGpu(src, dst);
+            ProcessDataPipelined(ts, inElt.Data());
+            return;
+        }
+
+        MAPS::OutputGuard<> outGuard{ this, Output(0) };
+        const cv::Mat matIn = m_hostInView(inElt.Data().imageData);
+
+        if (m_useCuda)
+        {
+            cv::cuda::GpuMat src(matIn);
+            if (m_gpuMatAsOutput)
+            {
+                MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+                cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
+                ConvertGpu(src, dst);
+            }
+            else
+            {
+                IplImage& imageOut = outGuard.DataAs<IplImage>();
+                cv::Mat matOut = m_hostOutView(imageOut.imageData);
+                cv::cuda::GpuMat dst;
+                ConvertGpu(src, dst);
+                dst.download(matOut);
+
+                if (static_cast<void*>(matOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+                    Error("cv::Mat data ptr and imageOut data ptr are different.");
+            }
         }
         else
         {
             IplImage& imageOut = outGuard.DataAs<IplImage>();
-            cv::Mat matOut = convTools::noCopyIplImage2Mat(&imageOut);
-            cv::cuda::GpuMat dst;
-            ConvertGpu(src, dst);
-            dst.download(matOut);
+            cv::Mat matOut = m_hostOutView(imageOut.imageData); // Convert IplImage to cv::Mat without copying
+            Convert(matIn, matOut);
 
             if (static_cast<void*>(matOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
                 Error("cv::Mat data ptr and imageOut data ptr are different.");
         }
+
+        outGuard.VectorSize() = 0;
+        outGuard.Timestamp() = ts;
     }
-    else
+    catch (const std::exception& e)
+    {
+        Error(e.what());
+    }
+}
+
+// The frames are output by WritePipelined() as soon as their work is complete, in the order of reception (see GpuPipeline).
+void MAPSColorSpaceConverter::ProcessDataPipelined(const MAPSTimestamp ts, const IplImage& imageIn)
+{
+    const auto emit = [this](const GpuPipeline::Slot& done) { WritePipelined(done); };
+    GpuPipeline::Slot& slot = m_pipeline.Next(emit);
+
+    slot.Upload(m_hostInView(imageIn.imageData));
+    ConvertGpu(slot.Src(), slot.Dst(), slot.work, slot.planes, slot.stream);
+    slot.Download();
+    m_pipeline.Submit(ts);
+    m_pipeline.EmitCompleted(emit);
+}
+
+void MAPSColorSpaceConverter::WritePipelined(const GpuPipeline::Slot& done)
+{
+    MAPS::OutputGuard<> outGuard{ this, Output(0) };
+    IplImage& imageOut = outGuard.DataAs<IplImage>();
+    cv::Mat matOut = m_hostOutView(imageOut.imageData);
+    done.PinnedOut().copyTo(matOut);
+    outGuard.VectorSize() = 0;
+    outGuard.Timestamp() = done.Timestamp();
+
+    if (static_cast<void*>(matOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+        Error("cv::Mat data ptr and imageOut data ptr are different.");
+}
+
+// The first frame of a batch is waited for, the next ones for batch_timeout at most: the batch is processed when it is full
+// or when the timeout expires, so that the frames are not delayed by more than batch_timeout.
+void MAPSColorSpaceConverter::ReadBatch()
+{
+    const FrameBatch::ClearGuard clearGuard{ m_batch };
+    try
     {
-        IplImage& imageOut = outGuard.DataAs<IplImage>();
-        cv::Mat matOut = convTools::noCopyIplImage2Mat(&imageOut); // Convert IplImage to cv::Mat without copying
+        MAPSIOElt* ioElt = StartReading(Input(0));
+        if (ioElt == nullptr)
+            return;
+        AddToBatch(*ioElt);
 
-        try {
-            // OpenCV uses YCrCb and RTMaps uses YCbCr
-            if (m_inputCS == CS_YUV24)
+        const MAPSTimestamp deadline = MAPS::CurrentTime() + m_batchTimeout;
+        while (!m_batch.Full())
+        {
+            bool timedOut = false;
+            if (DataAvailableInFIFO(Input(0)))
             {
-                cv::split(matIn, m_tempChannels);
-                std::swap(m_tempChannels[1], m_tempChannels[2]);
-                cv::merge(m_tempChannels, m_workImage);
-                // Convert matIn in another color depending on the colorspace wanted (m_openCVConvertCode), and finally store the new color image in component output
-                cv::cvtColor(m_workImage, matOut, m_openCVConvertCode);
+                ioElt = StartReading(Input(0));
             }
-            else if (m_outputCS == CS_YUV24)
+            else
             {
-                cv::cvtColor(matIn, m_workImage, m_openCVConvertCode);
-                cv::split(m_workImage, m_tempChannels);
-                std::swap(m_tempChannels[1], m_tempChannels[2]);
-                cv::merge(m_tempChannels, matOut);
+                // Blocking read until the next frame arrives or the deadline passes
+                const MAPSDelay remaining = deadline - MAPS::CurrentTime();
+                if (remaining <= 0)
+                    break;
+                ioElt = StartReading(Input(0), remaining, &timedOut);
             }
-            else
+            if (ioElt == nullptr)
             {
-                cv::cvtColor(matIn, matOut, m_openCVConvertCode);
+                if (timedOut)
+                    break;
+                return; // The component is dying
             }
+            AddToBatch(*ioElt);
         }
-        catch (const std::exception& e)
+
+        // All the frames may have been dropped by the input policy
+        if (m_batch.Size() == 0)
+            return;
+
+        ProcessBatch();
+    }
+    catch (const std::exception& e)
+    {
+        Error(e.what());
+    }
+}
+
+void MAPSColorSpaceConverter::AddToBatch(MAPSIOElt& ioElt)
+{
+    const IplImage& imageIn = ioElt.IplImage();
+    if (!m_outputAllocated)
+    {
+        AllocateOutputs(imageIn);
+        m_outputAllocated = true;
+    }
+
+    if (DropInput(ioElt.Timestamp()))
+        return;
+
+    m_batch.Add(m_hostInView(imageIn.imageData), ioElt.Timestamp());
+}
+
+// The conversion is per pixel: the stacked frames of the batch are converted in a single call (a single upload,
+// conversion and download in CUDA mode), then output one by one with their own timestamps.
+void MAPSColorSpaceConverter::ProcessBatch()
+{
+    const int count = m_batch.Size();
+    const int frameHeight = m_roi.height;
+
+    if (m_useCuda)
+    {
+        m_gpuBatchIn.upload(m_batch.Frames(), m_batchStream);
+        ConvertGpu(m_gpuBatchIn, m_gpuBatchOut, m_gpuWorkImage, m_gpuTempChannels, m_batchStream);
+        if (!m_gpuMatAsOutput)
+            m_gpuBatchOut.download(m_batchOut, m_batchStream);
+        m_batchStream.waitForCompletion();
+    }
+    else
+    {
+        Convert(m_batch.Frames(), m_batchOut);
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        MAPS::OutputGuard<> outGuard{ this, Output(0) };
+        if (m_gpuMatAsOutput)
         {
-            Error(e.what());
+            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+            cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
+            FrameBatch::Slice(m_gpuBatchOut, i, frameHeight).copyTo(dst);
         }
+        else
+        {
+            IplImage& imageOut = outGuard.DataAs<IplImage>();
+            cv::Mat matOut = m_hostOutView(imageOut.imageData);
+            FrameBatch::Slice(m_batchOut, i, frameHeight).copyTo(matOut);
 
-        if (static_cast<void*>(matOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
-            Error("cv::Mat data ptr and imageOut data ptr are different.");
+            if (static_cast<void*>(matOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+                Error("cv::Mat data ptr and imageOut data ptr are different.");
+        }
+        outGuard.VectorSize() = 0;
+        outGuard.Timestamp() = m_batch.Timestamp(i);
     }
-
-    outGuard.VectorSize() = 0;
-    outGuard.Timestamp() = ts;
 }
 
 void MAPSColorSpaceConverter::AllocateOutputBufferSizeGpu(const MAPSTimestamp, const MAPS::InputElt<MapsCudaStruct> imageInElt)
 {
     const IplImage& imageIn = imageInElt.Data().m_IplImageProxy;
 
+    ResolveRoi(imageIn);
     int inputChanSeq = *(MAPSUInt32*)imageIn.channelSeq;
     CheckInputColorSpace(inputChanSeq);
     IplImage model;
@@ -366,7 +578,7 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSizeGpu(const MAPSTimestamp, c
         else
             Error("Cannot convert the input image format to GRAY. Only RGB to GRAY and BGR to GRAY are supported.");
 
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, "GRAY", imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, "GRAY", IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     case CS_RGB24: //RGB
@@ -383,7 +595,7 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSizeGpu(const MAPSTimestamp, c
         else
             Error("Cannot convert the input image format to RGB24. Only GRAY to RGB, YUV 24 to RGB and HSV to RGB transformations are supported.");
 
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, MAPS_CHANNELSEQ_RGB, imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, MAPS_CHANNELSEQ_RGB, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     case CS_BGR24: // BGR
@@ -402,7 +614,7 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSizeGpu(const MAPSTimestamp, c
         else
             Error("Cannot convert the input image to BRG24. Only GRAY to BGR, YUV 24 to BGR and HSV to BGR transformations are supported.");
 
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, MAPS_CHANNELSEQ_BGR, imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, MAPS_CHANNELSEQ_BGR, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     case CS_YUV24: // YUV
@@ -413,7 +625,7 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSizeGpu(const MAPSTimestamp, c
         else
             Error("Cannot convert the input image format to YUV24. Only RGB to YUV and BGR to YUV transformations are supported.");
 
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, MAPS_CHANNELSEQ_YUV, imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, MAPS_CHANNELSEQ_YUV, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     case CS_HSV: // HSV
@@ -424,7 +636,7 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSizeGpu(const MAPSTimestamp, c
         else
             Error("Cannot convert the input image format to HSV. Only RGB to HSV and BGR to HSV transformations are supported.");
 
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, MAPS_FC('H', 'S', 'V', 000), imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, MAPS_FC('H', 'S', 'V', 000), IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     case CS_RGBA: // RGBA
@@ -437,7 +649,7 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSizeGpu(const MAPSTimestamp, c
         else
             Error("Conversion not supported. Ask Intempora.");
 
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, MAPS_CHANNELSEQ_RGBA, imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, MAPS_CHANNELSEQ_RGBA, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     case CS_BGRA: // BGRA
@@ -450,20 +662,22 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSizeGpu(const MAPSTimestamp, c
         else
             Error("Conversion not supported.");
 
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, MAPS_CHANNELSEQ_BGRA, imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, MAPS_CHANNELSEQ_BGRA, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     default:
         Error("Unsupported image format on input. This component can only deal with GRAY, RGB, BGR, YUV and HSV images.");
     }
 
+    CreateViews(imageIn, model);
+
     if (m_gpuMatAsOutput)
     {
         try
         {
             AllocateDynamicOutputBuffers(
                 DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(model.width, model.height, model.nChannels, model); }  // struct allocation
+                    [&] { return new MapsCudaStruct(model.width, model.height, model.nChannels, model, m_memoryMode); }  // struct allocation
                 )
             );
         }
@@ -474,37 +688,45 @@ void MAPSColorSpaceConverter::AllocateOutputBufferSizeGpu(const MAPSTimestamp, c
     }
     else
     {
-        Output(0).AllocOutputBufferIplImage(model);
+        AllocateIplImageOutputBuffer(Output(0), model);
     }
 }
 
 void MAPSColorSpaceConverter::ProcessDataGpu(const MAPSTimestamp ts, const MAPS::InputElt<MapsCudaStruct> inElt)
 {
-    MAPS::OutputGuard<> outGuard{ this, Output(0) };
-    const IplImage& proxy = inElt.Data().m_IplImageProxy;
-    const cv::cuda::GpuMat src(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), inElt.Data().m_points);
-
-    if (m_gpuMatAsOutput)
+    try
     {
-        MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-        const IplImage& proxyDst = outputData.m_IplImageProxy;
-        cv::cuda::GpuMat dst(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
-        ConvertGpu(src, dst);
+        if (DropInput(ts))
+            return;
+
+        MAPS::OutputGuard<> outGuard{ this, Output(0) };
+        const cv::cuda::GpuMat src = m_deviceInView(inElt.Data().m_points);
+
+        if (m_gpuMatAsOutput)
+        {
+            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+            cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
+            ConvertGpu(src, dst);
+        }
+        else
+        {
+            IplImage& imageOut = outGuard.DataAs<IplImage>();
+            cv::Mat matOut = m_hostOutView(imageOut.imageData); // Convert IplImage to cv::Mat without copying
+            cv::cuda::GpuMat dst;
+            ConvertGpu(src, dst);
+            dst.download(matOut);
+
+            if (static_cast<void*>(matOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+                Error("cv::Mat data ptr and imageOut data ptr are different.");
+        }
+
+        outGuard.VectorSize() = 0;
+        outGuard.Timestamp() = ts;
     }
-    else
+    catch (const std::exception& e)
     {
-        IplImage& imageOut = outGuard.DataAs<IplImage>();
-        cv::Mat matOut = convTools::noCopyIplImage2Mat(&imageOut); // Convert IplImage to cv::Mat without copying
-        cv::cuda::GpuMat dst;
-        ConvertGpu(src, dst);
-        dst.download(matOut);
-
-        if (static_cast<void*>(matOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
-            Error("cv::Mat data ptr and imageOut data ptr are different.");
+        Error(e.what());
     }
-
-    outGuard.VectorSize() = 0;
-    outGuard.Timestamp() = ts;
 }
 
 void MAPSColorSpaceConverter::CheckInputColorSpace(int chanSeq)
@@ -565,31 +787,67 @@ void MAPSColorSpaceConverter::CheckInputColorSpace(int chanSeq)
     }
 }
 
+void MAPSColorSpaceConverter::Convert(const cv::Mat& src, cv::Mat& dst)
+{
+    try {
+        // OpenCV uses YCrCb and RTMaps uses YCbCr
+        if (m_inputCS == CS_YUV24)
+        {
+            cv::split(src, m_tempChannels);
+            std::swap(m_tempChannels[1], m_tempChannels[2]);
+            cv::merge(m_tempChannels, m_workImage);
+            // Convert src in another color depending on the colorspace wanted (m_openCVConvertCode), and finally store the new color image in dst
+            cv::cvtColor(m_workImage, dst, m_openCVConvertCode);
+        }
+        else if (m_outputCS == CS_YUV24)
+        {
+            cv::cvtColor(src, m_workImage, m_openCVConvertCode);
+            cv::split(m_workImage, m_tempChannels);
+            std::swap(m_tempChannels[1], m_tempChannels[2]);
+            cv::merge(m_tempChannels, dst);
+        }
+        else
+        {
+            cv::cvtColor(src, dst, m_openCVConvertCode);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        Error(e.what());
+    }
+}
+
 void MAPSColorSpaceConverter::ConvertGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst)
 {
     std::vector<cv::cuda::GpuMat> tempChannels;
     cv::cuda::GpuMat workImage;
+    ConvertGpu(src, dst, workImage, tempChannels, cv::cuda::Stream::Null());
+}
 
+// workImage and tempChannels must stay alive until the work enqueued on stream is done.
+void MAPSColorSpaceConverter::ConvertGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst, cv::cuda::GpuMat& workImage,
+                                         std::vector<cv::cuda::GpuMat>& tempChannels, cv::cuda::Stream& stream)
+{
     try {
         // OpenCV uses YCrCb and RTMaps uses YCbCr
         if (m_inputCS == CS_YUV24)
         {
-            cv::cuda::split(src, tempChannels);
+            cv::cuda::split(src, tempChannels, stream);
             std::swap(tempChannels[1], tempChannels[2]);
-            cv::cuda::merge(tempChannels, workImage);
+            cv::cuda::merge(tempChannels, workImage, stream);
             // Convert matIn in another color depending on the colorspace wanted (m_openCVConvertCode), and finally store the new color image in component output
-            cv::cuda::cvtColor(workImage, dst, m_openCVConvertCode);
+            cv::cuda::cvtColor(workImage, dst, m_openCVConvertCode, 0, stream);
         }
         else if (m_outputCS == CS_YUV24)
         {
-            cv::cuda::cvtColor(src, workImage, m_openCVConvertCode);
-            cv::cuda::split(workImage, tempChannels);
+            cv::cuda::cvtColor(src, workImage, m_openCVConvertCode, 0, stream);
+            cv::cuda::split(workImage, tempChannels, stream);
             std::swap(tempChannels[1], tempChannels[2]);
-            cv::cuda::merge(tempChannels, dst);
+            cv::cuda::merge(tempChannels, dst, stream);
         }
         else
         {
-            cv::cuda::cvtColor(src, dst, m_openCVConvertCode);
+            cv::cuda::cvtColor(src, dst, m_openCVConvertCode, 0, stream);
         }
     }
     catch (const std::exception& e)
@@ -674,16 +932,4 @@ void MAPSColorSpaceConverter::Set(MAPSProperty& p, const MAPSEnumStruct& enum_pr
         }
     }
     MAPSComponent::Set(p, enum_prop);
-}
-
-void MAPSColorSpaceConverter::FreeBuffers()
-{
-    if (m_useCuda && m_gpuMatAsOutput)
-    {
-        MAPS_DynamicCustomStructComponent::FreeBuffers();
-    }
-    else
-    {
-        MAPSComponent::FreeBuffers();
-    }
 }
\ No newline at end of file
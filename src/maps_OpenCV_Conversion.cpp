@@ -17,6 +17,7 @@
 /////////////////////////////////////////////////////////////////////////////////
 
 #include "maps_OpenCV_Conversion.h"
+#include <algorithm>
 #include <vector>
 #include <sstream>
 
@@ -41,7 +42,7 @@ MAT noCopy(IPL image)
 	if (!image->roi)
 	{
 		return cv::Mat(static_cast<int>(image->height), static_cast<int>(image->width),
-                       CV_MAKETYPE(image->depth == 8 ? 0 : image->depth / 8, image->nChannels),
+                       convTools::cvType(image),
                        image->imageData, image->widthStep);
 	}
 	else
@@ -87,7 +88,7 @@ MAT noCopy(IPL image)
 		}
 
 		cv::Mat shallowCopy = cv::Mat(static_cast<int>(image->height), static_cast<int>(image->width),
-                                      CV_MAKETYPE(image->depth == 8 ? 0 : image->depth / 8, image->nChannels),
+                                      convTools::cvType(image),
 			image->imageData, image->widthStep);
 		return shallowCopy(cv::Range(image->roi->yOffset, lastRow),
 						   cv::Range(image->roi->xOffset, lastCol));
@@ -104,6 +105,75 @@ const cv::Mat convTools::noCopyIplImage2Mat(const IplImage* image)
 	return noCopy<const IplImage*, const cv::Mat>(image);
 }
 
+const cv::Mat convTools::noCopyIplImage2MatRoi(const IplImage* image, MAPSInt32 x, MAPSInt32 y, MAPSInt32 width, MAPSInt32 height)
+{
+	const cv::Mat full = noCopy<const IplImage*, const cv::Mat>(image);
+	if ((x < 0) || (y < 0) || (width <= 0) || (height <= 0) || (x + width > full.cols) || (y + height > full.rows))
+	{
+		std::ostringstream s;
+		s << "ROI [" << x << ", " << y << ", " << width << " x " << height << "] is outside of the " << full.cols << " x " << full.rows << " image.";
+		throw std::domain_error(s.str());
+	}
+	return full(cv::Rect(x, y, width, height));
+}
+
+cv::Mat convTools::noCopyIplImage2MatRoi(IplImage* image, MAPSInt32 x, MAPSInt32 y, MAPSInt32 width, MAPSInt32 height)
+{
+	return noCopyIplImage2MatRoi(static_cast<const IplImage*>(image), x, y, width, height); // Shares the data of the image
+}
+
+cv::Rect convTools::resolveRoi(int imageWidth, int imageHeight, MAPSInt64 x, MAPSInt64 y, MAPSInt64 width, MAPSInt64 height, int alignment)
+{
+	x -= x % alignment;
+	y -= y % alignment;
+	if (width <= 0)
+		width = imageWidth - x;
+	if (height <= 0)
+		height = imageHeight - y;
+	width = std::min<MAPSInt64>(width, imageWidth - x);
+	height = std::min<MAPSInt64>(height, imageHeight - y);
+	width -= width % alignment;
+	height -= height % alignment;
+
+	if ((x < 0) || (y < 0) || (width <= 0) || (height <= 0))
+	{
+		std::ostringstream s;
+		s << "The region of interest [" << x << ", " << y << ", " << width << " x " << height << "] does not fit in the " << imageWidth << " x " << imageHeight << " image.";
+		throw std::domain_error(s.str());
+	}
+	return cv::Rect(static_cast<int>(x), static_cast<int>(y), static_cast<int>(width), static_cast<int>(height));
+}
+
+int convTools::cvDepth(const IplImage* image)
+{
+	switch (static_cast<unsigned int>(image->depth))
+	{
+	case IPL_DEPTH_8U:
+		return CV_8U;
+	case IPL_DEPTH_8S:
+		return CV_8S;
+	case IPL_DEPTH_16U:
+		return CV_16U;
+	case IPL_DEPTH_16S:
+		return CV_16S;
+	case IPL_DEPTH_32S:
+		return CV_32S;
+	case IPL_DEPTH_32F:
+		return CV_32F;
+	default:
+	{
+		std::ostringstream s;
+		s << "Image depth [" << image->depth << "] is not supported by cv::Mat.";
+		throw std::domain_error(s.str());
+	}
+	}
+}
+
+int convTools::cvType(const IplImage* image)
+{
+	return CV_MAKETYPE(cvDepth(image), image->nChannels);
+}
+
 cv::Mat convTools::copyIplImage2Mat(const IplImage* image)
 {
 	if ((image->dataOrder != IPL_DATA_ORDER_PLANE) || (image->nChannels == 1))
@@ -112,7 +182,80 @@ cv::Mat convTools::copyIplImage2Mat(const IplImage* image)
 	}
 	else
 	{
-		throw std::domain_error("Cannot convert planar color IplImage to cv::Mat.");
+		cv::Mat packed;
+		planarToPacked(image, packed);
+		return packed;
+	}
+}
+
+namespace
+{
+	// Builds one cv::Mat header per plane of a planar IplImage (restricted to its ROI if any). Returns the number of planes.
+	// The planes follow each other in the buffer, each of them being height * widthStep bytes long.
+	int planeHeaders(const IplImage* image, cv::Mat (&planes)[4])
+	{
+		if ((image->nChannels < 1) || (image->nChannels > 4))
+		{
+			std::ostringstream s;
+			s << "Planar images with " << image->nChannels << " channels are not supported. Only 1 to 4 channels can be converted.";
+			throw std::domain_error(s.str());
+		}
+		if ((image->height <= 0) || (image->width <= 0))
+		{
+			throw std::domain_error("Image width or height <= 0. Cannot convert planar IplImage.");
+		}
+
+		const int type = CV_MAKETYPE(cvDepth(image), 1);
+		const size_t planeStride = static_cast<size_t>(image->widthStep) * image->height;
+		for (int c = 0; c < image->nChannels; ++c)
+		{
+			planes[c] = cv::Mat(image->height, image->width, type, image->imageData + c * planeStride, image->widthStep);
+			if (image->roi)
+			{
+				planes[c] = planes[c](cv::Rect(image->roi->xOffset, image->roi->yOffset, image->roi->width, image->roi->height));
+			}
+		}
+		return image->nChannels;
+	}
+}
+
+// cv::merge and cv::split are vectorized by OpenCV (SSE/AVX2/NEON depending on the build), which
+// brings the conversion close to memcpy speed without any other dependency.
+void convTools::planarToPacked(const IplImage* planar, cv::Mat& packed)
+{
+	cv::Mat planes[4];
+	const int cn = planeHeaders(planar, planes);
+
+	if (cn == 1)
+	{
+		planes[0].copyTo(packed);
+	}
+	else
+	{
+		packed.create(planes[0].size(), CV_MAKETYPE(planes[0].depth(), cn));
+		cv::merge(planes, cn, packed);
+	}
+}
+
+void convTools::packedToPlanar(const cv::Mat& packed, IplImage* planar)
+{
+	cv::Mat planes[4];
+	const int cn = planeHeaders(planar, planes);
+
+	if ((packed.size() != planes[0].size()) || (packed.type() != CV_MAKETYPE(planes[0].depth(), cn)))
+	{
+		throw std::domain_error("The packed image and the planar IplImage have different sizes or formats.");
+	}
+
+	uchar* const firstPlane = planes[0].data;
+	if (cn == 1)
+		packed.copyTo(planes[0]);
+	else
+		cv::split(packed, planes);
+
+	if (planes[0].data != firstPlane) // if the ptr are different then opencv reallocated memory for the cv::Mat
+	{
+		throw std::domain_error("Planar IplImage data ptr changed during the conversion.");
 	}
 }
 
@@ -0,0 +1,122 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////
+// Purpose of this module : Records a decimated subset of the images of a GpuMat stream to a raw file, for debugging,
+// without downloading them in the thread of the component that produces them.
+////////////////////////////////
+
+#include "maps_OpenCV_CudaTap.h"	// Includes the header of this component
+
+// Use the macros to declare the inputs
+MAPS_BEGIN_INPUTS_DEFINITION(MAPSOpenCV_CudaTap)
+MAPS_INPUT("i_gpu", Filter_MapsCudaStruct, MAPS::FifoReader)
+MAPS_END_INPUTS_DEFINITION
+
+// Use the macros to declare the outputs
+MAPS_BEGIN_OUTPUTS_DEFINITION(MAPSOpenCV_CudaTap)
+MAPS_OUTPUT("tap_stats", MAPS::Float64, nullptr, nullptr, 3)
+MAPS_END_OUTPUTS_DEFINITION
+
+// Use the macros to declare the properties
+MAPS_BEGIN_PROPERTIES_DEFINITION(MAPSOpenCV_CudaTap)
+MAPS_PROPERTY("file", "gpu_tap.raw", false, false)
+MAPS_PROPERTY("decimation", 1, false, false)
+MAPS_PROPERTY("ring_size", 4, false, false)
+MAPS_END_PROPERTIES_DEFINITION
+
+// Use the macros to declare the actions
+MAPS_BEGIN_ACTIONS_DEFINITION(MAPSOpenCV_CudaTap)
+    //MAPS_ACTION("aName",MAPSOpenCV_CudaTap::ActionName)
+MAPS_END_ACTIONS_DEFINITION
+
+// Use the macros to declare this component (OpenCV_CudaTap) behaviour
+MAPS_COMPONENT_DEFINITION(MAPSOpenCV_CudaTap, "OpenCV_CudaTap_cuda", "1.0.0", 128,
+                            MAPS::Threaded | MAPS::Sequential, MAPS::Threaded,
+                            -1, // Nb of inputs
+                            -1, // Nb of outputs
+                            -1, // Nb of properties
+                            -1) // Nb of actions
+
+void MAPSOpenCV_CudaTap::Birth()
+{
+    try
+    {
+        m_tap.Start((const char*)GetStringProperty("file"),
+            static_cast<int>(GetIntegerProperty("decimation")),
+            static_cast<int>(GetIntegerProperty("ring_size")));
+    }
+    catch (const std::exception& e)
+    {
+        Error(e.what());
+    }
+
+    m_inputReader = MAPS::MakeInputReader::Reactive(
+        this,
+        Input(0),
+        &MAPSOpenCV_CudaTap::StartRecording,  // Called when data is received for the first time only
+        &MAPSOpenCV_CudaTap::ProcessData      // Called when data is received for the first time AND all subsequent times
+    );
+}
+
+void MAPSOpenCV_CudaTap::Core()
+{
+    m_inputReader->Read();
+}
+
+void MAPSOpenCV_CudaTap::Death()
+{
+    m_inputReader.reset();
+
+    // Writes the frames still in the ring before closing the file
+    m_tap.Stop();
+    ReportInfo(m_tap.Report().c_str());
+}
+
+void MAPSOpenCV_CudaTap::StartRecording(const MAPSTimestamp, const MAPS::InputElt<MapsCudaStruct> imageInElt)
+{
+    // The page-locked slots are allocated here rather than by the first Offer()
+    try
+    {
+        m_tap.Preallocate(MapsCudaTap::FrameBytes(imageInElt.Data()));
+    }
+    catch (const std::exception& e)
+    {
+        Error(e.what());
+    }
+
+    const IplImage& proxy = imageInElt.Data().m_IplImageProxy;
+    std::ostringstream oss;
+    oss << "Recording " << proxy.width << " x " << proxy.height << " images with " << proxy.nChannels << " channels to "
+        << (const char*)GetStringProperty("file");
+    ReportInfo(oss.str().c_str());
+}
+
+// The frame is only referenced and its copy enqueued: the component never waits for the GPU nor the disk,
+// a frame is dropped when the ring is full or when its slot is too small (larger frames, the slots are being enlarged).
+void MAPSOpenCV_CudaTap::ProcessData(const MAPSTimestamp ts, const MAPS::InputElt<MapsCudaStruct> inElt)
+{
+    m_tap.Offer(inElt.Data(), ts);
+
+    MAPS::OutputGuard<MAPSFloat64> outGuard{ this, Output("tap_stats") };
+    outGuard.Data(0) = static_cast<MAPSFloat64>(m_tap.Captured());
+    outGuard.Data(1) = static_cast<MAPSFloat64>(m_tap.Dropped());
+    outGuard.Data(2) = static_cast<MAPSFloat64>(m_tap.Offered());
+    outGuard.VectorSize() = 3;
+    outGuard.Timestamp() = ts;
+}
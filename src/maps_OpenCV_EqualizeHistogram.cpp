@@ -23,6 +23,10 @@
 
 ////////////////////////////////
 // Purpose of this module : Equalizes histogram of grayscale image.
+//                          Color images are equalized channel by channel, or on their luma only.
+//                          Either a global equalization or a CLAHE (contrast limited adaptive equalization) is used.
+//                          In temporal mode, the equalization uses the smoothed histograms of the previous frames.
+//                          Optionally publishes the histograms and statistics of each channel.
 ////////////////////////////////
 
 
@@ -32,6 +36,11 @@
 #include <opencv2/cudawarping.hpp>
 #include "opencv2/cudaarithm.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
 // Use the macros to declare the inputs
 MAPS_BEGIN_INPUTS_DEFINITION(MAPSOpenCV_EqualizeHistogram)
 MAPS_INPUT("imageIn", MAPS::FilterIplImage, MAPS::FifoReader)
@@ -42,13 +51,35 @@ MAPS_END_INPUTS_DEFINITION
 MAPS_BEGIN_OUTPUTS_DEFINITION(MAPSOpenCV_EqualizeHistogram)
 MAPS_OUTPUT("imageOut", MAPS::IplImage, nullptr, nullptr, 0)
 MAPS_OUTPUT_USER_DYNAMIC_STRUCTURE("o_gpu", MapsCudaStruct)
+MAPS_OUTPUT("stats", MAPS::Float64, nullptr, nullptr, 4 * (9 + 256))
+MAPS_OUTPUT("input_stats", MAPS::Float64, nullptr, nullptr, 2)
 MAPS_END_OUTPUTS_DEFINITION
 
 // Use the macros to declare the properties
 MAPS_BEGIN_PROPERTIES_DEFINITION(MAPSOpenCV_EqualizeHistogram)
 MAPS_PROPERTY("use_cuda", false, false, false)
+MAPS_PROPERTY_ENUM("channel_mode", "Per channel|Luma", 0, false, false)
+MAPS_PROPERTY_ENUM("method", "Global|CLAHE|Statistics only", 0, false, false)
+MAPS_PROPERTY("temporal", false, false, false)
+MAPS_PROPERTY("statistics_output", false, false, false)
 MAPS_PROPERTY("gpu_mat_as_input", false, false, false)
 MAPS_PROPERTY("gpu_mat_as_output", false, false, false)
+MAPS_PROPERTY("clip_limit", 40.0, false, false)
+MAPS_PROPERTY("tile_grid_x", 8, false, false)
+MAPS_PROPERTY("tile_grid_y", 8, false, false)
+MAPS_PROPERTY_ENUM("temporal_subsampling", "1/4|1/16", 1, false, false)
+MAPS_PROPERTY("temporal_smoothing", 0.8, false, false)
+MAPS_PROPERTY("roi_x", 0, false, false)
+MAPS_PROPERTY("roi_y", 0, false, false)
+MAPS_PROPERTY("roi_width", 0, false, false)
+MAPS_PROPERTY("roi_height", 0, false, false)
+MAPS_PROPERTY_ENUM("input_policy", "FIFO|Latest only|Drop every N", 0, false, false)
+MAPS_PROPERTY("drop_interval", 2, false, false)
+MAPS_PROPERTY("fifo_depth", 0, false, false)
+MAPS_PROPERTY("memory_budget", 0, false, false)
+MAPS_PROPERTY("lazy_allocation", false, false, false)
+MAPS_PROPERTY("prewarm_buffers", 2, false, false)
+MAPS_PROPERTY_ENUM("memory_mode", "Device|Managed|Mapped", 0, false, false)
 MAPS_END_PROPERTIES_DEFINITION
 
 // Use the macros to declare the actions
@@ -56,17 +87,99 @@ MAPS_BEGIN_ACTIONS_DEFINITION(MAPSOpenCV_EqualizeHistogram)
     //MAPS_ACTION("aName",MAPSOpenCV_EqualizeHistogram::ActionName)
 MAPS_END_ACTIONS_DEFINITION
 
+//Version 1.2: added the "Luma" channel mode.
+//Version 1.3: added the CLAHE method.
+//Version 1.4: added the temporal mode.
+//Version 1.5: added the statistics output and the "Statistics only" method.
+//Version 1.6: added the "in_place" property (GpuMat input and output only), removed since: the other readers of the input could not be detected.
+//Version 1.7: added the roi_x, roi_y, roi_width and roi_height properties, only the region of interest is equalized.
+//Version 1.8: added the input_policy and drop_interval properties and the input_stats output.
+//Version 1.9: added the fifo_depth and memory_budget properties (GpuMat output only).
+//Version 1.10: lazy_allocation and prewarm_buffers properties, the device memory of the GpuMat output buffers is allocated on their first use.
+//Version 1.11: memory_mode property, the GpuMat output buffers can be allocated in managed or mapped host memory, readable from the host without download.
+
 // Use the macros to declare this component (OpenCV_Resize) behaviour
-MAPS_COMPONENT_DEFINITION(MAPSOpenCV_EqualizeHistogram,"OpenCV_HistogramEqualize_cuda", "1.1.1", 128,
+MAPS_COMPONENT_DEFINITION(MAPSOpenCV_EqualizeHistogram,"OpenCV_HistogramEqualize_cuda", "1.11.0", 128,
                             MAPS::Threaded|MAPS::Sequential, MAPS::Threaded,
                             0, // Nb of inputs
                             0, // Nb of outputs
-                            1, // Nb of properties
+                            5, // Nb of properties
                             -1) // Nb of actions
 
+namespace
+{
+    // BT.601 luma, with the Q14 coefficients of cv::cvtColor (and cv::cuda::cvtColor) so that the CPU and GPU paths
+    // and the CLAHE luma plane agree
+    inline int Luma(int r, int g, int b)
+    {
+        return (4899 * r + 9617 * g + 1868 * b + (1 << 13)) >> 14;
+    }
+
+    // Luminance scale per luma value (Q12) : (equalized luma / luma), rounded to the nearest, 0 for a null luma.
+    // The GPU path computes the scale with cv::cuda::divide, in Q8 (see EqualizeLumaGpu()).
+    void BuildLumaScale(const uchar* lut, int lutStep, int* scale)
+    {
+        scale[0] = 0;
+        for (int i = 1; i < 256; ++i)
+            scale[i] = ((lut[i * lutStep] << 12) + i / 2) / i;
+    }
+
+    // Luminance scale (Q12) for every pair of luma and equalized luma, at [luma * 256 + equalized luma],
+    // rounded as BuildLumaScale(). For the CLAHE, whose equalized luma depends on the position.
+    const int* LumaScaleTable()
+    {
+        static const std::vector<int> table = []
+        {
+            std::vector<int> values(256 * 256, 0);
+            for (int luma = 1; luma < 256; ++luma)
+            {
+                for (int eq = 0; eq < 256; ++eq)
+                    values[luma * 256 + eq] = ((eq << 12) + luma / 2) / luma;
+            }
+            return values;
+        }();
+        return table.data();
+    }
+
+    // Equalization LUT, computed the same way as cv::equalizeHist. lutStep is the distance between two entries of lut.
+    void BuildEqualizationLut(const int* hist, uchar* lut, int lutStep)
+    {
+        int total = 0;
+        for (int i = 0; i < 256; ++i)
+            total += hist[i];
+
+        int first = 0;
+        while (first < 255 && !hist[first])
+            ++first;
+
+        if (hist[first] == total)
+        {
+            // Uniform image : nothing to equalize
+            for (int i = 0; i < 256; ++i)
+                lut[i * lutStep] = static_cast<uchar>(i);
+            return;
+        }
+
+        const float scale = 255.0f / (total - hist[first]);
+        int sum = 0;
+        for (int i = 0; i < 256; ++i)
+        {
+            if (i > first)
+                sum += hist[i];
+            lut[i * lutStep] = i > first ? cv::saturate_cast<uchar>(sum * scale) : 0;
+        }
+    }
+
+    // Number of values published on the "stats" output for each channel : min, max, mean, stddev, 5 percentiles, 256 bins
+    const int kStatsPerChannel = 9 + 256;
+}
 
 void MAPSOpenCV_EqualizeHistogram::Birth()
 {
+    ApplyGpuOutputProperties();
+
+    ApplyInputPolicyProperties();
+
     if (m_useCuda && m_gpuMatAsInput)
     {
         m_inputReader = MAPS::MakeInputReader::Reactive(
@@ -85,6 +198,32 @@ void MAPSOpenCV_EqualizeHistogram::Birth()
             &MAPSOpenCV_EqualizeHistogram::ProcessData      // Called when data is received for the first time AND all subsequent times
         );
     }
+
+    if (m_useClahe)
+    {
+        // The CLAHE objects keep their internal buffers from one frame to the next
+        const double clipLimit = GetFloatProperty("clip_limit");
+        const cv::Size tileGrid(static_cast<int>(GetIntegerProperty("tile_grid_x")), static_cast<int>(GetIntegerProperty("tile_grid_y")));
+        if (clipLimit <= 0.0)
+            Error("clip_limit property : the value must be strictly positive.");
+        if (tileGrid.width < 1 || tileGrid.height < 1)
+            Error("tile_grid_x and tile_grid_y properties : the values must be at least 1.");
+
+        if (m_useCuda)
+            m_gpuClahe = cv::cuda::createCLAHE(clipLimit, tileGrid);
+        else
+            m_clahe = cv::createCLAHE(clipLimit, tileGrid);
+    }
+
+    if (m_temporal)
+    {
+        m_temporalStep = GetIntegerProperty("temporal_subsampling") == 0 ? 2 : 4;
+        m_temporalSmoothing = GetFloatProperty("temporal_smoothing");
+        if (m_temporalSmoothing < 0.0 || m_temporalSmoothing >= 1.0)
+            Error("temporal_smoothing property : the value must be in [0, 1[.");
+    }
+    m_temporalInitialized = false;
+    m_smoothHist.clear();
 }
 
 void MAPSOpenCV_EqualizeHistogram::Core()
@@ -95,6 +234,28 @@ void MAPSOpenCV_EqualizeHistogram::Core()
 void MAPSOpenCV_EqualizeHistogram::Death()
 {
     m_inputReader.reset();
+
+    if (m_inputPolicy.Enabled())
+        ReportInfo(m_inputPolicy.Report().c_str());
+
+    m_planesMatImages.clear();
+    m_gpuPlanes.clear();
+    m_gpuScalePlanes.clear();
+    m_gpuLuma.release();
+    m_gpuLumaEq.release();
+    m_gpuScale.release();
+    m_gpuUnitScale.release();
+    m_gpuScaleImage.release();
+    m_gpuWide.release();
+    m_planeScratch.release();
+    m_luma.release();
+    m_lumaEq.release();
+    m_clahe.release();
+    m_gpuClahe.release();
+    m_temporalLut.release();
+    m_gpuTemporalLuts.clear();
+    m_uploadedTemporalLuts.clear();
+    m_temporalSampler.Release();
 }
 
 void MAPSOpenCV_EqualizeHistogram::Dynamic()
@@ -103,6 +264,30 @@ void MAPSOpenCV_EqualizeHistogram::Dynamic()
     m_gpuMatAsInput = false;
     m_gpuMatAsOutput = false;
 
+    NewProperty("roi_x");
+    NewProperty("roi_y");
+    NewProperty("roi_width");
+    NewProperty("roi_height");
+
+    m_lumaMode = GetIntegerProperty("channel_mode") == 1;
+    m_useClahe = GetIntegerProperty("method") == 1;
+    m_statsOnly = GetIntegerProperty("method") == 2;
+    m_statsOutput = m_statsOnly || GetBoolProperty("statistics_output");
+    if (m_useClahe)
+    {
+        NewProperty("clip_limit");
+        NewProperty("tile_grid_x");
+        NewProperty("tile_grid_y");
+    }
+
+    // The temporal mode replaces the global equalization only
+    m_temporal = !m_useClahe && !m_statsOnly && GetBoolProperty("temporal");
+    if (m_temporal)
+    {
+        NewProperty("temporal_subsampling");
+        NewProperty("temporal_smoothing");
+    }
+
     if (cv::cuda::getCudaEnabledDeviceCount() > 0)
     {
         Property("use_cuda").SetMutable(true);
@@ -129,7 +314,11 @@ void MAPSOpenCV_EqualizeHistogram::Dynamic()
             NewInput("imageIn");
         }
 
-        if (m_gpuMatAsOutput)
+        if (m_statsOnly)
+        {
+            m_gpuMatAsOutput = false;
+        }
+        else if (m_gpuMatAsOutput)
         {
             NewOutput("o_gpu");
         }
@@ -141,33 +330,36 @@ void MAPSOpenCV_EqualizeHistogram::Dynamic()
     else
     {
         NewInput("imageIn");
-        NewOutput("imageOut");
+        if (!m_statsOnly)
+            NewOutput("imageOut");
     }
-}
 
-void MAPSOpenCV_EqualizeHistogram::FreeBuffers()
-{
-    if (m_useCuda && m_gpuMatAsOutput)
-    {
-        MAPS_DynamicCustomStructComponent::FreeBuffers();
-    }
-    else
-    {
-        MAPSComponent::FreeBuffers();
-    }
+    if (m_statsOutput)
+        NewOutput("stats");
+
+    NewInputPolicyProperties();
+    NewGpuOutputProperties("o_gpu");
 }
 
 void MAPSOpenCV_EqualizeHistogram::AllocateOutputBufferSize(const MAPSTimestamp, const MAPS::InputElt<IplImage> imageInElt)
 {
     const IplImage& imageIn = imageInElt.Data();
 
+    CheckInputImage(imageIn);
+    ResolveRoi(imageIn);
+    IplImage model = MAPS::IplImageModel(m_roi.width, m_roi.height, imageIn.channelSeq, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
+    CreateViews(imageIn, model);
+
+    if (m_statsOnly)
+        return;
+
     if (m_gpuMatAsOutput)
     {
         try
         {
             AllocateDynamicOutputBuffers(
                 DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(imageIn.width, imageIn.height, imageIn.nChannels, imageIn); }  // struct allocation
+                    [&] { return new MapsCudaStruct(model.width, model.height, model.nChannels, model, m_memoryMode); }  // struct allocation
                 )
             );
         }
@@ -178,7 +370,7 @@ void MAPSOpenCV_EqualizeHistogram::AllocateOutputBufferSize(const MAPSTimestamp,
     }
     else
     {
-        Output(0).AllocOutputBufferIplImage(imageIn);
+        AllocateIplImageOutputBuffer(Output(0), model);
     }
 }
 
@@ -186,13 +378,24 @@ void MAPSOpenCV_EqualizeHistogram::AllocateOutputBufferSizeGpu(const MAPSTimesta
 {
     const MapsCudaStruct& imageIn = imageInElt.Data();
 
+    CheckInputImage(imageIn.m_IplImageProxy);
+    ResolveRoi(imageIn.m_IplImageProxy);
+    IplImage model = MAPS::IplImageModel(m_roi.width, m_roi.height, imageIn.m_IplImageProxy.channelSeq, IPL_DATA_ORDER_PIXEL,
+        imageIn.m_IplImageProxy.depth, imageIn.m_IplImageProxy.align);
+    CreateViews(imageIn.m_IplImageProxy, model);
+
+    if (m_statsOnly)
+        return;
+
     if (m_gpuMatAsOutput)
     {
+        // Without ROI the output buffers have the same layout as the input ones
+        const bool fullFrame = m_roi.size() == cv::Size(imageIn.m_IplImageProxy.width, imageIn.m_IplImageProxy.height);
         try
         {
             AllocateDynamicOutputBuffers(
                 DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(imageIn); }
+                    [&] { return fullFrame ? new MapsCudaStruct(imageIn.m_size, imageIn.m_IplImageProxy, m_memoryMode) : new MapsCudaStruct(model.width, model.height, model.nChannels, model, m_memoryMode); }
                 )
             );
         }
@@ -203,18 +406,42 @@ void MAPSOpenCV_EqualizeHistogram::AllocateOutputBufferSizeGpu(const MAPSTimesta
     }
     else
     {
-        IplImage model = MAPS::IplImageModel(imageIn.m_IplImageProxy.width, imageIn.m_IplImageProxy.height, imageIn.m_IplImageProxy.channelSeq, IPL_DATA_ORDER_PIXEL,
-            imageIn.m_IplImageProxy.depth, imageIn.m_IplImageProxy.align);
-        Output(0).AllocOutputBufferIplImage(model);
+        AllocateIplImageOutputBuffer(Output(0), model);
     }
 }
 
+void MAPSOpenCV_EqualizeHistogram::CheckInputImage(const IplImage& image)
+{
+    if (image.depth != IPL_DEPTH_8U)
+        Error("This component only accepts 8 bits images on its input.");
+
+    m_nChannels = image.nChannels;
+
+    const MAPSInt32 chanSeq = *(MAPSInt32*)image.channelSeq;
+    m_isBGR = (chanSeq == MAPS_CHANNELSEQ_BGR || chanSeq == MAPS_CHANNELSEQ_BGRA);
+
+    if (m_lumaMode && m_nChannels > 1 && chanSeq != MAPS_CHANNELSEQ_BGR && chanSeq != MAPS_CHANNELSEQ_BGRA &&
+        chanSeq != MAPS_CHANNELSEQ_RGB && chanSeq != MAPS_CHANNELSEQ_RGBA)
+        Error("In \"Luma\" mode, this component only accepts grayscale or RGB/BGR/RGBA/BGRA images on its input.");
+}
+
 void MAPSOpenCV_EqualizeHistogram::ProcessData(const MAPSTimestamp ts, const MAPS::InputElt<IplImage> inElt)
 {
     try
     {
+        if (DropInput(ts))
+            return;
+
         const IplImage& imageIn = inElt.Data();
-        m_tempImageIn = convTools::noCopyIplImage2Mat(&imageIn); // Convert IplImage to cv::Mat without copying
+        m_tempImageIn = m_hostInView(imageIn.imageData);
+
+        if (m_statsOnly)
+        {
+            HistogramPass(m_tempImageIn, nullptr, &m_statsHist, [](const cv::Range&) {});
+            WriteStatistics(ts);
+            return;
+        }
+
         MAPS::OutputGuard<> outGuard{ this, Output(0) };
 
         if (m_useCuda)
@@ -222,44 +449,18 @@ void MAPSOpenCV_EqualizeHistogram::ProcessData(const MAPSTimestamp ts, const MAP
             cv::cuda::GpuMat src(m_tempImageIn);
             if (m_gpuMatAsOutput)
             {
-                MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-                const IplImage& proxyDst = outputData.m_IplImageProxy;
-                cv::cuda::GpuMat dst(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
-                if (m_tempImageIn.channels() == 1) // If there is only one channel, equalize it
-                {
-                    cv::cuda::equalizeHist(src, dst);
-                }
-                else
-                {
-                    std::vector<cv::cuda::GpuMat> planesMatImages;
-                    cv::cuda::split(src, planesMatImages); // Split the channels
-                    for (int i = 0; i < imageIn.nChannels; i++)
-                    {
-                        cv::cuda::equalizeHist(planesMatImages[i], planesMatImages[i]); // Equalize all single-channel
-                    }
-                    cv::cuda::merge(planesMatImages, dst); // Merge to produce the equalize image
-                }
+                MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+                cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
+
+                EqualizeGpu(src, dst);
             }
             else
             {
                 cv::cuda::GpuMat dst;
                 const IplImage& imageOut = outGuard.DataAs<IplImage>();
-                m_tempImageOut = convTools::noCopyIplImage2Mat(&imageOut); // Convert IplImage to cv::Mat without copying
-
-                if (m_tempImageIn.channels() == 1) // If there is only one channel, equalize it
-                {
-                    cv::cuda::equalizeHist(src, dst);
-                }
-                else
-                {
-                    std::vector<cv::cuda::GpuMat> planesMatImages;
-                    cv::cuda::split(src, planesMatImages); // Split the channels
-                    for (int i = 0; i < imageIn.nChannels; i++)
-                    {
-                        cv::cuda::equalizeHist(planesMatImages[i], planesMatImages[i]); // Equalize all single-channel
-                    }
-                    cv::cuda::merge(planesMatImages, dst); // Merge to produce the equalize image
-                }
+                m_tempImageOut = m_hostOutView(imageOut.imageData);
+
+                EqualizeGpu(src, dst);
                 dst.download(m_tempImageOut);
 
                 if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
@@ -269,26 +470,18 @@ void MAPSOpenCV_EqualizeHistogram::ProcessData(const MAPSTimestamp ts, const MAP
         else
         {
             const IplImage& imageOut = outGuard.DataAs<IplImage>();
-            m_tempImageOut = convTools::noCopyIplImage2Mat(&imageOut); // Convert IplImage to cv::Mat without copying
-            if (m_tempImageIn.channels() == 1) // If there is only one channel, equalize it
-            {
-                cv::equalizeHist(m_tempImageIn, m_tempImageOut);
-            }
-            else
-            {
-                cv::split(m_tempImageIn, m_planesMatImages); // Split the channels
-                for (int i = 0; i < imageIn.nChannels; i++)
-                {
-                    cv::equalizeHist(m_planesMatImages[i], m_planesMatImages[i]); // Equalize all single-channel
-                }
-                cv::merge(m_planesMatImages, m_tempImageOut); // Merge to produce the equalize image
-            }
+            m_tempImageOut = m_hostOutView(imageOut.imageData);
+
+            Equalize(m_tempImageIn, m_tempImageOut);
 
             if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
                 Error("cv::Mat data ptr and imageOut data ptr are different.");
         }
 
         outGuard.Timestamp() = ts;
+
+        if (m_statsOutput)
+            WriteStatistics(ts);
     }
     catch (const std::exception& e)
     {
@@ -300,51 +493,34 @@ void MAPSOpenCV_EqualizeHistogram::ProcessDataGpu(const MAPSTimestamp ts, const
 {
     try
     {
+        if (DropInput(ts))
+            return;
+
+        const cv::cuda::GpuMat src = m_deviceInView(inElt.Data().m_points);
+
+        if (m_statsOnly)
+        {
+            ComputeHistogramsGpu(src);
+            WriteStatistics(ts);
+            return;
+        }
+
         MAPS::OutputGuard<> outGuard{ this, Output(0) };
-        const IplImage& proxy = inElt.Data().m_IplImageProxy;
-        const cv::cuda::GpuMat src(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), inElt.Data().m_points);
-        const IplImage& imageIn = inElt.Data().m_IplImageProxy;
 
         if (m_gpuMatAsOutput)
         {
-            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-            const IplImage& proxyDst = outputData.m_IplImageProxy;
-            cv::cuda::GpuMat dst(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
-            if (imageIn.nChannels == 1) // If there is only one channel, equalize it
-            {
-                cv::cuda::equalizeHist(src, dst);
-            }
-            else
-            {
-                std::vector<cv::cuda::GpuMat> planesMatImages;
-                cv::cuda::split(src, planesMatImages); // Split the channels
-                for (int i = 0; i < imageIn.nChannels; i++)
-                {
-                    cv::cuda::equalizeHist(planesMatImages[i], planesMatImages[i]); // Equalize all single-channel
-                }
-                cv::cuda::merge(planesMatImages, dst); // Merge to produce the equalize image
-            }
+            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+            cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
+
+            EqualizeGpu(src, dst);
         }
         else
         {
             cv::cuda::GpuMat dst;
             const IplImage& imageOut = outGuard.DataAs<IplImage>();
-            m_tempImageOut = convTools::noCopyIplImage2Mat(&imageOut); // Convert IplImage to cv::Mat without copying
+            m_tempImageOut = m_hostOutView(imageOut.imageData);
 
-            if (imageIn.nChannels == 1) // If there is only one channel, equalize it
-            {
-                cv::cuda::equalizeHist(src, dst);
-            }
-            else
-            {
-                std::vector<cv::cuda::GpuMat> planesMatImages;
-                cv::cuda::split(src, planesMatImages); // Split the channels
-                for (int i = 0; i < imageIn.nChannels; i++)
-                {
-                    cv::cuda::equalizeHist(planesMatImages[i], planesMatImages[i]); // Equalize all single-channel
-                }
-                cv::cuda::merge(planesMatImages, dst); // Merge to produce the equalize image
-            }
+            EqualizeGpu(src, dst);
             dst.download(m_tempImageOut);
 
             if (static_cast<void*>(m_tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
@@ -352,9 +528,515 @@ void MAPSOpenCV_EqualizeHistogram::ProcessDataGpu(const MAPSTimestamp ts, const
         }
 
         outGuard.Timestamp() = ts;
+
+        if (m_statsOutput)
+            WriteStatistics(ts);
     }
     catch (const std::exception& e)
     {
         Error(e.what());
     }
 }
+
+void MAPSOpenCV_EqualizeHistogram::Equalize(const cv::Mat& src, cv::Mat& dst)
+{
+    if (m_temporal)
+    {
+        EqualizeTemporal(src, dst);
+        return;
+    }
+
+    if (m_statsOutput && !m_useClahe && !(m_lumaMode && src.channels() > 1))
+    {
+        // The histograms are needed anyway : equalize with them instead of letting cv::equalizeHist compute them again
+        EqualizeGlobal(src, dst);
+        return;
+    }
+
+    if (m_statsOutput && m_useClahe)
+        HistogramPass(src, nullptr, &m_statsHist, [](const cv::Range&) {}); // CLAHE has no global histogram : additional read
+
+    if (src.channels() == 1) // If there is only one channel, equalize it
+    {
+        EqualizePlane(src, dst);
+    }
+    else if (m_lumaMode)
+    {
+        if (m_useClahe)
+            EqualizeLumaClahe(src, dst);
+        else
+            EqualizeLuma(src, dst);
+    }
+    else
+    {
+        cv::split(src, m_planesMatImages); // Split the channels
+        for (cv::Mat& plane : m_planesMatImages)
+        {
+            EqualizePlane(plane, m_planeScratch); // Equalize all single-channel
+            std::swap(plane, m_planeScratch);
+        }
+        cv::merge(m_planesMatImages, dst); // Merge to produce the equalize image
+    }
+}
+
+void MAPSOpenCV_EqualizeHistogram::EqualizePlane(const cv::Mat& src, cv::Mat& dst)
+{
+    if (m_useClahe)
+        m_clahe->apply(src, dst); // Tile histograms and interpolation are spread over the OpenCV thread pool
+    else
+        cv::equalizeHist(src, dst);
+}
+
+// Equalizes each channel with its own histogram : one pass to compute all the histograms, then a single multi-channel LUT.
+void MAPSOpenCV_EqualizeHistogram::EqualizeGlobal(const cv::Mat& src, cv::Mat& dst)
+{
+    const int cn = src.channels();
+
+    HistogramPass(src, nullptr, &m_statsHist, [](const cv::Range&) {});
+
+    m_globalLut.create(1, 256, CV_8UC(cn));
+    for (int c = 0; c < cn; ++c)
+        BuildEqualizationLut(&m_statsHist[c * 256], m_globalLut.ptr<uchar>() + c, cn);
+
+    cv::LUT(src, m_globalLut, dst);
+}
+
+// Equalizes the luma of the image and scales each pixel by (equalized luma / luma), which keeps the hue and the saturation.
+// The image is read twice (histogram, then scaling) and written once : no luma/chroma planes are stored.
+void MAPSOpenCV_EqualizeHistogram::EqualizeLuma(const cv::Mat& src, cv::Mat& dst)
+{
+    // Histogram of the luma, computed on the fly (and the histograms of the channels for the statistics)
+    HistogramPass(src, &m_lumaHist, m_statsOutput ? &m_statsHist : nullptr, [](const cv::Range&) {});
+
+    uchar lut[256];
+    BuildEqualizationLut(m_lumaHist.data(), lut, 1);
+
+    int scale[256];
+    BuildLumaScale(lut, 1, scale);
+
+    // Scaling pass
+    dst.create(src.size(), src.type());
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range)
+    {
+        cv::Mat dstRows = dst.rowRange(range);
+        ScaleByLuma(src.rowRange(range), dstRows, scale);
+    }, std::max(1, src.rows / 32));
+}
+
+// Scales each pixel by scale[luma] (Q12). Alpha (if any) is copied as is.
+void MAPSOpenCV_EqualizeHistogram::ScaleByLuma(const cv::Mat& src, cv::Mat& dst, const int* scale)
+{
+    const int cn = src.channels();
+    const int rIdx = m_isBGR ? 2 : 0;
+    const int bIdx = m_isBGR ? 0 : 2;
+
+    for (int y = 0; y < src.rows; ++y)
+    {
+        const uchar* pixIn = src.ptr<uchar>(y);
+        uchar* pixOut = dst.ptr<uchar>(y);
+        for (int x = 0; x < src.cols; ++x, pixIn += cn, pixOut += cn)
+        {
+            const int s = scale[Luma(pixIn[rIdx], pixIn[1], pixIn[bIdx])];
+            pixOut[0] = static_cast<uchar>(std::min((pixIn[0] * s + 2048) >> 12, 255));
+            pixOut[1] = static_cast<uchar>(std::min((pixIn[1] * s + 2048) >> 12, 255));
+            pixOut[2] = static_cast<uchar>(std::min((pixIn[2] * s + 2048) >> 12, 255));
+            if (cn == 4)
+                pixOut[3] = pixIn[3];
+        }
+    }
+}
+
+// Accumulates the histograms of the rows of the image that are multiple of step (firstRow is the index of the first row
+// of the stripe in the image), one pixel every step : the histogram of the luma in lumaHist (256 bins),
+// and the histogram of each channel in channelHist (256 bins per channel). Any of them can be null.
+void MAPSOpenCV_EqualizeHistogram::AccumulateHistogram(const cv::Mat& rows, int firstRow, int step, int* lumaHist, int* channelHist)
+{
+    const int cn = rows.channels();
+    const int rIdx = m_isBGR ? 2 : 0;
+    const int bIdx = m_isBGR ? 0 : 2;
+
+    // 4 banks used in turn : consecutive samples falling in the same bin do not wait for each other's increment.
+    // The bank follows the sample count and not x, which moves by step.
+    int lumaBanks[4][256] = {};
+    int channelBanks[4][4 * 256] = {};
+    unsigned int n = 0;
+
+    for (int y = (step - firstRow % step) % step; y < rows.rows; y += step)
+    {
+        const uchar* pix = rows.ptr<uchar>(y);
+        for (int x = 0; x < rows.cols; x += step)
+        {
+            const uchar* p = pix + x * cn;
+            const int bank = n++ & 3;
+            if (lumaHist)
+                ++lumaBanks[bank][Luma(p[rIdx], p[1], p[bIdx])];
+            if (channelHist)
+            {
+                for (int c = 0; c < cn; ++c)
+                    ++channelBanks[bank][c * 256 + p[c]];
+            }
+        }
+    }
+
+    if (lumaHist)
+    {
+        for (int i = 0; i < 256; ++i)
+            lumaHist[i] += lumaBanks[0][i] + lumaBanks[1][i] + lumaBanks[2][i] + lumaBanks[3][i];
+    }
+    if (channelHist)
+    {
+        for (int i = 0; i < cn * 256; ++i)
+            channelHist[i] += channelBanks[0][i] + channelBanks[1][i] + channelBanks[2][i] + channelBanks[3][i];
+    }
+}
+
+// Computes the histograms of the whole image, stripe by stripe in parallel, and calls apply on each stripe
+// right after its histograms, while it is still in cache.
+template <typename Apply>
+void MAPSOpenCV_EqualizeHistogram::HistogramPass(const cv::Mat& src, std::vector<int>* lumaHist, std::vector<int>* channelHist, Apply apply, int step)
+{
+    const int cn = src.channels();
+    if (lumaHist)
+        lumaHist->assign(256, 0);
+    if (channelHist)
+        channelHist->assign(cn * 256, 0);
+
+    std::mutex histMutex;
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range)
+    {
+        std::vector<int> stripeLuma(lumaHist ? 256 : 0, 0);
+        std::vector<int> stripeChannels(channelHist ? cn * 256 : 0, 0);
+        AccumulateHistogram(src.rowRange(range), range.start, step,
+            lumaHist ? stripeLuma.data() : nullptr, channelHist ? stripeChannels.data() : nullptr);
+
+        apply(range);
+
+        std::lock_guard<std::mutex> lock(histMutex);
+        for (size_t i = 0; i < stripeLuma.size(); ++i)
+            (*lumaHist)[i] += stripeLuma[i];
+        for (size_t i = 0; i < stripeChannels.size(); ++i)
+            (*channelHist)[i] += stripeChannels[i];
+    }, std::max(1, src.rows / 32));
+}
+
+// Applies the LUT built from the previous frames, and gathers the subsampled histograms of the current frame in the same pass.
+void MAPSOpenCV_EqualizeHistogram::EqualizeTemporal(const cv::Mat& src, cv::Mat& dst)
+{
+    const bool luma = m_lumaMode && src.channels() > 1;
+
+    // In "Luma" mode the histograms of the channels are only needed for the statistics. Otherwise they are the ones
+    // used for the equalization.
+    std::vector<int>* lumaHist = luma ? &m_frameHist : nullptr;
+    std::vector<int>* channelHist = luma ? (m_statsOutput ? &m_statsHist : nullptr) : &m_frameHist;
+
+    if (!m_temporalInitialized)
+    {
+        // First frame : no previous histogram, the statistics of this frame are used
+        HistogramPass(src, lumaHist, channelHist, [](const cv::Range&) {}, m_temporalStep);
+        UpdateTemporalLut(m_frameHist.data(), static_cast<int>(m_frameHist.size() / 256));
+    }
+
+    dst.create(src.size(), src.type());
+    HistogramPass(src, lumaHist, channelHist, [&](const cv::Range& range)
+    {
+        const cv::Mat srcRows = src.rowRange(range);
+        cv::Mat dstRows = dst.rowRange(range);
+        if (luma)
+            ScaleByLuma(srcRows, dstRows, m_temporalLumaScale);
+        else
+            cv::LUT(srcRows, m_temporalLut, dstRows);
+    }, m_temporalStep);
+
+    if (!luma && m_statsOutput)
+        m_statsHist = m_frameHist;
+
+    UpdateTemporalLut(m_frameHist.data(), static_cast<int>(m_frameHist.size() / 256)); // Used by the next frame
+}
+
+// Blends the histograms of the current frame into the smoothed histograms and rebuilds the equalization LUTs from them.
+void MAPSOpenCV_EqualizeHistogram::UpdateTemporalLut(const int* hist, int nbHist)
+{
+    int count = 0;
+    for (int i = 0; i < 256; ++i)
+        count += hist[i];
+    if (count == 0)
+        return;
+
+    if (m_smoothHist.size() != static_cast<size_t>(nbHist * 256))
+    {
+        m_smoothHist.assign(nbHist * 256, 0.0);
+        m_temporalInitialized = false;
+    }
+
+    for (int i = 0; i < nbHist * 256; ++i)
+    {
+        const double p = static_cast<double>(hist[i]) / count;
+        m_smoothHist[i] = m_temporalInitialized ? m_temporalSmoothing * m_smoothHist[i] + (1.0 - m_temporalSmoothing) * p : p;
+    }
+    m_temporalInitialized = true;
+
+    // Equalization LUTs, computed the same way as cv::equalizeHist
+    m_temporalLut.create(1, 256, CV_8UC(nbHist));
+    for (int h = 0; h < nbHist; ++h)
+    {
+        const double* smooth = &m_smoothHist[h * 256];
+        int first = 0;
+        while (first < 255 && smooth[first] <= 0.0)
+            ++first;
+
+        const double range = 1.0 - smooth[first];
+        double cdf = 0.0;
+        for (int i = 0; i < 256; ++i)
+        {
+            uchar value;
+            if (range <= 1e-9)
+                value = static_cast<uchar>(i); // Uniform image : keep it as is
+            else if (i <= first)
+                value = 0;
+            else
+            {
+                cdf += smooth[i];
+                value = cv::saturate_cast<uchar>(255.0 * cdf / range);
+            }
+            m_temporalLut.ptr<uchar>()[i * nbHist + h] = value;
+        }
+    }
+
+    if (m_lumaMode && m_nChannels > 1)
+        BuildLumaScale(m_temporalLut.ptr<uchar>(), 1, m_temporalLumaScale);
+
+    if (m_useCuda)
+    {
+        // A cv::cuda::LookUpTable cannot be updated : it is only recreated when its table actually changed,
+        // which is rare once the smoothed histograms are stable. It takes a table of 1 or 3 channels : with 4
+        // channels, there is one table per plane.
+        const int nbLuts = nbHist == 4 ? 4 : 1;
+        m_gpuTemporalLuts.resize(nbLuts);
+        m_uploadedTemporalLuts.resize(nbLuts);
+        for (int h = 0; h < nbLuts; ++h)
+        {
+            if (nbLuts > 1)
+                cv::extractChannel(m_temporalLut, m_planeLut, h);
+            const cv::Mat& table = nbLuts > 1 ? m_planeLut : m_temporalLut;
+            const cv::Mat& uploaded = m_uploadedTemporalLuts[h];
+            if (!m_gpuTemporalLuts[h] || uploaded.type() != table.type()
+                || !std::equal(table.ptr<uchar>(), table.ptr<uchar>() + 256 * table.channels(), uploaded.ptr<uchar>()))
+            {
+                m_gpuTemporalLuts[h] = cv::cuda::createLookUpTable(table);
+                table.copyTo(m_uploadedTemporalLuts[h]);
+            }
+        }
+    }
+}
+
+// Same as EqualizeLuma() but with a CLAHE on the luma plane : the equalized luma depends on the position,
+// so the luma plane is stored and each pixel is scaled by (equalized luma / luma).
+void MAPSOpenCV_EqualizeHistogram::EqualizeLumaClahe(const cv::Mat& src, cv::Mat& dst)
+{
+    const int cn = src.channels();
+    if (cn == 3)
+        cv::cvtColor(src, m_luma, m_isBGR ? cv::COLOR_BGR2GRAY : cv::COLOR_RGB2GRAY);
+    else
+        cv::cvtColor(src, m_luma, m_isBGR ? cv::COLOR_BGRA2GRAY : cv::COLOR_RGBA2GRAY);
+
+    m_clahe->apply(m_luma, m_lumaEq);
+
+    // Same rounded scale as the global equalization, without a division in the scaling pass
+    const int* scaleTable = LumaScaleTable();
+
+    dst.create(src.size(), src.type());
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range)
+    {
+        for (int y = range.start; y < range.end; ++y)
+        {
+            const uchar* pixIn = src.ptr<uchar>(y);
+            const uchar* luma = m_luma.ptr<uchar>(y);
+            const uchar* lumaEq = m_lumaEq.ptr<uchar>(y);
+            uchar* pixOut = dst.ptr<uchar>(y);
+            for (int x = 0; x < src.cols; ++x, pixIn += cn, pixOut += cn)
+            {
+                const int s = scaleTable[(luma[x] << 8) + lumaEq[x]]; // Q12
+                pixOut[0] = static_cast<uchar>(std::min((pixIn[0] * s + 2048) >> 12, 255));
+                pixOut[1] = static_cast<uchar>(std::min((pixIn[1] * s + 2048) >> 12, 255));
+                pixOut[2] = static_cast<uchar>(std::min((pixIn[2] * s + 2048) >> 12, 255));
+                if (cn == 4)
+                    pixOut[3] = pixIn[3];
+            }
+        }
+    }, std::max(1, src.rows / 32));
+}
+
+void MAPSOpenCV_EqualizeHistogram::EqualizeGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst)
+{
+    if (m_temporal)
+    {
+        // The statistics are computed on a nearest neighbour subsample, which is the only part of the image downloaded.
+        // The download does not wait for the GPU : the subsample of a frame updates the LUT from the next frame on
+        // (or later, if the GPU is late), except on the first frame, which has no previous histogram.
+        cv::Mat sample;
+        if (m_temporalSampler.Take(sample))
+            UpdateTemporalLutGpu(sample);
+        m_temporalSampler.Enqueue(src, m_temporalStep);
+        if (!m_temporalInitialized && m_temporalSampler.Take(sample, true))
+            UpdateTemporalLutGpu(sample);
+    }
+    else if (m_statsOutput)
+    {
+        ComputeHistogramsGpu(src);
+    }
+
+    if (src.channels() == 1) // If there is only one channel, equalize it
+    {
+        EqualizePlaneGpu(src, dst, 0);
+    }
+    else if (m_lumaMode)
+    {
+        EqualizeLumaGpu(src, dst);
+    }
+    else if (m_temporal && src.channels() == 3)
+    {
+        m_gpuTemporalLuts[0]->transform(src, dst); // One LUT with a table per channel
+    }
+    else
+    {
+        cv::cuda::split(src, m_gpuPlanes); // Split the channels
+        for (size_t i = 0; i < m_gpuPlanes.size(); i++)
+        {
+            EqualizePlaneGpu(m_gpuPlanes[i], m_gpuLumaEq, static_cast<int>(i)); // Equalize all single-channel
+            std::swap(m_gpuPlanes[i], m_gpuLumaEq);
+        }
+        cv::cuda::merge(m_gpuPlanes, dst); // Merge to produce the equalize image
+    }
+}
+
+// Gathers the histograms of a subsample downloaded in temporal mode, and updates the LUTs with them.
+void MAPSOpenCV_EqualizeHistogram::UpdateTemporalLutGpu(const cv::Mat& sample)
+{
+    const bool luma = m_lumaMode && sample.channels() > 1;
+    const int nbBins = (luma ? 1 : sample.channels()) * 256;
+    m_frameHist.assign(nbBins, 0);
+    if (luma && m_statsOutput)
+        m_statsHist.assign(sample.channels() * 256, 0);
+    AccumulateHistogram(sample, 0, 1, luma ? m_frameHist.data() : nullptr,
+        luma ? (m_statsOutput ? m_statsHist.data() : nullptr) : m_frameHist.data());
+    if (!luma && m_statsOutput)
+        m_statsHist = m_frameHist;
+    UpdateTemporalLut(m_frameHist.data(), nbBins / 256);
+}
+
+// plane is the index of the histogram of the plane in temporal mode
+void MAPSOpenCV_EqualizeHistogram::EqualizePlaneGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst, int plane)
+{
+    if (m_temporal)
+        m_gpuTemporalLuts[plane]->transform(src, dst);
+    else if (m_useClahe)
+        m_gpuClahe->apply(src, dst, cv::cuda::Stream::Null());
+    else
+        cv::cuda::equalizeHist(src, dst);
+}
+
+// Same as EqualizeLuma() on the device : the luma is equalized (or goes through the CLAHE, or the temporal LUT)
+// and each pixel is scaled by (equalized luma / luma). The scale is computed in Q8 on 16 bits (at most 255 * 256) and
+// applied by a single multiplication, rounded to the nearest and saturated : the result may differ by 1 from the Q12
+// arithmetic of the CPU path. cv::cuda::multiply needs operands of the same type, so the image is widened to 16 bits
+// once. All the intermediate buffers are kept from one frame to the next.
+void MAPSOpenCV_EqualizeHistogram::EqualizeLumaGpu(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst)
+{
+    const int cn = src.channels();
+    if (cn == 3)
+        cv::cuda::cvtColor(src, m_gpuLuma, m_isBGR ? cv::COLOR_BGR2GRAY : cv::COLOR_RGB2GRAY);
+    else
+        cv::cuda::cvtColor(src, m_gpuLuma, m_isBGR ? cv::COLOR_BGRA2GRAY : cv::COLOR_RGBA2GRAY);
+    EqualizePlaneGpu(m_gpuLuma, m_gpuLumaEq, 0);
+
+    // Scale per pixel (Q8), rounded to the nearest : the division by a null luma gives 0
+    cv::cuda::divide(m_gpuLumaEq, m_gpuLuma, m_gpuScale, 256.0, CV_16U);
+
+    m_gpuScalePlanes.assign(cn, m_gpuScale);
+    if (cn == 4)
+    {
+        // Unity scale : alpha is copied as is
+        if (m_gpuUnitScale.size() != src.size())
+        {
+            m_gpuUnitScale.create(src.size(), CV_16UC1);
+            m_gpuUnitScale.setTo(cv::Scalar::all(1 << 8));
+        }
+        m_gpuScalePlanes[3] = m_gpuUnitScale;
+    }
+    cv::cuda::merge(m_gpuScalePlanes, m_gpuScaleImage);
+
+    src.convertTo(m_gpuWide, CV_16U);
+    cv::cuda::multiply(m_gpuWide, m_gpuScaleImage, dst, 1.0 / 256.0, CV_8U);
+}
+
+// Computes the histogram of each channel on the device : only the histograms are downloaded.
+void MAPSOpenCV_EqualizeHistogram::ComputeHistogramsGpu(const cv::cuda::GpuMat& src)
+{
+    const int cn = src.channels();
+    m_statsHist.assign(cn * 256, 0);
+
+    if (cn > 1)
+        cv::cuda::split(src, m_gpuStatsPlanes);
+
+    for (int c = 0; c < cn; ++c)
+    {
+        cv::cuda::calcHist(cn > 1 ? m_gpuStatsPlanes[c] : src, m_gpuHist);
+        cv::Mat hist(1, 256, CV_32SC1, &m_statsHist[c * 256]);
+        m_gpuHist.download(hist);
+    }
+}
+
+// Publishes, for each channel : min, max, mean, stddev, 1st, 5th, 50th, 95th and 99th percentiles, then the 256 bins of the histogram.
+void MAPSOpenCV_EqualizeHistogram::WriteStatistics(const MAPSTimestamp ts)
+{
+    static const double percentiles[5] = { 1.0, 5.0, 50.0, 95.0, 99.0 };
+
+    const int cn = static_cast<int>(m_statsHist.size() / 256);
+    MAPS::OutputGuard<MAPSFloat64> outGuard{ this, Output("stats") };
+
+    for (int c = 0; c < cn; ++c)
+    {
+        const int* hist = &m_statsHist[c * 256];
+        MAPSFloat64* out = &outGuard.Data(c * kStatsPerChannel);
+
+        double count = 0.0, sum = 0.0, sumSq = 0.0;
+        int minValue = 255, maxValue = 0;
+        for (int i = 0; i < 256; ++i)
+        {
+            if (hist[i])
+            {
+                minValue = std::min(minValue, i);
+                maxValue = std::max(maxValue, i);
+            }
+            count += hist[i];
+            sum += static_cast<double>(hist[i]) * i;
+            sumSq += static_cast<double>(hist[i]) * i * i;
+            out[9 + i] = hist[i];
+        }
+
+        if (count == 0.0)
+        {
+            std::fill(out, out + 9, 0.0);
+            continue;
+        }
+
+        const double mean = sum / count;
+        out[0] = minValue;
+        out[1] = maxValue;
+        out[2] = mean;
+        out[3] = std::sqrt(std::max(sumSq / count - mean * mean, 0.0));
+
+        double cumul = 0.0;
+        int bin = 0;
+        for (int p = 0; p < 5; ++p)
+        {
+            const double target = count * percentiles[p] / 100.0;
+            while (bin < 255 && cumul + hist[bin] < target)
+                cumul += hist[bin++];
+            out[4 + p] = bin;
+        }
+    }
+
+    outGuard.VectorSize() = cn * kStatsPerChannel;
+    outGuard.Timestamp() = ts;
+}
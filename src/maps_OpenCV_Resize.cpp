@@ -40,6 +40,7 @@ MAPS_END_INPUTS_DEFINITION
 MAPS_BEGIN_OUTPUTS_DEFINITION(MAPSOpenCV_Resize)
 MAPS_OUTPUT("imageOut", MAPS::IplImage, nullptr, nullptr, 0)
 MAPS_OUTPUT_USER_DYNAMIC_STRUCTURE("o_gpu", MapsCudaStruct)
+MAPS_OUTPUT("input_stats", MAPS::Float64, nullptr, nullptr, 2)
 MAPS_END_OUTPUTS_DEFINITION
 
 // Use the macros to declare the properties
@@ -50,6 +51,20 @@ MAPS_PROPERTY_ENUM("interpolation", "Nearest Neighbor|Bilinear|Bicubic|Area|Lanc
 MAPS_PROPERTY("use_cuda", false, false, false)
 MAPS_PROPERTY("gpu_mat_as_input", false, false, false)
 MAPS_PROPERTY("gpu_mat_as_output", false, false, false)
+MAPS_PROPERTY("roi_x", 0, false, false)
+MAPS_PROPERTY("roi_y", 0, false, false)
+MAPS_PROPERTY("roi_width", 0, false, false)
+MAPS_PROPERTY("roi_height", 0, false, false)
+MAPS_PROPERTY_ENUM("pipeline", "Off|Double buffering|Triple buffering", 0, false, false)
+MAPS_PROPERTY("batch_size", 1, false, false)
+MAPS_PROPERTY("batch_timeout", 20000, false, false)
+MAPS_PROPERTY_ENUM("input_policy", "FIFO|Latest only|Drop every N", 0, false, false)
+MAPS_PROPERTY("drop_interval", 2, false, false)
+MAPS_PROPERTY("fifo_depth", 0, false, false)
+MAPS_PROPERTY("memory_budget", 0, false, false)
+MAPS_PROPERTY("lazy_allocation", false, false, false)
+MAPS_PROPERTY("prewarm_buffers", 2, false, false)
+MAPS_PROPERTY_ENUM("memory_mode", "Device|Managed|Mapped", 0, false, false)
 MAPS_END_PROPERTIES_DEFINITION
 
 // Use the macros to declare the actions
@@ -57,8 +72,16 @@ MAPS_BEGIN_ACTIONS_DEFINITION(MAPSOpenCV_Resize)
     //MAPS_ACTION("aName",MAPSOpenCV_Resize::ActionName)
 MAPS_END_ACTIONS_DEFINITION
 
+//Version 1.2: roi_x, roi_y, roi_width and roi_height properties, only the region of interest is resized.
+//Version 1.3: pipeline property, overlaps the upload, resize and download of consecutive frames in CUDA mode with IplImage input and output.
+//Version 1.4: batch_size and batch_timeout properties, resizes several IplImage frames per call.
+//Version 1.5: input_policy and drop_interval properties, input_stats output: stale frames can be skipped when the component falls behind its input.
+//Version 1.6: fifo_depth and memory_budget properties, sizes the FIFO of the GpuMat outputs and bounds the device memory of their buffers.
+//Version 1.7: lazy_allocation and prewarm_buffers properties, the device memory of the GpuMat output buffers is allocated on their first use.
+//Version 1.8: memory_mode property, the GpuMat output buffers can be allocated in managed or mapped host memory, readable from the host without download.
+
 // Use the macros to declare this component (OpenCV_Resize) behaviour
-MAPS_COMPONENT_DEFINITION(MAPSOpenCV_Resize, "OpenCV_Resize_cuda", "1.1.0", 128,
+MAPS_COMPONENT_DEFINITION(MAPSOpenCV_Resize, "OpenCV_Resize_cuda", "1.8.0", 128,
                             MAPS::Threaded | MAPS::Sequential, MAPS::Threaded,
                             0, // Nb of inputs
                             0, // Nb of outputs
@@ -67,10 +90,23 @@ MAPS_COMPONENT_DEFINITION(MAPSOpenCV_Resize, "OpenCV_Resize_cuda", "1.1.0", 128,
 
 void MAPSOpenCV_Resize::Birth()
 {
+    ApplyGpuOutputProperties();
+    ApplyInputPolicyProperties();
+
     m_newSize = cv::Size(static_cast<int>(GetIntegerProperty("new_size_x")), static_cast<int>(GetIntegerProperty("new_size_y")));
     UpdateInterp(GetIntegerProperty("interpolation"));
+
+    // Selection 1 and 2 give 2 and 3 slots, 0 disables the pipeline
+    const bool pipelined = m_useCuda && !m_gpuMatAsInput && !m_gpuMatAsOutput && m_batchSize <= 1;
+    m_pipeline.Reset(pipelined ? static_cast<int>(GetIntegerProperty("pipeline")) + 1 : 0);
    
-    if (m_useCuda && m_gpuMatAsInput)
+    if (m_batchSize > 1)
+    {
+        // The inputs are read in Core(), see ReadBatch()
+        m_batchTimeout = GetIntegerProperty("batch_timeout");
+        m_outputAllocated = false;
+    }
+    else if (m_useCuda && m_gpuMatAsInput)
     {
         m_inputReader = MAPS::MakeInputReader::Reactive(
             this,
@@ -93,18 +129,53 @@ void MAPSOpenCV_Resize::Birth()
 
 void MAPSOpenCV_Resize::Core()
 {
+    if (m_batchSize > 1)
+    {
+        ReadBatch();
+        return;
+    }
+
+    // The frames completed since the last input are output before waiting for the next one. When no input is waiting,
+    // the frames still in flight are waited for and output: they are not held while the read blocks.
+    if (m_pipeline.Enabled())
+        m_pipeline.EmitBeforeRead([this](const GpuPipeline::Slot& done) { WritePipelined(done); }, DataAvailableInFIFO(Input(0)) != 0);
+
     m_inputReader->Read();
 }
 
 void MAPSOpenCV_Resize::Death()
 {
     m_inputReader.reset();
+
+    if (m_inputPolicy.Enabled())
+        ReportInfo(m_inputPolicy.Report().c_str());
+
+    m_batch.Clear();
+    m_gpuBatchIn.release();
+    m_gpuBatchOut.release();
+
+    if (m_pipeline.Enabled())
+    {
+        // The frames still in flight are output
+        m_pipeline.Flush([this](const GpuPipeline::Slot& done) { WritePipelined(done); });
+        ReportInfo(m_pipeline.Report().c_str());
+        m_pipeline.Reset(0);
+    }
 }
 
 void MAPSOpenCV_Resize::AllocateOutputBufferSize(const MAPSTimestamp, const MAPS::InputElt<IplImage> imageInElt)
 {
-    const IplImage& imageIn = imageInElt.Data();
-    IplImage model = MAPS::IplImageModel(m_newSize.width, m_newSize.height, imageIn.channelSeq, imageIn.dataOrder, imageIn.depth, imageIn.align);
+    AllocateOutputs(imageInElt.Data());
+}
+
+void MAPSOpenCV_Resize::AllocateOutputs(const IplImage& imageIn)
+{
+    ResolveRoi(imageIn);
+    IplImage model = MAPS::IplImageModel(m_newSize.width, m_newSize.height, imageIn.channelSeq, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
+    CreateViews(imageIn, model);
+
+    if (m_batchSize > 1)
+        m_batch.Reset(m_batchSize, m_roi.size(), m_hostInView.Type());
 
     if (m_gpuMatAsOutput)
     {
@@ -112,7 +183,7 @@ void MAPSOpenCV_Resize::AllocateOutputBufferSize(const MAPSTimestamp, const MAPS
         {
             AllocateDynamicOutputBuffers(
                 DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(model.width, model.height, model.nChannels, model); }  // struct allocation
+                    [&] { return new MapsCudaStruct(model.width, model.height, model.nChannels, model, m_memoryMode); }  // struct allocation
                 )
             );
         }
@@ -123,7 +194,7 @@ void MAPSOpenCV_Resize::AllocateOutputBufferSize(const MAPSTimestamp, const MAPS
     }
     else
     {
-        Output(0).AllocOutputBufferIplImage(model);
+        AllocateIplImageOutputBuffer(Output(0), model);
     }
 }
 
@@ -131,23 +202,31 @@ void MAPSOpenCV_Resize::ProcessData(const MAPSTimestamp ts, const MAPS::InputElt
 {
     try
     {
+        if (DropInput(ts))
+            return;
+
+        if (m_pipeline.Enabled())
+        {
+            ProcessDataPipelined(ts, inElt.Data());
+            return;
+        }
+
         MAPS::OutputGuard<> outGuard{ this, Output(0) };
-        cv::Mat tempImageIn = convTools::noCopyIplImage2Mat(&inElt.Data());
+        const cv::Mat tempImageIn = m_hostInView(inElt.Data().imageData);
 
         if (m_useCuda)
         {
             cv::cuda::GpuMat src(tempImageIn);
             if (m_gpuMatAsOutput)
             {
-                MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-                const IplImage& proxyDst = outputData.m_IplImageProxy;
-                cv::cuda::GpuMat dst(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
+                MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+                cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
                 cv::cuda::resize(src, dst, m_newSize, 0, 0, m_method);
             }
             else
             {
                 const IplImage& imageOut = outGuard.DataAs<IplImage>();
-                cv::Mat tempImageOut = convTools::noCopyIplImage2Mat(&imageOut);
+                cv::Mat tempImageOut = m_hostOutView(imageOut.imageData);
                 cv::cuda::GpuMat dst;
                 cv::cuda::resize(src, dst, m_newSize, 0, 0, m_method);
                 dst.download(tempImageOut);
@@ -159,7 +238,7 @@ void MAPSOpenCV_Resize::ProcessData(const MAPSTimestamp ts, const MAPS::InputElt
         else
         {
             const IplImage& imageOut = outGuard.DataAs<IplImage>();
-            cv::Mat tempImageOut = convTools::noCopyIplImage2Mat(&imageOut);
+            cv::Mat tempImageOut = m_hostOutView(imageOut.imageData);
             cv::resize(tempImageIn, tempImageOut, m_newSize, 0, 0, m_method);
 
             if (static_cast<void*>(tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
@@ -174,9 +253,159 @@ void MAPSOpenCV_Resize::ProcessData(const MAPSTimestamp ts, const MAPS::InputElt
     }
 }
 
+// The frames are output by WritePipelined() as soon as their work is complete, in the order of reception (see GpuPipeline).
+void MAPSOpenCV_Resize::ProcessDataPipelined(const MAPSTimestamp ts, const IplImage& imageIn)
+{
+    const auto emit = [this](const GpuPipeline::Slot& done) { WritePipelined(done); };
+    GpuPipeline::Slot& slot = m_pipeline.Next(emit);
+
+    slot.Upload(m_hostInView(imageIn.imageData));
+    cv::cuda::resize(slot.Src(), slot.Dst(), m_newSize, 0, 0, m_method, slot.stream);
+    slot.Download();
+    m_pipeline.Submit(ts);
+    m_pipeline.EmitCompleted(emit);
+}
+
+void MAPSOpenCV_Resize::WritePipelined(const GpuPipeline::Slot& done)
+{
+    MAPS::OutputGuard<> outGuard{ this, Output(0) };
+    IplImage& imageOut = outGuard.DataAs<IplImage>();
+    cv::Mat tempImageOut = m_hostOutView(imageOut.imageData);
+    done.PinnedOut().copyTo(tempImageOut);
+    outGuard.Timestamp() = done.Timestamp();
+
+    if (static_cast<void*>(tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+        Error("cv::Mat data ptr and imageOut data ptr are different.");
+}
+
+// The first frame of a batch is waited for, the next ones for batch_timeout at most: the batch is processed when it is full
+// or when the timeout expires, so that the frames are not delayed by more than batch_timeout.
+void MAPSOpenCV_Resize::ReadBatch()
+{
+    const FrameBatch::ClearGuard clearGuard{ m_batch };
+    try
+    {
+        MAPSIOElt* ioElt = StartReading(Input(0));
+        if (ioElt == nullptr)
+            return;
+        AddToBatch(*ioElt);
+
+        const MAPSTimestamp deadline = MAPS::CurrentTime() + m_batchTimeout;
+        while (!m_batch.Full())
+        {
+            bool timedOut = false;
+            if (DataAvailableInFIFO(Input(0)))
+            {
+                ioElt = StartReading(Input(0));
+            }
+            else
+            {
+                // Blocking read until the next frame arrives or the deadline passes
+                const MAPSDelay remaining = deadline - MAPS::CurrentTime();
+                if (remaining <= 0)
+                    break;
+                ioElt = StartReading(Input(0), remaining, &timedOut);
+            }
+            if (ioElt == nullptr)
+            {
+                if (timedOut)
+                    break;
+                return; // The component is dying
+            }
+            AddToBatch(*ioElt);
+        }
+
+        // All the frames may have been dropped by the input policy
+        if (m_batch.Size() == 0)
+            return;
+
+        ProcessBatch();
+    }
+    catch (const std::exception& e)
+    {
+        Error(e.what());
+    }
+}
+
+void MAPSOpenCV_Resize::AddToBatch(MAPSIOElt& ioElt)
+{
+    const IplImage& imageIn = ioElt.IplImage();
+    if (!m_outputAllocated)
+    {
+        AllocateOutputs(imageIn);
+        m_outputAllocated = true;
+    }
+
+    if (DropInput(ioElt.Timestamp()))
+        return;
+
+    m_batch.Add(m_hostInView(imageIn.imageData), ioElt.Timestamp());
+}
+
+// The frames are resized in one call: a single upload, resize calls queued on one stream and a single download in CUDA mode,
+// one parallel loop over the frames otherwise. They are then output one by one with their own timestamps.
+void MAPSOpenCV_Resize::ProcessBatch()
+{
+    const int count = m_batch.Size();
+    const cv::Mat frames = m_batch.Frames();
+    const int srcHeight = m_roi.height;
+    const int dstHeight = m_newSize.height;
+
+    if (m_useCuda)
+    {
+        m_gpuBatchIn.upload(frames, m_batchStream);
+        m_gpuBatchOut.create(count * dstHeight, m_newSize.width, frames.type());
+        for (int i = 0; i < count; ++i)
+        {
+            cv::cuda::GpuMat dst = FrameBatch::Slice(m_gpuBatchOut, i, dstHeight);
+            cv::cuda::resize(FrameBatch::Slice(m_gpuBatchIn, i, srcHeight), dst, m_newSize, 0, 0, m_method, m_batchStream);
+        }
+        if (!m_gpuMatAsOutput)
+            m_gpuBatchOut.download(m_batchOut, m_batchStream);
+        m_batchStream.waitForCompletion();
+    }
+    else
+    {
+        m_batchOut.create(count * dstHeight, m_newSize.width, frames.type());
+        cv::parallel_for_(cv::Range(0, count), [&](const cv::Range& range)
+        {
+            for (int i = range.start; i < range.end; ++i)
+            {
+                cv::Mat dst = FrameBatch::Slice(m_batchOut, i, dstHeight);
+                cv::resize(FrameBatch::Slice(frames, i, srcHeight), dst, m_newSize, 0, 0, m_method);
+            }
+        });
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        MAPS::OutputGuard<> outGuard{ this, Output(0) };
+        if (m_gpuMatAsOutput)
+        {
+            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+            cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
+            FrameBatch::Slice(m_gpuBatchOut, i, dstHeight).copyTo(dst);
+        }
+        else
+        {
+            IplImage& imageOut = outGuard.DataAs<IplImage>();
+            cv::Mat tempImageOut = m_hostOutView(imageOut.imageData);
+            FrameBatch::Slice(m_batchOut, i, dstHeight).copyTo(tempImageOut);
+
+            if (static_cast<void*>(tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+                Error("cv::Mat data ptr and imageOut data ptr are different.");
+        }
+        outGuard.Timestamp() = m_batch.Timestamp(i);
+    }
+}
+
 void MAPSOpenCV_Resize::AllocateOutputBufferSizeGpu(const MAPSTimestamp, const MAPS::InputElt<MapsCudaStruct> imageInElt)
 {
     const MapsCudaStruct& imageIn = imageInElt.Data();
+    const IplImage& proxy = imageIn.m_IplImageProxy;
+    ResolveRoi(proxy);
+    IplImage model = MAPS::IplImageModel(m_newSize.width, m_newSize.height, proxy.channelSeq, IPL_DATA_ORDER_PIXEL, proxy.depth, proxy.align);
+    CreateViews(proxy, model);
 
     if (m_gpuMatAsOutput)
     {
@@ -184,7 +413,7 @@ void MAPSOpenCV_Resize::AllocateOutputBufferSizeGpu(const MAPSTimestamp, const M
         {
             AllocateDynamicOutputBuffers(
                 DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(m_newSize.width, m_newSize.height, imageIn.m_IplImageProxy.nChannels, imageIn.m_IplImageProxy); }
+                    [&] { return new MapsCudaStruct(model.width, model.height, model.nChannels, model, m_memoryMode); }
                 )
             );
         }
@@ -195,9 +424,7 @@ void MAPSOpenCV_Resize::AllocateOutputBufferSizeGpu(const MAPSTimestamp, const M
     }
     else
     {
-        const IplImage& proxy = imageIn.m_IplImageProxy;
-        IplImage model = MAPS::IplImageModel(m_newSize.width, m_newSize.height, proxy.channelSeq, proxy.dataOrder, proxy.depth, proxy.align);
-        Output(0).AllocOutputBufferIplImage(model);
+        AllocateIplImageOutputBuffer(Output(0), model);
     }  
 }
 
@@ -205,22 +432,23 @@ void MAPSOpenCV_Resize::ProcessDataGpu(const MAPSTimestamp ts, const MAPS::Input
 {
     try
     {
+        if (DropInput(ts))
+            return;
+
         MAPS::OutputGuard<> outGuard{ this, Output(0) };
-        const IplImage& proxy = inElt.Data().m_IplImageProxy;
-        const cv::cuda::GpuMat src(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), inElt.Data().m_points);
+        const cv::cuda::GpuMat src = m_deviceInView(inElt.Data().m_points);
 
         if (m_gpuMatAsOutput)
         {
-            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-            const IplImage& proxyDst = outputData.m_IplImageProxy;
-            cv::cuda::GpuMat dst(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
+            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+            cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
             cv::cuda::resize(src, dst, m_newSize, 0, 0, m_method);
             outGuard.Timestamp() = ts;
         }
         else
         {
             IplImage& imageOut = outGuard.DataAs<IplImage>();
-            cv::Mat tempImageOut = convTools::noCopyIplImage2Mat(&imageOut);
+            cv::Mat tempImageOut = m_hostOutView(imageOut.imageData);
             cv::cuda::GpuMat dst;
             cv::cuda::resize(src, dst, m_newSize, 0, 0, m_method);
             dst.download(tempImageOut);
@@ -286,6 +514,12 @@ void MAPSOpenCV_Resize::Dynamic()
     m_useCuda = false;
     m_gpuMatAsInput = false;
     m_gpuMatAsOutput = false;
+    m_batchSize = 1;
+
+    NewProperty("roi_x");
+    NewProperty("roi_y");
+    NewProperty("roi_width");
+    NewProperty("roi_height");
 
     if (cv::cuda::getCudaEnabledDeviceCount() > 0)
     {
@@ -327,18 +561,22 @@ void MAPSOpenCV_Resize::Dynamic()
         NewInput("imageIn");
         NewOutput("imageOut");
     }
-}
 
-void MAPSOpenCV_Resize::FreeBuffers()
-{
-    if (m_useCuda && m_gpuMatAsOutput)
+    // Batches are made of IplImage frames
+    if (!m_gpuMatAsInput)
     {
-        MAPS_DynamicCustomStructComponent::FreeBuffers();
+        m_batchSize = static_cast<int>(NewProperty("batch_size").IntegerValue());
+        if (m_batchSize > 1)
+            NewProperty("batch_timeout");
     }
-    else
+
+    if (m_useCuda && !m_gpuMatAsInput && !m_gpuMatAsOutput && m_batchSize <= 1)
     {
-        MAPSComponent::FreeBuffers();
+        NewProperty("pipeline");
     }
+
+    NewInputPolicyProperties();
+    NewGpuOutputProperties("o_gpu");
 }
 
 void MAPSOpenCV_Resize::Set(MAPSProperty& p, const MAPSEnumStruct& enumStruct)
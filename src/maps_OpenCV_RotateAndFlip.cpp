@@ -31,6 +31,9 @@
 #include <opencv2/cudawarping.hpp>
 #include <opencv2/cudaarithm.hpp>
 
+#include <cmath>
+#include <limits>
+
 // Use the macros to declare the inputs
 MAPS_BEGIN_INPUTS_DEFINITION(MAPSOpenCV_RotateAndFlip)
     MAPS_INPUT("imageIn", MAPS::FilterIplImage, MAPS::FifoReader)
@@ -42,6 +45,7 @@ MAPS_BEGIN_INPUTS_DEFINITION(MAPSOpenCV_RotateAndFlip)
 MAPS_BEGIN_OUTPUTS_DEFINITION(MAPSOpenCV_RotateAndFlip)
     MAPS_OUTPUT("imageOut", MAPS::IplImage, nullptr, nullptr, 0)
     MAPS_OUTPUT_USER_DYNAMIC_STRUCTURE("o_gpu", MapsCudaStruct)
+    MAPS_OUTPUT("input_stats", MAPS::Float64, nullptr, nullptr, 2)
 MAPS_END_OUTPUTS_DEFINITION
 
 // Use the macros to declare the properties
@@ -52,7 +56,19 @@ MAPS_BEGIN_PROPERTIES_DEFINITION(MAPSOpenCV_RotateAndFlip)
     MAPS_PROPERTY("gpu_mat_as_output", false, false, false)
     MAPS_PROPERTY_ENUM("angle_input_mode", "Property|Input", 0, false, false)
     MAPS_PROPERTY("angle", 0, false, true)
-    MAPS_END_PROPERTIES_DEFINITION
+    MAPS_PROPERTY("expand_canvas", false, false, false)
+    MAPS_PROPERTY("roi_x", 0, false, false)
+    MAPS_PROPERTY("roi_y", 0, false, false)
+    MAPS_PROPERTY("roi_width", 0, false, false)
+    MAPS_PROPERTY("roi_height", 0, false, false)
+    MAPS_PROPERTY_ENUM("input_policy", "FIFO|Latest only|Drop every N", 0, false, false)
+    MAPS_PROPERTY("drop_interval", 2, false, false)
+    MAPS_PROPERTY("fifo_depth", 0, false, false)
+    MAPS_PROPERTY("memory_budget", 0, false, false)
+    MAPS_PROPERTY("lazy_allocation", false, false, false)
+    MAPS_PROPERTY("prewarm_buffers", 2, false, false)
+    MAPS_PROPERTY_ENUM("memory_mode", "Device|Managed|Mapped", 0, false, false)
+MAPS_END_PROPERTIES_DEFINITION
 
 // Use the macros to declare the actions
 MAPS_BEGIN_ACTIONS_DEFINITION(MAPSOpenCV_RotateAndFlip)
@@ -61,9 +77,17 @@ MAPS_END_ACTIONS_DEFINITION
 
 //Version 1.1: added rotation with certain angle, eventually provided on input.
 //Version 1.2: corrected rotation for 90 deg counter clockwise.
+//Version 1.3: exact 90 and 180 deg rotations (transpose and flip instead of warpAffine).
+//Version 1.4: cached remap tables for rotations in degrees, expand_canvas property.
+//Version 1.5: GpuMat input forwarded without copy to the GpuMat output when the operation is a no-op.
+//Version 1.6: roi_x, roi_y, roi_width and roi_height properties, only the region of interest is rotated or flipped.
+//Version 1.7: input_policy and drop_interval properties, input_stats output: stale frames can be skipped when the component falls behind its input.
+//Version 1.8: fifo_depth and memory_budget properties, sizes the FIFO of the GpuMat outputs and bounds the device memory of their buffers.
+//Version 1.9: lazy_allocation and prewarm_buffers properties, the device memory of the GpuMat output buffers is allocated on their first use.
+//Version 1.10: memory_mode property, the GpuMat output buffers can be allocated in managed or mapped host memory, readable from the host without download.
 
 // Use the macros to declare this component (OpenCV_RotateAndFlip) behaviour
-MAPS_COMPONENT_DEFINITION(MAPSOpenCV_RotateAndFlip, "OpenCV_RotateAndFlip_cuda", "1.1.0", 128,
+MAPS_COMPONENT_DEFINITION(MAPSOpenCV_RotateAndFlip, "OpenCV_RotateAndFlip_cuda", "1.10.0", 128,
                          MAPS::Threaded, MAPS::Threaded,
                          0, // Nb of inputs. Leave -1 to use the number of declared input definitions
                          0, // Nb of outputs. Leave -1 to use the number of declared output definitions
@@ -84,6 +108,7 @@ enum Operation : uint8_t
 void MAPSOpenCV_RotateAndFlip::Dynamic()
 {
     m_operation = static_cast<int>(GetIntegerProperty("operation"));
+    m_expandCanvas = false;
     if (m_operation == 6)
     {
         NewProperty("angle_input_mode");
@@ -93,12 +118,19 @@ void MAPSOpenCV_RotateAndFlip::Dynamic()
             NewProperty("angle");
         else
             NewInput("angle_in");
+
+        m_expandCanvas = NewProperty("expand_canvas").BoolValue();
     }
 
     m_useCuda = false;
     m_gpuMatAsInput = false;
     m_gpuMatAsOutput = false;
 
+    NewProperty("roi_x");
+    NewProperty("roi_y");
+    NewProperty("roi_width");
+    NewProperty("roi_height");
+
     if (cv::cuda::getCudaEnabledDeviceCount() > 0)
     {
         Property("use_cuda").SetMutable(true);
@@ -139,10 +171,19 @@ void MAPSOpenCV_RotateAndFlip::Dynamic()
         NewInput("imageIn");
         NewOutput("imageOut");
     }
+
+    NewInputPolicyProperties();
+    NewGpuOutputProperties("o_gpu");
 }
 
 void MAPSOpenCV_RotateAndFlip::Birth()
 {
+    ApplyGpuOutputProperties();
+    ApplyInputPolicyProperties();
+
+    m_angle = 0;
+    m_mapsAngle = std::numeric_limits<int>::min();
+
     m_inputs.push_back(&Input(0));
     if (m_operation == 6 && m_angleInputMode != 0)
         m_inputs.push_back(&Input(1));
@@ -181,25 +222,25 @@ void MAPSOpenCV_RotateAndFlip::Core()
 void MAPSOpenCV_RotateAndFlip::Death()
 {
     m_inputReader.reset();
-    m_inputs.clear();
-}
 
-void MAPSOpenCV_RotateAndFlip::FreeBuffers()
-{
-    if (m_useCuda && m_gpuMatAsOutput)
-    {
-        MAPS_DynamicCustomStructComponent::FreeBuffers();
-    }
-    else
-    {
-        MAPSComponent::FreeBuffers();
-    }
+    if (m_inputPolicy.Enabled())
+        ReportInfo(m_inputPolicy.Report().c_str());
+
+    m_inputs.clear();
+    m_gpuSrc.release();
+    m_gpuTransposed.release();
+    m_gpuDst.release();
+    m_map1.release();
+    m_map2.release();
+    m_gpuMapX.release();
+    m_gpuMapY.release();
+    m_mapsAngle = std::numeric_limits<int>::min();
 }
 
 void MAPSOpenCV_RotateAndFlip::AllocateOutputBufferSize(const MAPSTimestamp, const MAPS::ArrayView <MAPS::InputElt<>> inElts)
 {
     const IplImage& imageIn = inElts[0].DataAs<IplImage>();
-    cv::Mat tempImageIn = convTools::noCopyIplImage2Mat(&imageIn);
+    ResolveRoi(imageIn);
     IplImage model;
 
     switch (m_operation)
@@ -208,26 +249,35 @@ void MAPSOpenCV_RotateAndFlip::AllocateOutputBufferSize(const MAPSTimestamp, con
     case Operation_Rotation_180: // 180 deg
     case Operation_Flip_Up_Down: // Flip up-down
     case Operation_Flip_Left_Right: // Flip left-right
-    case Operation_Rotation_SpecifiedDegrees: // Specify in degrees
-        model = MAPS::IplImageModel(imageIn.width, imageIn.height, imageIn.channelSeq, imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, imageIn.channelSeq, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
+    case Operation_Rotation_SpecifiedDegrees: // Specify in degrees
+    {
+        const cv::Size canvas = RotationCanvasSize(m_roi.size());
+        m_canvasSize = canvas;
+        model = MAPS::IplImageModel(canvas.width, canvas.height, imageIn.channelSeq, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
+    }
+    break;
+
     case Operation_Rotation_90_ClockWise: // 90 deg clockwise
     case Operation_Rotation_90_CounterClockWise: // 90 deg counter-clockwise
-        model = MAPS::IplImageModel(imageIn.height, imageIn.width, imageIn.channelSeq, imageIn.dataOrder, imageIn.depth, imageIn.align);
+        model = MAPS::IplImageModel(m_roi.height, m_roi.width, imageIn.channelSeq, IPL_DATA_ORDER_PIXEL, imageIn.depth, imageIn.align);
         break;
 
     default:
         Error("Unknown operation.");
     }
 
+    CreateViews(imageIn, model);
+
     if (m_gpuMatAsOutput)
     {
         try
         {
             AllocateDynamicOutputBuffers(
                 DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(model.width, model.height, model.nChannels, model); }  // struct allocation
+                    [&] { return new MapsCudaStruct(model.width, model.height, model.nChannels, model, m_memoryMode); }  // struct allocation
                 )
             );
         }
@@ -238,13 +288,14 @@ void MAPSOpenCV_RotateAndFlip::AllocateOutputBufferSize(const MAPSTimestamp, con
     }
     else
     {
-        Output(0).AllocOutputBufferIplImage(model);
+        AllocateIplImageOutputBuffer(Output(0), model);
     }
 }
 
 void MAPSOpenCV_RotateAndFlip::AllocateOutputBufferSizeGpu(const MAPSTimestamp, const MAPS::ArrayView<MAPS::InputElt<>> inElts)
 {
     const IplImage& proxy = inElts[0].DataAs<MapsCudaStruct>().m_IplImageProxy;
+    ResolveRoi(proxy);
     IplImage model;
 
     switch (m_operation)
@@ -253,26 +304,35 @@ void MAPSOpenCV_RotateAndFlip::AllocateOutputBufferSizeGpu(const MAPSTimestamp,
     case Operation_Rotation_180: // 180 deg
     case Operation_Flip_Up_Down: // Flip up-down
     case Operation_Flip_Left_Right: // Flip left-right
-    case Operation_Rotation_SpecifiedDegrees: // Specify in degrees
-        model = MAPS::IplImageModel(proxy.width, proxy.height, proxy.channelSeq, proxy.dataOrder, proxy.depth, proxy.align);
+        model = MAPS::IplImageModel(m_roi.width, m_roi.height, proxy.channelSeq, IPL_DATA_ORDER_PIXEL, proxy.depth, proxy.align);
         break;
 
+    case Operation_Rotation_SpecifiedDegrees: // Specify in degrees
+    {
+        const cv::Size canvas = RotationCanvasSize(m_roi.size());
+        m_canvasSize = canvas;
+        model = MAPS::IplImageModel(canvas.width, canvas.height, proxy.channelSeq, IPL_DATA_ORDER_PIXEL, proxy.depth, proxy.align);
+    }
+    break;
+
     case Operation_Rotation_90_ClockWise: // 90 deg clockwise
     case Operation_Rotation_90_CounterClockWise: // 90 deg counter-clockwise
-        model = MAPS::IplImageModel(proxy.height, proxy.width, proxy.channelSeq, proxy.dataOrder, proxy.depth, proxy.align);
+        model = MAPS::IplImageModel(m_roi.height, m_roi.width, proxy.channelSeq, IPL_DATA_ORDER_PIXEL, proxy.depth, proxy.align);
         break;
 
     default:
         Error("Unknown operation.");
     }
 
+    CreateViews(proxy, model);
+
     if (m_gpuMatAsOutput)
     {
         try
         {
             AllocateDynamicOutputBuffers(
                 DynamicOutput<MapsCudaStruct>(Output("o_gpu"),
-                    [&] { return new MapsCudaStruct(model.width, model.height, model.nChannels, model); }
+                    [&] { return new MapsCudaStruct(model.width, model.height, model.nChannels, model, m_memoryMode); }
                 )
             );
         }
@@ -283,45 +343,37 @@ void MAPSOpenCV_RotateAndFlip::AllocateOutputBufferSizeGpu(const MAPSTimestamp,
     }
     else
     {
-        Output(0).AllocOutputBufferIplImage(model);
+        AllocateIplImageOutputBuffer(Output(0), model);
     }
 }
 
 void MAPSOpenCV_RotateAndFlip::ProcessData(const MAPSTimestamp ts, const MAPS::ArrayView <MAPS::InputElt<>> inElts)
 {
-    MAPS::OutputGuard<> outGuard{ this, Output(0) };
-    const IplImage& imageIn = inElts[0].DataAs<IplImage>();
-    cv::Mat tempImageIn = convTools::noCopyIplImage2Mat(&imageIn);
-
     try
     {
+        if (DropInput(ts))
+            return;
+
+        MAPS::OutputGuard<> outGuard{ this, Output(0) };
+        const IplImage& imageIn = inElts[0].DataAs<IplImage>();
+        const cv::Mat tempImageIn = m_hostInView(imageIn.imageData);
+
         switch (m_operation)
         {
         case Operation_None: // None
-            if (m_gpuMatAsOutput)
-            {
-                MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-                const IplImage& proxyDst = outputData.m_IplImageProxy;
-                cv::cuda::GpuMat dst(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
-                dst.upload(tempImageIn);
-            }
-            else
-            {
-                IplImage& imageOut = outGuard.DataAs<IplImage>();
-                memcpy(imageOut.imageData, imageIn.imageData, imageIn.imageSize);
-            }
+            PassThrough(outGuard, imageIn, tempImageIn);
             break;
 
         case Operation_Rotation_90_ClockWise: // 90 deg clockwise
-            Rotate(-90, outGuard, tempImageIn);
+            RotateExact(cv::ROTATE_90_CLOCKWISE, outGuard, tempImageIn);
             break;
 
         case Operation_Rotation_90_CounterClockWise: // 90 deg counter-clockwise
-            Rotate(90, outGuard, tempImageIn);
+            RotateExact(cv::ROTATE_90_COUNTERCLOCKWISE, outGuard, tempImageIn);
             break;
 
         case Operation_Rotation_180: // 180 deg
-            Rotate(180, outGuard, tempImageIn);
+            RotateExact(cv::ROTATE_180, outGuard, tempImageIn);
             break;
 
         case Operation_Flip_Up_Down: // Flip up-down
@@ -334,71 +386,54 @@ void MAPSOpenCV_RotateAndFlip::ProcessData(const MAPSTimestamp ts, const MAPS::A
 
         case Operation_Rotation_SpecifiedDegrees: // Specify in degrees
         {
-            int rotationDegrees = 0;
-            if (m_angleInputMode == 0)
-            {
-                rotationDegrees = static_cast<int>(GetIntegerProperty("angle"));
-            }
-            else if (DataAvailableInFIFO(Input(1)))
-            {
-                MAPSIOElt* ioeltRot = StartReading(Input(1));
-                rotationDegrees = static_cast<int>(ioeltRot->Integer32());
-            }
-
-            Rotate(rotationDegrees, outGuard, tempImageIn);
+            const int degrees = ReadAngle();
+            if (degrees % 360 == 0 && m_canvasSize == tempImageIn.size())
+                PassThrough(outGuard, imageIn, tempImageIn);
+            else
+                Rotate(degrees, outGuard, tempImageIn);
         }
         break;
 
         default:
             Error("Unknown operation.");
         }
+
+        outGuard.VectorSize() = 0;
+        outGuard.Timestamp() = ts;
     }
     catch (const std::exception& e)
     {
         Error(e.what());
     }
-
-    outGuard.VectorSize() = 0;
-    outGuard.Timestamp() = ts;
 }
 
 void MAPSOpenCV_RotateAndFlip::ProcessDataGpu(const MAPSTimestamp ts, const MAPS::ArrayView<MAPS::InputElt<>> inElts)
 {
-    MAPS::OutputGuard<> outGuard{ this, Output(0) };
-    const MapsCudaStruct& imageIn = inElts[0].DataAs<MapsCudaStruct>();
-    const IplImage& proxy = imageIn.m_IplImageProxy;
-    const cv::cuda::GpuMat src(proxy.height, proxy.width, CV_MAKETYPE(proxy.depth == 8 ? 0 : proxy.depth / 8, proxy.nChannels), imageIn.m_points);
-
     try
     {
+        if (DropInput(ts))
+            return;
+
+        MAPS::OutputGuard<> outGuard{ this, Output(0) };
+        const MapsCudaStruct& imageIn = inElts[0].DataAs<MapsCudaStruct>();
+        const cv::cuda::GpuMat src = m_deviceInView(imageIn.m_points);
+
         switch (m_operation)
         {
         case Operation_None: // None
-            if (m_gpuMatAsOutput)
-            {
-                MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-                const IplImage& proxyDst = outputData.m_IplImageProxy;
-                cv::cuda::GpuMat dst(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
-                src.copyTo(dst);
-            }
-            else
-            {
-                IplImage& imageOut = outGuard.DataAs<IplImage>();
-                cv::Mat tempImageOut = convTools::noCopyIplImage2Mat(&imageOut);
-                src.download(tempImageOut);
-            }
+            PassThroughGpu(outGuard, imageIn, src);
             break;
 
         case Operation_Rotation_90_ClockWise: // 90 deg clockwise
-            RotateGpu(-90, outGuard, src);
+            RotateExactGpu(cv::ROTATE_90_CLOCKWISE, outGuard, src);
             break;
 
         case Operation_Rotation_90_CounterClockWise: // 90 deg counter-clockwise
-            RotateGpu(90, outGuard, src);
+            RotateExactGpu(cv::ROTATE_90_COUNTERCLOCKWISE, outGuard, src);
             break;
 
         case Operation_Rotation_180: // 180 deg
-            RotateGpu(180, outGuard, src);
+            RotateExactGpu(cv::ROTATE_180, outGuard, src);
             break;
 
         case Operation_Flip_Up_Down: // Flip up-down
@@ -411,69 +446,169 @@ void MAPSOpenCV_RotateAndFlip::ProcessDataGpu(const MAPSTimestamp ts, const MAPS
 
         case Operation_Rotation_SpecifiedDegrees: // Specify in degrees
         {
-            int rotationDegrees = 0;
-            if (m_angleInputMode == 0)
-            {
-                rotationDegrees = static_cast<int>(GetIntegerProperty("angle"));
-            }
-            else if (DataAvailableInFIFO(Input(1)))
-            {
-                MAPSIOElt* ioeltRot = StartReading(Input(1));
-                rotationDegrees = static_cast<int>(ioeltRot->Integer32());
-            }
-
-            RotateGpu(rotationDegrees, outGuard, src);
+            const int degrees = ReadAngle();
+            if (degrees % 360 == 0 && m_canvasSize == src.size())
+                PassThroughGpu(outGuard, imageIn, src);
+            else
+                RotateGpu(degrees, outGuard, src);
         }
         break;
 
         default:
             Error("Unknown operation.");
         }
+
+        outGuard.VectorSize() = 0;
+        outGuard.Timestamp() = ts;
     }
     catch (const std::exception& e)
     {
         Error(e.what());
     }
+}
 
-    outGuard.VectorSize() = 0;
-    outGuard.Timestamp() = ts;
+void MAPSOpenCV_RotateAndFlip::PassThrough(MAPS::OutputGuard<>& outGuard, const IplImage& imageIn, const cv::Mat& src)
+{
+    if (m_gpuMatAsOutput)
+    {
+        MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+        cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
+        dst.upload(src);
+    }
+    else if (src.size() == cv::Size(imageIn.width, imageIn.height) && !m_hostInView.IsPlanar())
+    {
+        // The host buffers belong to the RTMaps FIFOs, they cannot be shared between the input and the output.
+        IplImage& imageOut = outGuard.DataAs<IplImage>();
+        memcpy(imageOut.imageData, imageIn.imageData, imageIn.imageSize);
+    }
+    else
+    {
+        IplImage& imageOut = outGuard.DataAs<IplImage>();
+        cv::Mat tempImageOut = m_hostOutView(imageOut.imageData);
+        src.copyTo(tempImageOut);
+
+        if (static_cast<void*>(tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+            Error("cv::Mat data ptr and imageOut data ptr are different.");
+    }
 }
 
-void MAPSOpenCV_RotateAndFlip::Rotate(int degrees, MAPS::OutputGuard<>& outGuard, const cv::Mat& imageIn)
+void MAPSOpenCV_RotateAndFlip::PassThroughGpu(MAPS::OutputGuard<>& outGuard, const MapsCudaStruct& imageIn, const cv::cuda::GpuMat& src)
 {
-    cv::Mat rotationMatrix = cv::Mat(2, 3, CV_32FC1);
-    cv::Point2f center;
-    center.x = imageIn.cols / 2.0f;
-    center.y = imageIn.rows / 2.0f;
+    if (m_gpuMatAsOutput && src.size() == cv::Size(imageIn.m_IplImageProxy.width, imageIn.m_IplImageProxy.height) && imageIn.CanShare() && !m_deviceInView.IsPlanar())
+    {
+        // No copy: the output references the input buffer, which stays alive as long as the output element does.
+        outGuard.DataAs<MapsCudaStruct>().ShareFrom(imageIn);
+    }
+    else if (m_gpuMatAsOutput)
+    {
+        // The region of interest is not contiguous in the input buffer (or the input cannot be shared) : it is copied
+        MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+        cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
+        src.copyTo(dst);
+    }
+    else
+    {
+        IplImage& imageOut = outGuard.DataAs<IplImage>();
+        cv::Mat tempImageOut = m_hostOutView(imageOut.imageData);
+        src.download(tempImageOut);
 
-    if (m_useCuda)
+        if (static_cast<void*>(tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+            Error("cv::Mat data ptr and imageOut data ptr are different.");
+    }
+}
+
+int MAPSOpenCV_RotateAndFlip::ReadAngle()
+{
+    if (m_angleInputMode == 0)
     {
-        rotationMatrix = cv::getRotationMatrix2D(center, degrees, 1.0);
-        cv::cuda::GpuMat src(imageIn);
+        m_angle = static_cast<int>(GetIntegerProperty("angle"));
+    }
+    else if (DataAvailableInFIFO(Input(1)))
+    {
+        MAPSIOElt* ioeltRot = StartReading(Input(1));
+        m_angle = static_cast<int>(ioeltRot->Integer32());
+    }
 
-        if (m_gpuMatAsOutput)
-        {
-            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-            const IplImage& proxyDst = outputData.m_IplImageProxy;
-            cv::cuda::GpuMat dst(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
-            cv::cuda::warpAffine(src, dst, rotationMatrix, imageIn.size());
-        }
-        else
+    // When no new angle is available on the input, the last one is kept.
+    return m_angle;
+}
+
+cv::Size MAPSOpenCV_RotateAndFlip::RotationCanvasSize(const cv::Size& srcSize)
+{
+    if (!m_expandCanvas)
+        return srcSize;
+
+    if (m_angleInputMode != 0)
+    {
+        // The angle is not known yet and can take any value: use a square that contains the image at every angle.
+        const int diagonal = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(srcSize.width) * srcSize.width + static_cast<double>(srcSize.height) * srcSize.height)));
+        return cv::Size(diagonal, diagonal);
+    }
+
+    // Bounding box of the image rotated by the current angle
+    const double radians = GetIntegerProperty("angle") * CV_PI / 180.0;
+    const double c = std::abs(std::cos(radians));
+    const double s = std::abs(std::sin(radians));
+    return cv::Size(cvRound(srcSize.width * c + srcSize.height * s), cvRound(srcSize.width * s + srcSize.height * c));
+}
+
+void MAPSOpenCV_RotateAndFlip::UpdateRotationMaps(int degrees, const cv::Size& srcSize, const cv::Size& dstSize, bool gpu)
+{
+    if (degrees == m_mapsAngle && srcSize == m_mapsSrcSize && dstSize == m_mapsDstSize)
+        return;
+
+    // Same transform as warpAffine: rotation around the center of the image, which is moved to the center of the output.
+    cv::Mat rotationMatrix = cv::getRotationMatrix2D(cv::Point2f(srcSize.width / 2.0f, srcSize.height / 2.0f), degrees, 1.0);
+    rotationMatrix.at<double>(0, 2) += (dstSize.width - srcSize.width) / 2.0;
+    rotationMatrix.at<double>(1, 2) += (dstSize.height - srcSize.height) / 2.0;
+
+    cv::Mat inverse;
+    cv::invertAffineTransform(rotationMatrix, inverse);
+    const double* m = inverse.ptr<double>();
+
+    cv::Mat mapX(dstSize, CV_32FC1);
+    cv::Mat mapY(dstSize, CV_32FC1);
+    for (int y = 0; y < dstSize.height; ++y)
+    {
+        float* xs = mapX.ptr<float>(y);
+        float* ys = mapY.ptr<float>(y);
+        for (int x = 0; x < dstSize.width; ++x)
         {
-            IplImage& imageOut = outGuard.DataAs<IplImage>();
-            cv::Mat tempImageOut = convTools::noCopyIplImage2Mat(&imageOut);
-            cv::cuda::GpuMat dst;
-            cv::cuda::warpAffine(src, dst, rotationMatrix, imageIn.size());
-            dst.download(tempImageOut);
+            xs[x] = static_cast<float>(m[0] * x + m[1] * y + m[2]);
+            ys[x] = static_cast<float>(m[3] * x + m[4] * y + m[5]);
         }
     }
+
+    if (gpu)
+    {
+        m_gpuMapX.upload(mapX);
+        m_gpuMapY.upload(mapY);
+    }
+    else
+    {
+        // Fixed-point tables: remap then only does the table lookups and the bilinear blend.
+        cv::convertMaps(mapX, mapY, m_map1, m_map2, CV_16SC2);
+    }
+
+    m_mapsAngle = degrees;
+    m_mapsSrcSize = srcSize;
+    m_mapsDstSize = dstSize;
+}
+
+void MAPSOpenCV_RotateAndFlip::Rotate(int degrees, MAPS::OutputGuard<>& outGuard, const cv::Mat& imageIn)
+{
+    if (m_useCuda)
+    {
+        m_gpuSrc.upload(imageIn);
+        RotateGpu(degrees, outGuard, m_gpuSrc);
+    }
     else
     {
         IplImage& imageOut = outGuard.DataAs<IplImage>();
-        cv::Mat tempImageOut = convTools::noCopyIplImage2Mat(&imageOut);
+        cv::Mat tempImageOut = m_hostOutView(imageOut.imageData);
 
-        rotationMatrix = cv::getRotationMatrix2D(center, degrees, 1.0);
-        cv::warpAffine(imageIn, tempImageOut, rotationMatrix, imageIn.size());
+        UpdateRotationMaps(degrees, imageIn.size(), tempImageOut.size(), false);
+        cv::remap(imageIn, tempImageOut, m_map1, m_map2, cv::INTER_LINEAR);
 
         if (static_cast<void*>(tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
             Error("cv::Mat data ptr and imageOut data ptr are different.");
@@ -482,26 +617,94 @@ void MAPSOpenCV_RotateAndFlip::Rotate(int degrees, MAPS::OutputGuard<>& outGuard
 
 void MAPSOpenCV_RotateAndFlip::RotateGpu(int degrees, MAPS::OutputGuard<>& outGuard, const cv::cuda::GpuMat& imageIn)
 {
-    cv::Mat rotationMatrix = cv::Mat(2, 3, CV_32FC1);
-    cv::Point2f center;
-    center.x = imageIn.cols / 2.0f;
-    center.y = imageIn.rows / 2.0f;
-    rotationMatrix = cv::getRotationMatrix2D(center, degrees, 1.0);
+    if (m_gpuMatAsOutput)
+    {
+        MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+        cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
+        UpdateRotationMaps(degrees, imageIn.size(), dst.size(), true);
+        cv::cuda::remap(imageIn, dst, m_gpuMapX, m_gpuMapY, cv::INTER_LINEAR);
+    }
+    else
+    {
+        IplImage& imageOut = outGuard.DataAs<IplImage>();
+        cv::Mat tempImageOut = m_hostOutView(imageOut.imageData);
+        UpdateRotationMaps(degrees, imageIn.size(), tempImageOut.size(), true);
+        cv::cuda::remap(imageIn, m_gpuDst, m_gpuMapX, m_gpuMapY, cv::INTER_LINEAR);
+        m_gpuDst.download(tempImageOut);
+
+        if (static_cast<void*>(tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+            Error("cv::Mat data ptr and imageOut data ptr are different.");
+    }
+}
+
+void MAPSOpenCV_RotateAndFlip::RotateExact(int rotateCode, MAPS::OutputGuard<>& outGuard, const cv::Mat& imageIn)
+{
+    if (m_useCuda)
+    {
+        m_gpuSrc.upload(imageIn);
+        RotateExactGpu(rotateCode, outGuard, m_gpuSrc);
+    }
+    else
+    {
+        IplImage& imageOut = outGuard.DataAs<IplImage>();
+        cv::Mat tempImageOut = m_hostOutView(imageOut.imageData);
+
+        // cv::rotate is a blocked transpose followed by a flip: no interpolation, and the output size is swapped for 90 deg.
+        cv::rotate(imageIn, tempImageOut, rotateCode);
+
+        if (static_cast<void*>(tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+            Error("cv::Mat data ptr and imageOut data ptr are different.");
+    }
+}
 
+void MAPSOpenCV_RotateAndFlip::RotateExactGpu(int rotateCode, MAPS::OutputGuard<>& outGuard, const cv::cuda::GpuMat& imageIn)
+{
+    cv::cuda::GpuMat dst;
     if (m_gpuMatAsOutput)
     {
-        MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-        const IplImage& proxyDst = outputData.m_IplImageProxy;
-        cv::cuda::GpuMat dst(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
-        cv::cuda::warpAffine(imageIn, dst, rotationMatrix, imageIn.size());
+        MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+        dst = m_deviceOutView(outputData.m_points);
+    }
+    else
+    {
+        const cv::Size dstSize = rotateCode == cv::ROTATE_180 ? imageIn.size() : cv::Size(imageIn.rows, imageIn.cols);
+        m_gpuDst.create(dstSize, imageIn.type());
+        dst = m_gpuDst;
+    }
+    void* const dstData = dst.data;
+
+    if (rotateCode == cv::ROTATE_180)
+    {
+        cv::cuda::flip(imageIn, dst, -1);
+    }
+    else if (imageIn.elemSize() == 1 || imageIn.elemSize() == 4 || imageIn.elemSize() == 8)
+    {
+        // 90 deg: transpose, then mirror the columns (clockwise) or the rows (counter-clockwise)
+        cv::cuda::transpose(imageIn, m_gpuTransposed);
+        cv::cuda::flip(m_gpuTransposed, dst, rotateCode == cv::ROTATE_90_CLOCKWISE ? 1 : 0);
     }
     else
+    {
+        // cv::cuda::transpose does not handle this pixel size (e.g. 3 channels): integer affine map with nearest sampling, which is exact as well.
+        cv::Mat_<double> map(2, 3);
+        if (rotateCode == cv::ROTATE_90_CLOCKWISE)
+            map << 0, -1, imageIn.rows - 1, 1, 0, 0;
+        else
+            map << 0, 1, 0, -1, 0, imageIn.cols - 1;
+        cv::cuda::warpAffine(imageIn, dst, map, dst.size(), cv::INTER_NEAREST);
+    }
+
+    if (static_cast<void*>(dst.data) != dstData) // if the ptr are different then opencv reallocated memory for the cv::cuda::GpuMat
+        Error("cv::cuda::GpuMat data ptr and output data ptr are different.");
+
+    if (!m_gpuMatAsOutput)
     {
         IplImage& imageOut = outGuard.DataAs<IplImage>();
-        cv::Mat tempImageOut = convTools::noCopyIplImage2Mat(&imageOut);
-        cv::cuda::GpuMat dst;
-        cv::cuda::warpAffine(imageIn, dst, rotationMatrix, imageIn.size());
+        cv::Mat tempImageOut = m_hostOutView(imageOut.imageData);
         dst.download(tempImageOut);
+
+        if (static_cast<void*>(tempImageOut.data) != static_cast<void*>(imageOut.imageData)) // if the ptr are different then opencv reallocated memory for the cv::Mat
+            Error("cv::Mat data ptr and imageOut data ptr are different.");
     }
 }
 
@@ -513,15 +716,14 @@ void MAPSOpenCV_RotateAndFlip::Flip(int flipMode, MAPS::OutputGuard<>& outGuard,
 
         if (m_gpuMatAsOutput)
         {
-            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-            const IplImage& proxyDst = outputData.m_IplImageProxy;
-            cv::cuda::GpuMat dst(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
+            MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+            cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
             cv::cuda::flip(src, dst, flipMode);
         }
         else
         {
             IplImage& imageOut = outGuard.DataAs<IplImage>();
-            cv::Mat tempImageOut = convTools::noCopyIplImage2Mat(&imageOut);
+            cv::Mat tempImageOut = m_hostOutView(imageOut.imageData);
             cv::cuda::GpuMat dst;
             cv::cuda::flip(src, dst, flipMode);
             dst.download(tempImageOut);
@@ -530,7 +732,7 @@ void MAPSOpenCV_RotateAndFlip::Flip(int flipMode, MAPS::OutputGuard<>& outGuard,
     else
     {
         IplImage& imageOut = outGuard.DataAs<IplImage>();
-        cv::Mat tempImageOut = convTools::noCopyIplImage2Mat(&imageOut);
+        cv::Mat tempImageOut = m_hostOutView(imageOut.imageData);
 
         cv::flip(imageIn, tempImageOut, flipMode);
 
@@ -543,15 +745,14 @@ void MAPSOpenCV_RotateAndFlip::FlipGpu(int flipMode, MAPS::OutputGuard<>& outGua
 {
     if (m_gpuMatAsOutput)
     {
-        MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>();
-        const IplImage& proxyDst = outputData.m_IplImageProxy;
-        cv::cuda::GpuMat dst(proxyDst.height, proxyDst.width, CV_MAKETYPE(proxyDst.depth == 8 ? 0 : proxyDst.depth / 8, proxyDst.nChannels), outputData.m_points);
+        MapsCudaStruct& outputData = outGuard.DataAs<MapsCudaStruct>().Writable();
+        cv::cuda::GpuMat dst = m_deviceOutView(outputData.m_points);
         cv::cuda::flip(imageIn, dst, flipMode);
     }
     else
     {
         IplImage& imageOut = outGuard.DataAs<IplImage>();
-        cv::Mat tempImageOut = convTools::noCopyIplImage2Mat(&imageOut);
+        cv::Mat tempImageOut = m_hostOutView(imageOut.imageData);
         cv::cuda::GpuMat dst;
         cv::cuda::flip(imageIn, dst, flipMode);
         dst.download(tempImageOut);
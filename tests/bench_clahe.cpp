@@ -0,0 +1,79 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+// CPU CLAHE of EqualizeHistogram (method "CLAHE") on 1080p and 4K grayscale images, with the default clip_limit and
+// tile grid of the component:
+// - the CLAHE object kept from one frame to the next, as the component does, on all the threads and on one thread;
+// - a CLAHE object created on each frame.
+// Usage: bench_clahe [iterations]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace
+{
+    const double kClipLimit = 40.0;
+    const cv::Size kTileGrid(8, 8);
+
+    // Mean time of op in ms
+    template <typename Op>
+    double Time(const int iterations, Op op)
+    {
+        op(); // warm-up: allocations
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            op();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+    }
+
+    void Bench(const cv::Size& size, const char* name, const int iterations)
+    {
+        // Dark noisy scene: the case CLAHE is used for
+        cv::Mat src(size, CV_8UC1);
+        cv::randn(src, cv::Scalar(40), cv::Scalar(12));
+        cv::Mat dst;
+
+        const int threads = cv::getNumThreads();
+        const cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(kClipLimit, kTileGrid);
+        const double cachedMs = Time(iterations, [&] { clahe->apply(src, dst); });
+
+        cv::setNumThreads(1);
+        const double singleThreadMs = Time(iterations, [&] { clahe->apply(src, dst); });
+        cv::setNumThreads(threads);
+
+        const double recreatedMs = Time(iterations, [&] { cv::createCLAHE(kClipLimit, kTileGrid)->apply(src, dst); });
+
+        std::printf("%-5s  cached %7.3f ms (%6.1f fps)  1 thread %7.3f ms  recreated %7.3f ms\n",
+            name, cachedMs, 1000.0 / cachedMs, singleThreadMs, recreatedMs);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int iterations = argc > 1 ? std::max(1, std::atoi(argv[1])) : 50;
+    std::printf("clip limit %.1f, %d x %d tiles, %d iterations, %d threads\n", kClipLimit, kTileGrid.width, kTileGrid.height, iterations, cv::getNumThreads());
+
+    Bench(cv::Size(1920, 1080), "1080p", iterations);
+    Bench(cv::Size(3840, 2160), "4K", iterations);
+    return 0;
+}
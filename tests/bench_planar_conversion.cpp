@@ -0,0 +1,95 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+// Throughput of the planar <-> packed conversions of convTools on 1080p images, against a memcpy of the same bytes.
+// Planar to packed is measured through HostImageView, as the components read planar color images.
+// Usage: bench_planar_conversion [iterations]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "common/maps_image_view.h"
+
+namespace
+{
+    const int kWidth = 1920;
+    const int kHeight = 1080;
+
+    IplImage PlanarModel(const int nbChannels, const int depth)
+    {
+        IplImage image;
+        std::memset(&image, 0, sizeof(image));
+        image.nSize = sizeof(IplImage);
+        image.nChannels = nbChannels;
+        image.depth = depth;
+        image.dataOrder = IPL_DATA_ORDER_PLANE;
+        image.width = kWidth;
+        image.height = kHeight;
+        image.widthStep = kWidth * ((depth & 0xFF) / 8);
+        image.imageSize = image.widthStep * kHeight * nbChannels;
+        return image;
+    }
+
+    // Mean time of op in ms
+    template <typename Op>
+    double Time(const int iterations, Op op)
+    {
+        op(); // warm-up: allocations
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            op();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+    }
+
+    void Bench(const int nbChannels, const int depth, const char* depthName, const int iterations)
+    {
+        IplImage planar = PlanarModel(nbChannels, depth);
+        std::vector<char> planarData(planar.imageSize, 1);
+        std::vector<char> copy(planar.imageSize);
+        planar.imageData = planarData.data();
+
+        const HostImageView view(planar);
+        cv::Mat packed;
+
+        const double memcpyMs = Time(iterations, [&] { std::memcpy(copy.data(), planarData.data(), planarData.size()); });
+        const double toPackedMs = Time(iterations, [&] { packed = view(planarData.data()); });
+        const double toPlanarMs = Time(iterations, [&] { convTools::packedToPlanar(packed, &planar); });
+
+        const double gbPerS = planar.imageSize / (memcpyMs * 1e6);
+        std::printf("%d channels %-4s  memcpy %6.3f ms (%5.2f GB/s)  planar->packed %6.3f ms (x%.2f)  packed->planar %6.3f ms (x%.2f)\n",
+            nbChannels, depthName, memcpyMs, gbPerS, toPackedMs, toPackedMs / memcpyMs, toPlanarMs, toPlanarMs / memcpyMs);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int iterations = argc > 1 ? std::max(1, std::atoi(argv[1])) : 100;
+    std::printf("%d x %d, %d iterations, %d threads\n", kWidth, kHeight, iterations, cv::getNumThreads());
+
+    for (int nbChannels = 2; nbChannels <= 4; ++nbChannels)
+    {
+        Bench(nbChannels, IPL_DEPTH_8U, "8U", iterations);
+        Bench(nbChannels, IPL_DEPTH_16U, "16U", iterations);
+        Bench(nbChannels, IPL_DEPTH_32F, "32F", iterations);
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+// Exact 90 and 180 deg rotations of RotateAndFlip (cv::rotate: transpose and flip) against the getRotationMatrix2D
+// and warpAffine path they replaced, on 1080p images. The warpAffine output gets the swapped size for 90 deg, so that
+// both paths write the same number of pixels.
+// Usage: bench_rotate [iterations]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace
+{
+    const cv::Size kSize(1920, 1080);
+
+    // Mean time of op in ms
+    template <typename Op>
+    double Time(const int iterations, Op op)
+    {
+        op(); // warm-up: allocations
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            op();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+    }
+
+    void Bench(const int type, const char* typeName, const int rotateCode, const double angle, const char* rotationName, const int iterations)
+    {
+        cv::Mat src(kSize, type);
+        cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(255));
+        cv::Mat dst;
+        cv::Mat copy;
+
+        const cv::Size dstSize = rotateCode == cv::ROTATE_180 ? kSize : cv::Size(kSize.height, kSize.width);
+        cv::Mat rotation = cv::getRotationMatrix2D(cv::Point2f((kSize.width - 1) * 0.5f, (kSize.height - 1) * 0.5f), angle, 1.0);
+        // Center of the input moved to the center of the output
+        rotation.at<double>(0, 2) += (dstSize.width - kSize.width) * 0.5;
+        rotation.at<double>(1, 2) += (dstSize.height - kSize.height) * 0.5;
+
+        const double copyMs = Time(iterations, [&] { src.copyTo(copy); });
+        const double rotateMs = Time(iterations, [&] { cv::rotate(src, dst, rotateCode); });
+        const double warpMs = Time(iterations, [&] { cv::warpAffine(src, dst, rotation, dstSize); });
+
+        std::printf("%-5s %-8s  copy %6.3f ms  cv::rotate %6.3f ms  warpAffine %6.3f ms (x%.1f)\n",
+            typeName, rotationName, copyMs, rotateMs, warpMs, warpMs / rotateMs);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int iterations = argc > 1 ? std::max(1, std::atoi(argv[1])) : 100;
+    std::printf("%d x %d, %d iterations, %d threads\n", kSize.width, kSize.height, iterations, cv::getNumThreads());
+
+    const struct { int type; const char* name; } types[] = { { CV_8UC1, "8UC1" }, { CV_8UC3, "8UC3" }, { CV_8UC4, "8UC4" } };
+    for (const auto& t : types)
+    {
+        Bench(t.type, t.name, cv::ROTATE_90_CLOCKWISE, -90.0, "90 cw", iterations);
+        Bench(t.type, t.name, cv::ROTATE_90_COUNTERCLOCKWISE, 90.0, "90 ccw", iterations);
+        Bench(t.type, t.name, cv::ROTATE_180, 180.0, "180", iterations);
+    }
+    return 0;
+}
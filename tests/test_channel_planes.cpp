@@ -0,0 +1,200 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+// Split and merge of MapsCudaStruct images (ChannelPlanes, used by ChannelsSplitter and ChannelsMerger), run on
+// buffers allocated in MapsCudaMemory::Host memory: no GPU is needed.
+// Checks, for 1 to 4 channels, pixel-ordered and planar images:
+// - each output of the split gets its own buffer, holding the selected channel;
+// - the zero-copy split of planar images references the right plane;
+// - merging the split channels gives back the input image;
+// - the host view of a planar color image interleaves its region of interest into a packed matrix.
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "common/maps_channel_planes.h"
+
+namespace
+{
+    const int kWidth = 37;   // odd sizes: no padding hides an offset error
+    const int kHeight = 11;
+
+    int g_failures = 0;
+
+    void Check(const bool condition, const char* what, const int nbChannels, const bool planar)
+    {
+        if (!condition)
+        {
+            std::printf("FAILED: %s (%d channels, %s)\n", what, nbChannels, planar ? "planar" : "pixel order");
+            ++g_failures;
+        }
+    }
+
+    // Header of the images of the test, with the packed rows of the MapsCudaStruct data
+    IplImage Model(const int nbChannels, const bool planar)
+    {
+        IplImage image;
+        std::memset(&image, 0, sizeof(image));
+        image.nSize = sizeof(IplImage);
+        image.nChannels = nbChannels;
+        image.depth = IPL_DEPTH_8U;
+        image.dataOrder = planar ? IPL_DATA_ORDER_PLANE : IPL_DATA_ORDER_PIXEL;
+        image.width = kWidth;
+        image.height = kHeight;
+        image.widthStep = kWidth * (planar ? 1 : nbChannels);
+        image.imageSize = kWidth * kHeight * nbChannels;
+        return image;
+    }
+
+    unsigned char Value(const int x, const int y, const int c)
+    {
+        return static_cast<unsigned char>(x * 7 + y * 13 + c * 61 + 1);
+    }
+
+    size_t Offset(const int x, const int y, const int c, const int nbChannels, const bool planar)
+    {
+        return planar ? static_cast<size_t>(c) * kWidth * kHeight + y * kWidth + x
+                      : (static_cast<size_t>(y) * kWidth + x) * nbChannels + c;
+    }
+
+    void TestSplitMerge(const int nbChannels, const bool planar, const std::vector<int>& channels)
+    {
+        const IplImage model = Model(nbChannels, planar);
+        IplImage planeModel = Model(1, planar);
+        IplImage viewed = model;
+        if (planar)
+            viewed.nChannels = 1;
+
+        MapsCudaStruct in(model.imageSize, model, MapsCudaMemory::Host);
+        unsigned char* const inData = static_cast<unsigned char*>(in.Writable().m_points);
+        for (int c = 0; c < nbChannels; ++c)
+            for (int y = 0; y < kHeight; ++y)
+                for (int x = 0; x < kWidth; ++x)
+                    inData[Offset(x, y, c, nbChannels, planar)] = Value(x, y, c);
+
+        // Split
+        std::vector<std::unique_ptr<MapsCudaStruct>> outs;
+        std::vector<MapsCudaStruct*> outPtrs;
+        for (size_t i = 0; i < channels.size(); ++i)
+        {
+            outs.emplace_back(new MapsCudaStruct(planeModel.imageSize, planeModel, MapsCudaMemory::Host));
+            outPtrs.push_back(outs.back().get());
+        }
+        std::array<cv::Mat, 4> scratch;
+        ChannelPlanes::SplitImage(in, HostImageView(viewed), channels, outPtrs.data(), HostImageView(planeModel), scratch.data());
+
+        for (size_t i = 0; i < channels.size(); ++i)
+        {
+            Check(outs[i]->m_points != in.m_points, "the output has its own buffer", nbChannels, planar);
+            for (size_t j = 0; j < i; ++j)
+                Check(outs[i]->m_points != outs[j]->m_points, "each output has its own buffer", nbChannels, planar);
+
+            const unsigned char* const plane = static_cast<const unsigned char*>(outs[i]->m_points);
+            bool same = true;
+            for (int y = 0; y < kHeight; ++y)
+                for (int x = 0; x < kWidth; ++x)
+                    same = same && plane[y * kWidth + x] == Value(x, y, channels[i]);
+            Check(same, "the output holds the selected channel", nbChannels, planar);
+        }
+
+        if (planar)
+        {
+            // Zero copy
+            for (size_t i = 0; i < channels.size(); ++i)
+            {
+                MapsCudaStruct shared(planeModel.imageSize, planeModel, MapsCudaMemory::Host);
+                ChannelPlanes::SharePlane(shared, in, channels[i], 0, kHeight);
+                Check(shared.m_points == inData + Offset(0, 0, channels[i], nbChannels, planar), "the shared plane is the selected one", nbChannels, planar);
+                Check(shared.m_size == kWidth * kHeight, "the shared plane has the size of a plane", nbChannels, planar);
+            }
+        }
+
+        if (static_cast<int>(channels.size()) != nbChannels || !std::is_sorted(channels.begin(), channels.end()))
+            return;
+
+        // Round trip: merge the split channels back
+        const HostImageView planeView(planeModel);
+        std::vector<cv::Mat> srcs;
+        for (const std::unique_ptr<MapsCudaStruct>& out : outs)
+            srcs.push_back(planeView(out->m_points));
+
+        MapsCudaStruct merged(model.imageSize, model, MapsCudaMemory::Host);
+        ChannelPlanes::MergeImages(srcs.data(), merged, HostImageView(viewed));
+        Check(merged.m_points != in.m_points, "the merged image has its own buffer", nbChannels, planar);
+        Check(std::memcmp(merged.m_points, in.m_points, model.imageSize) == 0, "split then merge gives back the image", nbChannels, planar);
+    }
+
+    void TestPlanarView(const int nbChannels, const cv::Rect& roi)
+    {
+        const IplImage model = Model(nbChannels, true);
+        std::vector<unsigned char> data(model.imageSize);
+        for (int c = 0; c < nbChannels; ++c)
+            for (int y = 0; y < kHeight; ++y)
+                for (int x = 0; x < kWidth; ++x)
+                    data[Offset(x, y, c, nbChannels, true)] = Value(x, y, c);
+
+        const HostImageView view(model, roi);
+        Check(view.IsPlanar(), "a planar color image is viewed through a packed copy", nbChannels, true);
+        const cv::Mat packed = view(data.data());
+        const cv::Rect region = roi.area() > 0 ? roi : cv::Rect(0, 0, kWidth, kHeight);
+        Check(packed.size() == region.size() && packed.channels() == nbChannels, "the packed matrix has the size of the region", nbChannels, true);
+
+        bool same = true;
+        for (int y = 0; y < region.height; ++y)
+            for (int x = 0; x < region.width; ++x)
+                for (int c = 0; c < nbChannels; ++c)
+                    same = same && packed.ptr<unsigned char>(y)[x * nbChannels + c] == Value(region.x + x, region.y + y, c);
+        Check(same, "the packed matrix interleaves the planes of the region", nbChannels, true);
+    }
+}
+
+int main()
+{
+    for (int nbChannels = 1; nbChannels <= 4; ++nbChannels)
+    {
+        for (const bool planar : { false, true })
+        {
+            std::vector<int> all;
+            for (int c = 0; c < nbChannels; ++c)
+                all.push_back(c);
+            TestSplitMerge(nbChannels, planar, all);
+
+            // Selections: the channels in reverse order, the last channel only
+            TestSplitMerge(nbChannels, planar, std::vector<int>(all.rbegin(), all.rend()));
+            TestSplitMerge(nbChannels, planar, { nbChannels - 1 });
+        }
+    }
+
+    for (int nbChannels = 2; nbChannels <= 4; ++nbChannels)
+    {
+        TestPlanarView(nbChannels, cv::Rect());
+        TestPlanarView(nbChannels, cv::Rect(3, 2, 20, 7));
+    }
+
+    if (g_failures != 0)
+    {
+        std::printf("%d check(s) failed.\n", g_failures);
+        return 1;
+    }
+    std::printf("All checks passed.\n");
+    return 0;
+}
@@ -0,0 +1,189 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+// Ordering of the frames of the GPU pipeline (BasicGpuPipeline, used by BayerDecoder, ColorSpaceConverter and Resize),
+// with slots that emulate the GPU on the host: the work of a frame completes after a given number of queries.
+// Checks, for 2 and 3 slots and for several completion patterns (in order, out of order, never before a wait):
+// - every frame is emitted exactly once, in the order of submission, with its own timestamp and result;
+// - a frame is emitted without waiting as soon as it and the frames before it are complete;
+// - the pipeline only waits when all the slots hold a frame;
+// - Flush() emits the frames still in flight;
+// - a frame is not held when no further input arrives: EmitBeforeRead() waits for it when no input is waiting.
+
+#include <cstdio>
+#include <vector>
+
+#include "common/maps_gpu_pipeline.h"
+
+namespace
+{
+    int g_failures = 0;
+    int g_waits = 0;    // calls to HostSlot::WaitForCompletion()
+
+    void Check(const bool condition, const char* what, const int depth, const char* pattern)
+    {
+        if (!condition)
+        {
+            std::printf("FAILED: %s (%d slots, %s)\n", what, depth, pattern);
+            ++g_failures;
+        }
+    }
+
+    // Emulated slot: the work submitted to it completes after m_remaining calls to IsComplete(), or when waited for.
+    class HostSlot : public GpuPipelineSlotBase
+    {
+    public:
+        void Process(const int value, const int queriesToComplete)
+        {
+            m_value = value;
+            m_remaining = queriesToComplete;
+        }
+
+        bool IsComplete()
+        {
+            if (m_remaining > 0)
+                --m_remaining;
+            return m_remaining == 0;
+        }
+
+        void WaitForCompletion()
+        {
+            m_remaining = 0;
+            ++g_waits;
+        }
+
+        int Result() const { return m_remaining == 0 ? 2 * m_value : -1; }
+
+    private:
+        int m_value = 0;
+        int m_remaining = 0;
+    };
+
+    using HostPipeline = BasicGpuPipeline<HostSlot>;
+
+    struct Emitted
+    {
+        MAPSTimestamp ts;
+        int result;
+    };
+
+    // queries(i) is the number of queries after which the work of the frame i completes, -1 for never (until waited for).
+    template <typename Queries>
+    void TestOrdering(const int depth, const char* pattern, const int nbFrames, Queries queries)
+    {
+        HostPipeline pipeline;
+        pipeline.Reset(depth);
+        std::vector<Emitted> emitted;
+        const auto emit = [&emitted](const HostSlot& done) { emitted.push_back({ done.Timestamp(), done.Result() }); };
+
+        for (int i = 0; i < nbFrames; ++i)
+        {
+            const size_t emittedBefore = emitted.size();
+            const bool slotFree = pipeline.InFlight() < depth;
+            const int waitsBefore = g_waits;
+            HostSlot& slot = pipeline.Next(emit);
+            if (slotFree)
+                Check(g_waits == waitsBefore, "no wait while a slot is free", depth, pattern);
+            else
+                Check(g_waits == waitsBefore + 1 && emitted.size() == emittedBefore + 1, "the oldest frame is waited for and emitted when all the slots are busy", depth, pattern);
+            Check(!slot.InFlight(), "the slot returned by Next() is free", depth, pattern);
+            Check(pipeline.InFlight() < depth, "a slot is free after Next()", depth, pattern);
+
+            slot.Process(i, queries(i) < 0 ? 1 << 30 : queries(i));
+            pipeline.Submit(1000 + 10 * i);
+            pipeline.EmitCompleted(emit);
+            pipeline.EmitBeforeRead(emit, true); // the next frame is already waiting
+
+            Check(pipeline.InFlight() == i + 1 - static_cast<int>(emitted.size()), "frames in flight", depth, pattern);
+        }
+
+        pipeline.Flush(emit);
+        Check(pipeline.InFlight() == 0, "nothing is in flight after Flush()", depth, pattern);
+        Check(static_cast<int>(emitted.size()) == nbFrames, "every frame is emitted once", depth, pattern);
+        for (size_t i = 0; i < emitted.size(); ++i)
+        {
+            Check(emitted[i].ts == static_cast<MAPSTimestamp>(1000 + 10 * i), "frames are emitted in order with their timestamp", depth, pattern);
+            Check(emitted[i].result == 2 * static_cast<int>(i), "frames are emitted once complete, with their result", depth, pattern);
+        }
+    }
+
+    // A frame completed before the frames in flight ahead of it is not emitted before them.
+    void TestNoOvertaking()
+    {
+        HostPipeline pipeline;
+        pipeline.Reset(3);
+        std::vector<Emitted> emitted;
+        const auto emit = [&emitted](const HostSlot& done) { emitted.push_back({ done.Timestamp(), done.Result() }); };
+
+        pipeline.Next(emit).Process(0, 3);
+        pipeline.Submit(1);
+        pipeline.Next(emit).Process(1, 1);
+        pipeline.Submit(2);
+        pipeline.EmitCompleted(emit);
+        Check(emitted.empty(), "a complete frame waits for the frames before it", 3, "overtaking");
+
+        pipeline.EmitCompleted(emit);
+        pipeline.EmitCompleted(emit);
+        Check(emitted.size() == 2, "both frames are emitted once the first one completes", 3, "overtaking");
+        Check(emitted.size() == 2 && emitted[0].ts == 1 && emitted[1].ts == 2, "frames are emitted in order", 3, "overtaking");
+    }
+
+    // The work of the last frames is not complete when they are submitted, and no further input arrives.
+    void TestStalledInput(const int depth)
+    {
+        HostPipeline pipeline;
+        pipeline.Reset(depth);
+        std::vector<Emitted> emitted;
+        const auto emit = [&emitted](const HostSlot& done) { emitted.push_back({ done.Timestamp(), done.Result() }); };
+
+        const int nbFrames = 2;
+        for (int i = 0; i < nbFrames; ++i)
+        {
+            pipeline.Next(emit).Process(i, 1 << 30); // complete when waited for only
+            pipeline.Submit(1000 + 10 * i);
+            pipeline.EmitCompleted(emit);
+            pipeline.EmitBeforeRead(emit, i + 1 < nbFrames);
+        }
+        Check(pipeline.InFlight() == 0, "nothing is in flight while the input is stalled", depth, "stalled input");
+        Check(static_cast<int>(emitted.size()) == nbFrames, "the frames are emitted before blocking on the input", depth, "stalled input");
+        for (size_t i = 0; i < emitted.size(); ++i)
+            Check(emitted[i].ts == static_cast<MAPSTimestamp>(1000 + 10 * i) && emitted[i].result == 2 * static_cast<int>(i), "frames are emitted in order once complete", depth, "stalled input");
+    }
+}
+
+int main()
+{
+    for (const int depth : { 2, 3 })
+    {
+        TestOrdering(depth, "immediate completion", 10, [](int) { return 1; });
+        TestOrdering(depth, "slow completion", 10, [](int) { return 4; });
+        TestOrdering(depth, "out of order completion", 10, [](int i) { return i % 2 == 0 ? 5 : 1; });
+        TestOrdering(depth, "completion on wait only", 10, [](int) { return -1; });
+        TestOrdering(depth, "fewer frames than slots", 1, [](int) { return -1; });
+        TestStalledInput(depth);
+    }
+    TestNoOvertaking();
+
+    if (g_failures != 0)
+    {
+        std::printf("%d check(s) failed.\n", g_failures);
+        return 1;
+    }
+    std::printf("All checks passed.\n");
+    return 0;
+}
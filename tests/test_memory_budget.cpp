@@ -0,0 +1,214 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+//   Copyright 2018-2024 Intempora S.A.S.
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+// Accounting of the buffers of MapsCudaStruct in the memory budget (MemoryBudget), with buffers allocated in
+// MapsCudaMemory::Host memory: no GPU is needed.
+// Checks that every buffer taken by Writable() is reserved in the budget of its owner while it is referenced:
+// - the first buffer, whether it is allocated or taken from the pool of released buffers;
+// - the buffer taken by copy-on-write when the previous one is shared, the shared one being given back once released;
+// - Writable() throws when the budget would be exceeded, and nothing is reserved then;
+// - a buffer of a previous run of the owner, released once the owner restarted, is not given back to the new run;
+// - the device memory left in the budget.
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "common/maps_cuda_struct.h"
+
+namespace
+{
+    const int kWidth = 64;
+    const int kHeight = 16;
+    const int kSize = kWidth * kHeight;
+
+    int g_failures = 0;
+    const int g_owner = 0;  // address used as budget owner
+
+    void Check(const bool condition, const char* what)
+    {
+        if (!condition)
+        {
+            std::printf("FAILED: %s\n", what);
+            ++g_failures;
+        }
+    }
+
+    IplImage Model()
+    {
+        IplImage image;
+        std::memset(&image, 0, sizeof(image));
+        image.nSize = sizeof(IplImage);
+        image.nChannels = 1;
+        image.depth = IPL_DEPTH_8U;
+        image.dataOrder = IPL_DATA_ORDER_PIXEL;
+        image.width = kWidth;
+        image.height = kHeight;
+        image.widthStep = kWidth;
+        image.imageSize = kSize;
+        return image;
+    }
+
+    // Output buffer of the owner, allocated on the first write as with lazy_allocation
+    MapsCudaStruct* NewOutput()
+    {
+        MapsCudaStruct* out = new MapsCudaStruct(kSize, Model(), MapsCudaMemory::Host);
+        PrepareDeviceMemory(out, &g_owner, false);
+        return out;
+    }
+
+    // Whether exactly bytes of device memory are reserved by g_owner, the only owner of the test
+    bool Reserved(const MAPSInt64 bytes)
+    {
+        MemoryBudget& budget = MemoryBudget::Instance();
+        try
+        {
+            // Fits exactly in a budget of bytes + 1, and not in a budget of bytes
+            budget.SetLimit(&g_owner, bytes + 1);
+            budget.Unreserve(&g_owner, budget.Reserve(&g_owner, 0, 1), 0, 1);
+        }
+        catch (const std::runtime_error&)
+        {
+            return false;
+        }
+        bool exact = bytes == 0;
+        if (!exact)
+        {
+            try
+            {
+                budget.SetLimit(&g_owner, bytes);
+                budget.Unreserve(&g_owner, budget.Reserve(&g_owner, 0, 1), 0, 1);
+            }
+            catch (const std::runtime_error&)
+            {
+                exact = true;
+            }
+        }
+        budget.SetLimit(&g_owner, 0);
+        return exact;
+    }
+
+    void TestFirstWrite()
+    {
+        MapsCudaStruct* out = NewOutput();
+        Check(Reserved(0), "nothing is reserved before the first write");
+        out->Writable();
+        Check(Reserved(kSize), "the first buffer is reserved");
+        out->Writable();
+        Check(Reserved(kSize), "writing again into a private buffer reserves nothing more");
+        delete out;
+        Check(Reserved(0), "the buffer is given back once released");
+
+        // The buffer released above is in the pool now
+        out = NewOutput();
+        out->Writable();
+        Check(Reserved(kSize), "a buffer taken from the pool is reserved");
+        delete out;
+        Check(Reserved(0), "the pooled buffer is given back once released");
+    }
+
+    void TestCopyOnWrite()
+    {
+        MapsCudaStruct* out = NewOutput();
+        out->Writable();
+
+        // A downstream component keeps a reference on the buffer (forwarded output)
+        MapsCudaStruct* forwarded = new MapsCudaStruct(kSize, Model(), MapsCudaMemory::Host);
+        forwarded->ShareFrom(*out);
+        out->Writable();
+        Check(out->m_points != forwarded->m_points, "a shared buffer is not written");
+        Check(Reserved(2 * kSize), "the buffer taken by copy-on-write is reserved, the shared one stays reserved");
+
+        delete forwarded;
+        Check(Reserved(kSize), "the shared buffer is given back once released by the downstream component");
+        delete out;
+        Check(Reserved(0), "every buffer is given back");
+    }
+
+    void TestBudgetExceeded()
+    {
+        MapsCudaStruct* out = NewOutput();
+        MemoryBudget::Instance().SetLimit(&g_owner, kSize - 1);
+        bool thrown = false;
+        try
+        {
+            out->Writable();
+        }
+        catch (const std::runtime_error&)
+        {
+            thrown = true;
+        }
+        Check(thrown, "Writable() throws when the budget would be exceeded");
+        Check(out->m_points == nullptr, "no buffer is taken when the budget would be exceeded");
+        Check(Reserved(0), "nothing is reserved when the budget would be exceeded");
+        delete out;
+    }
+
+    void TestRestartedOwner()
+    {
+        // A downstream component still references a buffer when the owner stops
+        MapsCudaStruct* out = NewOutput();
+        out->Writable();
+        MapsCudaStruct* forwarded = new MapsCudaStruct(kSize, Model(), MapsCudaMemory::Host);
+        forwarded->ShareFrom(*out);
+        delete out;
+        MemoryBudget::Instance().Release(&g_owner);
+
+        // The owner restarts at the same address
+        out = NewOutput();
+        out->Writable();
+        Check(Reserved(kSize), "the buffer of the new run is reserved");
+        delete forwarded;
+        Check(Reserved(kSize), "the buffer of the previous run is not given back to the new run");
+        delete out;
+        Check(Reserved(0), "the buffer of the new run is given back once released");
+    }
+
+    void TestAvailable()
+    {
+        MemoryBudget& budget = MemoryBudget::Instance();
+        Check(budget.Available() == -1, "nothing is available to compute without a budget");
+
+        budget.SetLimit(&g_owner, 3 * kSize);
+        MapsCudaStruct* out = NewOutput();
+        out->Writable();
+        Check(budget.Available() == 2 * kSize, "the budget left excludes the buffers reserved");
+        budget.SetLimit(&g_owner, kSize / 2);
+        Check(budget.Available() == 0, "no budget is left when the reservations exceed it");
+        budget.SetLimit(&g_owner, 0);
+        delete out;
+    }
+}
+
+int main()
+{
+    TestFirstWrite();
+    TestCopyOnWrite();
+    TestBudgetExceeded();
+    TestRestartedOwner();
+    TestAvailable();
+    MemoryBudget::Instance().Release(&g_owner);
+
+    if (g_failures != 0)
+    {
+        std::printf("%d check(s) failed.\n", g_failures);
+        return 1;
+    }
+    std::printf("All checks passed.\n");
+    return 0;
+}